@@ -17,6 +17,8 @@ zmqSubSocket.setsockopt(zmq.SUBSCRIBE, "hashtx")
 zmqSubSocket.setsockopt(zmq.SUBSCRIBE, "rawblock")
 zmqSubSocket.setsockopt(zmq.SUBSCRIBE, "rawtx")
 zmqSubSocket.setsockopt(zmq.SUBSCRIBE, "checkedblock")
+zmqSubSocket.setsockopt(zmq.SUBSCRIBE, "removedtx")
+zmqSubSocket.setsockopt(zmq.SUBSCRIBE, "shieldedblock")
 zmqSubSocket.connect("tcp://127.0.0.1:%i" % port)
 
 try:
@@ -43,6 +45,12 @@ try:
         elif topic == "checkedblock":
             print '- CHECKED BLOCK ('+sequence+') -'
             print binascii.hexlify(body[:80])
+        elif topic == "removedtx":
+            print '- REMOVED TX ('+sequence+') -'
+            print binascii.hexlify(body[:32]) + ' ' + body[32:]
+        elif topic == "shieldedblock":
+            print '- SHIELDED BLOCK ('+sequence+') -'
+            print binascii.hexlify(body)
 
 except KeyboardInterrupt:
     zmqContext.destroy()
@@ -22,6 +22,7 @@ testScripts=(
     'wallet_shieldcoinbase_sprout.py'
     'wallet_shieldcoinbase_sapling.py'
     'wallet_listreceived.py'
+    'wallet_lazyload.py'
     'wallet.py'
     'wallet_overwintertx.py'
     'wallet_persistence.py'
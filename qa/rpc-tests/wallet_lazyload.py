@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+# Copyright (c) 2020 The Zcash developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    get_coinbase_address,
+    start_nodes, stop_nodes, wait_bitcoinds,
+    wait_and_assert_operationid_status,
+)
+from decimal import Decimal
+
+# Settled transactions are at least this deep (MAX_REORG_LENGTH + 1)
+SETTLED_DEPTH = 100
+
+# Test that the notes of settled transactions, which -walletlazyload keeps
+# on disk, are still reported by z_listreceivedbyaddress and z_listunspent
+class WalletLazyLoadTest (BitcoinTestFramework):
+
+    def setup_nodes(self):
+        return start_nodes(4, self.options.tmpdir, [['-walletlazyload']] * 4)
+
+    def restart_nodes(self):
+        stop_nodes(self.nodes)
+        wait_bitcoinds()
+        self.setup_network()
+
+    def run_test(self):
+        zaddr = self.nodes[0].z_getnewaddress('sapling')
+        zaddrOther = self.nodes[1].z_getnewaddress('sapling')
+
+        # Shield coinbase funds to zaddr
+        taddr = get_coinbase_address(self.nodes[0])
+        opid = self.nodes[0].z_sendmany(taddr, [{'address': zaddr, 'amount': Decimal('20')}], 1, 0)
+        txidShield = wait_and_assert_operationid_status(self.nodes[0], opid)
+        self.sync_all()
+        self.nodes[0].generate(1)
+        self.sync_all()
+
+        # Spend that note, sending the change back to zaddr
+        opid = self.nodes[0].z_sendmany(zaddr, [{'address': zaddrOther, 'amount': Decimal('15')}], 1, 0)
+        txidSpend = wait_and_assert_operationid_status(self.nodes[0], opid)
+        self.sync_all()
+        self.nodes[0].generate(1)
+        self.sync_all()
+
+        received = self.nodes[0].z_listreceivedbyaddress(zaddr)
+        assert_equal(2, len(received))
+        unspent = self.nodes[0].z_listunspent()
+        assert_equal(1, len(unspent))
+        assert_equal(txidSpend, unspent[0]['txid'])
+        assert_equal(Decimal('5'), unspent[0]['amount'])
+        assert_equal(True, unspent[0]['change'])
+
+        # Once the spend is deep enough, the shielding transaction is
+        # settled, and is moved out of memory when the wallet is flushed
+        self.nodes[0].generate(SETTLED_DEPTH)
+        self.sync_all()
+        received = self.nodes[0].z_listreceivedbyaddress(zaddr)
+        self.restart_nodes()
+
+        # z_listunspent first, so that the settled notes are not yet indexed
+        # when the change is recognized
+        assert_equal(unspent, self.nodes[0].z_listunspent())
+
+        receivedAfter = self.nodes[0].z_listreceivedbyaddress(zaddr)
+        assert_equal(received, receivedAfter)
+        shielded = [r for r in receivedAfter if r['txid'] == txidShield]
+        assert_equal(1, len(shielded))
+        assert_equal(Decimal('20'), shielded[0]['amount'])
+        assert_equal(False, shielded[0]['change'])
+        assert_equal(201, shielded[0]['blockheight'])
+        assert_equal(SETTLED_DEPTH + 2, shielded[0]['confirmations'])
+
+        # The settled note is spent, so it is not counted in the balance
+        assert_equal(Decimal('5'), self.nodes[0].z_getbalance(zaddr))
+
+if __name__ == '__main__':
+    WalletLazyLoadTest().main()
@@ -8,14 +8,32 @@
 #
 
 from test_framework.test_framework import BitcoinTestFramework
-from test_framework.util import assert_equal, bytes_to_hex_str, start_nodes
-
+from test_framework.mininode import deser_uint256, deser_uint256_vector, deser_vector
+from test_framework.util import (
+    assert_equal,
+    bytes_to_hex_str,
+    start_nodes,
+    wait_and_assert_operationid_status,
+)
+
+from decimal import Decimal
+from io import BytesIO
 import zmq
 import struct
 
+class ShieldedTxSummary(object):
+    def deserialize(self, f):
+        self.nIndex = struct.unpack("<I", f.read(4))[0]
+        self.txid = deser_uint256(f)
+        self.sproutNullifiers = deser_uint256_vector(f)
+        self.sproutCommitments = deser_uint256_vector(f)
+        self.saplingNullifiers = deser_uint256_vector(f)
+        self.saplingCommitments = deser_uint256_vector(f)
+
 class ZMQTest(BitcoinTestFramework):
 
     port = 28332
+    shieldedPort = 28333
 
     def setup_nodes(self):
         self.zmqContext = zmq.Context()
@@ -23,13 +41,47 @@ class ZMQTest(BitcoinTestFramework):
         self.zmqSubSocket.setsockopt(zmq.SUBSCRIBE, b"hashblock")
         self.zmqSubSocket.setsockopt(zmq.SUBSCRIBE, b"hashtx")
         self.zmqSubSocket.connect("tcp://127.0.0.1:%i" % self.port)
+        self.zmqShieldedSocket = self.zmqContext.socket(zmq.SUB)
+        self.zmqShieldedSocket.setsockopt(zmq.SUBSCRIBE, b"removedtx")
+        self.zmqShieldedSocket.setsockopt(zmq.SUBSCRIBE, b"shieldedblock")
+        self.zmqShieldedSocket.connect("tcp://127.0.0.1:%i" % self.shieldedPort)
+        self.shieldedMessages = {b"removedtx": [], b"shieldedblock": []}
+        shieldedAddress = 'tcp://127.0.0.1:'+str(self.shieldedPort)
         return start_nodes(4, self.options.tmpdir, extra_args=[
-            ['-zmqpubhashtx=tcp://127.0.0.1:'+str(self.port), '-zmqpubhashblock=tcp://127.0.0.1:'+str(self.port)],
+            ['-zmqpubhashtx=tcp://127.0.0.1:'+str(self.port), '-zmqpubhashblock=tcp://127.0.0.1:'+str(self.port),
+             '-zmqpubremovedtx='+shieldedAddress, '-zmqpubshieldedblock='+shieldedAddress],
             [],
             [],
             []
             ])
 
+    # Returns the next message with the given topic on the shielded socket.
+    # Mempool removals and chain tips are signalled from different threads,
+    # so messages of the other topic are kept for later.
+    def recv_shielded(self, topic):
+        while len(self.shieldedMessages[topic]) == 0:
+            msg = self.zmqShieldedSocket.recv_multipart()
+            self.shieldedMessages[msg[0]].append((msg[1], struct.unpack('<I', msg[-1])[-1]))
+        return self.shieldedMessages[topic].pop(0)
+
+    def recv_removedtx(self):
+        (body, nseq) = self.recv_shielded(b"removedtx")
+        return (bytes_to_hex_str(body[:32]), body[32:], nseq)
+
+    def recv_shieldedblock(self):
+        (body, nseq) = self.recv_shielded(b"shieldedblock")
+        f = BytesIO(body)
+        block = {
+            'hash': deser_uint256(f),
+            'height': struct.unpack("<i", f.read(4))[0],
+            'connected': struct.unpack("<B", f.read(1))[0] == 1,
+            'finalsaplingroot': deser_uint256(f),
+            'vtx': deser_vector(f, ShieldedTxSummary),
+            'sequence': nseq,
+        }
+        assert_equal(b"", f.read())
+        return block
+
     def run_test(self):
         self.sync_all()
 
@@ -75,7 +127,8 @@ class ZMQTest(BitcoinTestFramework):
             assert_equal(genhashes[x], zmqHashes[x]) #blockhash from generate must be equal to the hash received over zmq
 
         #test tx from a second node
-        hashRPC = self.nodes[1].sendtoaddress(self.nodes[0].getnewaddress(), 1.0)
+        taddr = self.nodes[0].getnewaddress()
+        hashRPC = self.nodes[1].sendtoaddress(taddr, 1.0)
         self.sync_all()
 
         # now we should receive a zmq msg because the tx was broadcast
@@ -90,6 +143,62 @@ class ZMQTest(BitcoinTestFramework):
 
         assert_equal(hashRPC, hashZMQ) #blockhash from generate must be equal to the hash received over zmq
 
+        # the tx leaves the mempool of node 0 when node 1 mines it
+        blockhash = self.nodes[1].generate(1)[0]
+        self.sync_all()
+        assert_equal((hashRPC, b"block", 0), self.recv_removedtx())
+
+        # every connected block is published, transparent ones without summaries
+        nseq = 0
+        while True:
+            block = self.recv_shieldedblock()
+            assert_equal(nseq, block['sequence'])
+            assert_equal(True, block['connected'])
+            assert_equal([], block['vtx'])
+            nseq += 1
+            if block['hash'] == int(blockhash, 16):
+                break
+        assert_equal(self.nodes[0].getblockcount(), block['height'])
+
+        # a shielded tx is summarized in the block that mines it
+        zaddr = self.nodes[0].z_getnewaddress('sapling')
+        opid = self.nodes[0].z_sendmany(taddr, [{'address': zaddr, 'amount': Decimal('0.5')}])
+        txid = wait_and_assert_operationid_status(self.nodes[0], opid)
+        self.sync_all()
+        blockhash = self.nodes[0].generate(1)[0]
+        self.sync_all()
+        assert_equal((txid, b"block", 1), self.recv_removedtx())
+
+        rawtx = self.nodes[0].getrawtransaction(txid, 1)
+        cmus = [int(output['cmu'], 16) for output in rawtx['vShieldedOutput']]
+        assert(len(cmus) > 0)
+
+        def check_shielded_block(block, connected, nseq):
+            assert_equal(int(blockhash, 16), block['hash'])
+            assert_equal(self.nodes[0].getblock(blockhash)['height'], block['height'])
+            assert_equal(connected, block['connected'])
+            assert_equal(int(self.nodes[0].getblock(blockhash)['finalsaplingroot'], 16), block['finalsaplingroot'])
+            assert_equal(nseq, block['sequence'])
+            assert_equal(1, len(block['vtx']))
+            summary = block['vtx'][0]
+            assert_equal(1, summary.nIndex)
+            assert_equal(int(txid, 16), summary.txid)
+            assert_equal([], summary.sproutNullifiers)
+            assert_equal([], summary.sproutCommitments)
+            assert_equal([], summary.saplingNullifiers)
+            assert_equal(cmus, summary.saplingCommitments)
+
+        check_shielded_block(self.recv_shieldedblock(), True, nseq)
+
+        # disconnecting the block publishes the same summaries; the tx
+        # returns to the mempool and leaves it again on reconnection
+        self.nodes[0].invalidateblock(blockhash)
+        check_shielded_block(self.recv_shieldedblock(), False, nseq + 1)
+        self.nodes[0].reconsiderblock(blockhash)
+        check_shielded_block(self.recv_shieldedblock(), True, nseq + 2)
+        assert_equal((txid, b"block", 2), self.recv_removedtx())
+        self.sync_all()
+
 
 if __name__ == '__main__':
     ZMQTest ().main ()
@@ -95,6 +95,35 @@ void AsyncRPCQueue::addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOp
     this->condition_.notify_one();
 }
 
+/**
+ * Add shared_ptr to operation without queueing it, so that its status can be
+ * queried before it is started with queueOperation().
+ */
+void AsyncRPCQueue::addPendingOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOperation) {
+    std::lock_guard<std::mutex> guard(lock_);
+
+    // Don't add if queue is closed or finishing
+    if (isClosed() || isFinishing()) {
+        return;
+    }
+
+    operation_map_.emplace(ptrOperation->getId(), ptrOperation);
+}
+
+/**
+ * Queue an operation added with addPendingOperation() for execution.
+ */
+void AsyncRPCQueue::queueOperation(AsyncRPCOperationId id) {
+    std::lock_guard<std::mutex> guard(lock_);
+
+    if (isClosed() || isFinishing() || operation_map_.count(id) == 0) {
+        return;
+    }
+
+    operation_id_queue_.push(id);
+    this->condition_.notify_one();
+}
+
 /**
  * Return the operation for a given operation id.
  */
@@ -48,6 +48,9 @@ public:
     std::shared_ptr<AsyncRPCOperation> getOperationForId(AsyncRPCOperationId) const;
     std::shared_ptr<AsyncRPCOperation> popOperationForId(AsyncRPCOperationId);
     void addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOperation);
+    // Add an operation that is listed, but only runs once queueOperation() is called
+    void addPendingOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOperation);
+    void queueOperation(AsyncRPCOperationId id);
     std::vector<AsyncRPCOperationId> getAllOperationIds() const;
 
 private:
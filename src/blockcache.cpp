@@ -0,0 +1,326 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockcache.h"
+
+#include "consensus/consensus.h"
+#include "core_memusage.h"
+#include "crypto/common.h"
+#include "main.h"
+#include "util.h"
+
+#include <string.h>
+
+CBlockFileReader blockFileReader("blk");
+CBlockFileReader undoFileReader("rev", MAX_OPEN_BLOCK_READ_FILES, 0);
+CBlockCache blockCache;
+
+CBlockFileReader::CBlockFileReader(const char* prefixIn, size_t nMaxOpenFilesIn, size_t nReadaheadIn) :
+    prefix(prefixIn), nMaxOpenFiles(std::max(nMaxOpenFilesIn, (size_t)1)), nReadahead(nReadaheadIn), nUseCounter(0)
+{
+}
+
+CBlockFileReader::~CBlockFileReader()
+{
+    CloseAll();
+}
+
+void CBlockFileReader::SetReadahead(size_t nReadaheadIn)
+{
+    LOCK(cs);
+    nReadahead = nReadaheadIn;
+    for (auto& entry : mapFiles) {
+        std::vector<char>().swap(entry.second.vWindow);
+    }
+}
+
+CBlockFileReader::CReadFile* CBlockFileReader::GetFile(int nFile)
+{
+    AssertLockHeld(cs);
+    auto it = mapFiles.find(nFile);
+    if (it != mapFiles.end()) {
+        it->second.nLastUse = ++nUseCounter;
+        return &it->second;
+    }
+
+    if (mapFiles.size() >= nMaxOpenFiles) {
+        auto itOldest = mapFiles.begin();
+        for (auto itFile = mapFiles.begin(); itFile != mapFiles.end(); ++itFile) {
+            if (itFile->second.nLastUse < itOldest->second.nLastUse) {
+                itOldest = itFile;
+            }
+        }
+        CloseFile(itOldest);
+    }
+
+    boost::filesystem::path path = GetBlockPosFilename(CDiskBlockPos(nFile, 0), prefix);
+    FILE* file = fopen(path.string().c_str(), "rb");
+    if (!file) {
+        LogPrintf("Unable to open file %s\n", path.string());
+        return NULL;
+    }
+    // Reads are either served from the readahead window or are exact-sized,
+    // so stdio buffering would only add a copy and could return stale data.
+    setvbuf(file, NULL, _IONBF, 0);
+
+    CReadFile& rf = mapFiles[nFile];
+    rf.file = file;
+    rf.nLastUse = ++nUseCounter;
+    rf.nLastReadEnd = 0;
+    rf.nWindowStart = 0;
+    return &rf;
+}
+
+void CBlockFileReader::CloseFile(std::map<int, CReadFile>::iterator it)
+{
+    AssertLockHeld(cs);
+    fclose(it->second.file);
+    mapFiles.erase(it);
+}
+
+bool CBlockFileReader::ReadAt(CReadFile& rf, unsigned int nPos, char* pch, size_t nSize, bool fTrack)
+{
+    AssertLockHeld(cs);
+    uint64_t nEnd = (uint64_t)nPos + nSize;
+
+    if (nPos >= rf.nWindowStart && nEnd <= (uint64_t)rf.nWindowStart + rf.vWindow.size()) {
+        if (nSize > 0) {
+            memcpy(pch, &rf.vWindow[nPos - rf.nWindowStart], nSize);
+        }
+        if (fTrack) {
+            rf.nLastReadEnd = (unsigned int)nEnd;
+        }
+        return true;
+    }
+
+    // Only read ahead when this read continues where the previous one ended,
+    // so that random access (e.g. getblock on arbitrary heights) does not pay
+    // for data it will never use. Untracked reads (record headers) never do,
+    // or the payload read right after them would always look sequential.
+    bool fSequential = fTrack && nReadahead > 0 && nSize < nReadahead &&
+                       nPos >= rf.nLastReadEnd && nPos - rf.nLastReadEnd <= nReadahead;
+
+    if (fseek(rf.file, nPos, SEEK_SET)) {
+        rf.vWindow.clear();
+        return false;
+    }
+    if (fSequential) {
+        rf.vWindow.resize(nReadahead);
+        size_t nRead = fread(&rf.vWindow[0], 1, nReadahead, rf.file);
+        rf.vWindow.resize(nRead);
+        rf.nWindowStart = nPos;
+        if (nRead < nSize) {
+            clearerr(rf.file);
+            return false;
+        }
+        if (nSize > 0) {
+            memcpy(pch, &rf.vWindow[0], nSize);
+        }
+    } else if (nSize > 0 && fread(pch, 1, nSize, rf.file) != nSize) {
+        clearerr(rf.file);
+        return false;
+    }
+    if (fTrack) {
+        rf.nLastReadEnd = (unsigned int)nEnd;
+    }
+    return true;
+}
+
+bool CBlockFileReader::Read(const CDiskBlockPos& pos, char* pch, size_t nSize)
+{
+    if (pos.IsNull()) {
+        return false;
+    }
+    LOCK(cs);
+    CReadFile* rf = GetFile(pos.nFile);
+    if (!rf) {
+        return false;
+    }
+    return ReadAt(*rf, pos.nPos, pch, nSize);
+}
+
+bool CBlockFileReader::ReadRecordHeader(const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart, DiskRecordFormat& format, unsigned int& nStoredSize)
+{
+    if (pos.IsNull() || pos.nPos < DISK_RECORD_HEADER_SIZE) {
+        return error("%s: invalid position %s", __func__, pos.ToString());
+    }
+
+    unsigned char header[DISK_RECORD_HEADER_SIZE];
+    {
+        LOCK(cs);
+        CReadFile* rf = GetFile(pos.nFile);
+        if (!rf || !ReadAt(*rf, pos.nPos - DISK_RECORD_HEADER_SIZE, (char*)header, sizeof(header), false)) {
+            return error("%s: failed to read record header at %s", __func__, pos.ToString());
+        }
+    }
+    format = GetDiskRecordFormat(header, messageStart);
+    if (format == DISK_RECORD_INVALID) {
+        return error("%s: record magic mismatch at %s", __func__, pos.ToString());
+    }
+    nStoredSize = ReadLE32(header + MESSAGE_START_SIZE);
+    return true;
+}
+
+bool CBlockFileReader::ReadRecord(const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart, size_t nMaxSize, std::vector<char>& vchPayload, unsigned int* pnStoredSize)
+{
+    DiskRecordFormat format;
+    unsigned int nSize;
+    if (!ReadRecordHeader(pos, messageStart, format, nSize)) {
+        return false;
+    }
+    if (nSize > nMaxSize) {
+        return error("%s: record size %u too large at %s", __func__, nSize, pos.ToString());
+    }
+    if (pnStoredSize) {
+        *pnStoredSize = nSize;
+    }
+
+    if (format == DISK_RECORD_RAW) {
+        vchPayload.resize(nSize);
+        if (!Read(pos, vchPayload.data(), nSize)) {
+            return error("%s: failed to read record at %s", __func__, pos.ToString());
+        }
+        return true;
+    }
+
+    std::vector<char> vchCompressed(nSize);
+    if (!Read(pos, vchCompressed.data(), nSize)) {
+        return error("%s: failed to read record at %s", __func__, pos.ToString());
+    }
+    if (!DecompressDiskRecord(vchCompressed.data(), vchCompressed.size(), nMaxSize, vchPayload)) {
+        return error("%s: failed to decompress record at %s", __func__, pos.ToString());
+    }
+    return true;
+}
+
+bool CBlockFileReader::ReadRawBlock(const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart, std::vector<char>& vchBlock)
+{
+    return ReadRecord(pos, messageStart, MAX_BLOCK_SIZE, vchBlock);
+}
+
+void CBlockFileReader::Invalidate(int nFile)
+{
+    LOCK(cs);
+    auto it = mapFiles.find(nFile);
+    if (it != mapFiles.end()) {
+        it->second.vWindow.clear();
+    }
+}
+
+void CBlockFileReader::Close(int nFile)
+{
+    LOCK(cs);
+    auto it = mapFiles.find(nFile);
+    if (it != mapFiles.end()) {
+        CloseFile(it);
+    }
+}
+
+void CBlockFileReader::CloseAll()
+{
+    LOCK(cs);
+    while (!mapFiles.empty()) {
+        CloseFile(mapFiles.begin());
+    }
+}
+
+
+CBlockCache::CBlockCache(size_t nMaxUsageIn) :
+    nMaxUsage(nMaxUsageIn), nUsage(0), nHits(0), nMisses(0)
+{
+}
+
+void CBlockCache::Trim()
+{
+    AssertLockHeld(cs);
+    while (nUsage > nMaxUsage && !entries.empty()) {
+        auto it = mapEntries.find(entries.back().first);
+        nUsage -= it->second.second;
+        mapEntries.erase(it);
+        entries.pop_back();
+    }
+}
+
+void CBlockCache::SetMaxUsage(size_t nMaxUsageIn)
+{
+    LOCK(cs);
+    nMaxUsage = nMaxUsageIn;
+    Trim();
+}
+
+std::shared_ptr<const CBlock> CBlockCache::Get(const CDiskBlockPos& pos)
+{
+    LOCK(cs);
+    auto it = mapEntries.find(PosKey(pos.nFile, pos.nPos));
+    if (it == mapEntries.end()) {
+        nMisses++;
+        return nullptr;
+    }
+    nHits++;
+    entries.splice(entries.begin(), entries, it->second.first);
+    return it->second.first->second;
+}
+
+void CBlockCache::Insert(const CDiskBlockPos& pos, std::shared_ptr<const CBlock> pblock)
+{
+    LOCK(cs);
+    size_t nBlockUsage = sizeof(CBlock) + RecursiveDynamicUsage(*pblock);
+    if (nBlockUsage > nMaxUsage) {
+        return;
+    }
+
+    PosKey key(pos.nFile, pos.nPos);
+    auto it = mapEntries.find(key);
+    if (it != mapEntries.end()) {
+        entries.splice(entries.begin(), entries, it->second.first);
+        return;
+    }
+    entries.push_front(std::make_pair(key, pblock));
+    mapEntries.insert(std::make_pair(key, std::make_pair(entries.begin(), nBlockUsage)));
+    nUsage += nBlockUsage;
+    Trim();
+}
+
+void CBlockCache::EraseFile(int nFile)
+{
+    LOCK(cs);
+    auto it = mapEntries.lower_bound(PosKey(nFile, 0));
+    while (it != mapEntries.end() && it->first.first == nFile) {
+        nUsage -= it->second.second;
+        entries.erase(it->second.first);
+        it = mapEntries.erase(it);
+    }
+}
+
+void CBlockCache::Clear()
+{
+    LOCK(cs);
+    entries.clear();
+    mapEntries.clear();
+    nUsage = 0;
+}
+
+size_t CBlockCache::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    return nUsage;
+}
+
+size_t CBlockCache::Size() const
+{
+    LOCK(cs);
+    return mapEntries.size();
+}
+
+uint64_t CBlockCache::Hits() const
+{
+    LOCK(cs);
+    return nHits;
+}
+
+uint64_t CBlockCache::Misses() const
+{
+    LOCK(cs);
+    return nMisses;
+}
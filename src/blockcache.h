@@ -0,0 +1,134 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_BLOCKCACHE_H
+#define ZCASH_BLOCKCACHE_H
+
+#include "blockcompression.h"
+#include "chain.h"
+#include "primitives/block.h"
+#include "protocol.h"
+#include "sync.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <stdio.h>
+#include <utility>
+#include <vector>
+
+/** Default for -blockcachesize, the memory used for recently read blocks, in MiB */
+static const int64_t DEFAULT_BLOCK_CACHE_SIZE = 32;
+/** Default for -blockreadahead, the readahead window for sequential block file reads, in KiB */
+static const int64_t DEFAULT_BLOCK_READAHEAD = 1024;
+/** Maximum number of blk?????.dat files kept open for reading */
+static const size_t MAX_OPEN_BLOCK_READ_FILES = 8;
+
+/**
+ * Keeps read-only handles to blk?????.dat (or rev?????.dat) files open between reads, and
+ * serves sequential reads (e.g. callers walking the chain in order) from a
+ * per-file readahead window instead of issuing one syscall sequence per block.
+ *
+ * Handles are unbuffered so that data appended by WriteBlockToDisk through a
+ * separate handle is visible immediately; any readahead window for a file
+ * must be dropped with Invalidate() after that file is written to.
+ */
+class CBlockFileReader
+{
+private:
+    struct CReadFile {
+        FILE* file;
+        uint64_t nLastUse;
+        //! End offset of the previous tracked read (record headers are not
+        //! tracked), used to detect sequential access
+        unsigned int nLastReadEnd;
+        //! Readahead window covering [nWindowStart, nWindowStart + vWindow.size())
+        unsigned int nWindowStart;
+        std::vector<char> vWindow;
+    };
+
+    mutable CCriticalSection cs;
+    const char* prefix;
+    size_t nMaxOpenFiles;
+    size_t nReadahead;
+    uint64_t nUseCounter;
+    std::map<int, CReadFile> mapFiles;
+
+    CReadFile* GetFile(int nFile);
+    void CloseFile(std::map<int, CReadFile>::iterator it);
+    bool ReadAt(CReadFile& rf, unsigned int nPos, char* pch, size_t nSize, bool fTrack = true);
+
+public:
+    CBlockFileReader(const char* prefixIn, size_t nMaxOpenFilesIn = MAX_OPEN_BLOCK_READ_FILES, size_t nReadaheadIn = DEFAULT_BLOCK_READAHEAD << 10);
+    ~CBlockFileReader();
+
+    void SetReadahead(size_t nReadaheadIn);
+
+    /** Read nSize bytes at pos into pch. */
+    bool Read(const CDiskBlockPos& pos, char* pch, size_t nSize);
+
+    /** Read the format and stored payload length of the record at pos. */
+    bool ReadRecordHeader(const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart, DiskRecordFormat& format, unsigned int& nStoredSize);
+
+    /**
+     * Read the payload of the block or undo record stored at pos, checking
+     * the header in front of it and decompressing it if it is compressed.
+     * If pnStoredSize is given, it is set to the payload length on disk.
+     */
+    bool ReadRecord(const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart, size_t nMaxSize, std::vector<char>& vchPayload, unsigned int* pnStoredSize = NULL);
+
+    /** Read the serialized block stored at pos. */
+    bool ReadRawBlock(const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart, std::vector<char>& vchBlock);
+
+    /** Drop any readahead data for nFile, e.g. after the file was written to. */
+    void Invalidate(int nFile);
+    /** Close the handle for nFile, e.g. before the file is pruned. */
+    void Close(int nFile);
+    void CloseAll();
+};
+
+/**
+ * LRU cache of recently deserialized blocks, keyed by their position on disk
+ * and bounded by the dynamic memory usage of the cached blocks.
+ */
+class CBlockCache
+{
+private:
+    typedef std::pair<int, unsigned int> PosKey;
+    typedef std::list<std::pair<PosKey, std::shared_ptr<const CBlock>>> EntryList;
+
+    mutable CCriticalSection cs;
+    size_t nMaxUsage;
+    size_t nUsage;
+    uint64_t nHits;
+    uint64_t nMisses;
+    //! Most recently used entries are at the front
+    EntryList entries;
+    std::map<PosKey, std::pair<EntryList::iterator, size_t>> mapEntries;
+
+    void Trim();
+
+public:
+    CBlockCache(size_t nMaxUsageIn = DEFAULT_BLOCK_CACHE_SIZE << 20);
+
+    void SetMaxUsage(size_t nMaxUsageIn);
+
+    std::shared_ptr<const CBlock> Get(const CDiskBlockPos& pos);
+    void Insert(const CDiskBlockPos& pos, std::shared_ptr<const CBlock> pblock);
+    /** Remove all blocks stored in nFile, e.g. before the file is pruned. */
+    void EraseFile(int nFile);
+    void Clear();
+
+    size_t DynamicMemoryUsage() const;
+    size_t Size() const;
+    uint64_t Hits() const;
+    uint64_t Misses() const;
+};
+
+extern CBlockFileReader blockFileReader;
+extern CBlockFileReader undoFileReader;
+extern CBlockCache blockCache;
+
+#endif // ZCASH_BLOCKCACHE_H
@@ -0,0 +1,100 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "blockcompression.h"
+
+#include "crypto/common.h"
+#include "util.h"
+
+#include <string.h>
+
+#if ENABLE_ZSTD
+#include <zstd.h>
+#endif
+
+int nBlockCompressionLevel = DEFAULT_BLOCK_COMPRESSION_LEVEL;
+
+bool IsBlockCompressionAvailable()
+{
+#if ENABLE_ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
+void GetCompressedMessageStart(const CMessageHeader::MessageStartChars& messageStart, CMessageHeader::MessageStartChars& compressedStart)
+{
+    memcpy(compressedStart, messageStart, MESSAGE_START_SIZE);
+    compressedStart[MESSAGE_START_SIZE - 1] ^= 0x80;
+}
+
+DiskRecordFormat GetDiskRecordFormat(const unsigned char* pchRecordStart, const CMessageHeader::MessageStartChars& messageStart)
+{
+    if (memcmp(pchRecordStart, messageStart, MESSAGE_START_SIZE) == 0) {
+        return DISK_RECORD_RAW;
+    }
+    CMessageHeader::MessageStartChars compressedStart;
+    GetCompressedMessageStart(messageStart, compressedStart);
+    if (memcmp(pchRecordStart, compressedStart, MESSAGE_START_SIZE) == 0) {
+        return DISK_RECORD_COMPRESSED;
+    }
+    return DISK_RECORD_INVALID;
+}
+
+void EncodeDiskRecord(const char* pch, size_t nSize, const CMessageHeader::MessageStartChars& messageStart, int nLevel, std::vector<char>& vchRecord)
+{
+#if ENABLE_ZSTD
+    if (nLevel > 0) {
+        vchRecord.resize(DISK_RECORD_HEADER_SIZE + ZSTD_compressBound(nSize));
+        size_t nCompressed = ZSTD_compress(&vchRecord[DISK_RECORD_HEADER_SIZE], vchRecord.size() - DISK_RECORD_HEADER_SIZE, pch, nSize, nLevel);
+        if (!ZSTD_isError(nCompressed)) {
+            // Compressed records are written even when they are not smaller,
+            // so that a file written with compression enabled can be
+            // recognized from its first record.
+            CMessageHeader::MessageStartChars compressedStart;
+            GetCompressedMessageStart(messageStart, compressedStart);
+            memcpy(&vchRecord[0], compressedStart, MESSAGE_START_SIZE);
+            WriteLE32((unsigned char*)&vchRecord[MESSAGE_START_SIZE], nCompressed);
+            vchRecord.resize(DISK_RECORD_HEADER_SIZE + nCompressed);
+            return;
+        }
+        LogPrintf("%s: zstd compression failed: %s\n", __func__, ZSTD_getErrorName(nCompressed));
+    }
+#endif
+    vchRecord.resize(DISK_RECORD_HEADER_SIZE + nSize);
+    memcpy(&vchRecord[0], messageStart, MESSAGE_START_SIZE);
+    WriteLE32((unsigned char*)&vchRecord[MESSAGE_START_SIZE], nSize);
+    if (nSize > 0) {
+        memcpy(&vchRecord[DISK_RECORD_HEADER_SIZE], pch, nSize);
+    }
+}
+
+bool DecompressDiskRecord(const char* pch, size_t nSize, size_t nMaxSize, std::vector<char>& vchPayload)
+{
+#if ENABLE_ZSTD
+    unsigned long long nContentSize = ZSTD_getFrameContentSize(pch, nSize);
+    if (nContentSize == ZSTD_CONTENTSIZE_UNKNOWN || nContentSize == ZSTD_CONTENTSIZE_ERROR) {
+        return error("%s: invalid zstd frame", __func__);
+    }
+    if (nContentSize > nMaxSize) {
+        return error("%s: decompressed size %u too large", __func__, nContentSize);
+    }
+    vchPayload.resize(nContentSize);
+    size_t nDecompressed = ZSTD_decompress(vchPayload.data(), vchPayload.size(), pch, nSize);
+    if (ZSTD_isError(nDecompressed)) {
+        return error("%s: zstd decompression failed: %s", __func__, ZSTD_getErrorName(nDecompressed));
+    }
+    if (nDecompressed != nContentSize) {
+        return error("%s: decompressed %u bytes, expected %u", __func__, nDecompressed, nContentSize);
+    }
+    return true;
+#else
+    return error("%s: compressed block records require a build with zstd support", __func__);
+#endif
+}
@@ -0,0 +1,57 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_BLOCKCOMPRESSION_H
+#define ZCASH_BLOCKCOMPRESSION_H
+
+#include "protocol.h"
+
+#include <stdint.h>
+#include <vector>
+
+/** Default for -blockcompression, the zstd level for newly written block and undo records (0 = off) */
+static const int DEFAULT_BLOCK_COMPRESSION_LEVEL = 0;
+/** Highest accepted -blockcompression level */
+static const int MAX_BLOCK_COMPRESSION_LEVEL = 19;
+
+/** Size of the header (message start and payload length) in front of each block and undo record */
+static const unsigned int DISK_RECORD_HEADER_SIZE = MESSAGE_START_SIZE + sizeof(uint32_t);
+
+/**
+ * Block and undo records in blk?????.dat and rev?????.dat files are either
+ * raw, marked with the network message start, or hold a single zstd frame
+ * and are marked with the compressed message start. The stored length is
+ * the length of what follows the header, so CDiskBlockPos keeps addressing
+ * individual records in both cases and files may mix the two formats.
+ */
+enum DiskRecordFormat {
+    DISK_RECORD_INVALID,
+    DISK_RECORD_RAW,
+    DISK_RECORD_COMPRESSED,
+};
+
+extern int nBlockCompressionLevel;
+
+/** Whether this binary was built with zstd support. */
+bool IsBlockCompressionAvailable();
+
+/**
+ * The message start marking compressed records: the network message start
+ * with the top bit of its last byte flipped. It shares the first byte with
+ * the network message start, so scanning for records finds both formats.
+ */
+void GetCompressedMessageStart(const CMessageHeader::MessageStartChars& messageStart, CMessageHeader::MessageStartChars& compressedStart);
+
+DiskRecordFormat GetDiskRecordFormat(const unsigned char* pchRecordStart, const CMessageHeader::MessageStartChars& messageStart);
+
+/**
+ * Build the on-disk record (header followed by payload) for a serialized
+ * block or undo payload, compressing the payload if nLevel is positive.
+ */
+void EncodeDiskRecord(const char* pch, size_t nSize, const CMessageHeader::MessageStartChars& messageStart, int nLevel, std::vector<char>& vchRecord);
+
+/** Decompress the payload of a compressed record, which must not expand beyond nMaxSize. */
+bool DecompressDiskRecord(const char* pch, size_t nSize, size_t nMaxSize, std::vector<char>& vchPayload);
+
+#endif // ZCASH_BLOCKCOMPRESSION_H
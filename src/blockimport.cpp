@@ -0,0 +1,238 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockimport.h"
+
+#include "chainparams.h"
+#include "consensus/consensus.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "proof_verifier.h"
+#include "streams.h"
+#include "util.h"
+
+#include <boost/bind.hpp>
+
+CBlockImporter::CBlockImporter(const CChainParams& chainparamsIn, FILE* fileInIn, int nFileIn, int nWorkers) :
+    chainparams(chainparamsIn), fileIn(fileInIn), nFile(nFileIn), nReadSeq(0), nNextSeq(0), nGeneration(0),
+    fReadDone(false), fStop(false), fRestart(false), nRestartPos(0)
+{
+    nWorkers = std::max(nWorkers, 1);
+    nWindow = 4 * nWorkers;
+    threads.create_thread(boost::bind(&CBlockImporter::ThreadRead, this));
+    for (int i = 0; i < nWorkers; i++) {
+        threads.create_thread(boost::bind(&CBlockImporter::ThreadCheck, this));
+    }
+}
+
+CBlockImporter::~CBlockImporter()
+{
+    // This may run while the importing thread is being interrupted.
+    boost::this_thread::disable_interruption di;
+    Stop();
+    threads.join_all();
+}
+
+void CBlockImporter::Stop()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    fStop = true;
+    condWorker.notify_all();
+    condMaster.notify_all();
+}
+
+/** Queue a record; returns false if the reader has to stop or restart instead. */
+bool CBlockImporter::Push(CJob& job)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (!fStop && !fRestart && nReadSeq - nNextSeq >= nWindow) {
+        condMaster.wait(lock);
+    }
+    if (fStop || fRestart) {
+        return false;
+    }
+    job.nSeq = nReadSeq++;
+    job.nGeneration = nGeneration;
+    queueJobs.push_back(std::move(job));
+    condWorker.notify_one();
+    return true;
+}
+
+/** Wait until Next() sends the reader back to nPos; returns false on Stop(). */
+bool CBlockImporter::WaitForRestart(uint64_t& nPos)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (!fStop && !fRestart) {
+        condMaster.wait(lock);
+    }
+    if (fStop) {
+        return false;
+    }
+    fRestart = false;
+    nPos = nRestartPos;
+    return true;
+}
+
+void CBlockImporter::ThreadRead()
+{
+    RenameThread("zcash-blkread");
+    try {
+        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+        uint64_t nRewind = blkdat.GetPos();
+        while (true) {
+            if (blkdat.eof()) {
+                {
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    fReadDone = true;
+                    condMaster.notify_all();
+                }
+                if (!WaitForRestart(nRewind) || !blkdat.Seek(nRewind))
+                    break;
+            }
+            blkdat.SetPos(nRewind);
+            nRewind++; // start one byte further next time, in case of failure
+            blkdat.SetLimit(); // remove former limit
+            unsigned int nSize = 0;
+            CJob job;
+            try {
+                // locate a header
+                unsigned char buf[MESSAGE_START_SIZE];
+                blkdat.FindByte(chainparams.MessageStart()[0]);
+                nRewind = blkdat.GetPos()+1;
+                job.nRetryPos = nRewind;
+                blkdat >> FLATDATA(buf);
+                job.format = GetDiskRecordFormat(buf, chainparams.MessageStart());
+                if (job.format == DISK_RECORD_INVALID)
+                    continue;
+                // read size
+                blkdat >> nSize;
+                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+                    continue;
+            } catch (const std::exception&) {
+                // no valid block header found; don't complain, but stay
+                // around in case Next() sends the reader back
+                if (!blkdat.eof())
+                    break;
+                continue;
+            }
+            try {
+                // read the record; it is deserialized by the workers
+                uint64_t nBlockPos = blkdat.GetPos();
+                blkdat.SetLimit(nBlockPos + nSize);
+                job.pos = CDiskBlockPos(nFile, nBlockPos);
+                job.vch.resize(nSize);
+                blkdat.read(job.vch.data(), nSize);
+                nRewind = blkdat.GetPos();
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+                continue;
+            }
+            if (!Push(job)) {
+                if (!WaitForRestart(nRewind) || !blkdat.Seek(nRewind))
+                    break;
+            }
+        }
+    } catch (const std::runtime_error& e) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        strReadError = e.what();
+    }
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    fReadDone = true;
+    condMaster.notify_all();
+}
+
+void CBlockImporter::ThreadCheck()
+{
+    RenameThread("zcash-blkcheck");
+    while (true) {
+        CJob job;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!fStop && queueJobs.empty()) {
+                condWorker.wait(lock);
+            }
+            if (fStop) {
+                return;
+            }
+            job = std::move(queueJobs.front());
+            queueJobs.pop_front();
+        }
+
+        CResult result;
+        result.block.pos = job.pos;
+        result.nEnd = job.pos.nPos + job.vch.size();
+        result.nResume = job.nRetryPos;
+        try {
+            std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+            if (job.format == DISK_RECORD_COMPRESSED) {
+                std::vector<char> vchBlock;
+                if (!DecompressDiskRecord(job.vch.data(), job.vch.size(), MAX_BLOCK_SIZE, vchBlock))
+                    throw std::ios_base::failure("invalid compressed block");
+                CDataStream ssBlock(vchBlock, SER_DISK, CLIENT_VERSION);
+                ssBlock >> *pblock;
+                result.nResume = result.nEnd;
+            } else {
+                CDataStream ssBlock(job.vch, SER_DISK, CLIENT_VERSION);
+                ssBlock >> *pblock;
+                // The block may end before the size in its header says
+                result.nResume = job.pos.nPos + (job.vch.size() - ssBlock.size());
+            }
+
+            // Failures are left to ProcessNewBlock, which reports them and
+            // marks the block invalid where appropriate. Proofs are left to
+            // ConnectBlock, which skips them below checkpoints and
+            // -assumevalid as it does for blocks from the network.
+            CValidationState state;
+            auto verifier = ProofVerifier::Disabled();
+            if (CheckBlock(*pblock, state, chainparams, verifier, true, true))
+                pblock->fChecked = true;
+            result.block.pblock = pblock;
+        } catch (const std::exception& e) {
+            result.block.strError = e.what();
+        }
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        // Results read before the reader was sent back are dropped
+        if (job.nGeneration == nGeneration) {
+            mapDone.insert(std::make_pair(job.nSeq, result));
+            condMaster.notify_all();
+        }
+    }
+}
+
+bool CBlockImporter::Next(CImportedBlock& block)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        std::map<uint64_t, CResult>::iterator it = mapDone.find(nNextSeq);
+        if (it != mapDone.end()) {
+            block = it->second.block;
+            if (it->second.nResume != it->second.nEnd && strReadError.empty()) {
+                // The reader went on from the wrong place, so everything
+                // after this record is dropped and read again.
+                nRestartPos = it->second.nResume;
+                nGeneration++;
+                queueJobs.clear();
+                mapDone.clear();
+                nReadSeq = nNextSeq + 1;
+                fRestart = true;
+                fReadDone = false;
+            } else {
+                mapDone.erase(it);
+            }
+            nNextSeq++;
+            // Let the reader queue another record
+            condMaster.notify_all();
+            return true;
+        }
+        if (fReadDone && nNextSeq == nReadSeq) {
+            if (!strReadError.empty())
+                throw std::runtime_error(strReadError);
+            return false;
+        }
+        condMaster.wait(lock);
+    }
+}
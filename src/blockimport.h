@@ -0,0 +1,123 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_BLOCKIMPORT_H
+#define ZCASH_BLOCKIMPORT_H
+
+#include "blockcompression.h"
+#include "chain.h"
+#include "primitives/block.h"
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+class CChainParams;
+
+/** A block record read by CBlockImporter */
+struct CImportedBlock
+{
+    //! Position of the block payload in the file being imported
+    CDiskBlockPos pos;
+    //! The block, or NULL if the record could not be deserialized
+    std::shared_ptr<const CBlock> pblock;
+    //! Why the record could not be deserialized
+    std::string strError;
+};
+
+/**
+ * Pipelined reader for -reindex and -loadblock imports.
+ *
+ * One thread scans the file for block records, a pool of worker threads
+ * deserializes them and runs the context-free CheckBlock (including Equihash,
+ * but not proofs), and Next() hands them back in file order so that the
+ * caller can connect them. Blocks that pass are marked fChecked so that only
+ * ConnectBlock's proof verification is left to do; blocks that fail are
+ * still returned and rejected by the usual validation path.
+ *
+ * The reader assumes that each record ends where its size field says. When
+ * a record turns out not to deserialize, or to end earlier, the records read
+ * after it are discarded and the reader rescans from one byte after its
+ * magic or from the real end of the block, as a sequential scan would.
+ */
+class CBlockImporter
+{
+private:
+    struct CJob {
+        uint64_t nSeq;
+        uint64_t nGeneration;
+        //! Where to rescan from if the record does not deserialize
+        uint64_t nRetryPos;
+        CDiskBlockPos pos;
+        DiskRecordFormat format;
+        std::vector<char> vch;
+    };
+
+    struct CResult {
+        CImportedBlock block;
+        //! Where the reader went on after this record
+        uint64_t nEnd;
+        //! Where a sequential scan would go on after this record
+        uint64_t nResume;
+    };
+
+    const CChainParams& chainparams;
+    FILE* fileIn;
+    int nFile;
+    //! Maximum number of records read but not yet returned by Next()
+    size_t nWindow;
+
+    boost::mutex mutex;
+    //! Worker threads block on this when out of work
+    boost::condition_variable condWorker;
+    //! The reader and Next() block on this while waiting for the pipeline
+    boost::condition_variable condMaster;
+    std::deque<CJob> queueJobs;
+    std::map<uint64_t, CResult> mapDone;
+    //! Sequence number of the next record the reader will queue
+    uint64_t nReadSeq;
+    //! Sequence number of the next record Next() will return
+    uint64_t nNextSeq;
+    //! Incremented when the reader is sent back, to discard stale results
+    uint64_t nGeneration;
+    bool fReadDone;
+    bool fStop;
+    //! Set by Next() to make the reader rescan from nRestartPos
+    bool fRestart;
+    uint64_t nRestartPos;
+    std::string strReadError;
+
+    boost::thread_group threads;
+
+    bool Push(CJob& job);
+    bool WaitForRestart(uint64_t& nPos);
+    void ThreadRead();
+    void ThreadCheck();
+    void Stop();
+
+public:
+    /**
+     * Start importing from fileIn, which is taken over and closed once it
+     * has been read. nFile is used for the returned positions.
+     */
+    CBlockImporter(const CChainParams& chainparams, FILE* fileIn, int nFile, int nWorkers);
+    ~CBlockImporter();
+
+    /**
+     * Wait for the next block record in file order. Returns false once the
+     * whole file has been returned, and throws std::runtime_error if
+     * reading the file failed.
+     */
+    bool Next(CImportedBlock& block);
+};
+
+#endif // ZCASH_BLOCKIMPORT_H
@@ -601,4 +601,48 @@ public:
     const CBlockIndex *FindFork(const CBlockIndex *pindex) const;
 };
 
+/**
+ * The active chain as of one tip. Block index entries are not freed while
+ * the node runs and the fields read here do not change once a block has
+ * been connected, so a snapshot can be used without holding cs_main. Blocks
+ * are looked up through the skip list from the tip.
+ */
+class CChainSnapshot {
+private:
+    const CBlockIndex *pindexTip;
+
+public:
+    explicit CChainSnapshot(const CBlockIndex *pindex) : pindexTip(pindex) {}
+
+    /** Returns the index entry for the tip of this chain, or NULL if none. */
+    const CBlockIndex *Tip() const {
+        return pindexTip;
+    }
+
+    /** Returns the index entry at a particular height in this chain, or NULL if no such height exists. */
+    const CBlockIndex *operator[](int nHeight) const {
+        if (pindexTip == NULL || nHeight < 0 || nHeight > pindexTip->nHeight)
+            return NULL;
+        return pindexTip->GetAncestor(nHeight);
+    }
+
+    /** Check whether a block is present in this chain. */
+    bool Contains(const CBlockIndex *pindex) const {
+        return (*this)[pindex->nHeight] == pindex;
+    }
+
+    /** Find the successor of a block in this chain, or NULL if the given index is not found or is the tip. */
+    const CBlockIndex *Next(const CBlockIndex *pindex) const {
+        if (Contains(pindex))
+            return (*this)[pindex->nHeight + 1];
+        else
+            return NULL;
+    }
+
+    /** Return the maximal height in the chain. Is equal to chain.Tip() ? chain.Tip()->nHeight : -1. */
+    int Height() const {
+        return pindexTip ? pindexTip->nHeight : -1;
+    }
+};
+
 #endif // BITCOIN_CHAIN_H
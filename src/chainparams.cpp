@@ -217,6 +217,9 @@ public:
         // The best chain should have at least this much work.
         consensus.nMinimumChainWork = uint256S("0000000000000000000000000000000000000000000000000000058577ad3074");
 
+        // By default assume that the signatures and proofs in ancestors of this block are valid.
+        consensus.defaultAssumeValid = uint256S("0x00000257317a362097ccffa4b48bccdc290ed877f7fd735ae9a4fddbf04e0be5"); // 263300
+
         /**
          * The message start string should be awesome! ⓩ❤
          */
@@ -514,6 +517,9 @@ public:
         // The best chain should have at least this much work.
         consensus.nMinimumChainWork = uint256S("0x0000000000000000000000000000000000000000000000000000000000000000");
 
+        // By default assume that the signatures and proofs in ancestors of this block are valid.
+        consensus.defaultAssumeValid = uint256S("0x00");
+
         pchMessageStart[0] = 0xfa;
         pchMessageStart[1] = 0x1a;
         pchMessageStart[2] = 0xf9;
@@ -653,6 +659,9 @@ public:
         // The best chain should have at least this much work.
         consensus.nMinimumChainWork = uint256S("0x00");
 
+        // By default assume that the signatures and proofs in ancestors of this block are valid.
+        consensus.defaultAssumeValid = uint256S("0x00");
+
         pchMessageStart[0] = 0xaa;
         pchMessageStart[1] = 0xe8;
         pchMessageStart[2] = 0x3f;
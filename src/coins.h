@@ -472,6 +472,10 @@ protected:
     /* Cached dynamic memory usage for the inner CCoins objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Coins lookups answered from this cache, and passed on to the backing view. */
+    mutable uint64_t nCacheHits;
+    mutable uint64_t nCacheMisses;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
     ~CCoinsViewCache();
@@ -552,6 +556,10 @@ public:
     //! Calculate the size of the cache (in bytes)
     size_t DynamicMemoryUsage() const;
 
+    //! Number of coins lookups answered from the cache, and passed on to the backing view
+    uint64_t GetCacheHits() const { return nCacheHits; }
+    uint64_t GetCacheMisses() const { return nCacheMisses; }
+
     /** 
      * Amount of bitcoins coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
@@ -272,6 +272,8 @@ struct Params {
     int64_t MaxActualTimespan(int nHeight) const;
 
     uint256 nMinimumChainWork;
+    /** Default for -assumevalid: ancestors of this block skip script and proof verification */
+    uint256 defaultAssumeValid;
 };
 
 } // namespace Consensus
@@ -0,0 +1,179 @@
+#include <gtest/gtest.h>
+
+#include "blockcache.h"
+#include "chainparams.h"
+#include "main.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+
+static std::shared_ptr<const CBlock> MakeBlock(uint32_t nTime)
+{
+    CBlock block;
+    block.nTime = nTime;
+    return std::make_shared<const CBlock>(block);
+}
+
+TEST(BlockCache, EvictsLeastRecentlyUsed)
+{
+    CBlockCache cache;
+    cache.Insert(CDiskBlockPos(0, 8), MakeBlock(1));
+    size_t nBlockUsage = cache.DynamicMemoryUsage();
+    ASSERT_GT(nBlockUsage, 0);
+
+    // Room for exactly two blocks
+    cache.SetMaxUsage(2 * nBlockUsage);
+    cache.Insert(CDiskBlockPos(0, 100), MakeBlock(2));
+    EXPECT_EQ(2, cache.Size());
+
+    // Touch the first block so that the second one is evicted next
+    ASSERT_TRUE(cache.Get(CDiskBlockPos(0, 8)) != nullptr);
+    cache.Insert(CDiskBlockPos(1, 8), MakeBlock(3));
+    EXPECT_EQ(2, cache.Size());
+    EXPECT_EQ(2 * nBlockUsage, cache.DynamicMemoryUsage());
+    EXPECT_TRUE(cache.Get(CDiskBlockPos(0, 100)) == nullptr);
+
+    auto pblock = cache.Get(CDiskBlockPos(0, 8));
+    ASSERT_TRUE(pblock != nullptr);
+    EXPECT_EQ(1, pblock->nTime);
+    pblock = cache.Get(CDiskBlockPos(1, 8));
+    ASSERT_TRUE(pblock != nullptr);
+    EXPECT_EQ(3, pblock->nTime);
+
+    EXPECT_EQ(3, cache.Hits());
+    EXPECT_EQ(1, cache.Misses());
+}
+
+TEST(BlockCache, DisabledWhenEmpty)
+{
+    CBlockCache cache(0);
+    cache.Insert(CDiskBlockPos(0, 8), MakeBlock(1));
+    EXPECT_EQ(0, cache.Size());
+    EXPECT_TRUE(cache.Get(CDiskBlockPos(0, 8)) == nullptr);
+}
+
+TEST(BlockCache, EraseFile)
+{
+    CBlockCache cache;
+    cache.Insert(CDiskBlockPos(0, 8), MakeBlock(1));
+    cache.Insert(CDiskBlockPos(1, 8), MakeBlock(2));
+    cache.Insert(CDiskBlockPos(1, 100), MakeBlock(3));
+    cache.Insert(CDiskBlockPos(2, 8), MakeBlock(4));
+    size_t nBlockUsage = cache.DynamicMemoryUsage() / 4;
+
+    cache.EraseFile(1);
+    EXPECT_EQ(2, cache.Size());
+    EXPECT_EQ(2 * nBlockUsage, cache.DynamicMemoryUsage());
+    EXPECT_TRUE(cache.Get(CDiskBlockPos(1, 8)) == nullptr);
+    EXPECT_TRUE(cache.Get(CDiskBlockPos(1, 100)) == nullptr);
+    EXPECT_TRUE(cache.Get(CDiskBlockPos(0, 8)) != nullptr);
+    EXPECT_TRUE(cache.Get(CDiskBlockPos(2, 8)) != nullptr);
+}
+
+static void AppendRecord(FILE* file, const CMessageHeader::MessageStartChars& messageStart, const std::vector<char>& vch)
+{
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+    fileout << FLATDATA(messageStart) << (unsigned int)vch.size();
+    fileout.write(vch.data(), vch.size());
+    fileout.release();
+}
+
+TEST(BlockFileReader, ReadRawBlocks)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    const auto& messageStart = Params().MessageStart();
+
+    boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directories(pathTemp / "blocks");
+    mapArgs["-datadir"] = pathTemp.string();
+    ClearDatadirCache();
+
+    std::vector<char> vchFirst(100, 'a');
+    std::vector<char> vchSecond(300, 'b');
+    std::vector<char> vchThird(50, 'c');
+
+    FILE* file = fopen(GetBlockPosFilename(CDiskBlockPos(0, 0), "blk").string().c_str(), "wb");
+    ASSERT_TRUE(file != NULL);
+    AppendRecord(file, messageStart, vchFirst);
+    AppendRecord(file, messageStart, vchSecond);
+    fclose(file);
+
+    // A readahead window smaller than the file, but larger than each record
+    CBlockFileReader reader("blk", 2, 256);
+    std::vector<char> vch;
+    ASSERT_TRUE(reader.ReadRawBlock(CDiskBlockPos(0, 8), messageStart, vch));
+    EXPECT_EQ(vchFirst, vch);
+    ASSERT_TRUE(reader.ReadRawBlock(CDiskBlockPos(0, 116), messageStart, vch));
+    EXPECT_EQ(vchSecond, vch);
+    // Re-reading out of order is still correct
+    ASSERT_TRUE(reader.ReadRawBlock(CDiskBlockPos(0, 8), messageStart, vch));
+    EXPECT_EQ(vchFirst, vch);
+
+    // Positions that do not point at a record are rejected
+    EXPECT_FALSE(reader.ReadRawBlock(CDiskBlockPos(0, 20), messageStart, vch));
+    EXPECT_FALSE(reader.ReadRawBlock(CDiskBlockPos(0, 4), messageStart, vch));
+    EXPECT_FALSE(reader.ReadRawBlock(CDiskBlockPos(1, 8), messageStart, vch));
+
+    // Data appended after a read is visible once the file is invalidated
+    ASSERT_TRUE(reader.ReadRawBlock(CDiskBlockPos(0, 116), messageStart, vch));
+    file = fopen(GetBlockPosFilename(CDiskBlockPos(0, 0), "blk").string().c_str(), "ab");
+    ASSERT_TRUE(file != NULL);
+    AppendRecord(file, messageStart, vchThird);
+    fclose(file);
+    reader.Invalidate(0);
+    ASSERT_TRUE(reader.ReadRawBlock(CDiskBlockPos(0, 424), messageStart, vch));
+    EXPECT_EQ(vchThird, vch);
+
+    reader.CloseAll();
+    mapArgs.erase("-datadir");
+    ClearDatadirCache();
+    boost::filesystem::remove_all(pathTemp);
+}
+
+TEST(BlockFileReader, ReadCompressedRecords)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    const auto& messageStart = Params().MessageStart();
+
+    std::vector<char> vchPayload(1000, 'a');
+    std::vector<char> vchRecord;
+    EncodeDiskRecord(vchPayload.data(), vchPayload.size(), messageStart, 0, vchRecord);
+    ASSERT_EQ(DISK_RECORD_HEADER_SIZE + vchPayload.size(), vchRecord.size());
+    EXPECT_EQ(DISK_RECORD_RAW, GetDiskRecordFormat((unsigned char*)vchRecord.data(), messageStart));
+
+    if (!IsBlockCompressionAvailable()) {
+        return;
+    }
+
+    boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directories(pathTemp / "blocks");
+    mapArgs["-datadir"] = pathTemp.string();
+    ClearDatadirCache();
+
+    std::vector<char> vchRaw(300, 'b');
+    EncodeDiskRecord(vchPayload.data(), vchPayload.size(), messageStart, 3, vchRecord);
+    EXPECT_EQ(DISK_RECORD_COMPRESSED, GetDiskRecordFormat((unsigned char*)vchRecord.data(), messageStart));
+    EXPECT_LT(vchRecord.size(), DISK_RECORD_HEADER_SIZE + vchPayload.size());
+
+    // A compressed record followed by a raw one in the same file
+    FILE* file = fopen(GetBlockPosFilename(CDiskBlockPos(0, 0), "blk").string().c_str(), "wb");
+    ASSERT_TRUE(file != NULL);
+    ASSERT_EQ(vchRecord.size(), fwrite(vchRecord.data(), 1, vchRecord.size(), file));
+    unsigned int nRawPos = vchRecord.size() + DISK_RECORD_HEADER_SIZE;
+    AppendRecord(file, messageStart, vchRaw);
+    fclose(file);
+
+    CBlockFileReader reader("blk");
+    std::vector<char> vch;
+    ASSERT_TRUE(reader.ReadRecord(CDiskBlockPos(0, DISK_RECORD_HEADER_SIZE), messageStart, 10000, vch));
+    EXPECT_EQ(vchPayload, vch);
+    ASSERT_TRUE(reader.ReadRecord(CDiskBlockPos(0, nRawPos), messageStart, 10000, vch));
+    EXPECT_EQ(vchRaw, vch);
+    // The size limit applies to the decompressed payload
+    EXPECT_FALSE(reader.ReadRecord(CDiskBlockPos(0, DISK_RECORD_HEADER_SIZE), messageStart, 500, vch));
+
+    reader.CloseAll();
+    mapArgs.erase("-datadir");
+    ClearDatadirCache();
+    boost::filesystem::remove_all(pathTemp);
+}
@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+
+#include "arith_uint256.h"
+#include "blockimport.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "streams.h"
+
+#include <stdio.h>
+
+static void AppendRecord(FILE* file, const CMessageHeader::MessageStartChars& messageStart, const CDataStream& ss)
+{
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+    fileout << FLATDATA(messageStart) << (unsigned int)ss.size();
+    fileout.write(&ss[0], ss.size());
+    fileout.release();
+}
+
+TEST(BlockImporter, ReturnsBlocksInFileOrder)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    const auto& messageStart = Params().MessageStart();
+
+    CBlock genesis = Params().GenesisBlock();
+    CBlock tampered = genesis;
+    tampered.nNonce = ArithToUint256(UintToArith256(tampered.nNonce) + 1);
+
+    FILE* file = tmpfile();
+    ASSERT_TRUE(file != NULL);
+    std::vector<unsigned int> vPos;
+    const int nCopies = 20;
+    for (int i = 0; i < nCopies; i++) {
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << (i % 2 ? tampered : genesis);
+        AppendRecord(file, messageStart, ss);
+        vPos.push_back(ftell(file) - ss.size());
+    }
+    // A record that does not hold a block
+    CDataStream ssGarbage(SER_DISK, CLIENT_VERSION);
+    ssGarbage << std::vector<unsigned char>(100, 0xff);
+    AppendRecord(file, messageStart, ssGarbage);
+    vPos.push_back(ftell(file) - ssGarbage.size());
+    rewind(file);
+
+    CBlockImporter importer(Params(), file, 3, 4);
+    CImportedBlock imported;
+    for (int i = 0; i < nCopies; i++) {
+        ASSERT_TRUE(importer.Next(imported));
+        EXPECT_EQ(3, imported.pos.nFile);
+        EXPECT_EQ(vPos[i], imported.pos.nPos);
+        ASSERT_TRUE(imported.pblock != nullptr);
+        if (i % 2) {
+            // Returned for the usual validation path to reject
+            EXPECT_EQ(tampered.GetHash(), imported.pblock->GetHash());
+            EXPECT_FALSE(imported.pblock->fChecked);
+        } else {
+            EXPECT_EQ(genesis.GetHash(), imported.pblock->GetHash());
+            EXPECT_TRUE(imported.pblock->fChecked);
+        }
+    }
+    ASSERT_TRUE(importer.Next(imported));
+    EXPECT_EQ(vPos[nCopies], imported.pos.nPos);
+    EXPECT_TRUE(imported.pblock == nullptr);
+    EXPECT_FALSE(imported.strError.empty());
+
+    EXPECT_FALSE(importer.Next(imported));
+}
+
+TEST(BlockImporter, StopsBeforeEndOfFile)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    const auto& messageStart = Params().MessageStart();
+
+    FILE* file = tmpfile();
+    ASSERT_TRUE(file != NULL);
+    for (int i = 0; i < 100; i++) {
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << Params().GenesisBlock();
+        AppendRecord(file, messageStart, ss);
+    }
+    rewind(file);
+
+    // Destroying the importer with most of the file unread must not hang
+    CBlockImporter importer(Params(), file, 0, 2);
+    CImportedBlock imported;
+    ASSERT_TRUE(importer.Next(imported));
+}
@@ -1278,6 +1278,10 @@ TEST(ChecktransactionTests, HeartwoodEnforcesSaplingRulesOnShieldedCoinbase) {
     EXPECT_CALL(state, DoS(100, false, REJECT_INVALID, "bad-txns-sapling-binding-signature-invalid", false)).Times(1);
     ContextualCheckTransaction(tx, state, chainparams, 10, 57);
 
+    // Sapling proofs and signatures are not verified in blocks covered by -assumevalid.
+    MockCValidationState stateAssumeValid;
+    EXPECT_TRUE(ContextualCheckTransaction(tx, stateAssumeValid, chainparams, 10, true, IsInitialBlockDownload, false));
+
     RegtestDeactivateHeartwood();
 }
 
@@ -12,6 +12,7 @@ public:
     MOCK_METHOD0(GetRequestMethod, HTTPRequest::RequestMethod());
     MOCK_METHOD1(GetHeader, std::pair<bool, std::string>(const std::string& hdr));
     MOCK_METHOD2(WriteHeader, void(const std::string& hdr, const std::string& value));
+    MOCK_METHOD1(WriteReplyBody, void(const std::string& strData));
     MOCK_METHOD2(WriteReply, void(int nStatus, const std::string& strReply));
 
     MockHTTPRequest() : HTTPRequest(nullptr) {}
@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+
+#include "httpworkqueue.h"
+#include "utiltime.h"
+
+#include <boost/thread.hpp>
+
+// Records the order in which the queue runs its items
+struct TestWorkItem
+{
+    std::vector<std::string>& log;
+    boost::mutex& cs;
+    std::string name;
+
+    TestWorkItem(std::vector<std::string>& log, boost::mutex& cs, const std::string& name) :
+        log(log), cs(cs), name(name) {}
+
+    void operator()()
+    {
+        boost::lock_guard<boost::mutex> lock(cs);
+        log.push_back(name);
+    }
+};
+
+class HTTPWorkQueueTest : public ::testing::Test {
+protected:
+    std::vector<std::string> log;
+    boost::mutex cs;
+
+    TestWorkItem* Item(const std::string& name) {
+        return new TestWorkItem(log, cs, name);
+    }
+
+    // Run the queued items on one worker thread and return their order
+    std::vector<std::string> RunAll(WorkQueue<TestWorkItem>& queue, size_t nItems) {
+        boost::thread worker(&WorkQueue<TestWorkItem>::Run, &queue);
+        for (int i = 0; i < 500; i++) {
+            {
+                boost::lock_guard<boost::mutex> lock(cs);
+                if (log.size() >= nItems)
+                    break;
+            }
+            MilliSleep(10);
+        }
+        queue.Interrupt();
+        worker.join();
+        queue.WaitExit();
+        boost::lock_guard<boost::mutex> lock(cs);
+        return log;
+    }
+};
+
+TEST_F(HTTPWorkQueueTest, ServesClientsInTurn) {
+    WorkQueue<TestWorkItem> queue(16);
+    EXPECT_TRUE(queue.Enqueue("a", Item("a1")) == NULL);
+    EXPECT_TRUE(queue.Enqueue("a", Item("a2")) == NULL);
+    EXPECT_TRUE(queue.Enqueue("a", Item("a3")) == NULL);
+    EXPECT_TRUE(queue.Enqueue("b", Item("b1")) == NULL);
+    EXPECT_TRUE(queue.Enqueue("c", Item("c1")) == NULL);
+    EXPECT_TRUE(queue.Enqueue("b", Item("b2")) == NULL);
+    EXPECT_EQ(6, queue.Depth());
+
+    std::vector<std::string> expected = {"a1", "b1", "c1", "a2", "b2", "a3"};
+    EXPECT_EQ(expected, RunAll(queue, expected.size()));
+    EXPECT_EQ(0, queue.Depth());
+}
+
+TEST_F(HTTPWorkQueueTest, DropsFromLongestQueueWhenFull) {
+    WorkQueue<TestWorkItem> queue(3);
+    EXPECT_TRUE(queue.Enqueue("a", Item("a1")) == NULL);
+    EXPECT_TRUE(queue.Enqueue("a", Item("a2")) == NULL);
+    EXPECT_TRUE(queue.Enqueue("b", Item("b1")) == NULL);
+    EXPECT_EQ(3, queue.Depth());
+
+    // The client with the longest queue loses its own new item
+    TestWorkItem* a3 = Item("a3");
+    EXPECT_EQ(a3, queue.Enqueue("a", a3));
+    delete a3;
+    EXPECT_EQ(3, queue.Depth());
+
+    // So does a client that would end up with as many items as the longest
+    TestWorkItem* b2 = Item("b2");
+    EXPECT_EQ(b2, queue.Enqueue("b", b2));
+    delete b2;
+    EXPECT_EQ(3, queue.Depth());
+
+    // Otherwise the longest queue gives up its newest item
+    TestWorkItem* dropped = queue.Enqueue("c", Item("c1"));
+    ASSERT_TRUE(dropped != NULL);
+    EXPECT_EQ("a2", dropped->name);
+    delete dropped;
+    EXPECT_EQ(3, queue.Depth());
+
+    std::vector<std::string> expected = {"a1", "b1", "c1"};
+    EXPECT_EQ(expected, RunAll(queue, expected.size()));
+    EXPECT_EQ(0, queue.Depth());
+}
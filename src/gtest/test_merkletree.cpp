@@ -16,6 +16,7 @@
 
 #include <stdexcept>
 
+#include "arith_uint256.h"
 #include "utilstrencodings.h"
 #include "version.h"
 #include "serialize.h"
@@ -286,3 +287,61 @@ TEST(merkletree, testZeroElements) {
         ASSERT_TRUE(newTree.root() == oldroot);
     }
 }
+
+template<typename Tree, typename Witness, typename Hash>
+void test_append_all() {
+    Tree tree;
+    std::vector<Witness> expected;
+    std::vector<Witness> actual;
+
+    // Batches of different sizes, with a new witness after some of them so
+    // that the witnesses are filling subtrees of different depths.
+    uint64_t leaf = 0;
+    for (size_t batch = 0; batch < 60; batch++) {
+        std::vector<Hash> leaves;
+        for (size_t i = 0; i < (batch * 7) % 19; i++) {
+            leaves.push_back(Hash(ArithToUint256(arith_uint256(++leaf))));
+        }
+
+        std::vector<Witness*> witnesses;
+        for (Witness& witness : actual) {
+            witnesses.push_back(&witness);
+        }
+        Witness::append_all(witnesses, leaves);
+        for (const Hash& obj : leaves) {
+            tree.append(obj);
+            for (Witness& witness : expected) {
+                witness.append(obj);
+            }
+        }
+
+        for (size_t i = 0; i < expected.size(); i++) {
+            ASSERT_TRUE(actual[i] == expected[i]);
+            ASSERT_EQ(tree.root(), actual[i].root());
+        }
+
+        if (!leaves.empty() && batch % 3 != 1) {
+            expected.push_back(tree.witness());
+            actual.push_back(tree.witness());
+        }
+    }
+}
+
+TEST(merkletree, appendAll) {
+    test_append_all<SproutMerkleTree, SproutWitness, libzcash::SHA256Compress>();
+}
+
+TEST(merkletree, appendAllSapling) {
+    test_append_all<SaplingMerkleTree, SaplingWitness, libzcash::PedersenHash>();
+}
+
+TEST(merkletree, appendAllFull) {
+    SproutTestingMerkleTree tree;
+    tree.append(uint256());
+    SproutTestingWitness witness = tree.witness();
+    std::vector<SproutTestingWitness*> witnesses {&witness};
+
+    // The testing tree holds 16 leaves
+    SproutTestingWitness::append_all(witnesses, std::vector<libzcash::SHA256Compress>(15));
+    ASSERT_THROW(SproutTestingWitness::append_all(witnesses, std::vector<libzcash::SHA256Compress>(1)), std::runtime_error);
+}
@@ -176,3 +176,36 @@ TEST(Metrics, DisplayFunctions) {
     EXPECT_EQ(DisplayHashRate(1234567890.1),    "1.235 GSol/s");
     EXPECT_EQ(DisplayHashRate(1234567890123.4), "1.235 TSol/s");
 }
+
+TEST(Metrics, Histogram) {
+    MetricHistogram h({0.1, 1});
+    h.observe(0.05);
+    h.observe(0.1);
+    h.observe(0.5);
+    h.observe(2);
+
+    EXPECT_EQ(h.ToPrometheus("test_seconds", "stage=\"read\""),
+        "test_seconds_bucket{stage=\"read\",le=\"0.1\"} 2\n"
+        "test_seconds_bucket{stage=\"read\",le=\"1\"} 3\n"
+        "test_seconds_bucket{stage=\"read\",le=\"+Inf\"} 4\n"
+        "test_seconds_sum{stage=\"read\"} 2.650000\n"
+        "test_seconds_count{stage=\"read\"} 4\n");
+}
+
+TEST(Metrics, Registry) {
+    MetricValue& hits = GetMetricCounter("test_lookups_total", "Lookups.", "result=\"hit\"");
+    EXPECT_EQ(&hits, &GetMetricCounter("test_lookups_total", "Lookups.", "result=\"hit\""));
+    hits.add(3);
+    GetMetricCounter("test_lookups_total", "Lookups.", "result=\"miss\"").add();
+    GetMetricGauge("test_size", "Size.").set(-7);
+    RegisterMetricCallback("test_usage_bytes", "Usage.", false, [] { return (int64_t)42; });
+
+    std::string strMetrics = MetricsToPrometheus();
+    EXPECT_NE(strMetrics.find(
+        "# HELP test_lookups_total Lookups.\n"
+        "# TYPE test_lookups_total counter\n"
+        "test_lookups_total{result=\"hit\"} 3\n"
+        "test_lookups_total{result=\"miss\"} 1\n"), std::string::npos);
+    EXPECT_NE(strMetrics.find("# TYPE test_size gauge\ntest_size -7\n"), std::string::npos);
+    EXPECT_NE(strMetrics.find("# TYPE test_usage_bytes gauge\ntest_usage_bytes 42\n"), std::string::npos);
+}
@@ -0,0 +1,325 @@
+#include <gtest/gtest.h>
+
+#include "chain.h"
+#include "crypto/common.h"
+#include "main.h"
+#include "metrics.h"
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "utiltime.h"
+#include "version.h"
+#include "zmq/zmqpublishnotifier.h"
+
+#include <list>
+#include <memory>
+#include <thread>
+
+class ZMQPublisherTest : public ::testing::Test {
+protected:
+    void *pcontext;
+    void *psub;
+    std::list<std::unique_ptr<CZMQAbstractPublishNotifier>> notifiers;
+
+    void SetUp() {
+        pcontext = zmq_init(1);
+        ASSERT_TRUE(pcontext != NULL);
+        psub = NULL;
+        GetZMQPublisher().Start(64 << 20);
+    }
+
+    // Shuts down as CZMQNotificationInterface does, stopping the publisher
+    // before the notifiers close their sockets
+    void TearDown() {
+        GetZMQPublisher().Stop();
+        for (auto& notifier : notifiers)
+            notifier->Shutdown();
+        if (psub)
+            zmq_close(psub);
+        zmq_ctx_destroy(pcontext);
+    }
+
+    template <typename T>
+    T& AddNotifier(const std::string& address) {
+        T* notifier = new T();
+        notifier->SetAddress(address);
+        if (notifier->Initialize(pcontext))
+            notifiers.emplace_back(notifier);
+        else
+            ADD_FAILURE() << "Failed to initialize notifier at " << address;
+        return *notifier;
+    }
+
+    void Remove(CZMQAbstractPublishNotifier& notifier) {
+        notifier.Shutdown();
+        notifiers.remove_if([&notifier](const std::unique_ptr<CZMQAbstractPublishNotifier>& p) {
+            return p.get() == &notifier;
+        });
+    }
+
+    // Subscribes to every topic published at address, which the first
+    // notifier there has to be bound to already
+    void Subscribe(const std::string& address) {
+        psub = zmq_socket(pcontext, ZMQ_SUB);
+        ASSERT_TRUE(psub != NULL);
+        int timeout = 5000;
+        zmq_setsockopt(psub, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+        zmq_setsockopt(psub, ZMQ_SUBSCRIBE, "", 0);
+        ASSERT_EQ(0, zmq_connect(psub, address.c_str()));
+        // Give the subscription time to reach the publishing socket
+        MilliSleep(100);
+    }
+
+    // Receives a message, or returns false when none comes before the timeout
+    bool Receive(std::string& topic, std::vector<unsigned char>& body, uint32_t& nSequence) {
+        std::vector<std::vector<unsigned char>> parts;
+        int more = 1;
+        while (more) {
+            zmq_msg_t msg;
+            zmq_msg_init(&msg);
+            if (zmq_msg_recv(&msg, psub, 0) == -1) {
+                zmq_msg_close(&msg);
+                return false;
+            }
+            unsigned char *data = (unsigned char*)zmq_msg_data(&msg);
+            parts.emplace_back(data, data + zmq_msg_size(&msg));
+            more = zmq_msg_more(&msg);
+            zmq_msg_close(&msg);
+        }
+        EXPECT_EQ(3u, parts.size());
+        if (parts.size() != 3 || parts[2].size() != sizeof(uint32_t))
+            return false;
+        topic.assign(parts[0].begin(), parts[0].end());
+        body = parts[1];
+        nSequence = ReadLE32(parts[2].data());
+        return true;
+    }
+
+    bool ReceiveSequence(uint32_t& nSequence) {
+        std::string topic;
+        std::vector<unsigned char> body;
+        return Receive(topic, body, nSequence);
+    }
+};
+
+static ZMQPayload TestPayload()
+{
+    return std::make_shared<CSerializeData>(32, 'x');
+}
+
+// A block index whose block the publisher cannot read. Reading it takes
+// cs_main, so while the test holds cs_main the publisher thread stalls on it.
+struct UnreadableBlockIndex {
+    uint256 hash;
+    CBlockIndex index;
+
+    UnreadableBlockIndex() {
+        hash = GetRandHash();
+        index.phashBlock = &hash;
+    }
+};
+
+TEST_F(ZMQPublisherTest, OverflowIsCountedAndLeavesSequenceGap) {
+    static MetricValue& dropped = GetMetricCounter("buck_zmq_dropped_messages_total",
+        "ZMQ messages dropped because the publisher queue was full.");
+    GetZMQPublisher().Stop();
+    GetZMQPublisher().Start(64);
+
+    auto& notifier = AddNotifier<CZMQPublishHashTransactionNotifier>("inproc://zmqtest-overflow");
+    Subscribe("inproc://zmqtest-overflow");
+
+    UnreadableBlockIndex blocker;
+    int64_t nDropped = dropped.get();
+    {
+        LOCK(cs_main);
+        // Sequence 0 stalls the publisher, 1 and 2 fill the queue, and 3
+        // and 4 are dropped
+        notifier.SendMessage("rawblock", nullptr, nullptr, &blocker.index, CDiskBlockPos());
+        for (int i = 0; i < 4; i++)
+            notifier.SendMessage("hashtx", TestPayload());
+        EXPECT_EQ(nDropped + 2, dropped.get());
+    }
+
+    // The unreadable block is skipped
+    uint32_t nSequence;
+    ASSERT_TRUE(ReceiveSequence(nSequence));
+    EXPECT_EQ(1, nSequence);
+    ASSERT_TRUE(ReceiveSequence(nSequence));
+    EXPECT_EQ(2, nSequence);
+
+    // Subscribers see the dropped messages as a gap
+    notifier.SendMessage("hashtx", TestPayload());
+    ASSERT_TRUE(ReceiveSequence(nSequence));
+    EXPECT_EQ(5, nSequence);
+    EXPECT_EQ(nDropped + 2, dropped.get());
+}
+
+TEST_F(ZMQPublisherTest, StopDropsUnsentMessages) {
+    auto& notifier = AddNotifier<CZMQPublishHashTransactionNotifier>("inproc://zmqtest-stop");
+    Subscribe("inproc://zmqtest-stop");
+
+    UnreadableBlockIndex blocker;
+    std::thread stopper;
+    {
+        LOCK(cs_main);
+        notifier.SendMessage("rawblock", nullptr, nullptr, &blocker.index, CDiskBlockPos());
+        notifier.SendMessage("hashtx", TestPayload());
+
+        // Stop() clears the queue right away, but can only join the
+        // publisher thread once it gets cs_main. The queue accepts messages
+        // until then.
+        stopper = std::thread([] { GetZMQPublisher().Stop(); });
+        int64_t nTimeout = GetTimeMillis() + 5000;
+        while (GetZMQPublisher().Queue(NULL, "hashtx", TestPayload(), nullptr, NULL, CDiskBlockPos(), 0)) {
+            ASSERT_LT(GetTimeMillis(), nTimeout);
+            MilliSleep(10);
+        }
+    }
+    stopper.join();
+
+    uint32_t nSequence;
+    EXPECT_FALSE(ReceiveSequence(nSequence));
+}
+
+TEST_F(ZMQPublisherTest, RemovingNotifierKeepsSharedSocket) {
+    auto& removed = AddNotifier<CZMQPublishHashTransactionNotifier>("inproc://zmqtest-remove");
+    auto& notifier = AddNotifier<CZMQPublishHashBlockNotifier>("inproc://zmqtest-remove");
+    Subscribe("inproc://zmqtest-remove");
+
+    // Removing one notifier, as CZMQNotificationInterface does when one
+    // fails, leaves the socket to the other
+    Remove(removed);
+
+    notifier.SendMessage("hashblock", TestPayload());
+    std::string topic;
+    std::vector<unsigned char> body;
+    uint32_t nSequence;
+    ASSERT_TRUE(Receive(topic, body, nSequence));
+    EXPECT_EQ("hashblock", topic);
+    EXPECT_EQ(0, nSequence);
+}
+
+TEST_F(ZMQPublisherTest, RemovedTransactionPayload) {
+    auto& notifier = AddNotifier<CZMQPublishRemovedTransactionNotifier>("inproc://zmqtest-removedtx");
+    Subscribe("inproc://zmqtest-removedtx");
+
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    CTransaction tx(mtx);
+    uint256 hash = tx.GetHash();
+    std::vector<unsigned char> vHash(hash.begin(), hash.end());
+    std::reverse(vHash.begin(), vHash.end());
+
+    std::vector<std::pair<MemPoolRemovalReason, std::string>> reasons = {
+        {MemPoolRemovalReason::EXPIRY, "expiry"},
+        {MemPoolRemovalReason::SIZELIMIT, "sizelimit"},
+        {MemPoolRemovalReason::REORG, "reorg"},
+        {MemPoolRemovalReason::BLOCK, "block"},
+        {MemPoolRemovalReason::CONFLICT, "conflict"},
+        {MemPoolRemovalReason::BRANCHID, "branchid"},
+    };
+    for (const auto& reason : reasons) {
+        EXPECT_TRUE(notifier.NotifyTransactionRemoval(tx, reason.first));
+    }
+
+    for (uint32_t i = 0; i < reasons.size(); i++) {
+        std::string topic;
+        std::vector<unsigned char> body;
+        uint32_t nSequence;
+        ASSERT_TRUE(Receive(topic, body, nSequence));
+        EXPECT_EQ("removedtx", topic);
+        EXPECT_EQ(i, nSequence);
+        // The txid, in the byte order of hashtx, then the reason
+        ASSERT_EQ(32 + reasons[i].second.size(), body.size());
+        EXPECT_EQ(vHash, std::vector<unsigned char>(body.begin(), body.begin() + 32));
+        EXPECT_EQ(reasons[i].second, std::string(body.begin() + 32, body.end()));
+    }
+}
+
+TEST_F(ZMQPublisherTest, ShieldedBlockPayload) {
+    auto& notifier = AddNotifier<CZMQPublishShieldedBlockNotifier>("inproc://zmqtest-shieldedblock");
+    Subscribe("inproc://zmqtest-shieldedblock");
+
+    // A transparent transaction, which is left out, then one with a
+    // JoinSplit and one with a Sapling spend and output
+    CMutableTransaction mtxTransparent;
+    mtxTransparent.vin.resize(1);
+    mtxTransparent.vin[0].prevout = COutPoint(GetRandHash(), 0);
+
+    CMutableTransaction mtxSprout;
+    mtxSprout.nVersion = 2;
+    JSDescription jsdesc;
+    jsdesc.nullifiers = {GetRandHash(), GetRandHash()};
+    jsdesc.commitments = {GetRandHash(), GetRandHash()};
+    mtxSprout.vJoinSplit.push_back(jsdesc);
+
+    CMutableTransaction mtxSapling;
+    mtxSapling.fOverwintered = true;
+    mtxSapling.nVersion = SAPLING_TX_VERSION;
+    mtxSapling.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+    SpendDescription spend;
+    spend.nullifier = GetRandHash();
+    mtxSapling.vShieldedSpend.push_back(spend);
+    OutputDescription output;
+    output.cmu = GetRandHash();
+    mtxSapling.vShieldedOutput.push_back(output);
+
+    CBlock block;
+    block.vtx.push_back(CTransaction(mtxTransparent));
+    block.vtx.push_back(CTransaction(mtxSprout));
+    block.vtx.push_back(CTransaction(mtxSapling));
+
+    uint256 hash = GetRandHash();
+    CBlockIndex index;
+    index.phashBlock = &hash;
+    index.nHeight = 1234;
+    index.hashFinalSaplingRoot = GetRandHash();
+
+    EXPECT_TRUE(notifier.NotifyChainTip(&index, block, true));
+    EXPECT_TRUE(notifier.NotifyChainTip(&index, block, false));
+
+    for (uint32_t i = 0; i < 2; i++) {
+        std::string topic;
+        std::vector<unsigned char> body;
+        uint32_t nSequence;
+        ASSERT_TRUE(Receive(topic, body, nSequence));
+        EXPECT_EQ("shieldedblock", topic);
+        EXPECT_EQ(i, nSequence);
+
+        CDataStream ss(body, SER_NETWORK, PROTOCOL_VERSION);
+        uint256 hashBlock, hashFinalSaplingRoot;
+        int32_t nHeight;
+        uint8_t fConnected;
+        ss >> hashBlock >> nHeight >> fConnected >> hashFinalSaplingRoot;
+        EXPECT_EQ(hash, hashBlock);
+        EXPECT_EQ(1234, nHeight);
+        // Connected first, then disconnected
+        EXPECT_EQ(i == 0 ? 1 : 0, fConnected);
+        EXPECT_EQ(index.hashFinalSaplingRoot, hashFinalSaplingRoot);
+
+        uint64_t nTxs = ReadCompactSize(ss);
+        ASSERT_EQ(2, nTxs);
+        for (uint32_t nIndex = 1; nIndex <= 2; nIndex++) {
+            const CTransaction& tx = block.vtx[nIndex];
+            uint32_t nTxIndex;
+            uint256 txid;
+            std::vector<uint256> vSproutNullifiers, vSproutCommitments, vSaplingNullifiers, vSaplingCommitments;
+            ss >> nTxIndex >> txid >> vSproutNullifiers >> vSproutCommitments >> vSaplingNullifiers >> vSaplingCommitments;
+            EXPECT_EQ(nIndex, nTxIndex);
+            EXPECT_EQ(tx.GetHash(), txid);
+            if (nIndex == 1) {
+                EXPECT_EQ(std::vector<uint256>(jsdesc.nullifiers.begin(), jsdesc.nullifiers.end()), vSproutNullifiers);
+                EXPECT_EQ(std::vector<uint256>(jsdesc.commitments.begin(), jsdesc.commitments.end()), vSproutCommitments);
+                EXPECT_TRUE(vSaplingNullifiers.empty());
+                EXPECT_TRUE(vSaplingCommitments.empty());
+            } else {
+                EXPECT_TRUE(vSproutNullifiers.empty());
+                EXPECT_TRUE(vSproutCommitments.empty());
+                EXPECT_EQ(std::vector<uint256>{spend.nullifier}, vSaplingNullifiers);
+                EXPECT_EQ(std::vector<uint256>{output.cmu}, vSaplingCommitments);
+            }
+        }
+        EXPECT_TRUE(ss.empty());
+    }
+}
@@ -3,6 +3,7 @@
 #include "chainparams.h"
 #include "httpserver.h"
 #include "key_io.h"
+#include "metrics.h"
 #include "rpc/protocol.h"
 #include "rpc/server.h"
 #include "random.h"
@@ -140,14 +141,9 @@ static bool RPCAuthorized(const std::string& strAuth)
     return multiUserAuthorized(strUserPass);
 }
 
-static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
+/** Check the credentials of a request, replying with HTTP_UNAUTHORIZED if they are wrong */
+static bool CheckAuthorization(HTTPRequest* req)
 {
-    // JSONRPC handles only POST
-    if (req->GetRequestMethod() != HTTPRequest::POST) {
-        req->WriteReply(HTTP_BAD_METHOD, "JSONRPC server handles only POST requests");
-        return false;
-    }
-    // Check authorization
     std::pair<bool, std::string> authHeader = req->GetHeader("authorization");
     if (!authHeader.first) {
         req->WriteHeader("WWW-Authenticate", WWW_AUTH_HEADER_DATA);
@@ -167,6 +163,18 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         req->WriteReply(HTTP_UNAUTHORIZED);
         return false;
     }
+    return true;
+}
+
+static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
+{
+    // JSONRPC handles only POST
+    if (req->GetRequestMethod() != HTTPRequest::POST) {
+        req->WriteReply(HTTP_BAD_METHOD, "JSONRPC server handles only POST requests");
+        return false;
+    }
+    if (!CheckAuthorization(req))
+        return false;
 
     JSONRequest jreq;
     try {
@@ -175,24 +183,27 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         if (!valRequest.read(req->ReadBody()))
             throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
 
-        std::string strReply;
         // singleton request
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
             UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
 
-            // Send reply
-            strReply = JSONRPCReply(result, NullUniValue, jreq.id);
+            // Send reply, serializing it straight into the output buffer as
+            // results such as getrawmempool or getblock can be large
+            req->WriteHeader("Content-Type", "application/json");
+            JSONRPCWriteReply(result, jreq.id, [req](const std::string& strData) {
+                req->WriteReplyBody(strData);
+            });
+            req->WriteReply(HTTP_OK);
 
         // array of requests
-        } else if (valRequest.isArray())
-            strReply = JSONRPCExecBatch(valRequest.get_array());
-        else
+        } else if (valRequest.isArray()) {
+            std::string strReply = JSONRPCExecBatch(valRequest.get_array());
+            req->WriteHeader("Content-Type", "application/json");
+            req->WriteReply(HTTP_OK, strReply);
+        } else
             throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
-
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strReply);
     } catch (const UniValue& objError) {
         JSONErrorReply(req, objError, jreq.id);
         return false;
@@ -203,6 +214,20 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
     return true;
 }
 
+static bool HTTPReq_Metrics(HTTPRequest* req, const std::string &)
+{
+    if (req->GetRequestMethod() != HTTPRequest::GET) {
+        req->WriteReply(HTTP_BAD_METHOD, "Metrics are only served to GET requests");
+        return false;
+    }
+    if (!CheckAuthorization(req))
+        return false;
+
+    req->WriteHeader("Content-Type", "text/plain; version=0.0.4");
+    req->WriteReply(HTTP_OK, RPCMetricsToPrometheus() + MetricsToPrometheus());
+    return true;
+}
+
 static bool InitRPCAuthentication()
 {
     if (mapArgs["-rpcpassword"] == "")
@@ -228,6 +253,7 @@ bool StartHTTPRPC()
         return false;
 
     RegisterHTTPHandler("/", true, HTTPReq_JSONRPC);
+    RegisterHTTPHandler("/metrics", true, HTTPReq_Metrics);
 
     assert(EventBase());
     httpRPCTimerInterface = new HTTPRPCTimerInterface(EventBase());
@@ -244,6 +270,7 @@ void StopHTTPRPC()
 {
     LogPrint("rpc", "Stopping HTTP RPC server\n");
     UnregisterHTTPHandler("/", true);
+    UnregisterHTTPHandler("/metrics", true);
     if (httpRPCTimerInterface) {
         RPCUnregisterTimerInterface(httpRPCTimerInterface);
         delete httpRPCTimerInterface;
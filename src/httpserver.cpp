@@ -3,9 +3,11 @@
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
 #include "httpserver.h"
+#include "httpworkqueue.h"
 
 #include "chainparamsbase.h"
 #include "compat.h"
+#include "metrics.h"
 #include "util.h"
 #include "netbase.h"
 #include "rpc/protocol.h" // For HTTP status codes
@@ -26,6 +28,7 @@
 #include <event2/buffer.h>
 #include <event2/util.h>
 #include <event2/keyvalq_struct.h>
+#include <event2/listener.h>
 
 #ifdef EVENT__HAVE_NETINET_IN_H
 #include <netinet/in.h>
@@ -58,109 +61,6 @@ private:
     HTTPRequestHandler func;
 };
 
-/** Simple work queue for distributing work over multiple threads.
- * Work items are simply callable objects.
- */
-template <typename WorkItem>
-class WorkQueue
-{
-private:
-    /** Mutex protects entire object */
-    CWaitableCriticalSection cs;
-    CConditionVariable cond;
-    /* XXX in C++11 we can use std::unique_ptr here and avoid manual cleanup */
-    std::deque<WorkItem*> queue;
-    bool running;
-    size_t maxDepth;
-    int numThreads;
-
-    /** RAII object to keep track of number of running worker threads */
-    class ThreadCounter
-    {
-    public:
-        WorkQueue &wq;
-        ThreadCounter(WorkQueue &w): wq(w)
-        {
-            boost::lock_guard<boost::mutex> lock(wq.cs);
-            wq.numThreads += 1;
-        }
-        ~ThreadCounter()
-        {
-            boost::lock_guard<boost::mutex> lock(wq.cs);
-            wq.numThreads -= 1;
-            wq.cond.notify_all();
-        }
-    };
-
-public:
-    WorkQueue(size_t maxDepth) : running(true),
-                                 maxDepth(maxDepth),
-                                 numThreads(0)
-    {
-    }
-    /*( Precondition: worker threads have all stopped
-     * (call WaitExit)
-     */
-    ~WorkQueue()
-    {
-        while (!queue.empty()) {
-            delete queue.front();
-            queue.pop_front();
-        }
-    }
-    /** Enqueue a work item */
-    bool Enqueue(WorkItem* item)
-    {
-        boost::unique_lock<boost::mutex> lock(cs);
-        if (queue.size() >= maxDepth) {
-            return false;
-        }
-        queue.push_back(item);
-        cond.notify_one();
-        return true;
-    }
-    /** Thread function */
-    void Run()
-    {
-        ThreadCounter count(*this);
-        while (running) {
-            WorkItem* i = 0;
-            {
-                boost::unique_lock<boost::mutex> lock(cs);
-                while (running && queue.empty())
-                    cond.wait(lock);
-                if (!running)
-                    break;
-                i = queue.front();
-                queue.pop_front();
-            }
-            (*i)();
-            delete i;
-        }
-    }
-    /** Interrupt and exit loops */
-    void Interrupt()
-    {
-        boost::unique_lock<boost::mutex> lock(cs);
-        running = false;
-        cond.notify_all();
-    }
-    /** Wait for worker threads to exit */
-    void WaitExit()
-    {
-        boost::unique_lock<boost::mutex> lock(cs);
-        while (numThreads > 0)
-            cond.wait(lock);
-    }
-
-    /** Return current depth of queue */
-    size_t Depth()
-    {
-        boost::unique_lock<boost::mutex> lock(cs);
-        return queue.size();
-    }
-};
-
 struct HTTPPathHandler
 {
     HTTPPathHandler() {}
@@ -175,18 +75,21 @@ struct HTTPPathHandler
 
 /** HTTP module state */
 
-//! libevent event loop
-static struct event_base* eventBase = 0;
-//! HTTP server
-struct evhttp* eventHTTP = 0;
+//! libevent event loops; the first one also runs timers for other modules
+static std::vector<struct event_base*> eventBases;
+//! HTTP servers, one for each event loop, accepting on the same sockets
+static std::vector<struct evhttp*> eventHTTPs;
 //! List of subnets to allow RPC connections from
 static std::vector<CSubNet> rpc_allow_subnets;
-//! Work queue for handling longer requests off the event loop thread
-static WorkQueue<HTTPClosure>* workQueue = 0;
+//! Work queue for handling longer requests off the event loop threads
+static WorkQueue<HTTPWorkItem>* workQueue = 0;
 //! Handlers for (sub)paths
 std::vector<HTTPPathHandler> pathHandlers;
-//! Bound listening sockets
-std::vector<evhttp_bound_socket *> boundSockets;
+//! Listening sockets, with the server accepting on each. The sockets are
+//! bound by the first server, which closes them when they are deleted.
+std::vector<std::pair<struct evhttp*, evhttp_bound_socket*> > boundSockets;
+//! Idle timeout of connections, advertised to clients that keep them alive
+static int nHTTPServerTimeout = DEFAULT_HTTP_SERVER_TIMEOUT;
 
 /** Check if a network address is allowed to access the HTTP server */
 static bool ClientAllowed(const CNetAddr& netaddr)
@@ -246,10 +149,20 @@ static std::string RequestMethodString(HTTPRequest::RequestMethod m)
     }
 }
 
-/** HTTP request callback */
+/** Tell the client to retry a request that there is no room for */
+static void RejectBusy(HTTPRequest* req)
+{
+    static MetricValue& rejected = GetMetricCounter("buck_http_rejected_requests_total",
+        "HTTP requests answered with 503 because the work queue was full.");
+    rejected.add();
+    req->WriteHeader("Retry-After", "1");
+    req->WriteReply(HTTP_SERVUNAVAIL, "Work queue depth exceeded, retry later");
+}
+
+/** HTTP request callback; arg is the event base of the server */
 static void http_request_cb(struct evhttp_request* req, void* arg)
 {
-    std::unique_ptr<HTTPRequest> hreq(new HTTPRequest(req));
+    std::unique_ptr<HTTPRequest> hreq(new HTTPRequest(req, (struct event_base*)arg));
 
     LogPrint("http", "Received a %s request for %s from %s\n",
              RequestMethodString(hreq->GetRequestMethod()), hreq->GetURI(), hreq->GetPeer().ToString());
@@ -283,14 +196,16 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
         }
     }
 
-    // Dispatch to worker thread
+    // Dispatch to worker thread, queued by client address
     if (i != iend) {
-        std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(hreq.release(), path, i->handler));
+        std::string client = hreq->GetPeer().ToStringIP();
+        HTTPWorkItem* item = new HTTPWorkItem(hreq.release(), path, i->handler);
         assert(workQueue);
-        if (workQueue->Enqueue(item.get()))
-            item.release(); /* if true, queue took ownership */
-        else
-            item->req->WriteReply(HTTP_INTERNAL, "Work queue depth exceeded");
+        std::unique_ptr<HTTPWorkItem> dropped(workQueue->Enqueue(client, item));
+        if (dropped) {
+            LogPrint("http", "Work queue full, rejecting a request from %s\n", dropped->req->GetPeer().ToStringIP());
+            RejectBusy(dropped->req.get());
+        }
     } else {
         hreq->WriteReply(HTTP_NOTFOUND);
     }
@@ -304,7 +219,7 @@ static void http_reject_request_cb(struct evhttp_request* req, void*)
 }
 
 /** Event dispatcher thread */
-static void ThreadHTTP(struct event_base* base, struct evhttp* http)
+static void ThreadHTTP(struct event_base* base)
 {
     RenameThread("zcash-http");
     LogPrint("http", "Entering http event loop\n");
@@ -344,7 +259,7 @@ static bool HTTPBindAddresses(struct evhttp* http)
         LogPrint("http", "Binding RPC on address %s port %i\n", i->first, i->second);
         evhttp_bound_socket *bind_handle = evhttp_bind_socket_with_handle(http, i->first.empty() ? NULL : i->first.c_str(), i->second);
         if (bind_handle) {
-            boundSockets.push_back(bind_handle);
+            boundSockets.push_back(std::make_pair(http, bind_handle));
         } else {
             LogPrintf("Binding RPC on address %s port %i failed.\n", i->first, i->second);
         }
@@ -352,8 +267,58 @@ static bool HTTPBindAddresses(struct evhttp* http)
     return !boundSockets.empty();
 }
 
+/** Accept connections on the sockets bound by the first server in http as well.
+ * Every event loop waiting on a socket is woken for a new connection, and
+ * the first one to accept it serves it.
+ */
+static bool HTTPShareBoundSockets(struct event_base* base, struct evhttp* http)
+{
+    size_t nBound = boundSockets.size();
+    for (size_t i = 0; i < nBound; i++) {
+        evutil_socket_t fd = evhttp_bound_socket_get_fd(boundSockets[i].second);
+        // Leave closing the socket to the server that bound it
+        struct evconnlistener* listener = evconnlistener_new(base, NULL, NULL, LEV_OPT_REUSEABLE, -1, fd);
+        if (!listener)
+            return false;
+        evhttp_bound_socket* handle = evhttp_bind_listener(http, listener);
+        if (!handle) {
+            evconnlistener_free(listener);
+            return false;
+        }
+        boundSockets.push_back(std::make_pair(http, handle));
+    }
+    return true;
+}
+
+/** Create an HTTP server on an event loop */
+static struct evhttp* HTTPNewServer(struct event_base* base)
+{
+    struct evhttp* http = evhttp_new(base); // XXX RAII
+    if (!http)
+        return NULL;
+    evhttp_set_timeout(http, nHTTPServerTimeout);
+    evhttp_set_max_body_size(http, MAX_SIZE);
+    evhttp_set_gencb(http, http_request_cb, base);
+    return http;
+}
+
+/** Free the HTTP servers and their event loops */
+static void HTTPFreeServers()
+{
+    // Shared sockets were added last; delete them before the bound ones close
+    for (std::vector<std::pair<struct evhttp*, evhttp_bound_socket*> >::reverse_iterator i = boundSockets.rbegin(); i != boundSockets.rend(); ++i)
+        evhttp_del_accept_socket(i->first, i->second);
+    boundSockets.clear();
+    BOOST_FOREACH (struct evhttp* http, eventHTTPs)
+        evhttp_free(http);
+    eventHTTPs.clear();
+    BOOST_FOREACH (struct event_base* base, eventBases)
+        event_base_free(base);
+    eventBases.clear();
+}
+
 /** Simple wrapper to set thread name and run work queue */
-static void HTTPWorkQueueRun(WorkQueue<HTTPClosure>* queue)
+static void HTTPWorkQueueRun(WorkQueue<HTTPWorkItem>* queue)
 {
     RenameThread("zcash-httpworker");
     queue->Run();
@@ -374,9 +339,6 @@ static void libevent_log_cb(int severity, const char *msg)
 
 bool InitHTTPServer()
 {
-    struct evhttp* http = 0;
-    struct event_base* base = 0;
-
     if (!InitHTTPAllowList())
         return false;
 
@@ -403,49 +365,55 @@ bool InitHTTPServer()
     evthread_use_pthreads();
 #endif
 
-    base = event_base_new(); // XXX RAII
-    if (!base) {
-        LogPrintf("Couldn't create an event_base: exiting\n");
-        return false;
-    }
-
-    /* Create a new evhttp object to handle requests. */
-    http = evhttp_new(base); // XXX RAII
-    if (!http) {
-        LogPrintf("couldn't create evhttp. Exiting.\n");
-        event_base_free(base);
-        return false;
-    }
+    nHTTPServerTimeout = GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT);
+    int eventThreads = std::max((long)GetArg("-rpceventthreads", DEFAULT_HTTP_EVENT_THREADS), 1L);
+    for (int i = 0; i < eventThreads; i++) {
+        struct event_base* base = event_base_new(); // XXX RAII
+        if (!base) {
+            LogPrintf("Couldn't create an event_base: exiting\n");
+            HTTPFreeServers();
+            return false;
+        }
+        eventBases.push_back(base);
 
-    evhttp_set_timeout(http, GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT));
-    evhttp_set_max_body_size(http, MAX_SIZE);
-    evhttp_set_gencb(http, http_request_cb, NULL);
+        /* Create a new evhttp object to handle requests. */
+        struct evhttp* http = HTTPNewServer(base);
+        if (!http) {
+            LogPrintf("couldn't create evhttp. Exiting.\n");
+            HTTPFreeServers();
+            return false;
+        }
+        eventHTTPs.push_back(http);
 
-    if (!HTTPBindAddresses(http)) {
-        LogPrintf("Unable to bind any endpoint for RPC server\n");
-        evhttp_free(http);
-        event_base_free(base);
-        return false;
+        if (i == 0 && !HTTPBindAddresses(http)) {
+            LogPrintf("Unable to bind any endpoint for RPC server\n");
+            HTTPFreeServers();
+            return false;
+        }
+        if (i > 0 && !HTTPShareBoundSockets(base, http)) {
+            LogPrintf("Unable to share the RPC server sockets between event loops\n");
+            HTTPFreeServers();
+            return false;
+        }
     }
 
     LogPrint("http", "Initialized HTTP server\n");
     int workQueueDepth = std::max((long)GetArg("-rpcworkqueue", DEFAULT_HTTP_WORKQUEUE), 1L);
     LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
 
-    workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
-    eventBase = base;
-    eventHTTP = http;
+    workQueue = new WorkQueue<HTTPWorkItem>(workQueueDepth);
     return true;
 }
 
-boost::thread threadHTTP;
+std::vector<boost::thread> threadsHTTP;
 
 bool StartHTTPServer()
 {
     LogPrint("http", "Starting HTTP server\n");
     int rpcThreads = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
-    LogPrintf("HTTP: starting %d worker threads\n", rpcThreads);
-    threadHTTP = boost::thread(boost::bind(&ThreadHTTP, eventBase, eventHTTP));
+    LogPrintf("HTTP: starting %d event loops and %d worker threads\n", eventBases.size(), rpcThreads);
+    BOOST_FOREACH (struct event_base* base, eventBases)
+        threadsHTTP.push_back(boost::thread(boost::bind(&ThreadHTTP, base)));
 
     for (int i = 0; i < rpcThreads; i++) {
         boost::thread rpc_worker(HTTPWorkQueueRun, workQueue);
@@ -457,14 +425,13 @@ bool StartHTTPServer()
 void InterruptHTTPServer()
 {
     LogPrint("http", "Interrupting HTTP server\n");
-    if (eventHTTP) {
-        // Unlisten sockets
-        BOOST_FOREACH (evhttp_bound_socket *socket, boundSockets) {
-            evhttp_del_accept_socket(eventHTTP, socket);
-        }
-        // Reject requests on current connections
-        evhttp_set_gencb(eventHTTP, http_reject_request_cb, NULL);
-    }
+    // Unlisten sockets, shared ones first
+    for (std::vector<std::pair<struct evhttp*, evhttp_bound_socket*> >::reverse_iterator i = boundSockets.rbegin(); i != boundSockets.rend(); ++i)
+        evhttp_del_accept_socket(i->first, i->second);
+    boundSockets.clear();
+    // Reject requests on current connections
+    BOOST_FOREACH (struct evhttp* http, eventHTTPs)
+        evhttp_set_gencb(http, http_reject_request_cb, NULL);
     if (workQueue)
         workQueue->Interrupt();
 }
@@ -476,37 +443,36 @@ void StopHTTPServer()
         LogPrint("http", "Waiting for HTTP worker threads to exit\n");
         workQueue->WaitExit();
         delete workQueue;
-    }
-    if (eventBase) {
-        LogPrint("http", "Waiting for HTTP event thread to exit\n");
-        // Exit the event loop as soon as there are no active events.
-        event_base_loopexit(eventBase, nullptr);
-        // Give event loop a few seconds to exit (to send back last RPC responses), then break it
+        workQueue = 0;
+    }
+    if (!threadsHTTP.empty()) {
+        LogPrint("http", "Waiting for HTTP event threads to exit\n");
+        // Exit the event loops as soon as there are no active events.
+        BOOST_FOREACH (struct event_base* base, eventBases)
+            event_base_loopexit(base, nullptr);
+        // Give event loops a few seconds to exit (to send back last RPC responses), then break them
         // Before this was solved with event_base_loopexit, but that didn't work as expected in
         // at least libevent 2.0.21 and always introduced a delay. In libevent
         // master that appears to be solved, so in the future that solution
         // could be used again (if desirable).
         // (see discussion in https://github.com/bitcoin/bitcoin/pull/6990)
-        if (!threadHTTP.try_join_for(boost::chrono::milliseconds(2000))) {
-            LogPrintf("HTTP event loop did not exit within allotted time, sending loopbreak\n");
-            event_base_loopbreak(eventBase);
-            threadHTTP.join();
+        boost::chrono::steady_clock::time_point deadline = boost::chrono::steady_clock::now() + boost::chrono::milliseconds(2000);
+        for (size_t i = 0; i < threadsHTTP.size(); i++) {
+            if (!threadsHTTP[i].try_join_until(deadline)) {
+                LogPrintf("HTTP event loop did not exit within allotted time, sending loopbreak\n");
+                event_base_loopbreak(eventBases[i]);
+                threadsHTTP[i].join();
+            }
         }
+        threadsHTTP.clear();
     }
-    if (eventHTTP) {
-        evhttp_free(eventHTTP);
-        eventHTTP = 0;
-    }
-    if (eventBase) {
-        event_base_free(eventBase);
-        eventBase = 0;
-    }
+    HTTPFreeServers();
     LogPrint("http", "Stopped HTTP server\n");
 }
 
 struct event_base* EventBase()
 {
-    return eventBase;
+    return eventBases.empty() ? NULL : eventBases[0];
 }
 
 static void httpevent_callback_fn(evutil_socket_t, short, void* data)
@@ -535,8 +501,9 @@ void HTTPEvent::trigger(struct timeval* tv)
     else
         evtimer_add(ev, tv); // trigger after timeval passed
 }
-HTTPRequest::HTTPRequest(struct evhttp_request* req) : req(req),
-                                                       replySent(false)
+HTTPRequest::HTTPRequest(struct evhttp_request* req, struct event_base* base) : req(req),
+                                                                                base(base),
+                                                                                replySent(false)
 {
 }
 HTTPRequest::~HTTPRequest()
@@ -587,6 +554,14 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
     evhttp_add_header(headers, hdr.c_str(), value.c_str());
 }
 
+void HTTPRequest::WriteReplyBody(const std::string& strData)
+{
+    assert(!replySent && req);
+    struct evbuffer* evb = evhttp_request_get_output_buffer(req);
+    assert(evb);
+    evbuffer_add(evb, strData.data(), strData.size());
+}
+
 /** Closure sent to main thread to request a reply to be sent to
  * a HTTP request.
  * Replies must be sent in the main loop in the main http thread,
@@ -595,11 +570,16 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
 {
     assert(!replySent && req);
-    // Send event to main http thread to send reply message
+    // Tell clients that keep the connection open how long it may stay idle,
+    // so that they do not reuse it just as the server closes it
+    const char* connection = evhttp_find_header(evhttp_request_get_input_headers(req), "Connection");
+    if (!connection || strcasecmp(connection, "close") != 0)
+        WriteHeader("Keep-Alive", strprintf("timeout=%d", nHTTPServerTimeout));
+    // Send event to the http thread of the request to send reply message
     struct evbuffer* evb = evhttp_request_get_output_buffer(req);
     assert(evb);
     evbuffer_add(evb, strReply.data(), strReply.size());
-    HTTPEvent* ev = new HTTPEvent(eventBase, true,
+    HTTPEvent* ev = new HTTPEvent(base ? base : EventBase(), true,
         boost::bind(evhttp_send_reply, req, nStatus, (const char*)NULL, (struct evbuffer *)NULL));
     ev->trigger(0);
     replySent = true;
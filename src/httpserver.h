@@ -11,6 +11,7 @@
 #include <boost/scoped_ptr.hpp>
 
 static const int DEFAULT_HTTP_THREADS=4;
+static const int DEFAULT_HTTP_EVENT_THREADS=1;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
 static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
 
@@ -43,8 +44,8 @@ void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPR
 /** Unregister handler for prefix */
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
 
-/** Return evhttp event base. This can be used by submodules to
- * queue timers or custom events.
+/** Return the event base of the first HTTP event loop. This can be used
+ * by submodules to queue timers or custom events.
  */
 struct event_base* EventBase();
 
@@ -55,13 +56,15 @@ class HTTPRequest
 {
 private:
     struct evhttp_request* req;
+    //! Event loop of the connection, which sends the reply
+    struct event_base* base;
 
     // For test access
 protected:
     bool replySent;
 
 public:
-    HTTPRequest(struct evhttp_request* req);
+    HTTPRequest(struct evhttp_request* req, struct event_base* base = NULL);
     virtual ~HTTPRequest();
 
     enum RequestMethod {
@@ -105,6 +108,12 @@ public:
      */
     virtual void WriteHeader(const std::string& hdr, const std::string& value);
 
+    /**
+     * Append data to the body of the reply, for replies produced in pieces.
+     * The body is sent by the following WriteReply call.
+     */
+    virtual void WriteReplyBody(const std::string& strData);
+
     /**
      * Write HTTP reply.
      * nStatus is the HTTP status code to send.
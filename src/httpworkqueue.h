@@ -0,0 +1,157 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_HTTPWORKQUEUE_H
+#define BITCOIN_HTTPWORKQUEUE_H
+
+#include "sync.h"
+
+#include <deque>
+#include <map>
+#include <string>
+
+/** Simple work queue for distributing work over multiple threads.
+ * Work items are simply callable objects.
+ *
+ * Each client has a queue of its own and the worker threads serve the
+ * clients in turn, so that a client sending many requests does not hold up
+ * the others. When the queue is full, the client with the most queued
+ * items gives up its newest one to make room.
+ */
+template <typename WorkItem>
+class WorkQueue
+{
+private:
+    /** Mutex protects entire object */
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    /* XXX in C++11 we can use std::unique_ptr here and avoid manual cleanup */
+    std::map<std::string, std::deque<WorkItem*> > queues;
+    /** Clients with queued items, in the order they will be served */
+    std::deque<std::string> clients;
+    size_t depth;
+    bool running;
+    size_t maxDepth;
+    int numThreads;
+
+    /** RAII object to keep track of number of running worker threads */
+    class ThreadCounter
+    {
+    public:
+        WorkQueue &wq;
+        ThreadCounter(WorkQueue &w): wq(w)
+        {
+            boost::lock_guard<boost::mutex> lock(wq.cs);
+            wq.numThreads += 1;
+        }
+        ~ThreadCounter()
+        {
+            boost::lock_guard<boost::mutex> lock(wq.cs);
+            wq.numThreads -= 1;
+            wq.cond.notify_all();
+        }
+    };
+
+public:
+    WorkQueue(size_t maxDepth) : depth(0),
+                                 running(true),
+                                 maxDepth(maxDepth),
+                                 numThreads(0)
+    {
+    }
+    /*( Precondition: worker threads have all stopped
+     * (call WaitExit)
+     */
+    ~WorkQueue()
+    {
+        for (auto& entry : queues) {
+            for (WorkItem* item : entry.second)
+                delete item;
+        }
+    }
+    /** Enqueue a work item for a client.
+     * Returns the item that was dropped to keep the queue within its depth:
+     * the newest item of another client, item itself if this client already
+     * has the most items queued, or NULL if nothing was dropped. The caller
+     * owns the dropped item.
+     */
+    WorkItem* Enqueue(const std::string& client, WorkItem* item)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        WorkItem* dropped = NULL;
+        if (depth >= maxDepth) {
+            typename std::map<std::string, std::deque<WorkItem*> >::iterator longest = queues.end();
+            for (typename std::map<std::string, std::deque<WorkItem*> >::iterator it = queues.begin(); it != queues.end(); ++it) {
+                if (longest == queues.end() || it->second.size() > longest->second.size())
+                    longest = it;
+            }
+            typename std::map<std::string, std::deque<WorkItem*> >::iterator own = queues.find(client);
+            size_t nOwn = own == queues.end() ? 0 : own->second.size();
+            if (longest == queues.end() || nOwn + 1 >= longest->second.size())
+                return item;
+            // The longest queue keeps at least two items, so it stays in clients
+            dropped = longest->second.back();
+            longest->second.pop_back();
+            depth--;
+        }
+        std::deque<WorkItem*>& queue = queues[client];
+        if (queue.empty())
+            clients.push_back(client);
+        queue.push_back(item);
+        depth++;
+        cond.notify_one();
+        return dropped;
+    }
+    /** Thread function */
+    void Run()
+    {
+        ThreadCounter count(*this);
+        while (running) {
+            WorkItem* i = 0;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                while (running && clients.empty())
+                    cond.wait(lock);
+                if (!running)
+                    break;
+                // Take the oldest item of the next client in turn
+                std::string client = clients.front();
+                clients.pop_front();
+                std::deque<WorkItem*>& queue = queues[client];
+                i = queue.front();
+                queue.pop_front();
+                depth--;
+                if (queue.empty())
+                    queues.erase(client);
+                else
+                    clients.push_back(client);
+            }
+            (*i)();
+            delete i;
+        }
+    }
+    /** Interrupt and exit loops */
+    void Interrupt()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        running = false;
+        cond.notify_all();
+    }
+    /** Wait for worker threads to exit */
+    void WaitExit()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (numThreads > 0)
+            cond.wait(lock);
+    }
+
+    /** Return current depth of queue */
+    size_t Depth()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        return depth;
+    }
+};
+
+#endif // BITCOIN_HTTPWORKQUEUE_H
@@ -11,6 +11,7 @@
 #include "crypto/common.h"
 #include "addrman.h"
 #include "amount.h"
+#include "blockcache.h"
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "consensus/upgrades.h"
@@ -41,6 +42,8 @@
 #include "validationinterface.h"
 #ifdef ENABLE_WALLET
 #include "key_io.h"
+#include "wallet/asyncrpcoperation_consolidate.h"
+#include "wallet/asyncrpcoperation_payoutbatch.h"
 #include "wallet/wallet.h"
 #include "wallet/walletdb.h"
 #endif
@@ -197,6 +200,8 @@ void Shutdown()
     StopRPC();
     StopHTTPServer();
 #ifdef ENABLE_WALLET
+    StopPayoutBatches();
+    StopConsolidations();
     if (pwalletMain)
         pwalletMain->Flush(false);
 #endif
@@ -232,6 +237,9 @@ void Shutdown()
         delete pblocktree;
         pblocktree = NULL;
     }
+    blockFileReader.CloseAll();
+    undoFileReader.CloseAll();
+    blockCache.Clear();
 #ifdef ENABLE_WALLET
     if (pwalletMain)
         pwalletMain->Flush(true);
@@ -304,7 +312,10 @@ bool static Bind(const CService &addr, unsigned int flags) {
 
 void OnRPCStopped()
 {
-    cvBlockChange.notify_all();
+    {
+        boost::unique_lock<boost::mutex> lock(csBestBlock);
+        cvBlockChange.notify_all();
+    }
     LogPrint("rpc", "RPC stopped.\n");
 }
 
@@ -328,6 +339,12 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-?", _("This help message"));
     strUsage += HelpMessageOpt("-alerts", strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-assumevalid=<hex>", strprintf(_("If this block is in the chain assume that it and its ancestors are valid and potentially skip their script and proof verification (0 to verify all, default: %s, testnet: %s)"),
+        Params(CBaseChainParams::MAIN).GetConsensus().defaultAssumeValid.GetHex(), Params(CBaseChainParams::TESTNET).GetConsensus().defaultAssumeValid.GetHex()));
+    strUsage += HelpMessageOpt("-blockcachesize=<n>", strprintf(_("Keep up to <n> MiB of recently read blocks in memory (0 to disable, default: %u)"), DEFAULT_BLOCK_CACHE_SIZE));
+    strUsage += HelpMessageOpt("-blockcompression=<n>", strprintf(_("Store blocks and undo data compressed with zstd level <n> (1-%d, 0 to disable, default: %u). "
+            "Existing block files are converted in the background after startup"), MAX_BLOCK_COMPRESSION_LEVEL, DEFAULT_BLOCK_COMPRESSION_LEVEL));
+    strUsage += HelpMessageOpt("-blockreadahead=<n>", strprintf(_("Read ahead <n> KiB when block files are read sequentially (0 to disable, default: %u)"), DEFAULT_BLOCK_READAHEAD));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), DEFAULT_CHECKBLOCKS));
     strUsage += HelpMessageOpt("-checklevel=<n>", strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), DEFAULT_CHECKLEVEL));
@@ -405,7 +422,10 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-zmqpubhashblock=<address>", _("Enable publish hash block in <address>"));
     strUsage += HelpMessageOpt("-zmqpubhashtx=<address>", _("Enable publish hash transaction in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawblock=<address>", _("Enable publish raw block in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubqueuesize=<n>", strprintf(_("Maximum size in MiB of the messages waiting to be published; messages that do not fit are dropped (default: %u)"), DEFAULT_ZMQ_PUB_QUEUE_SIZE));
     strUsage += HelpMessageOpt("-zmqpubrawtx=<address>", _("Enable publish raw transaction in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubremovedtx=<address>", _("Enable publish hash and removal reason of transactions leaving the mempool in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubshieldedblock=<address>", _("Enable publish nullifiers and note commitments of connected and disconnected blocks in <address>"));
 #endif
 
     strUsage += HelpMessageGroup(_("Debugging/Testing options:"));
@@ -444,6 +464,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxtxfee=<amt>", strprintf(_("Maximum total fees (in %s) to use in a single wallet transaction or raw transaction; setting this too low may abort large transactions (default: %s)"),
         CURRENCY_UNIT, FormatMoney(DEFAULT_TRANSACTION_MAXFEE)));
     strUsage += HelpMessageOpt("-printtoconsole", _("Send trace/debug info to console instead of debug.log file"));
+    strUsage += HelpMessageOpt("-tracefile=<file>", _("Write the timing of the spans enabled by -debug, such as the validation stages with -debug=bench, to <file> in the Chrome trace event format; this can be an absolute path or a path relative to the data directory"));
     if (showDebug)
     {
         strUsage += HelpMessageOpt("-printpriority", strprintf("Log transaction priority and fee per kB when mining blocks (default: %u)", DEFAULT_PRINTPRIORITY));
@@ -488,15 +509,15 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-rpcauth=<userpw>", _("Username and hashed password for JSON-RPC connections. The field <userpw> comes in the format: <USERNAME>:<SALT>$<HASH>. A canonical python script is included in share/rpcuser. This option can be specified multiple times"));
     strUsage += HelpMessageOpt("-rpcport=<port>", strprintf(_("Listen for JSON-RPC connections on <port> (default: %u or testnet: %u)"), 8232, 18232));
     strUsage += HelpMessageOpt("-rpcallowip=<ip>", _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times"));
+    strUsage += HelpMessageOpt("-rpcasyncthreads=<n>", strprintf(_("Set the number of threads to service Async RPC calls (default: %d)"), DEFAULT_RPC_ASYNC_THREADS));
+    strUsage += HelpMessageOpt("-rpcbatchthreads=<n>", strprintf(_("Set the number of threads executing the read-only calls of a batch request (default: %d)"), DEFAULT_RPC_BATCH_THREADS));
     strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_HTTP_THREADS));
+    strUsage += HelpMessageOpt("-rpceventthreads=<n>", strprintf(_("Set the number of threads accepting RPC connections and sending replies (default: %d)"), DEFAULT_HTTP_EVENT_THREADS));
     if (showDebug) {
-        strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
+        strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls; further calls are answered with 503 (default: %d)", DEFAULT_HTTP_WORKQUEUE));
         strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
     }
 
-    // Disabled until we can lock notes and also tune performance of the prover which by default uses multiple threads
-    //strUsage += HelpMessageOpt("-rpcasyncthreads=<n>", strprintf(_("Set the number of threads to service Async RPC calls (default: %d)"), 1));
-
     if (mode == HMM_BITCOIND) {
         strUsage += HelpMessageGroup(_("Metrics Options (only if -daemon and -printtoconsole are not set):"));
         strUsage += HelpMessageOpt("-showmetrics", _("Show metrics on stdout (default: 1 if running in a console, 0 otherwise)"));
@@ -647,6 +668,9 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
         }
     }
 
+    // -blockcompression
+    CompressBlockFiles(chainparams);
+
     if (GetBoolArg("-stopafterblockimport", DEFAULT_STOPAFTERBLOCKIMPORT)) {
         LogPrintf("Stopping after block import\n");
         StartShutdown();
@@ -816,8 +840,21 @@ void InitLogging()
         pathDebugLen = pathDebugStr.length();
     }
 
+    boost::filesystem::path pathTrace(GetArg("-tracefile", ""));
+    if (!pathTrace.empty() && !pathTrace.is_absolute()) {
+        pathTrace = GetDataDir() / pathTrace;
+    }
+    const boost::filesystem::path::string_type& pathTraceStr = pathTrace.native();
+    const codeunit* pathTraceCStr = nullptr;
+    size_t pathTraceLen = 0;
+    if (!pathTrace.empty()) {
+        pathTraceCStr = reinterpret_cast<const codeunit*>(pathTraceStr.c_str());
+        pathTraceLen = pathTraceStr.length();
+    }
+
     pTracingHandle = tracing_init(
         pathDebugCStr, pathDebugLen,
+        pathTraceCStr, pathTraceLen,
         initialFilter.c_str(),
         fLogTimestamps);
 
@@ -963,6 +1000,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
 
+    hashAssumeValid = uint256S(GetArg("-assumevalid", chainparams.GetConsensus().defaultAssumeValid.GetHex()));
+    if (!hashAssumeValid.IsNull())
+        LogPrintf("Assuming ancestors of block %s have valid scripts and proofs.\n", hashAssumeValid.GetHex());
+    else
+        LogPrintf("Validating scripts and proofs for all blocks.\n");
+
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
     nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
     if (nScriptCheckThreads <= 0)
@@ -988,6 +1031,20 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         fPruneMode = true;
     }
 
+    nBlockCompressionLevel = GetArg("-blockcompression", DEFAULT_BLOCK_COMPRESSION_LEVEL);
+    if (nBlockCompressionLevel < 0 || nBlockCompressionLevel > MAX_BLOCK_COMPRESSION_LEVEL) {
+        return InitError(strprintf(_("-blockcompression must be between 0 and %d"), MAX_BLOCK_COMPRESSION_LEVEL));
+    }
+    if (nBlockCompressionLevel > 0 && !IsBlockCompressionAvailable()) {
+        return InitError(_("-blockcompression requires a build with zstd support"));
+    }
+    if (nBlockCompressionLevel > 0) {
+        LogPrintf("Block and undo records are written with zstd level %d.\n", nBlockCompressionLevel);
+        if (fPruneMode) {
+            LogPrintf("Existing block files are not converted to compressed storage in prune mode.\n");
+        }
+    }
+
     RegisterAllCoreRPCCommands(tableRPC);
 #ifdef ENABLE_WALLET
     bool fDisableWallet = GetBoolArg("-disablewallet", false);
@@ -1189,6 +1246,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     // Count uptime
     MarkStartTime();
+    RegisterNodeMetrics();
 
     if ((chainparams.NetworkIDString() != "regtest") &&
             GetBoolArg("-showmetrics", isatty(STDOUT_FILENO)) &&
@@ -1381,6 +1439,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
 
+    int64_t nBlockCacheSize = std::max(GetArg("-blockcachesize", DEFAULT_BLOCK_CACHE_SIZE), (int64_t)0);
+    int64_t nBlockReadahead = std::max(GetArg("-blockreadahead", DEFAULT_BLOCK_READAHEAD), (int64_t)0);
+    blockCache.SetMaxUsage(nBlockCacheSize << 20);
+    blockFileReader.SetReadahead(nBlockReadahead << 10);
+    LogPrintf("* Using %.1fMiB for recently read blocks, %dKiB block file readahead\n", (double)nBlockCacheSize, nBlockReadahead);
+
     bool clearWitnessCaches = false;
 
     bool fLoaded = false;
@@ -1693,6 +1757,13 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     StartNode(threadGroup, scheduler);
 
+#ifdef ENABLE_WALLET
+    if (pwalletMain) {
+        StartPayoutBatches(scheduler);
+        StartConsolidations(scheduler);
+    }
+#endif
+
     // Monitor the chain every minute, and alert if we get blocks much quicker or slower than expected.
     CScheduler::Function f = boost::bind(&PartitionCheck, &IsInitialBlockDownload,
                                          boost::ref(cs_main), boost::cref(pindexBestHeader));
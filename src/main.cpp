@@ -11,6 +11,9 @@
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockcache.h"
+#include "blockcompression.h"
+#include "blockimport.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -60,10 +63,12 @@ using namespace std;
  * Global state
  */
 
-CCriticalSection cs_main;
+CInstrumentedCriticalSection cs_main("cs_main");
 
 BlockMap mapBlockIndex;
 CChain chainActive;
+static CCriticalSection cs_chainSnapshot;
+static std::shared_ptr<const CChainSnapshot> pchainSnapshot = std::make_shared<CChainSnapshot>(nullptr);
 CBlockIndex *pindexBestHeader = NULL;
 static int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
@@ -80,6 +85,7 @@ bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+uint256 hashAssumeValid;
 bool fCoinbaseEnforcedShieldingEnabled = true;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
@@ -238,6 +244,10 @@ namespace {
 
     /** Dirty block file entries. */
     set<int> setDirtyFileInfo;
+
+    /** Transaction index entries of blocks moved to a new position, written
+     *  together with the block index entries that point there. */
+    std::vector<std::pair<uint256, CDiskTxPos> > vDirtyTxIndex;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -770,6 +780,8 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& in
  *    nHeight can become valid at a later height), we make the bans conditional on not
  *    being in Initial Block Download mode.
  * 4. The isInitBlockDownload argument is a function parameter to assist with testing.
+ * 5. If fCheckProofs is false (for blocks covered by -assumevalid), Sapling proofs and
+ *    signatures are not verified.
  */
 bool ContextualCheckTransaction(
         const CTransaction& tx,
@@ -777,7 +789,8 @@ bool ContextualCheckTransaction(
         const CChainParams& chainparams,
         const int nHeight,
         const bool isMined,
-        bool (*isInitBlockDownload)(const CChainParams&))
+        bool (*isInitBlockDownload)(const CChainParams&),
+        bool fCheckProofs)
 {
     const int DOS_LEVEL_BLOCK = 100;
     // DoS level set to 10 to be more forgiving.
@@ -1078,8 +1091,9 @@ bool ContextualCheckTransaction(
         }
     }
 
-    if (!tx.vShieldedSpend.empty() ||
-        !tx.vShieldedOutput.empty())
+    if (fCheckProofs &&
+        (!tx.vShieldedSpend.empty() ||
+         !tx.vShieldedOutput.empty()))
     {
         auto ctx = librustzcash_sapling_verification_ctx_init();
 
@@ -1429,6 +1443,9 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                         bool* pfMissingInputs, bool fRejectAbsurdFee)
 {
     AssertLockHeld(cs_main);
+    auto span = TracingSpan("debug", "mempool", "AcceptToMemoryPool");
+    auto spanGuard = span.Enter();
+
     if (pfMissingInputs)
         *pfMissingInputs = false;
 
@@ -1751,16 +1768,45 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
     if (fTxIndex) {
         CDiskTxPos postx;
         if (pblocktree->ReadTxIndex(hash, postx)) {
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-            if (file.IsNull())
-                return error("%s: OpenBlockFile failed", __func__);
+            std::shared_ptr<const CBlock> pblock = blockCache.Get(postx);
+            if (pblock) {
+                for (const CTransaction& tx : pblock->vtx) {
+                    if (tx.GetHash() == hash) {
+                        txOut = tx;
+                        hashBlock = pblock->GetHash();
+                        return true;
+                    }
+                }
+            }
+            DiskRecordFormat format;
+            unsigned int nStoredSize;
+            if (!blockFileReader.ReadRecordHeader(postx, Params().MessageStart(), format, nStoredSize))
+                return error("%s: ReadRecordHeader failed", __func__);
             CBlockHeader header;
-            try {
-                file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txOut;
-            } catch (const std::exception& e) {
-                return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+            if (format == DISK_RECORD_COMPRESSED) {
+                // Transaction offsets refer to the uncompressed block
+                std::vector<char> vchBlock;
+                if (!blockFileReader.ReadRawBlock(postx, Params().MessageStart(), vchBlock))
+                    return error("%s: ReadRawBlock failed", __func__);
+                try {
+                    CDataStream ssBlock(vchBlock, SER_DISK, CLIENT_VERSION);
+                    ssBlock >> header;
+                    ssBlock.ignore(postx.nTxOffset);
+                    ssBlock >> txOut;
+                } catch (const std::exception& e) {
+                    return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+                }
+            } else {
+                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+                if (file.IsNull())
+                    return error("%s: OpenBlockFile failed", __func__);
+                try {
+                    file >> header;
+                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+                    file >> txOut;
+                } catch (const std::exception& e) {
+                    return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+                }
             }
             hashBlock = header.GetHash();
             if (txOut.GetHash() != hash)
@@ -1807,52 +1853,61 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
 // CBlock and CBlockIndex
 //
 
-bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+void EncodeBlockRecord(const CBlock& block, const CMessageHeader::MessageStartChars& messageStart, std::vector<char>& vchRecord)
+{
+    CDataStream ssBlock(SER_DISK, CLIENT_VERSION);
+    ssBlock << block;
+    EncodeDiskRecord(&ssBlock[0], ssBlock.size(), messageStart, nBlockCompressionLevel, vchRecord);
+}
+
+bool WriteBlockToDisk(const std::vector<char>& vchRecord, CDiskBlockPos& pos)
 {
     // Open history file to append
     CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
     if (fileout.IsNull())
         return error("WriteBlockToDisk: OpenBlockFile failed");
 
-    // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, block);
-    fileout << FLATDATA(messageStart) << nSize;
+    // Write index header and block
+    fileout.write(vchRecord.data(), vchRecord.size());
+    pos.nPos += DISK_RECORD_HEADER_SIZE;
 
-    // Write block
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0)
-        return error("WriteBlockToDisk: ftell failed");
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
+    // Readahead data for this file may predate the write.
+    blockFileReader.Invalidate(pos.nFile);
 
     return true;
 }
 
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
 {
-    block.SetNull();
+    std::shared_ptr<const CBlock> pblock = blockCache.Get(pos);
+    if (pblock) {
+        block = *pblock;
+        return true;
+    }
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    block.SetNull();
 
     // Read block
+    std::vector<char> vchBlock;
+    if (!blockFileReader.ReadRawBlock(pos, Params().MessageStart(), vchBlock))
+        return error("ReadBlockFromDisk: failed to read block at %s", pos.ToString());
     try {
-        filein >> block;
+        CDataStream ssBlock(vchBlock, SER_DISK, CLIENT_VERSION);
+        ssBlock >> block;
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
     }
 
     // Check the header
-    unsigned int nHeight = chainActive.Height();
     if (block.GetHash() != Params().GenesisBlock().GetHash()) {
     if (!(CheckEquihashSolution(&block, consensusParams) &&
           CheckProofOfWork(block.GetHash(), block.nBits, consensusParams)))
         return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
     }
 
+    blockCache.Insert(pos, std::make_shared<const CBlock>(block));
+
     return true;
 }
 
@@ -1866,6 +1921,46 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadBlockFromDiskUnlocked(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams, CDiskBlockPos pos)
+{
+    if (pos.IsNull()) {
+        LOCK(cs_main);
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+            return error("%s: block %s not available", __func__, pindex->GetBlockHash().ToString());
+        pos = pindex->GetBlockPos();
+    }
+    if (ReadBlockFromDisk(block, pos, consensusParams) && block.GetHash() == pindex->GetBlockHash())
+        return true;
+
+    // CompressBlockFile or pruning may have moved the block since pos was
+    // taken; they cannot while cs_main is held.
+    LOCK(cs_main);
+    if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+        return error("%s: block %s not available", __func__, pindex->GetBlockHash().ToString());
+    return ReadBlockFromDisk(block, pindex, consensusParams);
+}
+
+bool ReadRawBlockFromDisk(std::vector<char>& vchBlock, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart)
+{
+    if (!blockFileReader.ReadRawBlock(pindex->GetBlockPos(), messageStart, vchBlock))
+        return error("ReadRawBlockFromDisk: failed to read block at %s", pindex->GetBlockPos().ToString());
+
+    // Only the header is deserialized, to check that the bytes on disk are
+    // the block the index says they are.
+    CBlockHeader header;
+    try {
+        CDataStream ssHeader(vchBlock, SER_DISK, CLIENT_VERSION);
+        ssHeader >> header;
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pindex->GetBlockPos().ToString());
+    }
+    if (header.GetHash() != pindex->GetBlockHash())
+        return error("ReadRawBlockFromDisk: GetHash() doesn't match index for %s at %s",
+                pindex->ToString(), pindex->GetBlockPos().ToString());
+    return true;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     CAmount nSubsidy = 1000 * COIN;
@@ -2318,45 +2413,58 @@ bool ContextualCheckInputs(
 
 namespace {
 
-bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
+void EncodeUndoRecord(const CBlockUndo& blockundo, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart, std::vector<char>& vchRecord)
+{
+    CDataStream ssUndo(SER_DISK, CLIENT_VERSION);
+    ssUndo << blockundo;
+    EncodeDiskRecord(&ssUndo[0], ssUndo.size(), messageStart, nBlockCompressionLevel, vchRecord);
+
+    // calculate & append checksum
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    hasher << hashBlock;
+    hasher << blockundo;
+    uint256 hashChecksum = hasher.GetHash();
+    vchRecord.insert(vchRecord.end(), hashChecksum.begin(), hashChecksum.end());
+}
+
+bool UndoWriteToDisk(const std::vector<char>& vchRecord, CDiskBlockPos& pos)
 {
     // Open history file to append
     CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
     if (fileout.IsNull())
         return error("%s: OpenUndoFile failed", __func__);
 
-    // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, blockundo);
-    fileout << FLATDATA(messageStart) << nSize;
+    // Write index header, undo data and checksum
+    fileout.write(vchRecord.data(), vchRecord.size());
+    pos.nPos += DISK_RECORD_HEADER_SIZE;
 
-    // Write undo data
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0)
-        return error("%s: ftell failed", __func__);
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
+    undoFileReader.Invalidate(pos.nFile);
 
-    // calculate & write checksum
-    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
-    hasher << hashBlock;
-    hasher << blockundo;
-    fileout << hasher.GetHash();
+    return true;
+}
 
+/** Read the (decompressed) serialized undo data at pos and the checksum stored after it. */
+bool ReadUndoRecord(const CDiskBlockPos& pos, std::vector<char>& vchUndo, uint256& hashChecksum)
+{
+    unsigned int nStoredSize;
+    if (!undoFileReader.ReadRecord(pos, Params().MessageStart(), MAX_SIZE, vchUndo, &nStoredSize))
+        return error("%s: ReadRecord failed", __func__);
+    CDiskBlockPos posChecksum(pos.nFile, pos.nPos + nStoredSize);
+    if (!undoFileReader.Read(posChecksum, (char*)hashChecksum.begin(), hashChecksum.size()))
+        return error("%s: failed to read checksum at %s", __func__, posChecksum.ToString());
     return true;
 }
 
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenBlockFile failed", __func__);
-
     // Read block
+    std::vector<char> vchUndo;
     uint256 hashChecksum;
+    if (!ReadUndoRecord(pos, vchUndo, hashChecksum))
+        return false;
     try {
-        filein >> blockundo;
-        filein >> hashChecksum;
+        CDataStream ssUndo(vchUndo, SER_DISK, CLIENT_VERSION);
+        ssUndo >> blockundo;
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s", __func__, e.what());
@@ -2621,7 +2729,7 @@ void ThreadScriptCheck() {
 // we're being fed a bad chain (blocks being generated much
 // too slowly or too quickly).
 void PartitionCheck(bool (*initialDownloadCheck)(const CChainParams&),
-                    CCriticalSection& cs, const CBlockIndex *const &bestHeader)
+                    CInstrumentedCriticalSection& cs, const CBlockIndex *const &bestHeader)
 {
     if (bestHeader == NULL || initialDownloadCheck(Params())) return;
 
@@ -2693,17 +2801,51 @@ void PartitionCheck(bool (*initialDownloadCheck)(const CChainParams&),
     }
 }
 
+/**
+ * Whether pindex is an ancestor of the -assumevalid block, on a header chain
+ * with at least the minimum chain work, and buried deeply enough that its
+ * scripts and proofs need not be verified.
+ */
+static bool IsBlockAssumedValid(const CBlockIndex* pindex, const Consensus::Params& consensusParams)
+{
+    AssertLockHeld(cs_main);
+    if (hashAssumeValid.IsNull())
+        return false;
+    BlockMap::const_iterator it = mapBlockIndex.find(hashAssumeValid);
+    if (it == mapBlockIndex.end() || it->second->GetAncestor(pindex->nHeight) != pindex)
+        return false;
+    if (pindexBestHeader == NULL || pindexBestHeader->GetAncestor(pindex->nHeight) != pindex)
+        return false;
+    // Do not skip verification when we may have been denied the real chain.
+    if (pindexBestHeader->nChainWork < UintToArith256(consensusParams.nMinimumChainWork))
+        return false;
+    // Require the block to be buried by about two weeks of work, so that an
+    // invalid block cannot be slipped in by persuading users to set
+    // -assumevalid to a recent block.
+    return GetBlockProofEquivalentTime(*pindexBestHeader, *pindex, *pindexBestHeader, consensusParams) > 60 * 60 * 24 * 7 * 2;
+}
+
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
+/** Record the time taken by one stage of connecting a block to the active chain */
+static void RecordConnectStage(const char* stage, int64_t nMicros)
+{
+    GetMetricHistogram("buck_block_connect_seconds", "Time taken by each stage of connecting a block to the active chain.",
+        METRIC_DURATION_BUCKETS, strprintf("stage=\"%s\"", stage)).observe(nMicros * 0.000001);
+}
+
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
                   CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
 {
     AssertLockHeld(cs_main);
 
+    auto span = TracingSpan("info", "main", "ConnectBlock");
+    auto spanGuard = span.Enter();
+
     bool fExpensiveChecks = true;
     if (fCheckpointsEnabled) {
         CBlockIndex *pindexLastCheckpoint = Checkpoints::GetLastCheckpoint(chainparams.Checkpoints());
@@ -2712,14 +2854,27 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             fExpensiveChecks = false;
         }
     }
+    if (fExpensiveChecks && IsBlockAssumedValid(pindex, chainparams.GetConsensus())) {
+        // This block is an ancestor of the -assumevalid block: disable script
+        // checks and JoinSplit proof verification. Sapling proofs were
+        // already skipped in AcceptBlock.
+        fExpensiveChecks = false;
+    }
 
     auto verifier = ProofVerifier::Strict();
     auto disabledVerifier = ProofVerifier::Disabled();
 
     bool fCheckPOW = !fJustCheck && (pindex->nHeight != 0);
     // Check it again to verify JoinSplit proofs, and in case a previous version let a bad block in
-    if (!CheckBlock(block, state, chainparams, fExpensiveChecks ? verifier : disabledVerifier, fCheckPOW, !fJustCheck))
-        return false;
+    int64_t nTimeCheckStart = GetTimeMicros();
+    {
+        auto spanCheck = TracingSpan("debug", "bench", "CheckBlock");
+        auto spanCheckGuard = spanCheck.Enter();
+        if (!CheckBlock(block, state, chainparams, fExpensiveChecks ? verifier : disabledVerifier, fCheckPOW, !fJustCheck))
+            return false;
+    }
+    if (!fJustCheck)
+        RecordConnectStage("proofs", GetTimeMicros() - nTimeCheckStart);
 
     // verify that the view's current state corresponds to the previous block
     uint256 hashPrevBlock = pindex->pprev == NULL ? uint256() : pindex->pprev->GetBlockHash();
@@ -2824,6 +2979,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     size_t total_sapling_tx = 0;
 
+    auto spanTransactions = TracingSpan("debug", "bench", "ConnectTransactions");
+    boost::optional<tracing::Entered> spanTransactionsGuard(spanTransactions.Enter());
+
     std::vector<PrecomputedTransactionData> txdata;
     txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
     for (unsigned int i = 0; i < block.vtx.size(); i++)
@@ -3013,6 +3171,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
         view.PushHistoryNode(consensusBranchId, historyNode);
     }
+    spanTransactionsGuard = boost::none;
 
     int64_t nTime1 = GetTimeMicros(); nTimeConnect += nTime1 - nTimeStart;
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime1 - nTimeStart) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime1 - nTimeStart) / (nInputs-1), nTimeConnect * 0.000001);
@@ -3024,22 +3183,34 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                                block.vtx[0].GetValueOut(), blockReward),
                                REJECT_INVALID, "bad-cb-amount");
 
-    if (!control.Wait())
-        return state.DoS(100, false);
+    {
+        auto spanScripts = TracingSpan("debug", "bench", "VerifyScripts");
+        auto spanScriptsGuard = spanScripts.Enter();
+        if (!control.Wait())
+            return state.DoS(100, false);
+    }
     int64_t nTime2 = GetTimeMicros(); nTimeVerify += nTime2 - nTimeStart;
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs-1), nTimeVerify * 0.000001);
 
     if (fJustCheck)
         return true;
 
+    RecordConnectStage("utxo", nTime1 - nTimeStart);
+    RecordConnectStage("scripts", nTime2 - nTime1);
+
+    auto spanIndex = TracingSpan("debug", "bench", "WriteIndex");
+    boost::optional<tracing::Entered> spanIndexGuard(spanIndex.Enter());
+
     // Write undo information to disk
     if (pindex->GetUndoPos().IsNull() || !pindex->IsValid(BLOCK_VALID_SCRIPTS))
     {
         if (pindex->GetUndoPos().IsNull()) {
             CDiskBlockPos pos;
-            if (!FindUndoPos(state, pindex->nFile, pos, ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION) + 40))
+            std::vector<char> vchRecord;
+            EncodeUndoRecord(blockundo, pindex->pprev->GetBlockHash(), chainparams.MessageStart(), vchRecord);
+            if (!FindUndoPos(state, pindex->nFile, pos, vchRecord.size()))
                 return error("ConnectBlock(): FindUndoPos failed");
-            if (!UndoWriteToDisk(blockundo, pos, pindex->pprev->GetBlockHash(), chainparams.MessageStart()))
+            if (!UndoWriteToDisk(vchRecord, pos))
                 return AbortNode(state, "Failed to write undo data");
 
             // update nUndoPos in block index
@@ -3105,8 +3276,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
+    spanIndexGuard = boost::none;
     int64_t nTime3 = GetTimeMicros(); nTimeIndex += nTime3 - nTime2;
     LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime3 - nTime2), nTimeIndex * 0.000001);
+    RecordConnectStage("index", nTime3 - nTime2);
 
     // Watch for changes to the previous coinbase transaction.
     static uint256 hashPrevBestCoinBase;
@@ -3133,6 +3306,9 @@ enum FlushStateMode {
  * or always and in all cases if we're in prune mode and are deleting files.
  */
 bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
+    auto span = TracingSpan("debug", "bench", "FlushStateToDisk");
+    auto spanGuard = span.Enter();
+
     const CChainParams& chainparams = Params();
     LOCK2(cs_main, cs_LastBlockFile);
     static int64_t nLastWrite = 0;
@@ -3191,7 +3367,9 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
                 vBlocks.push_back(*it);
                 it = setDirtyBlockIndex.erase(it);
             }
-            if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
+            std::vector<std::pair<uint256, CDiskTxPos> > vTxIndex;
+            vTxIndex.swap(vDirtyTxIndex);
+            if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks, vTxIndex)) {
                 return AbortNode(state, "Files to write to block index database");
             }
         }
@@ -3232,9 +3410,29 @@ void PruneAndFlush() {
     FlushStateToDisk(state, FLUSH_STATE_NONE);
 }
 
+/** Return the snapshot published by the last tip update; see main.h. */
+std::shared_ptr<const CChainSnapshot> GetChainSnapshot()
+{
+    LOCK(cs_chainSnapshot);
+    return pchainSnapshot;
+}
+
+/**
+ * Replace the snapshot returned by GetChainSnapshot() with one ending at
+ * pindexTip (or an empty one if NULL). Called with cs_main held whenever
+ * chainActive changes, so that the snapshot never lags behind it.
+ */
+static void PublishChainSnapshot(const CBlockIndex *pindexTip)
+{
+    auto snapshot = std::make_shared<CChainSnapshot>(pindexTip);
+    LOCK(cs_chainSnapshot);
+    pchainSnapshot = snapshot;
+}
+
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
     chainActive.SetTip(pindexNew);
+    PublishChainSnapshot(pindexNew);
 
     // New best block
     nTimeBestReceived = GetTime();
@@ -3259,7 +3457,12 @@ void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
         "progress", progress.c_str(),
         "cache", cache.c_str());
 
-    cvBlockChange.notify_all();
+    // Waiters check the tip with csBestBlock held, so taking it here means
+    // none of them can miss the notification.
+    {
+        boost::unique_lock<boost::mutex> lock(csBestBlock);
+        cvBlockChange.notify_all();
+    }
 }
 
 /**
@@ -3299,7 +3502,7 @@ bool static DisconnectTip(CValidationState &state, const CChainParams& chainpara
             list<CTransaction> removed;
             CValidationState stateDummy;
             if (tx.IsCoinBase() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL))
-                mempool.remove(tx, removed, true);
+                mempool.remove(tx, removed, true, MemPoolRemovalReason::REORG);
         }
         if (sproutAnchorBeforeDisconnect != sproutAnchorAfterDisconnect) {
             // The anchor may not change between block disconnects,
@@ -3361,11 +3564,13 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
+    RecordConnectStage("flush", nTime4 - nTime3);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
         return false;
     int64_t nTime5 = GetTimeMicros(); nTimeChainState += nTime5 - nTime4;
     LogPrint("bench", "  - Writing chainstate: %.2fms [%.2fs]\n", (nTime5 - nTime4) * 0.001, nTimeChainState * 0.000001);
+    RecordConnectStage("chainstate", nTime5 - nTime4);
     // Remove conflicting transactions from the mempool.
     std::list<CTransaction> txConflicted;
     mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted, !IsInitialBlockDownload(chainparams));
@@ -3389,6 +3594,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
     LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
+    RecordConnectStage("postprocess", nTime6 - nTime5);
     LogPrint("bench", "- Connect block: %.2fms [%.2fs]\n", (nTime6 - nTime1) * 0.001, nTimeTotal * 0.000001);
     return true;
 }
@@ -3557,8 +3763,12 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
                 pconnectBlock = pblock;
             } else {
                 // read the block to be connected from disk
+                int64_t nTimeReadStart = GetTimeMicros();
+                auto spanRead = TracingSpan("debug", "bench", "ReadBlockFromDisk");
+                auto spanReadGuard = spanRead.Enter();
                 if (!ReadBlockFromDisk(block, pindexConnect, chainparams.GetConsensus()))
                     return AbortNode(state, "Failed to read block");
+                RecordConnectStage("read", GetTimeMicros() - nTimeReadStart);
                 pconnectBlock = &block;
             }
 
@@ -4023,6 +4233,16 @@ bool CheckBlock(const CBlock& block, CValidationState& state,
 {
     // These are checks that are independent of context.
 
+    if (block.fChecked) {
+        // Only the proofs are left, if the caller wants them verified
+        if (!verifier.PerformsVerification())
+            return true;
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+            if (!CheckTransaction(tx, state, verifier))
+                return error("CheckBlock(): CheckTransaction failed");
+        return true;
+    }
+
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
     if (!CheckBlockHeader(block, state, chainparams, fCheckPOW))
@@ -4147,7 +4367,8 @@ bool ContextualCheckBlockHeader(
 
 bool ContextualCheckBlock(
     const CBlock& block, CValidationState& state,
-    const CChainParams& chainparams, CBlockIndex * const pindexPrev)
+    const CChainParams& chainparams, CBlockIndex * const pindexPrev,
+    bool fCheckProofs)
 {
     const int nHeight = pindexPrev == NULL ? 0 : pindexPrev->nHeight + 1;
     const Consensus::Params& consensusParams = chainparams.GetConsensus();
@@ -4156,7 +4377,7 @@ bool ContextualCheckBlock(
     BOOST_FOREACH(const CTransaction& tx, block.vtx) {
 
         // Check transaction contextually against consensus rules at block height
-        if (!ContextualCheckTransaction(tx, state, chainparams, nHeight, true)) {
+        if (!ContextualCheckTransaction(tx, state, chainparams, nHeight, true, IsInitialBlockDownload, fCheckProofs)) {
             return false; // Failure reason has been set in validation state object
         }
 
@@ -4186,7 +4407,7 @@ bool ContextualCheckBlock(
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL)
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL, bool fCheckPOW=true)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -4203,7 +4424,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
         return true;
     }
 
-    if (!CheckBlockHeader(block, state, chainparams))
+    if (!CheckBlockHeader(block, state, chainparams, fCheckPOW))
         return false;
 
     // Get prev block index
@@ -4242,7 +4463,8 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
 
     CBlockIndex *&pindex = *ppindex;
 
-    if (!AcceptBlockHeader(block, state, chainparams, &pindex))
+    // The Equihash solution of a block that passed CheckBlock is known to be valid
+    if (!AcceptBlockHeader(block, state, chainparams, &pindex, !block.fChecked))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -4269,7 +4491,8 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
     // See method docstring for why this is always disabled
     auto verifier = ProofVerifier::Disabled();
     bool fCheckPOW = (pindex->nHeight != 0);
-    if ((!CheckBlock(block, state, chainparams, verifier, fCheckPOW, true)) || !ContextualCheckBlock(block, state, chainparams, pindex->pprev)) {
+    bool fCheckProofs = !IsBlockAssumedValid(pindex, chainparams.GetConsensus());
+    if ((!CheckBlock(block, state, chainparams, verifier, fCheckPOW, true)) || !ContextualCheckBlock(block, state, chainparams, pindex->pprev, fCheckProofs)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
             setDirtyBlockIndex.insert(pindex);
@@ -4281,14 +4504,22 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
 
     // Write block to history file
     try {
-        unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
         CDiskBlockPos blockPos;
-        if (dbp != NULL)
+        std::vector<char> vchRecord;
+        unsigned int nRecordSize;
+        if (dbp != NULL) {
+            // The record is already on disk; this may overestimate its size
+            // if it is compressed, which only leaves a gap in the file.
             blockPos = *dbp;
-        if (!FindBlockPos(state, blockPos, nBlockSize+8, nHeight, block.GetBlockTime(), dbp != NULL))
+            nRecordSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION) + DISK_RECORD_HEADER_SIZE;
+        } else {
+            EncodeBlockRecord(block, chainparams.MessageStart(), vchRecord);
+            nRecordSize = vchRecord.size();
+        }
+        if (!FindBlockPos(state, blockPos, nRecordSize, nHeight, block.GetBlockTime(), dbp != NULL))
             return error("AcceptBlock(): FindBlockPos failed");
         if (dbp == NULL)
-            if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
+            if (!WriteBlockToDisk(vchRecord, blockPos))
                 AbortNode(state, "Failed to write block");
         if (!ReceivedBlockTransactions(block, state, chainparams, pindex, blockPos))
             return error("AcceptBlock(): ReceivedBlockTransactions failed");
@@ -4426,12 +4657,169 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        blockFileReader.Close(*it);
+        undoFileReader.Close(*it);
+        blockCache.EraseFile(*it);
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
     }
 }
 
+/** Rewrite the block (and undo) record of pindex as compressed records at the current write position. */
+static bool CompressBlockRecord(CBlockIndex* pindex, const CChainParams& chainparams)
+{
+    AssertLockHeld(cs_main);
+    CValidationState state;
+
+    std::vector<char> vchBlock, vchRecord;
+    if (!blockFileReader.ReadRawBlock(pindex->GetBlockPos(), chainparams.MessageStart(), vchBlock))
+        return error("%s: failed to read block %s", __func__, pindex->GetBlockHash().ToString());
+    EncodeDiskRecord(vchBlock.data(), vchBlock.size(), chainparams.MessageStart(), nBlockCompressionLevel, vchRecord);
+    CDiskBlockPos blockPos;
+    if (!FindBlockPos(state, blockPos, vchRecord.size(), pindex->nHeight, pindex->GetBlockTime()))
+        return error("%s: FindBlockPos failed", __func__);
+    if (!WriteBlockToDisk(vchRecord, blockPos))
+        return AbortNode(state, "Failed to write block");
+
+    CDiskBlockPos undoPos;
+    if (pindex->nStatus & BLOCK_HAVE_UNDO) {
+        // The checksum covers the uncompressed undo data, so it is kept as is.
+        std::vector<char> vchUndo;
+        uint256 hashChecksum;
+        if (!ReadUndoRecord(pindex->GetUndoPos(), vchUndo, hashChecksum))
+            return error("%s: failed to read undo data for %s", __func__, pindex->GetBlockHash().ToString());
+        EncodeDiskRecord(vchUndo.data(), vchUndo.size(), chainparams.MessageStart(), nBlockCompressionLevel, vchRecord);
+        vchRecord.insert(vchRecord.end(), hashChecksum.begin(), hashChecksum.end());
+        if (!FindUndoPos(state, blockPos.nFile, undoPos, vchRecord.size()))
+            return error("%s: FindUndoPos failed", __func__);
+        if (!UndoWriteToDisk(vchRecord, undoPos))
+            return AbortNode(state, "Failed to write undo data");
+    }
+
+    if (fTxIndex) {
+        // Only move entries that point at this copy of the block; a
+        // transaction may also be indexed in another block.
+        CBlock block;
+        try {
+            CDataStream ssBlock(vchBlock, SER_DISK, CLIENT_VERSION);
+            ssBlock >> block;
+        } catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
+        // The new positions are only written by the flush that also
+        // records the block index and file sizes for them, until which the
+        // old ones stay valid.
+        BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+            CDiskTxPos postx;
+            if (pblocktree->ReadTxIndex(tx.GetHash(), postx) &&
+                postx.nFile == pindex->nFile && postx.nPos == pindex->nDataPos) {
+                vDirtyTxIndex.push_back(std::make_pair(tx.GetHash(), CDiskTxPos(blockPos, postx.nTxOffset)));
+            }
+        }
+    }
+
+    pindex->nFile = blockPos.nFile;
+    pindex->nDataPos = blockPos.nPos;
+    if (pindex->nStatus & BLOCK_HAVE_UNDO)
+        pindex->nUndoPos = undoPos.nPos;
+    setDirtyBlockIndex.insert(pindex);
+    return true;
+}
+
+/** Move all blocks out of block file nFile into compressed records, then empty the file. */
+static bool CompressBlockFile(int nFile, const CChainParams& chainparams)
+{
+    std::vector<CBlockIndex*> vBlocks;
+    {
+        LOCK(cs_main);
+        for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it) {
+            CBlockIndex* pindex = it->second;
+            if (pindex->nFile == nFile && (pindex->nStatus & BLOCK_HAVE_DATA))
+                vBlocks.push_back(pindex);
+        }
+    }
+    std::sort(vBlocks.begin(), vBlocks.end(), [](const CBlockIndex* a, const CBlockIndex* b) {
+        return a->nHeight < b->nHeight;
+    });
+
+    LogPrintf("%s: compressing %u blocks in blk%05u.dat\n", __func__, vBlocks.size(), nFile);
+    BOOST_FOREACH(CBlockIndex* pindex, vBlocks) {
+        boost::this_thread::interruption_point();
+        // Take cs_main per block so that validation is not held up.
+        LOCK(cs_main);
+        if (pindex->nFile != nFile || !(pindex->nStatus & BLOCK_HAVE_DATA))
+            continue;
+        if (!CompressBlockRecord(pindex, chainparams))
+            return false;
+    }
+
+    LOCK(cs_main);
+    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it) {
+        if (it->second->nFile == nFile && (it->second->nStatus & BLOCK_HAVE_DATA))
+            return error("%s: blk%05u.dat is still in use", __func__, nFile);
+    }
+    {
+        LOCK(cs_LastBlockFile);
+        vinfoBlockFile[nFile].SetNull();
+        setDirtyFileInfo.insert(nFile);
+    }
+    // The old records must stay readable until the index pointing away
+    // from them is on disk.
+    CValidationState state;
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+        return false;
+
+    // Truncate rather than delete the files, since -reindex stops at the
+    // first missing block file.
+    blockFileReader.Close(nFile);
+    undoFileReader.Close(nFile);
+    blockCache.EraseFile(nFile);
+    CDiskBlockPos pos(nFile, 0);
+    FILE* file = OpenBlockFile(pos);
+    if (file) {
+        TruncateFile(file, 0);
+        fclose(file);
+    }
+    file = OpenUndoFile(pos);
+    if (file) {
+        TruncateFile(file, 0);
+        fclose(file);
+    }
+    return true;
+}
+
+void CompressBlockFiles(const CChainParams& chainparams)
+{
+    if (nBlockCompressionLevel <= 0 || fPruneMode)
+        return;
+
+    for (int nFile = 0; ; nFile++) {
+        boost::this_thread::interruption_point();
+        {
+            // The file currently being written is left alone; it will be
+            // converted on a later run once it is no longer the last one.
+            LOCK(cs_LastBlockFile);
+            if (nFile >= nLastBlockFile)
+                break;
+            if (vinfoBlockFile[nFile].nSize == 0)
+                continue;
+        }
+
+        // Files written with compression enabled start with a compressed record.
+        unsigned char buf[MESSAGE_START_SIZE];
+        if (!blockFileReader.Read(CDiskBlockPos(nFile, 0), (char*)buf, sizeof(buf)))
+            continue;
+        if (GetDiskRecordFormat(buf, chainparams.MessageStart()) != DISK_RECORD_RAW)
+            continue;
+
+        if (!CompressBlockFile(nFile, chainparams)) {
+            LogPrintf("%s: failed to compress blk%05u.dat, stopping\n", __func__, nFile);
+            return;
+        }
+    }
+}
+
 /* Calculate the block/rev files that should be deleted to remain under target*/
 void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight)
 {
@@ -4717,6 +5105,7 @@ bool static LoadBlockIndexDB()
     chainActive.SetTip(it->second);
     // Set hashFinalSproutRoot for the end of best chain
     it->second->hashFinalSproutRoot = pcoinsTip->GetBestAnchor(SPROUT);
+    PublishChainSnapshot(it->second);
 
     PruneBlockIndexCandidates();
 
@@ -4989,6 +5378,7 @@ void UnloadBlockIndex()
     LOCK(cs_main);
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
+    PublishChainSnapshot(NULL);
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
     mempool.clear();
@@ -5057,12 +5447,13 @@ bool InitBlockIndex(const CChainParams& chainparams)
         try {
             CBlock &block = const_cast<CBlock&>(chainparams.GenesisBlock());
             // Start new block file
-            unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+            std::vector<char> vchRecord;
+            EncodeBlockRecord(block, chainparams.MessageStart(), vchRecord);
             CDiskBlockPos blockPos;
             CValidationState state;
-            if (!FindBlockPos(state, blockPos, nBlockSize+8, 0, block.GetBlockTime()))
+            if (!FindBlockPos(state, blockPos, vchRecord.size(), 0, block.GetBlockTime()))
                 return error("LoadBlockIndex(): FindBlockPos failed");
-            if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
+            if (!WriteBlockToDisk(vchRecord, blockPos))
                 return error("LoadBlockIndex(): writing genesis block to disk failed");
             CBlockIndex *pindex = AddToBlockIndex(block, chainparams.GetConsensus());
             if (!ReceivedBlockTransactions(block, state, chainparams, pindex, blockPos))
@@ -5087,46 +5478,25 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
 
     int nLoaded = 0;
     try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
+        // This takes over fileIn, and reads and checks blocks ahead of the
+        // ones being connected here.
+        CBlockImporter importer(chainparams, fileIn, dbp ? dbp->nFile : -1, nScriptCheckThreads);
         size_t initialSize = nSizeReindexed;
-        while (!blkdat.eof()) {
+        CImportedBlock imported;
+        while (importer.Next(imported)) {
             boost::this_thread::interruption_point();
 
             if (fReindex)
-               nSizeReindexed = initialSize + nRewind;
+               nSizeReindexed = initialSize + imported.pos.nPos;
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, chainparams.MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
+            if (dbp)
+                dbp->nPos = imported.pos.nPos;
+            if (!imported.pblock) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, imported.strError);
+                continue;
             }
             try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
+                const CBlock& block = *imported.pblock;
 
                 // detect out of order blocks, and store them for later
                 uint256 hash = block.GetHash();
@@ -5157,15 +5527,16 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                     queue.pop_front();
                     std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
                     while (range.first != range.second) {
-                        if (ReadBlockFromDisk(block, range.first->second, chainparams.GetConsensus()))
+                        CBlock blockChild;
+                        if (ReadBlockFromDisk(blockChild, range.first->second, chainparams.GetConsensus()))
                         {
-                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
+                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__, blockChild.GetHash().ToString(),
                                     head.ToString());
                             CValidationState dummy;
-                            if (ProcessNewBlock(dummy, chainparams, NULL, &block, true, &(range.first->second)))
+                            if (ProcessNewBlock(dummy, chainparams, NULL, &blockChild, true, &(range.first->second)))
                             {
                                 nLoaded++;
-                                queue.push_back(block.GetHash());
+                                queue.push_back(blockChild.GetHash());
                             }
                         }
                         range.first = mapBlocksUnknownParent.erase(range.first);
@@ -5450,13 +5821,20 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
                     // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
-                        assert(!"cannot load block from disk");
                     if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
+                    {
+                        // The serialized form on disk is exactly what goes on
+                        // the wire, so there is no need to deserialize it.
+                        std::vector<char> vchBlock;
+                        if (!ReadRawBlockFromDisk(vchBlock, (*mi).second, Params().MessageStart()))
+                            assert(!"cannot load block from disk");
+                        pfrom->PushMessage("block", CFlatData(vchBlock));
+                    }
                     else // MSG_FILTERED_BLOCK)
                     {
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
+                            assert(!"cannot load block from disk");
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter)
                         {
@@ -34,6 +34,7 @@
 #include <algorithm>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -133,7 +134,7 @@ struct BlockHasher
 
 extern boost::optional<unsigned int> expiryDeltaArg;
 extern CScript COINBASE_FLAGS;
-extern CCriticalSection cs_main;
+extern CInstrumentedCriticalSection cs_main;
 extern CTxMemPool mempool;
 typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 extern BlockMap mapBlockIndex;
@@ -164,6 +165,8 @@ extern bool fTimestampIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+/** Block hash whose ancestors we will assume to have valid scripts and proofs (-assumevalid) */
+extern uint256 hashAssumeValid;
 // TODO: remove this flag by structuring our code such that
 // it is unneeded for testing
 extern bool fCoinbaseEnforcedShieldingEnabled;
@@ -233,6 +236,8 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = NULL);
+/** Move the blocks of block files written without compression into compressed records (-blockcompression) */
+void CompressBlockFiles(const CChainParams& chainparams);
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk */
@@ -251,7 +256,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
 /** Try to detect Partition (network isolation) attacks against us */
-void PartitionCheck(bool (*initialDownloadCheck)(const CChainParams&), CCriticalSection& cs, const CBlockIndex *const &bestHeader);
+void PartitionCheck(bool (*initialDownloadCheck)(const CChainParams&), CInstrumentedCriticalSection& cs, const CBlockIndex *const &bestHeader);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload(const CChainParams& chainParams);
 /** Format a string that describes several potential problems detected by the core */
@@ -341,7 +346,8 @@ bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, cons
 /** Check a transaction contextually against a set of consensus rules */
 bool ContextualCheckTransaction(const CTransaction& tx, CValidationState &state,
                                 const CChainParams& chainparams, int nHeight, bool isMined,
-                                bool (*isInitBlockDownload)(const CChainParams&) = IsInitialBlockDownload);
+                                bool (*isInitBlockDownload)(const CChainParams&) = IsInitialBlockDownload,
+                                bool fCheckProofs = true);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight);
@@ -440,9 +446,21 @@ bool GetTimestampIndex(unsigned int high, unsigned int low, bool fActiveOnly,
     std::vector<std::pair<uint256, unsigned int> > &hashes);
 
 /** Functions for disk access for blocks */
-bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
+/** Serialize block into the record stored in blk?????.dat, compressed if -blockcompression is set. */
+void EncodeBlockRecord(const CBlock& block, const CMessageHeader::MessageStartChars& messageStart, std::vector<char>& vchRecord);
+/** Write a record built by EncodeBlockRecord at pos, and point pos at the block within it. */
+bool WriteBlockToDisk(const std::vector<char>& vchRecord, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/**
+ * Read the block of pindex without holding cs_main during the read. The read
+ * starts at pos if given, or else at the position taken under cs_main; if the
+ * block has moved or its file was pruned in the meantime, it is read again
+ * with cs_main held. Must be called without cs_main.
+ */
+bool ReadBlockFromDiskUnlocked(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams, CDiskBlockPos pos = CDiskBlockPos());
+/** Read the serialized block for pindex from disk without deserializing its transactions. */
+bool ReadRawBlockFromDisk(std::vector<char>& vchBlock, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -461,7 +479,8 @@ bool CheckBlock(const CBlock& block, CValidationState& state,
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state,
                                 const CChainParams& chainparams, CBlockIndex *pindexPrev, bool fCheckPOW = true);
 bool ContextualCheckBlock(const CBlock& block, CValidationState& state,
-                          const CChainParams& chainparams, CBlockIndex *pindexPrev);
+                          const CChainParams& chainparams, CBlockIndex *pindexPrev,
+                          bool fCheckProofs = true);
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
@@ -506,6 +525,12 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex);
 /** The currently-connected chain of blocks (protected by cs_main). */
 extern CChain chainActive;
 
+/**
+ * Return chainActive as of the last tip update, for callers that do not hold
+ * cs_main. Never NULL; the snapshot is empty before the block index is loaded.
+ */
+std::shared_ptr<const CChainSnapshot> GetChainSnapshot();
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
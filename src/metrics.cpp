@@ -18,6 +18,8 @@
 #include <boost/range/irange.hpp>
 #include <boost/thread.hpp>
 #include <boost/thread/synchronized_value.hpp>
+#include <map>
+#include <memory>
 #include <string>
 #ifdef WIN32
 #include <io.h>
@@ -71,6 +73,167 @@ double AtomicTimer::rate(const AtomicCounter& count)
     return duration > 0 ? (double)count.get() / duration : 0;
 }
 
+const std::vector<double> METRIC_DURATION_BUCKETS = {0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10};
+
+MetricHistogram::MetricHistogram(const std::vector<double>& boundsIn) :
+    bounds(boundsIn), buckets(boundsIn.size() + 1), count(0), sum(0)
+{
+}
+
+void MetricHistogram::observe(double value)
+{
+    size_t nBucket = std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin();
+    std::unique_lock<std::mutex> lock(mtx);
+    buckets[nBucket]++;
+    count++;
+    sum += value;
+}
+
+static std::string JoinLabels(const std::string& labels, const std::string& extra)
+{
+    if (labels.empty() && extra.empty())
+        return "";
+    if (labels.empty() || extra.empty())
+        return "{" + labels + extra + "}";
+    return "{" + labels + "," + extra + "}";
+}
+
+std::string MetricHistogram::ToPrometheus(const std::string& name, const std::string& labels)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    std::string strOut;
+    uint64_t nCumulative = 0;
+    for (size_t i = 0; i < buckets.size(); i++) {
+        nCumulative += buckets[i];
+        std::string strBound = i < bounds.size() ? strprintf("%g", bounds[i]) : "+Inf";
+        strOut += strprintf("%s_bucket%s %d\n", name, JoinLabels(labels, "le=\"" + strBound + "\""), nCumulative);
+    }
+    strOut += strprintf("%s_sum%s %.6f\n", name, JoinLabels(labels, ""), sum);
+    strOut += strprintf("%s_count%s %d\n", name, JoinLabels(labels, ""), count);
+    return strOut;
+}
+
+enum MetricType {
+    METRIC_COUNTER,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM,
+};
+
+struct MetricFamily {
+    std::string help;
+    MetricType type;
+    // By labels
+    std::map<std::string, std::unique_ptr<MetricValue>> values;
+    std::map<std::string, std::unique_ptr<MetricHistogram>> histograms;
+    std::map<std::string, std::function<int64_t()>> callbacks;
+};
+
+static std::mutex cs_metricsRegistry;
+// Never freed, as metrics may be updated from other static destructors
+static std::map<std::string, MetricFamily>& mapMetrics = *new std::map<std::string, MetricFamily>();
+
+static MetricFamily& GetMetricFamily(const std::string& name, const std::string& help, MetricType type)
+{
+    auto it = mapMetrics.find(name);
+    if (it == mapMetrics.end()) {
+        it = mapMetrics.insert(std::make_pair(name, MetricFamily())).first;
+        it->second.help = help;
+        it->second.type = type;
+    }
+    assert(it->second.type == type);
+    return it->second;
+}
+
+static MetricValue& GetMetricValue(const std::string& name, const std::string& help, MetricType type, const std::string& labels)
+{
+    std::unique_lock<std::mutex> lock(cs_metricsRegistry);
+    std::unique_ptr<MetricValue>& value = GetMetricFamily(name, help, type).values[labels];
+    if (!value)
+        value.reset(new MetricValue());
+    return *value;
+}
+
+MetricValue& GetMetricCounter(const std::string& name, const std::string& help, const std::string& labels)
+{
+    return GetMetricValue(name, help, METRIC_COUNTER, labels);
+}
+
+MetricValue& GetMetricGauge(const std::string& name, const std::string& help, const std::string& labels)
+{
+    return GetMetricValue(name, help, METRIC_GAUGE, labels);
+}
+
+MetricHistogram& GetMetricHistogram(const std::string& name, const std::string& help, const std::vector<double>& bounds, const std::string& labels)
+{
+    std::unique_lock<std::mutex> lock(cs_metricsRegistry);
+    std::unique_ptr<MetricHistogram>& histogram = GetMetricFamily(name, help, METRIC_HISTOGRAM).histograms[labels];
+    if (!histogram)
+        histogram.reset(new MetricHistogram(bounds));
+    return *histogram;
+}
+
+void RegisterMetricCallback(const std::string& name, const std::string& help, bool fCounter, std::function<int64_t()> value, const std::string& labels)
+{
+    std::unique_lock<std::mutex> lock(cs_metricsRegistry);
+    GetMetricFamily(name, help, fCounter ? METRIC_COUNTER : METRIC_GAUGE).callbacks[labels] = value;
+}
+
+void RegisterNodeMetrics()
+{
+    RegisterMetricCallback("buck_mempool_transactions", "Transactions in the mempool.", false,
+        [] { return (int64_t)mempool.size(); });
+    RegisterMetricCallback("buck_mempool_bytes", "Serialized size of the transactions in the mempool.", false,
+        [] { return (int64_t)mempool.GetTotalTxSize(); });
+    RegisterMetricCallback("buck_mempool_usage_bytes", "Memory used by the mempool.", false,
+        [] { return (int64_t)mempool.DynamicMemoryUsage(); });
+
+    RegisterMetricCallback("buck_coins_cache_usage_bytes", "Memory used by the coins cache.", false,
+        [] { LOCK(cs_main); return pcoinsTip ? (int64_t)pcoinsTip->DynamicMemoryUsage() : 0; });
+    RegisterMetricCallback("buck_coins_cache_limit_bytes", "Memory the coins cache may use before it is flushed (-dbcache).", false,
+        [] { return (int64_t)nCoinCacheUsage; });
+    RegisterMetricCallback("buck_coins_cache_lookups_total", "Coins lookups in the coins cache.", true,
+        [] { LOCK(cs_main); return pcoinsTip ? (int64_t)pcoinsTip->GetCacheHits() : 0; }, "result=\"hit\"");
+    RegisterMetricCallback("buck_coins_cache_lookups_total", "Coins lookups in the coins cache.", true,
+        [] { LOCK(cs_main); return pcoinsTip ? (int64_t)pcoinsTip->GetCacheMisses() : 0; }, "result=\"miss\"");
+}
+
+std::string MetricsToPrometheus()
+{
+    struct FamilySnapshot {
+        std::string text;
+        std::vector<std::pair<std::string, std::function<int64_t()>>> callbacks;
+    };
+
+    // Read the callbacks once the registry is unlocked, as they may take
+    // locks that are held while metrics are updated.
+    std::vector<FamilySnapshot> vSnapshots;
+    {
+        std::unique_lock<std::mutex> lock(cs_metricsRegistry);
+        for (const auto& item : mapMetrics) {
+            const std::string& name = item.first;
+            const MetricFamily& family = item.second;
+            FamilySnapshot snapshot;
+            snapshot.text = strprintf("# HELP %s %s\n# TYPE %s %s\n", name, family.help, name,
+                family.type == METRIC_COUNTER ? "counter" : family.type == METRIC_GAUGE ? "gauge" : "histogram");
+            for (const auto& value : family.values)
+                snapshot.text += strprintf("%s%s %d\n", name, JoinLabels(value.first, ""), value.second->get());
+            for (const auto& histogram : family.histograms)
+                snapshot.text += histogram.second->ToPrometheus(name, histogram.first);
+            for (const auto& callback : family.callbacks)
+                snapshot.callbacks.push_back(std::make_pair(strprintf("%s%s", name, JoinLabels(callback.first, "")), callback.second));
+            vSnapshots.push_back(snapshot);
+        }
+    }
+
+    std::string strOut;
+    for (const FamilySnapshot& snapshot : vSnapshots) {
+        strOut += snapshot.text;
+        for (const auto& callback : snapshot.callbacks)
+            strOut += strprintf("%s %d\n", callback.first, callback.second());
+    }
+    return strOut;
+}
+
 static CCriticalSection cs_metrics;
 
 static boost::synchronized_value<int64_t> nNodeStartTime;
@@ -6,8 +6,10 @@
 #include "consensus/params.h"
 
 #include <atomic>
+#include <functional>
 #include <mutex>
 #include <string>
+#include <vector>
 
 struct AtomicCounter {
     std::atomic<uint64_t> value;
@@ -55,6 +57,64 @@ public:
     double rate(const AtomicCounter& count);
 };
 
+/** A counter or gauge served at /metrics */
+class MetricValue {
+private:
+    std::atomic<int64_t> value;
+
+public:
+    MetricValue() : value(0) {}
+
+    void add(int64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+    void set(int64_t n) { value.store(n, std::memory_order_relaxed); }
+    int64_t get() const { return value.load(std::memory_order_relaxed); }
+};
+
+/** Distribution of observed values, served at /metrics in cumulative buckets */
+class MetricHistogram {
+private:
+    std::mutex mtx;
+    const std::vector<double> bounds;
+    std::vector<uint64_t> buckets;
+    uint64_t count;
+    double sum;
+
+public:
+    explicit MetricHistogram(const std::vector<double>& boundsIn);
+
+    void observe(double value);
+
+    std::string ToPrometheus(const std::string& name, const std::string& labels);
+};
+
+/** Upper bounds, in seconds, of the buckets of duration histograms */
+extern const std::vector<double> METRIC_DURATION_BUCKETS;
+
+/**
+ * The node metrics served at /metrics in the Prometheus text format.
+ *
+ * Metrics are registered on first use and are never freed, so callers can
+ * keep the returned references, usually in static locals. labels is either
+ * empty or a list such as `stage="read"`; one name may be used with several
+ * labels, but always with the same help text and type.
+ */
+MetricValue& GetMetricCounter(const std::string& name, const std::string& help, const std::string& labels = "");
+MetricValue& GetMetricGauge(const std::string& name, const std::string& help, const std::string& labels = "");
+MetricHistogram& GetMetricHistogram(const std::string& name, const std::string& help, const std::vector<double>& bounds, const std::string& labels = "");
+
+/**
+ * Register a counter or gauge whose value is read when the metrics are
+ * served. The registry lock is not held while value runs, so it may take
+ * cs_main and other locks.
+ */
+void RegisterMetricCallback(const std::string& name, const std::string& help, bool fCounter, std::function<int64_t()> value, const std::string& labels = "");
+
+/** Register the metrics of the mempool and of the coins cache. */
+void RegisterNodeMetrics();
+
+/** Render all registered metrics in the Prometheus text format. */
+std::string MetricsToPrometheus();
+
 enum DurationFormat {
     FULL,
     REDUCED
@@ -13,6 +13,7 @@
 #include "addrman.h"
 #include "chainparams.h"
 #include "clientversion.h"
+#include "metrics.h"
 #include "primitives/transaction.h"
 #include "scheduler.h"
 #include "ui_interface.h"
@@ -573,6 +574,41 @@ void CNode::copyStats(CNodeStats &stats)
     stats.addrLocal = addrLocal.IsValid() ? addrLocal.ToString() : "";
 }
 
+// Message types that get their own byte counters; peers may send any command,
+// so the rest share one counter
+static const std::set<std::string> setMetricMessageTypes = {
+    "addr", "alert", "block", "filteradd", "filterclear", "filterload", "getaddr",
+    "getblocks", "getdata", "getheaders", "headers", "inv", "mempool", "merkleblock",
+    "notfound", "ping", "pong", "reject", "tx", "verack", "version",
+};
+
+// Sent and received byte counters, by message type
+typedef std::map<std::string, std::pair<MetricValue*, MetricValue*> > MessageByteCounters;
+
+static MessageByteCounters MakeMessageByteCounters()
+{
+    MessageByteCounters counters;
+    std::set<std::string> setTypes = setMetricMessageTypes;
+    setTypes.insert("other");
+    for (const std::string& strType : setTypes) {
+        std::string labels = strprintf("command=\"%s\"", strType);
+        counters[strType] = std::make_pair(
+            &GetMetricCounter("buck_peer_sent_bytes_total", "Bytes of messages sent to peers, by message type.", labels),
+            &GetMetricCounter("buck_peer_received_bytes_total", "Bytes of messages received from peers, by message type.", labels));
+    }
+    return counters;
+}
+
+static void RecordMessageBytes(bool fSent, const std::string& strCommand, uint64_t nBytes)
+{
+    // Resolved once, so that each message only costs a lookup and an add
+    static const MessageByteCounters counters = MakeMessageByteCounters();
+    MessageByteCounters::const_iterator it = counters.find(strCommand);
+    if (it == counters.end())
+        it = counters.find("other");
+    (fSent ? it->second.first : it->second.second)->add(nBytes);
+}
+
 // requires LOCK(cs_vRecvMsg)
 bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
 {
@@ -605,6 +641,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
 
         if (msg.complete()) {
             msg.nTime = GetTimeMicros();
+            RecordMessageBytes(false, msg.hdr.GetCommand(), CMessageHeader::HEADER_SIZE + msg.hdr.nMessageSize);
             messageHandlerCondition.notify_one();
         }
     }
@@ -2226,6 +2263,9 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
 
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
+    const char* pchCommand = &ssSend[MESSAGE_START_SIZE];
+    RecordMessageBytes(true, std::string(pchCommand, strnlen(pchCommand, CMessageHeader::COMMAND_SIZE)), ssSend.size());
+
     std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
     ssSend.GetAndClear(*it);
     nSendSize += (*it).size();
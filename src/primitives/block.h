@@ -85,6 +85,8 @@ public:
 
     // memory only
     mutable std::vector<uint256> vMerkleTree;
+    //! Set once CheckBlock has passed without proof verification (see CBlockImporter)
+    mutable bool fChecked;
 
     CBlock()
     {
@@ -110,6 +112,7 @@ public:
         CBlockHeader::SetNull();
         vtx.clear();
         vMerkleTree.clear();
+        fChecked = false;
     }
 
     CBlockHeader GetBlockHeader() const
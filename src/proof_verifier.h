@@ -32,6 +32,9 @@ public:
     // such as during reindexing.
     static ProofVerifier Disabled();
 
+    // Whether this context verifies proofs at all.
+    bool PerformsVerification() const { return perform_verification; }
+
     // Verifies that the JoinSplit proof is correct.
     bool VerifySprout(
         const JSDescription& jsdesc,
@@ -100,14 +100,14 @@ static UniValue ValuePoolDesc(
     return rv;
 }
 
-UniValue blockheaderToJSON(const CBlockIndex* blockindex)
+static UniValue blockheaderToJSON(const CBlockIndex* blockindex, const CChainSnapshot& chain)
 {
     UniValue result(UniValue::VOBJ);
     result.pushKV("hash", blockindex->GetBlockHash().GetHex());
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
-    if (chainActive.Contains(blockindex))
-        confirmations = chainActive.Height() - blockindex->nHeight + 1;
+    if (chain.Contains(blockindex))
+        confirmations = chain.Height() - blockindex->nHeight + 1;
     result.pushKV("confirmations", confirmations);
     result.pushKV("height", blockindex->nHeight);
     result.pushKV("version", blockindex->nVersion);
@@ -122,12 +122,17 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
 
     if (blockindex->pprev)
         result.pushKV("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
-    CBlockIndex *pnext = chainActive.Next(blockindex);
+    const CBlockIndex *pnext = chain.Next(blockindex);
     if (pnext)
         result.pushKV("nextblockhash", pnext->GetBlockHash().GetHex());
     return result;
 }
 
+UniValue blockheaderToJSON(const CBlockIndex* blockindex)
+{
+    return blockheaderToJSON(blockindex, *GetChainSnapshot());
+}
+
 // insightexplorer
 UniValue blockToDeltasJSON(const CBlock& block, const CBlockIndex* blockindex)
 {
@@ -218,14 +223,14 @@ UniValue blockToDeltasJSON(const CBlock& block, const CBlockIndex* blockindex)
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+static UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, const CChainSnapshot& chain, bool txDetails)
 {
     UniValue result(UniValue::VOBJ);
     result.pushKV("hash", block.GetHash().GetHex());
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
-    if (chainActive.Contains(blockindex))
-        confirmations = chainActive.Height() - blockindex->nHeight + 1;
+    if (chain.Contains(blockindex))
+        confirmations = chain.Height() - blockindex->nHeight + 1;
     result.pushKV("confirmations", confirmations);
     result.pushKV("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
     result.pushKV("height", blockindex->nHeight);
@@ -261,12 +266,17 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
 
     if (blockindex->pprev)
         result.pushKV("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
-    CBlockIndex *pnext = chainActive.Next(blockindex);
+    const CBlockIndex *pnext = chain.Next(blockindex);
     if (pnext)
         result.pushKV("nextblockhash", pnext->GetBlockHash().GetHex());
     return result;
 }
 
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+{
+    return blockToJSON(block, blockindex, *GetChainSnapshot(), txDetails);
+}
+
 UniValue getblockcount(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -280,8 +290,7 @@ UniValue getblockcount(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockcount", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Height();
+    return GetChainSnapshot()->Height();
 }
 
 UniValue getbestblockhash(const UniValue& params, bool fHelp)
@@ -297,8 +306,78 @@ UniValue getbestblockhash(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getbestblockhash", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Tip()->GetBlockHash().GetHex();
+    return GetChainSnapshot()->Tip()->GetBlockHash().GetHex();
+}
+
+UniValue waitfornewblock(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 2)
+        throw runtime_error(
+            "waitfornewblock ( \"blockhash\" timeout )\n"
+            "\nWaits for the tip of the best block chain to move away from blockhash, and returns the new tip.\n"
+            "\nArguments:\n"
+            "1. \"blockhash\"   (string, optional) The tip the caller knows about, usually the hash returned by the\n"
+            "                  previous call. Defaults to the current tip.\n"
+            "2. timeout       (numeric, optional, default=0) Time in milliseconds to wait for, 0 for no timeout\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"hash\" : \"hash\",     (string) The hash of the tip\n"
+            "  \"height\" : n,        (numeric) The height of the tip\n"
+            "  \"forkheight\" : n     (numeric, optional) The height of the last block of the chain ending at blockhash\n"
+            "                       that is still in the best chain, if blockhash is known\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("waitfornewblock", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\" 1000")
+            + HelpExampleRpc("waitfornewblock", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\", 1000")
+        );
+
+    uint256 hashWatched;
+    if (params.size() > 0 && !params[0].isNull())
+        hashWatched = ParseHashV(params[0], "blockhash");
+    else
+        hashWatched = GetChainSnapshot()->Tip()->GetBlockHash();
+
+    int64_t nTimeout = 0;
+    if (params.size() > 1)
+        nTimeout = params[1].get_int64();
+    if (nTimeout < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative timeout");
+
+    // UpdateTip publishes the new snapshot before it notifies cvBlockChange,
+    // which OnRPCStopped also notifies on shutdown.
+    std::shared_ptr<const CChainSnapshot> snapshot;
+    {
+        boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(nTimeout);
+        boost::unique_lock<boost::mutex> lock(csBestBlock);
+        while ((snapshot = GetChainSnapshot())->Tip()->GetBlockHash() == hashWatched && IsRPCRunning()) {
+            if (nTimeout == 0) {
+                cvBlockChange.wait(lock);
+            } else if (!cvBlockChange.timed_wait(lock, deadline)) {
+                snapshot = GetChainSnapshot();
+                break;
+            }
+        }
+    }
+    if (!IsRPCRunning())
+        throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("hash", snapshot->Tip()->GetBlockHash().GetHex());
+    ret.pushKV("height", snapshot->Height());
+
+    const CBlockIndex* pindexWatched = NULL;
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hashWatched);
+        if (mi != mapBlockIndex.end())
+            pindexWatched = mi->second;
+    }
+    // Block index entries are never freed, so the walk needs no lock
+    while (pindexWatched && !snapshot->Contains(pindexWatched))
+        pindexWatched = pindexWatched->pprev;
+    if (pindexWatched)
+        ret.pushKV("forkheight", pindexWatched->nHeight);
+    return ret;
 }
 
 UniValue getdifficulty(const UniValue& params, bool fHelp)
@@ -586,18 +665,18 @@ UniValue getblockhash(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockhash", "1000")
         );
 
-    LOCK(cs_main);
+    auto chain = GetChainSnapshot();
 
     int nHeight = params[0].get_int();
 
     if (nHeight < 0) {
-        nHeight += chainActive.Height() + 1;
+        nHeight += chain->Height() + 1;
     }
 
-    if (nHeight < 0 || nHeight > chainActive.Height())
+    if (nHeight < 0 || nHeight > chain->Height())
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
 
-    CBlockIndex* pblockindex = chainActive[nHeight];
+    const CBlockIndex* pblockindex = (*chain)[nHeight];
     return pblockindex->GetBlockHash().GetHex();
 }
 
@@ -633,8 +712,6 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockheader", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
         );
 
-    LOCK(cs_main);
-
     std::string strHash = params[0].get_str();
     uint256 hash(uint256S(strHash));
 
@@ -642,10 +719,20 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
     if (params.size() > 1)
         fVerbose = params[1].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+    auto chain = GetChainSnapshot();
+    CBlockIndex* pblockindex;
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
+        if (mi == mapBlockIndex.end())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        pblockindex = mi->second;
 
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
+        // Blocks outside the snapshot may still be updated, so describe
+        // them while holding the lock.
+        if (fVerbose && !chain->Contains(pblockindex))
+            return blockheaderToJSON(pblockindex, *chain);
+    }
 
     if (!fVerbose)
     {
@@ -655,7 +742,7 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
         return strHex;
     }
 
-    return blockheaderToJSON(pblockindex);
+    return blockheaderToJSON(pblockindex, *chain);
 }
 
 UniValue getblock(const UniValue& params, bool fHelp)
@@ -706,7 +793,7 @@ UniValue getblock(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblock", "12800")
         );
 
-    LOCK(cs_main);
+    auto chain = GetChainSnapshot();
 
     std::string strHash = params[0].get_str();
 
@@ -727,14 +814,14 @@ UniValue getblock(const UniValue& params, bool fHelp)
         }
 
         if (nHeight < 0) {
-            nHeight += chainActive.Height() + 1;
+            nHeight += chain->Height() + 1;
         }
 
-        if (nHeight < 0 || nHeight > chainActive.Height()) {
+        if (nHeight < 0 || nHeight > chain->Height()) {
             throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
         }
 
-        strHash = chainActive[nHeight]->GetBlockHash().GetHex();
+        strHash = (*chain)[nHeight]->GetBlockHash().GetHex();
     }
 
     uint256 hash(uint256S(strHash));
@@ -752,16 +839,29 @@ UniValue getblock(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Verbosity must be in range from 0 to 2");
     }
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+    CBlockIndex* pblockindex;
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
+        if (mi == mapBlockIndex.end())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        pblockindex = mi->second;
+
+        if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+
+        // Blocks outside the snapshot may still be updated, and transaction
+        // details look up the mempool and spent index, so describe those
+        // while holding the lock.
+        if (verbosity > 0 && (!chain->Contains(pblockindex) || verbosity >= 2 || fSpentIndex)) {
+            if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+                throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+            return blockToJSON(block, pblockindex, *chain, verbosity >= 2);
+        }
+    }
 
-    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+    if (!ReadBlockFromDiskUnlocked(block, pblockindex, Params().GetConsensus()))
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
     if (verbosity == 0)
@@ -772,7 +872,7 @@ UniValue getblock(const UniValue& params, bool fHelp)
         return strHex;
     }
 
-    return blockToJSON(block, pblockindex, verbosity >= 2);
+    return blockToJSON(block, pblockindex, *chain, verbosity >= 2);
 }
 
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
@@ -922,10 +1022,10 @@ UniValue verifychain(const UniValue& params, bool fHelp)
 }
 
 /** Implementation of IsSuperMajority with better feedback */
-static UniValue SoftForkMajorityDesc(int minVersion, CBlockIndex* pindex, int nRequired, const Consensus::Params& consensusParams)
+static UniValue SoftForkMajorityDesc(int minVersion, const CBlockIndex* pindex, int nRequired, const Consensus::Params& consensusParams)
 {
     int nFound = 0;
-    CBlockIndex* pstart = pindex;
+    const CBlockIndex* pstart = pindex;
     for (int i = 0; i < consensusParams.nMajorityWindow && pstart != NULL; i++)
     {
         if (pstart->nVersion >= minVersion)
@@ -941,7 +1041,7 @@ static UniValue SoftForkMajorityDesc(int minVersion, CBlockIndex* pindex, int nR
     return rv;
 }
 
-static UniValue SoftForkDesc(const std::string &name, int version, CBlockIndex* pindex, const Consensus::Params& consensusParams)
+static UniValue SoftForkDesc(const std::string &name, int version, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
     UniValue rv(UniValue::VOBJ);
     rv.pushKV("id", name);
@@ -1035,30 +1135,53 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockchaininfo", "")
         );
 
-    LOCK(cs_main);
+    // Describe the chain from a snapshot, and hold cs_main only to read
+    // the state that is not part of it.
+    auto chain = GetChainSnapshot();
+    const CBlockIndex* tip = chain->Tip();
+
+    int nHeaders;
+    uint64_t nSizeOnDisk;
+    uint64_t nCommitments;
+    int nPruneHeight = 0;
+    {
+        LOCK(cs_main);
+        nHeaders = pindexBestHeader ? pindexBestHeader->nHeight : -1;
+        nSizeOnDisk = CalculateCurrentUsage();
+
+        SproutMerkleTree tree;
+        pcoinsTip->GetSproutAnchorAt(pcoinsTip->GetBestAnchor(SPROUT), tree);
+        nCommitments = tree.size();
+
+        if (fPruneMode)
+        {
+            const CBlockIndex *block = tip;
+            while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA))
+                block = block->pprev;
+
+            nPruneHeight = block->nHeight;
+        }
+    }
 
     UniValue obj(UniValue::VOBJ);
     obj.pushKV("chain",                 Params().NetworkIDString());
-    obj.pushKV("blocks",                (int)chainActive.Height());
+    obj.pushKV("blocks",                (int)chain->Height());
     obj.pushKV("initial_block_download_complete", !IsInitialBlockDownload(Params()));
-    obj.pushKV("headers",               pindexBestHeader ? pindexBestHeader->nHeight : -1);
-    obj.pushKV("bestblockhash",         chainActive.Tip()->GetBlockHash().GetHex());
-    obj.pushKV("difficulty",            (double)GetNetworkDifficulty());
-    obj.pushKV("verificationprogress",  Checkpoints::GuessVerificationProgress(Params().Checkpoints(), chainActive.Tip()));
-    obj.pushKV("chainwork",             chainActive.Tip()->nChainWork.GetHex());
+    obj.pushKV("headers",               nHeaders);
+    obj.pushKV("bestblockhash",         tip->GetBlockHash().GetHex());
+    obj.pushKV("difficulty",            (double)GetNetworkDifficulty(tip));
+    obj.pushKV("verificationprogress",  Checkpoints::GuessVerificationProgress(Params().Checkpoints(), tip));
+    obj.pushKV("chainwork",             tip->nChainWork.GetHex());
     obj.pushKV("pruned",                fPruneMode);
-    obj.pushKV("size_on_disk",          CalculateCurrentUsage());
+    obj.pushKV("size_on_disk",          nSizeOnDisk);
 
     if (IsInitialBlockDownload(Params()))
-        obj.pushKV("estimatedheight",       EstimateNetHeight(Params().GetConsensus(), (int)chainActive.Height(), chainActive.Tip()->GetMedianTimePast()));
+        obj.pushKV("estimatedheight",       EstimateNetHeight(Params().GetConsensus(), (int)chain->Height(), tip->GetMedianTimePast()));
     else
-        obj.pushKV("estimatedheight",       (int)chainActive.Height());
+        obj.pushKV("estimatedheight",       (int)chain->Height());
 
-    SproutMerkleTree tree;
-    pcoinsTip->GetSproutAnchorAt(pcoinsTip->GetBestAnchor(SPROUT), tree);
-    obj.pushKV("commitments",           static_cast<uint64_t>(tree.size()));
+    obj.pushKV("commitments",           nCommitments);
 
-    CBlockIndex* tip = chainActive.Tip();
     UniValue valuePools(UniValue::VARR);
     valuePools.push_back(ValuePoolDesc("sprout", tip->nChainSproutValue, boost::none));
     valuePools.push_back(ValuePoolDesc("sapling", tip->nChainSaplingValue, boost::none));
@@ -1083,13 +1206,7 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
     obj.pushKV("consensus", consensus);
 
     if (fPruneMode)
-    {
-        CBlockIndex *block = chainActive.Tip();
-        while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA))
-            block = block->pprev;
-
-        obj.pushKV("pruneheight",        block->nHeight);
-    }
+        obj.pushKV("pruneheight",        nPruneHeight);
 
     if (Params().NetworkIDString() == "regtest") {
         obj.pushKV("fullyNotified", ChainIsFullyNotified());
@@ -1315,29 +1432,30 @@ UniValue reconsiderblock(const UniValue& params, bool fHelp)
 }
 
 static const CRPCCommand commands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
-    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true  },
-    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true  },
-    { "blockchain",         "getblockcount",          &getblockcount,          true  },
-    { "blockchain",         "getblock",               &getblock,               true  },
-    { "blockchain",         "getblockhash",           &getblockhash,           true  },
-    { "blockchain",         "getblockheader",         &getblockheader,         true  },
-    { "blockchain",         "getchaintips",           &getchaintips,           true  },
-    { "blockchain",         "getdifficulty",          &getdifficulty,          true  },
-    { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true  },
-    { "blockchain",         "getrawmempool",          &getrawmempool,          true  },
-    { "blockchain",         "gettxout",               &gettxout,               true  },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
-    { "blockchain",         "verifychain",            &verifychain,            true  },
+{ //  category              name                      actor (function)         okSafeMode readOnly
+  //  --------------------- ------------------------  -----------------------  ---------- --------
+    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,      true  },
+    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,      true  },
+    { "blockchain",         "getblockcount",          &getblockcount,          true,      true  },
+    { "blockchain",         "waitfornewblock",        &waitfornewblock,        true,      true  },
+    { "blockchain",         "getblock",               &getblock,               true,      true  },
+    { "blockchain",         "getblockhash",           &getblockhash,           true,      true  },
+    { "blockchain",         "getblockheader",         &getblockheader,         true,      true  },
+    { "blockchain",         "getchaintips",           &getchaintips,           true,      true  },
+    { "blockchain",         "getdifficulty",          &getdifficulty,          true,      true  },
+    { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,      true  },
+    { "blockchain",         "getrawmempool",          &getrawmempool,          true,      true  },
+    { "blockchain",         "gettxout",               &gettxout,               true,      true  },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,      false },
+    { "blockchain",         "verifychain",            &verifychain,            true,      false },
 
     // insightexplorer
-    { "blockchain",         "getblockdeltas",         &getblockdeltas,         false },    
-    { "blockchain",         "getblockhashes",         &getblockhashes,         true  },
+    { "blockchain",         "getblockdeltas",         &getblockdeltas,         false,     true  },    
+    { "blockchain",         "getblockhashes",         &getblockhashes,         true,      true  },
 
     /* Not shown in help */
-    { "hidden",             "invalidateblock",        &invalidateblock,        true  },
-    { "hidden",             "reconsiderblock",        &reconsiderblock,        true  },
+    { "hidden",             "invalidateblock",        &invalidateblock,        true,      false },
+    { "hidden",             "reconsiderblock",        &reconsiderblock,        true,      false },
 };
 
 void RegisterBlockchainRPCCommands(CRPCTable &tableRPC)
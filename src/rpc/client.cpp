@@ -63,6 +63,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getblocktemplate", 0 },
     { "listsinceblock", 1 },
     { "listsinceblock", 2 },
+    { "waitforwallettx", 0 },
+    { "waitforwallettx", 1 },
     { "sendmany", 1 },
     { "sendmany", 2 },
     { "sendmany", 4 },
@@ -74,6 +76,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "listunspent", 1 },
     { "listunspent", 2 },
     { "getblock", 1 },
+    { "waitfornewblock", 1 },
     { "getblockheader", 1 },
     { "gettransaction", 1 },
     { "getrawtransaction", 1 },
@@ -132,6 +135,10 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "z_gettotalbalance", 0},
     { "z_gettotalbalance", 1},
     { "z_gettotalbalance", 2},
+    { "z_consolidatenotes", 0},
+    { "z_consolidatenotes", 2},
+    { "z_consolidatenotes", 3},
+    { "z_consolidatenotes", 4},
     { "z_mergetoaddress", 0},
     { "z_mergetoaddress", 2},
     { "z_mergetoaddress", 3},
@@ -139,6 +146,9 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "z_sendmany", 1},
     { "z_sendmany", 2},
     { "z_sendmany", 3},
+    { "z_sendmanybatched", 1},
+    { "z_sendmanybatched", 2},
+    { "z_sendmanybatched", 3},
     { "z_shieldcoinbase", 2},
     { "z_shieldcoinbase", 3},
     { "z_getoperationstatus", 0},
@@ -930,25 +930,25 @@ UniValue getblocksubsidy(const UniValue& params, bool fHelp)
 }
 
 static const CRPCCommand commands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
-    { "mining",             "getlocalsolps",          &getlocalsolps,          true  },
-    { "mining",             "getnetworksolps",        &getnetworksolps,        true  },
-    { "mining",             "getnetworkhashps",       &getnetworkhashps,       true  },
-    { "mining",             "getmininginfo",          &getmininginfo,          true  },
-    { "mining",             "prioritisetransaction",  &prioritisetransaction,  true  },
-    { "mining",             "getblocktemplate",       &getblocktemplate,       true  },
-    { "mining",             "submitblock",            &submitblock,            true  },
-    { "mining",             "getblocksubsidy",        &getblocksubsidy,        true  },
+{ //  category              name                      actor (function)         okSafeMode readOnly
+  //  --------------------- ------------------------  -----------------------  ---------- --------
+    { "mining",             "getlocalsolps",          &getlocalsolps,          true,      true  },
+    { "mining",             "getnetworksolps",        &getnetworksolps,        true,      true  },
+    { "mining",             "getnetworkhashps",       &getnetworkhashps,       true,      true  },
+    { "mining",             "getmininginfo",          &getmininginfo,          true,      true  },
+    { "mining",             "prioritisetransaction",  &prioritisetransaction,  true,      false },
+    { "mining",             "getblocktemplate",       &getblocktemplate,       true,      false },
+    { "mining",             "submitblock",            &submitblock,            true,      false },
+    { "mining",             "getblocksubsidy",        &getblocksubsidy,        true,      true  },
 
 #ifdef ENABLE_MINING
-    { "generating",         "getgenerate",            &getgenerate,            true  },
-    { "generating",         "setgenerate",            &setgenerate,            true  },
-    { "generating",         "generate",               &generate,               true  },
+    { "generating",         "getgenerate",            &getgenerate,            true,      true  },
+    { "generating",         "setgenerate",            &setgenerate,            true,      false },
+    { "generating",         "generate",               &generate,               true,      false },
 #endif
 
-    { "util",               "estimatefee",            &estimatefee,            true  },
-    { "util",               "estimatepriority",       &estimatepriority,       true  },
+    { "util",               "estimatefee",            &estimatefee,            true,      true  },
+    { "util",               "estimatepriority",       &estimatepriority,       true,      true  },
 };
 
 void RegisterMiningRPCCommands(CRPCTable &tableRPC)
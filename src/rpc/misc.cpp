@@ -1131,27 +1131,27 @@ UniValue getspentinfo(const UniValue& params, bool fHelp)
 }
 
 static const CRPCCommand commands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
-    { "control",            "getinfo",                &getinfo,                true  }, /* uses wallet if enabled */
-    { "util",               "validateaddress",        &validateaddress,        true  }, /* uses wallet if enabled */
-    { "util",               "z_validateaddress",      &z_validateaddress,      true  }, /* uses wallet if enabled */
-    { "util",               "createmultisig",         &createmultisig,         true  },
-    { "util",               "verifymessage",          &verifymessage,          true  },
-    { "control",            "getexperimentalfeatures",&getexperimentalfeatures,true  },
+{ //  category              name                      actor (function)         okSafeMode readOnly
+  //  --------------------- ------------------------  -----------------------  ---------- --------
+    { "control",            "getinfo",                &getinfo,                true,      true  }, /* uses wallet if enabled */
+    { "util",               "validateaddress",        &validateaddress,        true,      true  }, /* uses wallet if enabled */
+    { "util",               "z_validateaddress",      &z_validateaddress,      true,      true  }, /* uses wallet if enabled */
+    { "util",               "createmultisig",         &createmultisig,         true,      true  },
+    { "util",               "verifymessage",          &verifymessage,          true,      true  },
+    { "control",            "getexperimentalfeatures",&getexperimentalfeatures,true,      true  },
 
     // START insightexplorer
     /* Address index */
-    { "addressindex",       "getaddresstxids",        &getaddresstxids,        false }, /* insight explorer */
-    { "addressindex",       "getaddressbalance",      &getaddressbalance,      false }, /* insight explorer */
-    { "addressindex",       "getaddressdeltas",       &getaddressdeltas,       false }, /* insight explorer */
-    { "addressindex",       "getaddressutxos",        &getaddressutxos,        false }, /* insight explorer */
-    { "addressindex",       "getaddressmempool",      &getaddressmempool,      true  }, /* insight explorer */
-    { "blockchain",         "getspentinfo",           &getspentinfo,           false }, /* insight explorer */
+    { "addressindex",       "getaddresstxids",        &getaddresstxids,        false,     true  }, /* insight explorer */
+    { "addressindex",       "getaddressbalance",      &getaddressbalance,      false,     true  }, /* insight explorer */
+    { "addressindex",       "getaddressdeltas",       &getaddressdeltas,       false,     true  }, /* insight explorer */
+    { "addressindex",       "getaddressutxos",        &getaddressutxos,        false,     true  }, /* insight explorer */
+    { "addressindex",       "getaddressmempool",      &getaddressmempool,      true,      true  }, /* insight explorer */
+    { "blockchain",         "getspentinfo",           &getspentinfo,           false,     true  }, /* insight explorer */
     // END insightexplorer
 
     /* Not shown in help */
-    { "hidden",             "setmocktime",            &setmocktime,            true  },
+    { "hidden",             "setmocktime",            &setmocktime,            true,      false },
 };
 
 void RegisterMiscRPCCommands(CRPCTable &tableRPC)
@@ -599,20 +599,20 @@ UniValue clearbanned(const UniValue& params, bool fHelp)
 }
 
 static const CRPCCommand commands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
-    { "network",            "getconnectioncount",     &getconnectioncount,     true  },
-    { "network",            "getdeprecationinfo",     &getdeprecationinfo,     true  },
-    { "network",            "ping",                   &ping,                   true  },
-    { "network",            "getpeerinfo",            &getpeerinfo,            true  },
-    { "network",            "addnode",                &addnode,                true  },
-    { "network",            "disconnectnode",         &disconnectnode,         true  },
-    { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true  },
-    { "network",            "getnettotals",           &getnettotals,           true  },
-    { "network",            "getnetworkinfo",         &getnetworkinfo,         true  },
-    { "network",            "setban",                 &setban,                 true  },
-    { "network",            "listbanned",             &listbanned,             true  },
-    { "network",            "clearbanned",            &clearbanned,            true  },
+{ //  category              name                      actor (function)         okSafeMode readOnly
+  //  --------------------- ------------------------  -----------------------  ---------- --------
+    { "network",            "getconnectioncount",     &getconnectioncount,     true,      true  },
+    { "network",            "getdeprecationinfo",     &getdeprecationinfo,     true,      true  },
+    { "network",            "ping",                   &ping,                   true,      false },
+    { "network",            "getpeerinfo",            &getpeerinfo,            true,      true  },
+    { "network",            "addnode",                &addnode,                true,      false },
+    { "network",            "disconnectnode",         &disconnectnode,         true,      false },
+    { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true,      true  },
+    { "network",            "getnettotals",           &getnettotals,           true,      true  },
+    { "network",            "getnetworkinfo",         &getnetworkinfo,         true,      true  },
+    { "network",            "setban",                 &setban,                 true,      false },
+    { "network",            "listbanned",             &listbanned,             true,      true  },
+    { "network",            "clearbanned",            &clearbanned,            true,      false },
 };
 
 void RegisterNetRPCCommands(CRPCTable &tableRPC)
@@ -61,6 +61,60 @@ UniValue JSONRPCError(int code, const string& message)
     return error;
 }
 
+/** Append value to buf as UniValue::write() would, flushing buf to write once it reaches nChunkSize bytes. */
+static void JSONWriteValue(const UniValue& value, std::string& buf, size_t nChunkSize,
+                           const std::function<void(const std::string&)>& write)
+{
+    switch (value.getType()) {
+    case UniValue::VOBJ: {
+        const std::vector<std::string>& keys = value.getKeys();
+        const std::vector<UniValue>& values = value.getValues();
+        buf += '{';
+        for (size_t i = 0; i < values.size(); i++) {
+            if (i > 0)
+                buf += ',';
+            buf += UniValue(keys[i]).write();
+            buf += ':';
+            JSONWriteValue(values[i], buf, nChunkSize, write);
+        }
+        buf += '}';
+        break;
+    }
+    case UniValue::VARR: {
+        const std::vector<UniValue>& values = value.getValues();
+        buf += '[';
+        for (size_t i = 0; i < values.size(); i++) {
+            if (i > 0)
+                buf += ',';
+            JSONWriteValue(values[i], buf, nChunkSize, write);
+        }
+        buf += ']';
+        break;
+    }
+    default:
+        buf += value.write();
+        break;
+    }
+
+    if (buf.size() >= nChunkSize) {
+        write(buf);
+        buf.clear();
+    }
+}
+
+void JSONRPCWriteReply(const UniValue& result, const UniValue& id,
+                       const std::function<void(const std::string&)>& write, size_t nChunkSize)
+{
+    std::string buf;
+    buf.reserve(nChunkSize + 1024);
+    buf += "{\"result\":";
+    JSONWriteValue(result, buf, nChunkSize, write);
+    buf += ",\"error\":null,\"id\":";
+    buf += id.write();
+    buf += "}\n";
+    write(buf);
+}
+
 /** Username used when cookie authentication is in use (arbitrary, only for
  * recognizability in debugging/logging purposes)
  */
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_RPCPROTOCOL_H
 #define BITCOIN_RPCPROTOCOL_H
 
+#include <functional>
 #include <list>
 #include <map>
 #include <stdint.h>
@@ -81,6 +82,15 @@ UniValue JSONRPCReplyObj(const UniValue& result, const UniValue& error, const Un
 std::string JSONRPCReply(const UniValue& result, const UniValue& error, const UniValue& id);
 UniValue JSONRPCError(int code, const std::string& message);
 
+/**
+ * Serialize the reply to a successful call as JSONRPCReply() does, passing it
+ * to write in pieces of about nChunkSize bytes. This avoids building the
+ * JSONRPCReplyObj() copy of the result and the std::string copy of the
+ * serialized reply; the result itself and whatever write() buffers remain.
+ */
+void JSONRPCWriteReply(const UniValue& result, const UniValue& id,
+                       const std::function<void(const std::string&)>& write, size_t nChunkSize = 1 << 16);
+
 /** Get name of RPC authentication cookie file */
 boost::filesystem::path GetAuthCookieFile();
 /** Generate a new RPC authentication cookie and write it to disk */
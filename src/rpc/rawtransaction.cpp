@@ -1114,17 +1114,17 @@ UniValue sendrawtransaction(const UniValue& params, bool fHelp)
 }
 
 static const CRPCCommand commands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
-    { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true  },
-    { "rawtransactions",    "createrawtransaction",   &createrawtransaction,   true  },
-    { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true  },
-    { "rawtransactions",    "decodescript",           &decodescript,           true  },
-    { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false },
-    { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false }, /* uses wallet if enabled */
-
-    { "blockchain",         "gettxoutproof",          &gettxoutproof,          true  },
-    { "blockchain",         "verifytxoutproof",       &verifytxoutproof,       true  },
+{ //  category              name                      actor (function)         okSafeMode readOnly
+  //  --------------------- ------------------------  -----------------------  ---------- --------
+    { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true,      true  },
+    { "rawtransactions",    "createrawtransaction",   &createrawtransaction,   true,      true  },
+    { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true,      true  },
+    { "rawtransactions",    "decodescript",           &decodescript,           true,      true  },
+    { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false,     false },
+    { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false,     false }, /* uses wallet if enabled */
+
+    { "blockchain",         "gettxoutproof",          &gettxoutproof,          true,      true  },
+    { "blockchain",         "verifytxoutproof",       &verifytxoutproof,       true,      true  },
 };
 
 void RegisterRawTransactionRPCCommands(CRPCTable &tableRPC)
@@ -14,7 +14,10 @@
 #include "utilstrencodings.h"
 #include "asyncrpcqueue.h"
 
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <thread>
 
 #include <univalue.h>
 
@@ -43,6 +46,9 @@ static std::vector<RPCTimerInterface*> timerInterfaces;
  * @note Can be changed to std::unique_ptr when C++11 */
 static std::map<std::string, boost::shared_ptr<RPCTimerBase> > deadlineTimers;
 
+static std::mutex cs_rpcStats;
+static std::map<std::string, CRPCMethodStats> mapRPCStats;
+
 static struct CRPCSignals
 {
     boost::signals2::signal<void ()> Started;
@@ -290,16 +296,149 @@ UniValue stop(const UniValue& params, bool fHelp)
     return "Buck server stopping";
 }
 
+std::map<std::string, CRPCMethodStats> GetRPCMethodStats()
+{
+    std::lock_guard<std::mutex> guard(cs_rpcStats);
+    return mapRPCStats;
+}
+
+static void RecordRPCCall(const std::string& strMethod, int64_t nMicros, bool fError)
+{
+    size_t nBucket = 0;
+    while (nBucket < RPC_LATENCY_BUCKET_COUNT - 1 && nMicros > RPC_LATENCY_BUCKETS[nBucket])
+        nBucket++;
+
+    std::lock_guard<std::mutex> guard(cs_rpcStats);
+    CRPCMethodStats& stats = mapRPCStats[strMethod];
+    stats.nCalls++;
+    if (fError)
+        stats.nErrors++;
+    stats.nTotalMicros += nMicros;
+    stats.vBuckets[nBucket]++;
+}
+
+std::string RPCMetricsToPrometheus()
+{
+    std::string strOut;
+
+    strOut += "# HELP buck_rpc_duration_seconds Time taken by RPC calls.\n";
+    strOut += "# TYPE buck_rpc_duration_seconds histogram\n";
+    std::map<std::string, CRPCMethodStats> mapStats = GetRPCMethodStats();
+    for (const auto& item : mapStats) {
+        const CRPCMethodStats& stats = item.second;
+        uint64_t nCumulative = 0;
+        for (size_t i = 0; i < RPC_LATENCY_BUCKET_COUNT; i++) {
+            nCumulative += stats.vBuckets[i];
+            std::string strBound = i < RPC_LATENCY_BUCKET_COUNT - 1 ? strprintf("%g", RPC_LATENCY_BUCKETS[i] / 1e6) : "+Inf";
+            strOut += strprintf("buck_rpc_duration_seconds_bucket{method=\"%s\",le=\"%s\"} %d\n", item.first, strBound, nCumulative);
+        }
+        strOut += strprintf("buck_rpc_duration_seconds_sum{method=\"%s\"} %.6f\n", item.first, stats.nTotalMicros / 1e6);
+        strOut += strprintf("buck_rpc_duration_seconds_count{method=\"%s\"} %d\n", item.first, stats.nCalls);
+    }
+    strOut += "# HELP buck_rpc_errors_total RPC calls that returned an error.\n";
+    strOut += "# TYPE buck_rpc_errors_total counter\n";
+    for (const auto& item : mapStats) {
+        strOut += strprintf("buck_rpc_errors_total{method=\"%s\"} %d\n", item.first, item.second.nErrors);
+    }
+
+    std::vector<const CLockStats*> vLockStats = GetAllLockStats();
+    strOut += "# HELP buck_lock_acquisitions_total Outermost acquisitions of a lock.\n";
+    strOut += "# TYPE buck_lock_acquisitions_total counter\n";
+    for (const CLockStats* stats : vLockStats)
+        strOut += strprintf("buck_lock_acquisitions_total{lock=\"%s\"} %d\n", stats->name, stats->nAcquired.load());
+    strOut += "# HELP buck_lock_contentions_total Acquisitions of a lock that waited for another thread.\n";
+    strOut += "# TYPE buck_lock_contentions_total counter\n";
+    for (const CLockStats* stats : vLockStats)
+        strOut += strprintf("buck_lock_contentions_total{lock=\"%s\"} %d\n", stats->name, stats->nContended.load());
+    strOut += "# HELP buck_lock_wait_seconds_total Time spent waiting for a lock.\n";
+    strOut += "# TYPE buck_lock_wait_seconds_total counter\n";
+    for (const CLockStats* stats : vLockStats)
+        strOut += strprintf("buck_lock_wait_seconds_total{lock=\"%s\"} %.6f\n", stats->name, stats->nWaitMicros.load() / 1e6);
+    strOut += "# HELP buck_lock_held_seconds_total Time a lock was held.\n";
+    strOut += "# TYPE buck_lock_held_seconds_total counter\n";
+    for (const CLockStats* stats : vLockStats)
+        strOut += strprintf("buck_lock_held_seconds_total{lock=\"%s\"} %.6f\n", stats->name, stats->nHeldMicros.load() / 1e6);
+
+    return strOut;
+}
+
+UniValue getrpcmetrics(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrpcmetrics\n"
+            "\nReturns call statistics for each RPC method, and wait and hold times of the main locks, since startup.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"methods\": {\n"
+            "    \"method\": {             (object) A method that has been called\n"
+            "      \"calls\": n,           (numeric) Number of calls\n"
+            "      \"errors\": n,          (numeric) Number of calls that returned an error\n"
+            "      \"total_ms\": n,        (numeric) Total time taken by the calls, in milliseconds\n"
+            "      \"histogram\": {        (object) Number of calls by latency\n"
+            "        \"le_ms\": n,         (numeric) Calls that took at most le_ms milliseconds and longer than the previous bound\n"
+            "        ...\n"
+            "        \"inf\": n            (numeric) Calls that took longer than the last bound\n"
+            "      }\n"
+            "    }, ...\n"
+            "  },\n"
+            "  \"locks\": {\n"
+            "    \"name\": {               (object) A lock, such as cs_main, mempool.cs or cs_wallet\n"
+            "      \"acquired\": n,        (numeric) Number of outermost acquisitions\n"
+            "      \"contended\": n,       (numeric) Number of acquisitions that waited for another thread\n"
+            "      \"wait_ms\": n,         (numeric) Total time spent waiting for the lock, in milliseconds\n"
+            "      \"held_ms\": n          (numeric) Total time the lock was held, in milliseconds\n"
+            "    }, ...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrpcmetrics", "")
+            + HelpExampleRpc("getrpcmetrics", "")
+        );
+
+    UniValue methods(UniValue::VOBJ);
+    for (const auto& item : GetRPCMethodStats()) {
+        const CRPCMethodStats& stats = item.second;
+        UniValue histogram(UniValue::VOBJ);
+        for (size_t i = 0; i < RPC_LATENCY_BUCKET_COUNT; i++) {
+            std::string strBound = i < RPC_LATENCY_BUCKET_COUNT - 1 ? strprintf("%d", RPC_LATENCY_BUCKETS[i] / 1000) : "inf";
+            histogram.pushKV(strBound, stats.vBuckets[i]);
+        }
+        UniValue method(UniValue::VOBJ);
+        method.pushKV("calls", stats.nCalls);
+        method.pushKV("errors", stats.nErrors);
+        method.pushKV("total_ms", stats.nTotalMicros / 1000.0);
+        method.pushKV("histogram", histogram);
+        methods.pushKV(item.first, method);
+    }
+
+    UniValue locks(UniValue::VOBJ);
+    for (const CLockStats* stats : GetAllLockStats()) {
+        UniValue lock(UniValue::VOBJ);
+        lock.pushKV("acquired", stats->nAcquired.load());
+        lock.pushKV("contended", stats->nContended.load());
+        lock.pushKV("wait_ms", stats->nWaitMicros.load() / 1000.0);
+        lock.pushKV("held_ms", stats->nHeldMicros.load() / 1000.0);
+        locks.pushKV(stats->name, lock);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("methods", methods);
+    ret.pushKV("locks", locks);
+    return ret;
+}
+
 /**
  * Call Table
  */
 static const CRPCCommand vRPCCommands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
+{ //  category              name                      actor (function)         okSafeMode readOnly
+  //  --------------------- ------------------------  -----------------------  ---------- --------
     /* Overall control/query calls */
-    { "control",            "help",                   &help,                   true  },
-    { "control",            "setlogfilter",           &setlogfilter,           true  },
-    { "control",            "stop",                   &stop,                   true  },
+    { "control",            "getrpcmetrics",          &getrpcmetrics,          true,      true  },
+    { "control",            "help",                   &help,                   true,      true  },
+    { "control",            "setlogfilter",           &setlogfilter,           true,      false },
+    { "control",            "stop",                   &stop,                   true,      false },
 };
 
 CRPCTable::CRPCTable()
@@ -342,20 +481,11 @@ bool StartRPC()
     fRPCRunning = true;
     g_rpcSignals.Started();
 
-    // Launch one async rpc worker.  The ability to launch multiple workers is not recommended at present and thus the option is disabled.
-    getAsyncRPCQueue()->addWorker();
-/*
-    int n = GetArg("-rpcasyncthreads", 1);
-    if (n<1) {
-        LogPrintf("ERROR: Invalid value %d for -rpcasyncthreads.  Must be at least 1.\n", n);
-        strerr = strprintf(_("An error occurred while setting up the Async RPC threads, invalid parameter value of %d (must be at least 1)."), n);
-        uiInterface.ThreadSafeMessageBox(strerr, "", CClientUIInterface::MSG_ERROR);
-        StartShutdown();
-        return;
-    }
-    for (int i = 0; i < n; i++)
+    // Operations lock the inputs they select, so several of them can build
+    // and prove transactions at the same time.
+    int nAsyncThreads = std::max((int)GetArg("-rpcasyncthreads", DEFAULT_RPC_ASYNC_THREADS), 1);
+    for (int i = 0; i < nAsyncThreads; i++)
         getAsyncRPCQueue()->addWorker();
-*/
     return true;
 }
 
@@ -457,11 +587,62 @@ static UniValue JSONRPCExecOne(const UniValue& req)
     return rpc_result;
 }
 
+static bool IsReadOnlyRequest(const UniValue& req)
+{
+    if (!req.isObject())
+        return false;
+    const UniValue& valMethod = find_value(req.get_obj(), "method");
+    if (!valMethod.isStr())
+        return false;
+    const CRPCCommand *pcmd = tableRPC[valMethod.get_str()];
+    return pcmd && pcmd->readOnly;
+}
+
+/**
+ * Execute requests [nBegin, nEnd) of a batch on up to nThreads threads,
+ * including the calling one, storing each reply at the index of its request.
+ */
+static void JSONRPCExecConcurrently(const UniValue& vReq, std::vector<UniValue>& vReply,
+                                    size_t nBegin, size_t nEnd, size_t nThreads)
+{
+    std::atomic<size_t> nNext(nBegin);
+    auto worker = [&]() {
+        for (size_t reqIdx = nNext++; reqIdx < nEnd; reqIdx = nNext++)
+            vReply[reqIdx] = JSONRPCExecOne(vReq[reqIdx]);
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min(nThreads, nEnd - nBegin); i++)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread& t : threads)
+        t.join();
+}
+
 std::string JSONRPCExecBatch(const UniValue& vReq)
 {
+    size_t nThreads = std::max((int)GetArg("-rpcbatchthreads", DEFAULT_RPC_BATCH_THREADS), 1);
+    std::vector<UniValue> vReply(vReq.size());
+
+    // Runs of read-only calls are executed concurrently. Any other call runs
+    // on its own, after the calls before it and before the calls after it.
+    size_t reqIdx = 0;
+    while (reqIdx < vReq.size()) {
+        size_t nEnd = reqIdx;
+        while (nThreads > 1 && nEnd < vReq.size() && IsReadOnlyRequest(vReq[nEnd]))
+            nEnd++;
+        if (nEnd - reqIdx > 1) {
+            JSONRPCExecConcurrently(vReq, vReply, reqIdx, nEnd, nThreads);
+            reqIdx = nEnd;
+        } else {
+            vReply[reqIdx] = JSONRPCExecOne(vReq[reqIdx]);
+            reqIdx++;
+        }
+    }
+
     UniValue ret(UniValue::VARR);
-    for (size_t reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    for (const UniValue& reply : vReply)
+        ret.push_back(reply);
 
     return ret.write() + "\n";
 }
@@ -482,13 +663,25 @@ UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params
 
     g_rpcSignals.PreCommand(*pcmd);
 
+    auto span = TracingSpanFields("debug", "rpc", "RPC", "method", strMethod.c_str());
+    auto spanGuard = span.Enter();
+
+    int64_t nStart = GetTimeMicros();
     try
     {
         // Execute
-        return pcmd->actor(params, false);
+        UniValue result = pcmd->actor(params, false);
+        RecordRPCCall(strMethod, GetTimeMicros() - nStart, false);
+        return result;
+    }
+    catch (const UniValue& objError)
+    {
+        RecordRPCCall(strMethod, GetTimeMicros() - nStart, true);
+        throw;
     }
     catch (const std::exception& e)
     {
+        RecordRPCCall(strMethod, GetTimeMicros() - nStart, true);
         throw JSONRPCError(RPC_MISC_ERROR, e.what());
     }
 
@@ -15,6 +15,7 @@
 #include <stdint.h>
 #include <string>
 #include <memory>
+#include <vector>
 
 #include <univalue.h>
 
@@ -46,6 +47,12 @@ public:
 /** Query whether RPC is running */
 bool IsRPCRunning();
 
+/** Default number of threads running async operations such as z_sendmany */
+static const int DEFAULT_RPC_ASYNC_THREADS = 1;
+
+/** Default number of threads executing the read-only calls of one batch request */
+static const int DEFAULT_RPC_BATCH_THREADS = 4;
+
 /** Get the async queue*/
 std::shared_ptr<AsyncRPCQueue> getAsyncRPCQueue();
 
@@ -124,6 +131,7 @@ public:
     std::string name;
     rpcfn_type actor;
     bool okSafeMode;
+    bool readOnly;      //!< Changes no node or wallet state, so may run alongside other calls
 };
 
 /**
@@ -183,6 +191,26 @@ void InterruptRPC();
 void StopRPC();
 std::string JSONRPCExecBatch(const UniValue& vReq);
 
+/** Upper bounds of the RPC latency histogram buckets, in microseconds; the last bucket is unbounded */
+static const int64_t RPC_LATENCY_BUCKETS[] = {1000, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000, 10000000};
+static const size_t RPC_LATENCY_BUCKET_COUNT = sizeof(RPC_LATENCY_BUCKETS) / sizeof(RPC_LATENCY_BUCKETS[0]) + 1;
+
+/** Calls to one RPC method since startup */
+struct CRPCMethodStats
+{
+    uint64_t nCalls = 0;
+    uint64_t nErrors = 0;
+    int64_t nTotalMicros = 0;
+    //! Number of calls in each latency bucket (not cumulative)
+    std::vector<uint64_t> vBuckets = std::vector<uint64_t>(RPC_LATENCY_BUCKET_COUNT);
+};
+
+/** Return the call statistics of every RPC method that has been called. */
+std::map<std::string, CRPCMethodStats> GetRPCMethodStats();
+
+/** Render the RPC and lock statistics in the Prometheus text format. */
+std::string RPCMetricsToPrometheus();
+
 extern std::string experimentalDisabledHelpMsg(const std::string& rpc, const std::vector<std::string>& enableArgs);
 
 #endif // BITCOIN_RPCSERVER_H
@@ -24,9 +24,14 @@ typedef struct TracingHandle TracingHandle;
 /// component. The handle must be freed to close the logging component.
 ///
 /// If log_path is NULL, logging is sent to standard output.
+///
+/// If trace_path is not NULL, the spans enabled by the filter are written to
+/// that file in the Chrome trace event format.
 TracingHandle* tracing_init(
     const codeunit* log_path,
     size_t log_path_len,
+    const codeunit* trace_path,
+    size_t trace_path_len,
     const char* initial_filter,
     bool log_timestamps);
 
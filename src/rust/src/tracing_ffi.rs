@@ -1,23 +1,28 @@
 use libc::c_char;
 use std::ffi::CStr;
+use std::fmt;
+use std::fs::File;
+use std::io::{self, Write};
 use std::path::Path;
 use std::slice;
 use std::str;
 use std::sync::atomic::{AtomicUsize, Ordering};
+use std::time::Instant;
 use tracing::{
     callsite::{Callsite, Identifier},
-    field::{FieldSet, Value},
+    field::{Field, FieldSet, Value, Visit},
     level_enabled,
     metadata::Kind,
-    span::Entered,
+    span::{self, Entered},
     subscriber::{Interest, Subscriber},
     Event, Metadata, Span,
 };
-use tracing_appender::non_blocking::WorkerGuard;
+use tracing_appender::non_blocking::{NonBlocking, WorkerGuard};
 use tracing_core::Once;
 use tracing_subscriber::{
     filter::EnvFilter,
-    layer::{Layer, SubscriberExt},
+    layer::{Context, Layer, SubscriberExt},
+    registry::LookupSpan,
     reload::{self, Handle},
     util::SubscriberInitExt,
 };
@@ -46,7 +51,158 @@ where
     }
 }
 
+static NEXT_THREAD_ID: AtomicUsize = AtomicUsize::new(1);
+
+thread_local! {
+    static THREAD_ID: usize = NEXT_THREAD_ID.fetch_add(1, Ordering::Relaxed);
+}
+
+fn json_escape(s: &str) -> String {
+    let mut escaped = String::with_capacity(s.len());
+    for c in s.chars() {
+        match c {
+            '"' => escaped.push_str("\\\""),
+            '\\' => escaped.push_str("\\\\"),
+            c if (c as u32) < 0x20 => escaped.push_str(&format!("\\u{:04x}", c as u32)),
+            c => escaped.push(c),
+        }
+    }
+    escaped
+}
+
+/// The fields of a span, as the members of a JSON object.
+struct ChromeTraceArgs(String);
+
+impl Visit for ChromeTraceArgs {
+    fn record_debug(&mut self, field: &Field, value: &dyn fmt::Debug) {
+        if !self.0.is_empty() {
+            self.0.push(',');
+        }
+        self.0.push_str(&format!(
+            "\"{}\":\"{}\"",
+            json_escape(field.name()),
+            json_escape(&format!("{:?}", value))
+        ));
+    }
+}
+
+/// Writes every enabled span that is entered and exited to a file in the
+/// Chrome trace event format, which chrome://tracing and Perfetto can load.
+///
+/// Events are handed to a background thread, and dropped rather than
+/// blocking the traced thread if it falls behind. The file is only a valid
+/// JSON array once it has been closed by dropping the `ChromeTraceFile`, but
+/// the viewers also accept a trace that ends early.
+struct ChromeTraceLayer {
+    writer: Option<NonBlocking>,
+    start: Instant,
+}
+
+impl ChromeTraceLayer {
+    fn write_event<S>(&self, id: &span::Id, ctx: Context<'_, S>, phase: &str)
+    where
+        S: Subscriber + for<'a> LookupSpan<'a>,
+    {
+        let writer = match &self.writer {
+            Some(writer) => writer,
+            None => return,
+        };
+        let span = match ctx.span(id) {
+            Some(span) => span,
+            None => return,
+        };
+
+        let ts = self.start.elapsed().as_micros();
+        let tid = THREAD_ID.with(|tid| *tid);
+        let meta = span.metadata();
+        let extensions = span.extensions();
+        let args = match extensions.get::<ChromeTraceArgs>() {
+            Some(args) if phase == "B" && !args.0.is_empty() => format!(",\"args\":{{{}}}", args.0),
+            _ => String::new(),
+        };
+        let event = format!(
+            ",\n{{\"name\":\"{}\",\"cat\":\"{}\",\"ph\":\"{}\",\"pid\":1,\"tid\":{},\"ts\":{}{}}}",
+            json_escape(meta.name()),
+            json_escape(meta.target()),
+            phase,
+            tid,
+            ts,
+            args
+        );
+        let _ = writer.clone().write_all(event.as_bytes());
+    }
+}
+
+impl<S> Layer<S> for ChromeTraceLayer
+where
+    S: Subscriber + for<'a> LookupSpan<'a>,
+{
+    fn new_span(&self, attrs: &span::Attributes<'_>, id: &span::Id, ctx: Context<'_, S>) {
+        if self.writer.is_none() {
+            return;
+        }
+        if let Some(span) = ctx.span(id) {
+            let mut args = ChromeTraceArgs(String::new());
+            attrs.record(&mut args);
+            span.extensions_mut().insert(args);
+        }
+    }
+
+    fn on_enter(&self, id: &span::Id, ctx: Context<'_, S>) {
+        self.write_event(id, ctx, "B");
+    }
+
+    fn on_exit(&self, id: &span::Id, ctx: Context<'_, S>) {
+        self.write_event(id, ctx, "E");
+    }
+}
+
+/// Closes the JSON array of a Chrome trace file, before the background
+/// thread is flushed and stopped.
+struct ChromeTraceFile {
+    writer: NonBlocking,
+    _guard: WorkerGuard,
+}
+
+impl Drop for ChromeTraceFile {
+    fn drop(&mut self) {
+        let _ = self.writer.write_all(b"\n]\n");
+    }
+}
+
+fn chrome_trace_init(trace_path: Option<&Path>) -> io::Result<(ChromeTraceLayer, Option<ChromeTraceFile>)> {
+    let start = Instant::now();
+    let trace_path = match trace_path {
+        Some(trace_path) => trace_path,
+        None => {
+            return Ok((
+                ChromeTraceLayer {
+                    writer: None,
+                    start,
+                },
+                None,
+            ))
+        }
+    };
+
+    let mut file = File::create(trace_path)?;
+    file.write_all(b"[{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"buckd\"}}")?;
+    let (writer, guard) = tracing_appender::non_blocking(file);
+
+    Ok((
+        ChromeTraceLayer {
+            writer: Some(writer.clone()),
+            start,
+        },
+        Some(ChromeTraceFile {
+            writer,
+            _guard: guard,
+        }),
+    ))
+}
+
 pub struct TracingHandle {
+    _trace_file: Option<ChromeTraceFile>,
     _file_guard: Option<WorkerGuard>,
     reload_handle: Box<dyn ReloadHandle>,
 }
@@ -56,6 +212,9 @@ pub extern "C" fn tracing_init(
     #[cfg(not(target_os = "windows"))] log_path: *const u8,
     #[cfg(target_os = "windows")] log_path: *const u16,
     log_path_len: usize,
+    #[cfg(not(target_os = "windows"))] trace_path: *const u8,
+    #[cfg(target_os = "windows")] trace_path: *const u16,
+    trace_path_len: usize,
     initial_filter: *const c_char,
     log_timestamps: bool,
 ) -> *mut TracingHandle {
@@ -75,8 +234,21 @@ pub extern "C" fn tracing_init(
     #[cfg(target_os = "windows")]
     let log_path = log_path.map(OsString::from_wide);
 
+    let trace_path = if trace_path.is_null() {
+        None
+    } else {
+        Some(unsafe { slice::from_raw_parts(trace_path, trace_path_len) })
+    };
+
+    #[cfg(not(target_os = "windows"))]
+    let trace_path = trace_path.map(OsStr::from_bytes);
+
+    #[cfg(target_os = "windows")]
+    let trace_path = trace_path.map(OsString::from_wide);
+
     tracing_init_inner(
         log_path.as_ref().map(Path::new),
+        trace_path.as_ref().map(Path::new),
         initial_filter,
         log_timestamps,
     )
@@ -84,6 +256,7 @@ pub extern "C" fn tracing_init(
 
 fn tracing_init_inner(
     log_path: Option<&Path>,
+    trace_path: Option<&Path>,
     initial_filter: &str,
     log_timestamps: bool,
 ) -> *mut TracingHandle {
@@ -108,12 +281,21 @@ fn tracing_init_inner(
     let stdout_logger = tracing_subscriber::fmt::layer().with_ansi(true);
     let filter = EnvFilter::from(initial_filter);
 
+    let (trace_layer, trace_file, trace_error) = match chrome_trace_init(trace_path) {
+        Ok((trace_layer, trace_file)) => (trace_layer, trace_file, None),
+        Err(e) => {
+            let (trace_layer, _) = chrome_trace_init(None).unwrap();
+            (trace_layer, None, Some(e))
+        }
+    };
+
     let reload_handle = match (file_logger, log_timestamps) {
         (None, true) => {
             let (filter, reload_handle) = reload::Layer::new(filter);
 
             tracing_subscriber::registry()
                 .with(stdout_logger)
+                .with(trace_layer)
                 .with(filter)
                 .init();
 
@@ -124,6 +306,7 @@ fn tracing_init_inner(
 
             tracing_subscriber::registry()
                 .with(stdout_logger.without_time())
+                .with(trace_layer)
                 .with(filter)
                 .init();
 
@@ -134,6 +317,7 @@ fn tracing_init_inner(
 
             tracing_subscriber::registry()
                 .with(file_logger)
+                .with(trace_layer)
                 .with(filter)
                 .init();
 
@@ -144,6 +328,7 @@ fn tracing_init_inner(
 
             tracing_subscriber::registry()
                 .with(file_logger.without_time())
+                .with(trace_layer)
                 .with(filter)
                 .init();
 
@@ -151,7 +336,16 @@ fn tracing_init_inner(
         }
     };
 
+    if let Some(e) = trace_error {
+        tracing::error!(
+            "Could not create trace file {}: {}",
+            trace_path.unwrap().display(),
+            e
+        );
+    }
+
     Box::into_raw(Box::new(TracingHandle {
+        _trace_file: trace_file,
         _file_guard: file_guard,
         reload_handle,
     }))
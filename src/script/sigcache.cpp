@@ -6,6 +6,7 @@
 #include "sigcache.h"
 
 #include "memusage.h"
+#include "metrics.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
@@ -92,16 +93,20 @@ public:
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
     static CSignatureCache signatureCache;
+    static MetricValue& hits = GetMetricCounter("buck_sigcache_lookups_total", "Signature verifications looked up in the signature cache.", "result=\"hit\"");
+    static MetricValue& misses = GetMetricCounter("buck_sigcache_lookups_total", "Signature verifications looked up in the signature cache.", "result=\"miss\"");
 
     uint256 entry;
     signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
 
     if (signatureCache.Get(entry)) {
+        hits.add();
         if (!store) {
             signatureCache.Erase(entry);
         }
         return true;
     }
+    misses.add();
 
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
@@ -7,11 +7,41 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <map>
+#include <memory>
+#include <mutex>
 #include <stdio.h>
 
 #include <boost/foreach.hpp>
 #include <boost/thread.hpp>
 
+static std::mutex cs_lockStats;
+
+static std::map<std::string, std::unique_ptr<CLockStats>>& LockStatsByName()
+{
+    // Never destroyed, as locks with static storage may outlive it otherwise
+    static std::map<std::string, std::unique_ptr<CLockStats>>* mapStats = new std::map<std::string, std::unique_ptr<CLockStats>>();
+    return *mapStats;
+}
+
+CLockStats& GetLockStats(const std::string& name)
+{
+    std::lock_guard<std::mutex> guard(cs_lockStats);
+    std::unique_ptr<CLockStats>& stats = LockStatsByName()[name];
+    if (!stats)
+        stats.reset(new CLockStats(name));
+    return *stats;
+}
+
+std::vector<const CLockStats*> GetAllLockStats()
+{
+    std::lock_guard<std::mutex> guard(cs_lockStats);
+    std::vector<const CLockStats*> vStats;
+    for (const auto& item : LockStatsByName())
+        vStats.push_back(item.second.get());
+    return vStats;
+}
+
 #ifdef DEBUG_LOCKCONTENTION
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 {
@@ -8,6 +8,13 @@
 
 #include "threadsafety.h"
 
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
@@ -80,6 +87,89 @@ typedef AnnotatedMixin<boost::recursive_mutex> CCriticalSection;
 /** Wrapped boost mutex: supports waiting but not recursive locking */
 typedef AnnotatedMixin<boost::mutex> CWaitableCriticalSection;
 
+/** How often, and for how long, a kind of lock was waited on and held */
+struct CLockStats
+{
+    std::string name;
+    //! Outermost acquisitions, and those that had to wait for another thread
+    std::atomic<uint64_t> nAcquired;
+    std::atomic<uint64_t> nContended;
+    std::atomic<uint64_t> nWaitMicros;
+    std::atomic<uint64_t> nHeldMicros;
+
+    explicit CLockStats(const std::string& nameIn) :
+        name(nameIn), nAcquired(0), nContended(0), nWaitMicros(0), nHeldMicros(0) {}
+};
+
+/** Return the statistics for locks named name, creating them on first use. */
+CLockStats& GetLockStats(const std::string& name);
+/** Return the statistics for all instrumented locks. */
+std::vector<const CLockStats*> GetAllLockStats();
+
+/**
+ * Recursive mutex that records its wait and hold times in the CLockStats of
+ * its name. All locks constructed with the same name share their stats. Only
+ * contended acquisitions and outermost acquire/release pairs read the clock.
+ *
+ * It wraps rather than derives from CCriticalSection, so that code cannot
+ * lock it through the base type and bypass the stats; functions that take
+ * such a lock have to take this type.
+ */
+class LOCKABLE CInstrumentedCriticalSection
+{
+private:
+    CCriticalSection cs;
+    CLockStats& stats;
+    //! Recursion depth and start of the outermost hold, guarded by this lock
+    int nDepth;
+    int64_t nLockedSince;
+
+    static int64_t NowMicros()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void Acquired()
+    {
+        if (nDepth++ == 0) {
+            nLockedSince = NowMicros();
+            stats.nAcquired.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+public:
+    explicit CInstrumentedCriticalSection(const std::string& name) :
+        stats(GetLockStats(name)), nDepth(0), nLockedSince(0) {}
+
+    void lock() EXCLUSIVE_LOCK_FUNCTION()
+    {
+        if (!cs.try_lock()) {
+            int64_t nStart = NowMicros();
+            cs.lock();
+            stats.nContended.fetch_add(1, std::memory_order_relaxed);
+            stats.nWaitMicros.fetch_add(NowMicros() - nStart, std::memory_order_relaxed);
+        }
+        Acquired();
+    }
+
+    void unlock() UNLOCK_FUNCTION()
+    {
+        if (--nDepth == 0) {
+            stats.nHeldMicros.fetch_add(NowMicros() - nLockedSince, std::memory_order_relaxed);
+        }
+        cs.unlock();
+    }
+
+    bool try_lock() EXCLUSIVE_TRYLOCK_FUNCTION(true)
+    {
+        if (!cs.try_lock())
+            return false;
+        Acquired();
+        return true;
+    }
+};
+
 /** Just a typedef for boost::condition_variable, can be wrapped later if desired */
 typedef boost::condition_variable CConditionVariable;
 
@@ -162,9 +252,33 @@ public:
 
 typedef CMutexLock<CCriticalSection> CCriticalBlock;
 
-#define LOCK(cs) CCriticalBlock criticalblock(cs, #cs, __FILE__, __LINE__)
-#define LOCK2(cs1, cs2) CCriticalBlock criticalblock1(cs1, #cs1, __FILE__, __LINE__), criticalblock2(cs2, #cs2, __FILE__, __LINE__)
-#define TRY_LOCK(cs, name) CCriticalBlock name(cs, #cs, __FILE__, __LINE__, true)
+/** Lock type for a LOCK argument, so that instrumented locks keep their own lock() and unlock() */
+template <typename MutexArg>
+using CCriticalBlockFor = CMutexLock<typename std::remove_reference<typename std::remove_pointer<MutexArg>::type>::type>;
+
+/** Two locks taken in order and released in reverse, declared as one object for LOCK2 */
+template <typename Mutex1, typename Mutex2>
+class SCOPED_LOCKABLE CMutexLock2
+{
+private:
+    CMutexLock<Mutex1> lock1;
+    CMutexLock<Mutex2> lock2;
+
+public:
+    template <typename Arg1, typename Arg2>
+    CMutexLock2(Arg1&& arg1, const char* pszName1, Arg2&& arg2, const char* pszName2, const char* pszFile, int nLine) :
+        lock1(arg1, pszName1, pszFile, nLine), lock2(arg2, pszName2, pszFile, nLine)
+    {
+    }
+};
+
+template <typename MutexArg1, typename MutexArg2>
+using CCriticalBlock2For = CMutexLock2<typename std::remove_reference<typename std::remove_pointer<MutexArg1>::type>::type,
+                                       typename std::remove_reference<typename std::remove_pointer<MutexArg2>::type>::type>;
+
+#define LOCK(cs) CCriticalBlockFor<decltype(cs)> criticalblock(cs, #cs, __FILE__, __LINE__)
+#define LOCK2(cs1, cs2) CCriticalBlock2For<decltype(cs1), decltype(cs2)> criticalblock2(cs1, #cs1, cs2, #cs2, __FILE__, __LINE__)
+#define TRY_LOCK(cs, name) CCriticalBlockFor<decltype(cs)> name(cs, #cs, __FILE__, __LINE__, true)
 
 #define ENTER_CRITICAL_SECTION(cs)                            \
     {                                                         \
@@ -416,7 +416,7 @@ static bool falseFunc(const CChainParams&) { return false; }
 void PartitionAlertTestImpl(const Consensus::Params& params, int startTime, int expectedTotal, int expectedSlow, int expectedFast)
 {
     // Test PartitionCheck
-    CCriticalSection csDummy;
+    CInstrumentedCriticalSection csDummy("csDummy");
     CBlockIndex indexDummy[800];
 
     // Generate fake blockchain timestamps relative to
@@ -411,4 +411,118 @@ BOOST_AUTO_TEST_CASE(rpc_insightexplorer)
     fTimestampIndex = false;
 }
 
+BOOST_AUTO_TEST_CASE(rpc_batch)
+{
+    if (RPCIsInWarmup(NULL))
+        SetRPCWarmupFinished();
+
+    // Read-only calls run concurrently, the others on their own, and the
+    // replies come back in request order.
+    UniValue batch(UniValue::VARR);
+    for (int i = 0; i < 20; i++) {
+        UniValue req(UniValue::VOBJ);
+        req.pushKV("id", i);
+        if (i == 5) {
+            req.pushKV("method", "nosuchmethod");
+        } else if (i == 10) {
+            req.pushKV("params", "notanarray");
+            req.pushKV("method", "decodescript");
+        } else {
+            UniValue params(UniValue::VARR);
+            params.push_back("51");
+            req.pushKV("method", i % 2 ? "decodescript" : "getblockcount");
+            req.pushKV("params", i % 2 ? params : UniValue(UniValue::VARR));
+        }
+        batch.push_back(req);
+    }
+
+    UniValue replies;
+    BOOST_CHECK(replies.read(JSONRPCExecBatch(batch)));
+    BOOST_CHECK(replies.isArray());
+    BOOST_CHECK_EQUAL(replies.size(), 20);
+    for (int i = 0; i < 20; i++) {
+        const UniValue& reply = replies[i];
+        BOOST_CHECK_EQUAL(find_value(reply, "id").get_int(), i);
+        if (i == 5) {
+            BOOST_CHECK_EQUAL(find_value(find_value(reply, "error"), "code").get_int(), RPC_METHOD_NOT_FOUND);
+        } else if (i == 10) {
+            BOOST_CHECK_EQUAL(find_value(find_value(reply, "error"), "code").get_int(), RPC_INVALID_REQUEST);
+        } else {
+            BOOST_CHECK(find_value(reply, "error").isNull());
+            BOOST_CHECK(!find_value(reply, "result").isNull());
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(rpc_write_reply)
+{
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("str", "quote\" backslash\\ newline\n");
+    result.pushKV("num", 1.5);
+    result.pushKV("bool", true);
+    result.pushKV("null", NullUniValue);
+    UniValue arr(UniValue::VARR);
+    for (int i = 0; i < 100; i++) {
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("txid", uint256S(strprintf("%x", i)).GetHex());
+        entry.pushKV("empty", UniValue(UniValue::VARR));
+        arr.push_back(entry);
+    }
+    result.pushKV("arr", arr);
+
+    std::vector<UniValue> ids = {NullUniValue, UniValue(7), UniValue("id")};
+    for (const UniValue& id : ids) {
+        for (size_t nChunkSize : {1, 100, 1 << 16}) {
+            std::string strReply;
+            size_t nPieces = 0;
+            JSONRPCWriteReply(result, id, [&](const std::string& strData) {
+                strReply += strData;
+                nPieces++;
+            }, nChunkSize);
+            BOOST_CHECK_EQUAL(strReply, JSONRPCReply(result, NullUniValue, id));
+            BOOST_CHECK(nChunkSize > 1000 ? nPieces == 1 : nPieces > 1);
+        }
+    }
+
+    // Scalar result
+    std::string strReply;
+    JSONRPCWriteReply(UniValue(42), UniValue(1), [&](const std::string& strData) {
+        strReply += strData;
+    });
+    BOOST_CHECK_EQUAL(strReply, JSONRPCReply(UniValue(42), NullUniValue, UniValue(1)));
+}
+
+BOOST_AUTO_TEST_CASE(rpc_metrics)
+{
+    if (RPCIsInWarmup(NULL))
+        SetRPCWarmupFinished();
+
+    CRPCMethodStats before = GetRPCMethodStats()["getblockcount"];
+    CallRPC("getblockcount");
+    BOOST_CHECK_THROW(CallRPC("getblockcount extra"), runtime_error);
+    {
+        LOCK(cs_main);
+    }
+
+    CRPCMethodStats after = GetRPCMethodStats()["getblockcount"];
+    BOOST_CHECK_EQUAL(after.nCalls, before.nCalls + 2);
+    BOOST_CHECK_EQUAL(after.nErrors, before.nErrors + 1);
+    uint64_t nBucketed = 0;
+    for (uint64_t n : after.vBuckets)
+        nBucketed += n;
+    BOOST_CHECK_EQUAL(nBucketed, after.nCalls);
+
+    UniValue r = CallRPC("getrpcmetrics");
+    UniValue method = find_value(find_value(r.get_obj(), "methods").get_obj(), "getblockcount");
+    BOOST_CHECK_EQUAL(find_value(method.get_obj(), "calls").get_int64(), (int64_t)after.nCalls);
+    BOOST_CHECK_EQUAL(find_value(method.get_obj(), "histogram").size(), RPC_LATENCY_BUCKET_COUNT);
+    UniValue lock = find_value(find_value(r.get_obj(), "locks").get_obj(), "cs_main");
+    BOOST_CHECK(find_value(lock.get_obj(), "acquired").get_int64() > 0);
+
+    std::string strMetrics = RPCMetricsToPrometheus();
+    BOOST_CHECK(strMetrics.find("# TYPE buck_rpc_duration_seconds histogram\n") != std::string::npos);
+    BOOST_CHECK(strMetrics.find(strprintf("buck_rpc_duration_seconds_bucket{method=\"getblockcount\",le=\"+Inf\"} %d\n", after.nCalls)) != std::string::npos);
+    BOOST_CHECK(strMetrics.find("buck_lock_acquisitions_total{lock=\"cs_main\"}") != std::string::npos);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -100,4 +100,45 @@ BOOST_AUTO_TEST_CASE(getlocator_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(chainsnapshot_test)
+{
+    // Build a main chain and a branch that splits off at block 499.
+    std::vector<CBlockIndex> vBlocksMain(1000);
+    for (unsigned int i=0; i<vBlocksMain.size(); i++) {
+        vBlocksMain[i].nHeight = i;
+        vBlocksMain[i].pprev = i ? &vBlocksMain[i - 1] : NULL;
+        vBlocksMain[i].BuildSkip();
+    }
+    std::vector<CBlockIndex> vBlocksSide(100);
+    for (unsigned int i=0; i<vBlocksSide.size(); i++) {
+        vBlocksSide[i].nHeight = i + 500;
+        vBlocksSide[i].pprev = i ? &vBlocksSide[i - 1] : &vBlocksMain[499];
+        vBlocksSide[i].BuildSkip();
+    }
+
+    CChain chain;
+    chain.SetTip(&vBlocksMain.back());
+    CChainSnapshot snapshot(&vBlocksMain.back());
+
+    BOOST_CHECK_EQUAL(snapshot.Height(), chain.Height());
+    BOOST_CHECK(snapshot.Tip() == chain.Tip());
+    BOOST_CHECK(snapshot[-1] == NULL);
+    BOOST_CHECK(snapshot[chain.Height() + 1] == NULL);
+    for (int i=0; i < 1000; i++) {
+        int nHeight = insecure_rand() % vBlocksMain.size();
+        BOOST_CHECK(snapshot[nHeight] == chain[nHeight]);
+        BOOST_CHECK(snapshot.Contains(&vBlocksMain[nHeight]));
+        BOOST_CHECK(snapshot.Next(&vBlocksMain[nHeight]) == chain.Next(&vBlocksMain[nHeight]));
+    }
+    for (const CBlockIndex& index : vBlocksSide) {
+        BOOST_CHECK(!snapshot.Contains(&index));
+        BOOST_CHECK(snapshot.Next(&index) == NULL);
+    }
+
+    CChainSnapshot empty(NULL);
+    BOOST_CHECK_EQUAL(empty.Height(), -1);
+    BOOST_CHECK(empty[0] == NULL);
+    BOOST_CHECK(!empty.Contains(&vBlocksMain[0]));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
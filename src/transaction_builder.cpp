@@ -102,7 +102,7 @@ TransactionBuilder::TransactionBuilder(
     int nHeight,
     CKeyStore* keystore,
     CCoinsViewCache* coinsView,
-    CCriticalSection* cs_coinsView) :
+    CInstrumentedCriticalSection* cs_coinsView) :
     consensusParams(consensusParams),
     nHeight(nHeight),
     keystore(keystore),
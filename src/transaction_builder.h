@@ -79,7 +79,7 @@ private:
     int nHeight;
     const CKeyStore* keystore;
     const CCoinsViewCache* coinsView;
-    CCriticalSection* cs_coinsView;
+    CInstrumentedCriticalSection* cs_coinsView;
     CMutableTransaction mtx;
     CAmount fee = 10000;
 
@@ -100,7 +100,7 @@ public:
         int nHeight,
         CKeyStore* keyStore = nullptr,
         CCoinsViewCache* coinsView = nullptr,
-        CCriticalSection* cs_coinsView = nullptr);
+        CInstrumentedCriticalSection* cs_coinsView = nullptr);
 
     void SetExpiryHeight(uint32_t nExpiryHeight);
 
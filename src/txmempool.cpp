@@ -9,6 +9,7 @@
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
 #include "main.h"
+#include "metrics.h"
 #include "policy/fees.h"
 #include "streams.h"
 #include "timedata.h"
@@ -234,7 +235,21 @@ void CTxMemPool::removeSpentIndex(const uint256 txhash)
 }
 // END insightexplorer
 
-void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& removed, bool fRecursive)
+std::string RemovalReasonToString(MemPoolRemovalReason reason)
+{
+    switch (reason) {
+        case MemPoolRemovalReason::EXPIRY: return "expiry";
+        case MemPoolRemovalReason::SIZELIMIT: return "sizelimit";
+        case MemPoolRemovalReason::REORG: return "reorg";
+        case MemPoolRemovalReason::BLOCK: return "block";
+        case MemPoolRemovalReason::CONFLICT: return "conflict";
+        case MemPoolRemovalReason::BRANCHID: return "branchid";
+        default: return "unknown";
+    }
+}
+
+void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& removed, bool fRecursive,
+                        MemPoolRemovalReason reason)
 {
     // Remove transaction from memory pool
     {
@@ -280,6 +295,7 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
                 mapSaplingNullifiers.erase(spendDescription.nullifier);
             }
             removed.push_back(tx);
+            GetMainSignals().TransactionRemovedFromMempool(tx, reason);
             totalTxSize -= mapTx.find(hash)->GetTxSize();
             cachedInnerUsage -= mapTx.find(hash)->DynamicMemoryUsage();
             mapTx.erase(hash);
@@ -323,7 +339,7 @@ void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMem
     }
     BOOST_FOREACH(const CTransaction& tx, transactionsToRemove) {
         list<CTransaction> removed;
-        remove(tx, removed, true);
+        remove(tx, removed, true, MemPoolRemovalReason::REORG);
     }
 }
 
@@ -364,7 +380,7 @@ void CTxMemPool::removeWithAnchor(const uint256 &invalidRoot, ShieldedType type)
 
     BOOST_FOREACH(const CTransaction& tx, transactionsToRemove) {
         list<CTransaction> removed;
-        remove(tx, removed, true);
+        remove(tx, removed, true, MemPoolRemovalReason::REORG);
     }
 }
 
@@ -379,7 +395,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
             const CTransaction &txConflict = *it->second.ptx;
             if (txConflict != tx)
             {
-                remove(txConflict, removed, true);
+                remove(txConflict, removed, true, MemPoolRemovalReason::CONFLICT);
             }
         }
     }
@@ -390,7 +406,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
             if (it != mapSproutNullifiers.end()) {
                 const CTransaction &txConflict = *it->second;
                 if (txConflict != tx) {
-                    remove(txConflict, removed, true);
+                    remove(txConflict, removed, true, MemPoolRemovalReason::CONFLICT);
                 }
             }
         }
@@ -400,7 +416,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
         if (it != mapSaplingNullifiers.end()) {
             const CTransaction &txConflict = *it->second;
             if (txConflict != tx) {
-                remove(txConflict, removed, true);
+                remove(txConflict, removed, true, MemPoolRemovalReason::CONFLICT);
             }
         }
     }
@@ -421,7 +437,7 @@ std::vector<uint256> CTxMemPool::removeExpired(unsigned int nBlockHeight)
     std::vector<uint256> ids;
     for (const CTransaction& tx : transactionsToRemove) {
         list<CTransaction> removed;
-        remove(tx, removed, true);
+        remove(tx, removed, true, MemPoolRemovalReason::EXPIRY);
         ids.push_back(tx.GetHash());
         LogPrint("mempool", "Removing expired txid: %s\n", tx.GetHash().ToString());
     }
@@ -447,7 +463,7 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
     BOOST_FOREACH(const CTransaction& tx, vtx)
     {
         std::list<CTransaction> dummy;
-        remove(tx, dummy, false);
+        remove(tx, dummy, false, MemPoolRemovalReason::BLOCK);
         removeConflicts(tx, conflicts);
         ClearPrioritisation(tx.GetHash());
     }
@@ -473,7 +489,7 @@ void CTxMemPool::removeWithoutBranchId(uint32_t nMemPoolBranchId)
 
     for (const CTransaction& tx : transactionsToRemove) {
         std::list<CTransaction> removed;
-        remove(tx, removed, true);
+        remove(tx, removed, true, MemPoolRemovalReason::BRANCHID);
     }
 }
 
@@ -839,11 +855,14 @@ bool CTxMemPool::IsRecentlyEvicted(const uint256& txId) {
 
 void CTxMemPool::EnsureSizeLimit() {
     AssertLockHeld(cs);
+    static MetricValue& evictions = GetMetricCounter("buck_mempool_evictions_total",
+        "Transactions evicted from the mempool to keep it within -mempooltxcostlimit.");
     boost::optional<uint256> maybeDropTxId;
     while ((maybeDropTxId = weightedTxTree->maybeDropRandom()).is_initialized()) {
         uint256 txId = maybeDropTxId.get();
         recentlyEvicted->add(txId);
+        evictions.add();
         std::list<CTransaction> removed;
-        remove(mapTx.find(txId)->GetTx(), removed, true);
+        remove(mapTx.find(txId)->GetTx(), removed, true, MemPoolRemovalReason::SIZELIMIT);
     }
 }
@@ -101,6 +101,19 @@ public:
 
 class CBlockPolicyEstimator;
 
+/** Reason why a transaction was removed from the mempool */
+enum class MemPoolRemovalReason {
+    UNKNOWN,    //!< Removed for an unspecified reason
+    EXPIRY,     //!< Reached its expiry height
+    SIZELIMIT,  //!< Evicted to keep the mempool within its cost limit
+    REORG,      //!< No longer valid after a block was disconnected
+    BLOCK,      //!< Included in a block
+    CONFLICT,   //!< Conflicts with a transaction in a block
+    BRANCHID,   //!< Does not commit to the consensus branch of the next block
+};
+
+std::string RemovalReasonToString(MemPoolRemovalReason reason);
+
 /** An inpoint - a combination of a transaction and an index n into its vin */
 class CInPoint
 {
@@ -160,7 +173,7 @@ public:
         >
     > indexed_transaction_set;
 
-    mutable CCriticalSection cs;
+    mutable CInstrumentedCriticalSection cs{"mempool.cs"};
     indexed_transaction_set mapTx;
 
 private:
@@ -199,7 +212,8 @@ public:
     void removeSpentIndex(const uint256 txhash);
     // END insightexplorer
 
-    void remove(const CTransaction &tx, std::list<CTransaction>& removed, bool fRecursive = false);
+    void remove(const CTransaction &tx, std::list<CTransaction>& removed, bool fRecursive = false,
+                MemPoolRemovalReason reason = MemPoolRemovalReason::UNKNOWN);
     void removeWithAnchor(const uint256 &invalidRoot, ShieldedType type);
     void removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight, int flags);
     void removeConflicts(const CTransaction &tx, std::list<CTransaction>& removed);
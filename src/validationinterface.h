@@ -20,6 +20,7 @@ class CTransaction;
 class CValidationInterface;
 class CValidationState;
 class uint256;
+enum class MemPoolRemovalReason;
 
 // These functions dispatch to one or all registered wallets
 
@@ -34,6 +35,7 @@ class CValidationInterface {
 protected:
     virtual void UpdatedBlockTip(const CBlockIndex *pindex) {}
     virtual void SyncTransaction(const CTransaction &tx, const CBlock *pblock, const int nHeight) {}
+    virtual void TransactionRemovedFromMempool(const CTransaction &tx, MemPoolRemovalReason reason) {}
     virtual void EraseFromWallet(const uint256 &hash) {}
     virtual void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, boost::optional<std::pair<SproutMerkleTree, SaplingMerkleTree>> added) {}
     virtual void UpdatedTransaction(const uint256 &hash) {}
@@ -52,6 +54,8 @@ struct CMainSignals {
     boost::signals2::signal<void (const CBlockIndex *)> UpdatedBlockTip;
     /** Notifies listeners of updated transaction data (transaction, and optionally the block it is found in. */
     boost::signals2::signal<void (const CTransaction &, const CBlock *, const int nHeight)> SyncTransaction;
+    /** Notifies listeners of a transaction leaving the mempool, with mempool.cs held. */
+    boost::signals2::signal<void (const CTransaction &, MemPoolRemovalReason)> TransactionRemovedFromMempool;
     /** Notifies listeners of an erased transaction (currently disabled, requires transaction replacement). */
     boost::signals2::signal<void (const uint256 &)> EraseTransaction;
     /** Notifies listeners of an updated transaction without new data (for now: a coinbase potentially becoming visible). */
@@ -0,0 +1,431 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "asyncrpcoperation_consolidate.h"
+
+#include "asyncrpcoperation_common.h"
+#include "asyncrpcqueue.h"
+#include "chainparams.h"
+#include "init.h"
+#include "key_io.h"
+#include "main.h"
+#include "rpc/protocol.h"
+#include "rpc/server.h"
+#include "transaction_builder.h"
+#include "util.h"
+#include "utilmoneystr.h"
+#include "wallet.h"
+
+#include <atomic>
+#include <set>
+#include <thread>
+
+using namespace libzcash;
+
+static std::mutex cs_consolidations;
+static CScheduler* pConsolidationScheduler = NULL;
+
+void CheckConsolidation(AsyncRPCOperationId id);
+
+std::vector<std::vector<size_t>> SplitIntoGroups(size_t nItems, size_t nGroups)
+{
+    std::vector<std::vector<size_t>> groups(nGroups);
+    for (size_t i = 0; i < nItems; i++) {
+        groups[i % nGroups].push_back(i);
+    }
+    return groups;
+}
+
+std::vector<size_t> PlanConsolidation(std::vector<CAmount> vValues, size_t nNotesPerTx, CAmount fee)
+{
+    std::vector<size_t> plan;
+    if (nNotesPerTx < 2) {
+        return plan;
+    }
+    while (vValues.size() > 1) {
+        size_t nTxs = (vValues.size() + nNotesPerTx - 1) / nNotesPerTx;
+        std::vector<CAmount> vOutputs;
+        for (const std::vector<size_t>& group : SplitIntoGroups(vValues.size(), nTxs)) {
+            CAmount total = 0;
+            for (size_t i : group) {
+                total += vValues[i];
+            }
+            if (total <= fee) {
+                return std::vector<size_t>();
+            }
+            vOutputs.push_back(total - fee);
+        }
+        plan.push_back(nTxs);
+        vValues = vOutputs;
+    }
+    return plan;
+}
+
+AsyncRPCOperation_consolidate::AsyncRPCOperation_consolidate(
+        std::vector<ConsolidationInput> inputs,
+        SaplingPaymentAddress toAddress,
+        std::vector<size_t> plan,
+        CAmount fee,
+        UniValue contextInfo) :
+        contextinfo_(contextInfo), inputs_(inputs), toaddress_(toAddress), plan_(plan), fee_(fee),
+        nLevel_(0), nBuilt_(0)
+{
+    if (plan_.empty()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Empty consolidation plan");
+    }
+
+    // Lock the notes so that other operations do not spend them
+    for (const ConsolidationInput& input : inputs_) {
+        lock_note(input.op);
+    }
+
+    LogPrint("zrpc", "%s: z_consolidatenotes initialized (notes=%d, levels=%d)\n", getId(), inputs_.size(), plan_.size());
+}
+
+AsyncRPCOperation_consolidate::~AsyncRPCOperation_consolidate() {
+}
+
+void AsyncRPCOperation_consolidate::main() {
+    if (isCancelled()) {
+        unlock_notes(); // clean up
+        return;
+    }
+
+    // The operation is queued again for each level after the first
+    if (isReady()) {
+        set_state(OperationStatus::EXECUTING);
+        start_execution_clock();
+    }
+
+    bool success = false;
+
+    try {
+        if (!main_impl()) {
+            // Waiting for the level to be mined
+            return;
+        }
+        success = true;
+    } catch (const UniValue& objError) {
+        int code = find_value(objError, "code").get_int();
+        std::string message = find_value(objError, "message").get_str();
+        set_error_code(code);
+        set_error_message(message);
+    } catch (const std::runtime_error& e) {
+        set_error_code(-1);
+        set_error_message("runtime error: " + std::string(e.what()));
+    } catch (const std::logic_error& e) {
+        set_error_code(-1);
+        set_error_message("logic error: " + std::string(e.what()));
+    } catch (const std::exception& e) {
+        set_error_code(-1);
+        set_error_message("general exception: " + std::string(e.what()));
+    } catch (...) {
+        set_error_code(-2);
+        set_error_message("unknown error");
+    }
+
+    stop_execution_clock();
+
+    unlock_notes(); // clean up
+
+    if (success) {
+        set_state(OperationStatus::SUCCESS);
+    } else {
+        set_state(OperationStatus::FAILED);
+    }
+
+    std::string s = strprintf("%s: z_consolidatenotes finished (status=%s", getId(), getStateAsString());
+    if (success) {
+        s += strprintf(", transactions=%d)\n", vTxids_.size());
+    } else {
+        s += strprintf(", error=%s)\n", getErrorMessage());
+    }
+    LogPrintf("%s", s);
+}
+
+/**
+ * Run the next level of the consolidation, and return whether the
+ * operation has finished. Otherwise it is queued again once the level has
+ * been mined.
+ */
+bool AsyncRPCOperation_consolidate::main_impl() {
+    std::vector<ConsolidationInput> outputs;
+    bool fMined = vPending_.empty() || get_outputs(outputs);
+    if (fMined && !vPending_.empty()) {
+        next_level(outputs);
+    }
+
+    if (!fMined || !run_level()) {
+        if (!schedule_check()) {
+            throw JSONRPCError(RPC_WALLET_ERROR, "Shutting down before the merge transactions were mined");
+        }
+        return false;
+    }
+
+    UniValue txids(UniValue::VARR);
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        for (const uint256& txid : vTxids_) {
+            txids.push_back(txid.GetHex());
+        }
+    }
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("txids", txids);
+    set_result(result);
+    return true;
+}
+
+/**
+ * Build and send the merge transactions of the current level. Returns
+ * whether that was the last level.
+ */
+bool AsyncRPCOperation_consolidate::run_level() {
+    size_t nLevel;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        nLevel = nLevel_;
+    }
+    if (inputs_.size() < 2 || plan_[nLevel] > inputs_.size()) {
+        throw JSONRPCError(RPC_WALLET_ERROR, strprintf("Level %d has %d notes to merge, which does not match the plan", nLevel, inputs_.size()));
+    }
+
+    std::vector<CTransaction> txs = build_level(inputs_, SplitIntoGroups(inputs_.size(), plan_[nLevel]));
+
+    // Send in plan order, so that the outputs of the next level are too
+    for (CTransaction& tx : txs) {
+        SendTransaction(tx, boost::none, testmode);
+        vPending_.push_back(tx.GetHash());
+        lock_note(SaplingOutPoint(tx.GetHash(), 0));
+        std::lock_guard<std::mutex> guard(lock_);
+        vTxids_.push_back(tx.GetHash());
+    }
+    LogPrint("zrpc", "%s: sent %d merge transactions at level %d\n", getId(), vPending_.size(), nLevel);
+
+    return testmode || nLevel + 1 == plan_.size();
+}
+
+/**
+ * Build the merge transactions of one level on a thread per core. The
+ * Groth16 prover already uses several threads for each proof, but the
+ * proofs of small transactions and the rest of the work do not fill them.
+ */
+std::vector<CTransaction> AsyncRPCOperation_consolidate::build_level(
+    const std::vector<ConsolidationInput>& inputs,
+    const std::vector<std::vector<size_t>>& groups)
+{
+    std::vector<SaplingOutPoint> ops;
+    for (const ConsolidationInput& input : inputs) {
+        ops.push_back(input.op);
+    }
+    uint256 anchor;
+    std::vector<boost::optional<SaplingWitness>> witnesses;
+    int nHeight;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        pwalletMain->GetSaplingNoteWitnesses(ops, witnesses, anchor);
+        nHeight = chainActive.Height() + 1;
+    }
+    for (size_t i = 0; i < witnesses.size(); i++) {
+        if (!witnesses[i]) {
+            throw JSONRPCError(RPC_WALLET_ERROR, "Missing witness for Sapling note");
+        }
+    }
+
+    std::vector<CTransaction> txs(groups.size());
+    std::vector<std::string> errors(groups.size());
+    std::atomic<size_t> nNext(0);
+    auto worker = [&]() {
+        size_t i;
+        while ((i = nNext++) < groups.size()) {
+            try {
+                txs[i] = build_merge(inputs, groups[i], witnesses, anchor, nHeight);
+            } catch (const UniValue& objError) {
+                errors[i] = find_value(objError, "message").get_str();
+            } catch (const std::exception& e) {
+                errors[i] = e.what();
+            }
+            std::lock_guard<std::mutex> guard(lock_);
+            nBuilt_++;
+        }
+    };
+    size_t nThreads = std::min(groups.size(), (size_t)std::max(GetNumCores(), 1));
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < nThreads; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& t : threads) {
+        t.join();
+    }
+
+    for (const std::string& strError : errors) {
+        if (!strError.empty()) {
+            throw JSONRPCError(RPC_WALLET_ERROR, "Failed to build merge transaction: " + strError);
+        }
+    }
+    return txs;
+}
+
+CTransaction AsyncRPCOperation_consolidate::build_merge(
+    const std::vector<ConsolidationInput>& inputs,
+    const std::vector<size_t>& group,
+    const std::vector<boost::optional<SaplingWitness>>& witnesses,
+    const uint256& anchor,
+    int nHeight)
+{
+    TransactionBuilder builder(Params().GetConsensus(), nHeight, pwalletMain);
+    builder.SetFee(fee_);
+    CAmount total = 0;
+    for (size_t i : group) {
+        builder.AddSaplingSpend(inputs[i].expsk, inputs[i].note, anchor, witnesses[i].get());
+        total += inputs[i].note.value();
+    }
+    // The only output, so it is always at index 0
+    uint256 ovk = inputs[group[0]].expsk.full_viewing_key().ovk;
+    builder.AddSaplingOutput(ovk, toaddress_, total - fee_);
+    return builder.Build().GetTxOrThrow();
+}
+
+/**
+ * Get the outputs of the merge transactions of the current level, in the
+ * order they were sent, if all of them have been mined. Fails if one of
+ * them left the mempool without being mined, for example because it
+ * expired.
+ */
+bool AsyncRPCOperation_consolidate::get_outputs(std::vector<ConsolidationInput>& outputs) {
+    std::set<libzcash::PaymentAddress> addresses = {toaddress_};
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    for (const uint256& txid : vPending_) {
+        auto it = pwalletMain->mapWallet.find(txid);
+        if (it == pwalletMain->mapWallet.end() || it->second.GetDepthInMainChain() < 0) {
+            throw JSONRPCError(RPC_WALLET_ERROR, strprintf("Merge transaction %s was not mined", txid.GetHex()));
+        }
+    }
+
+    // Our own planned outputs are locked, so include locked notes
+    std::vector<SproutNoteEntry> sproutEntries;
+    std::vector<SaplingNoteEntry> saplingEntries;
+    pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, addresses, 1, INT_MAX, true, true, false);
+    std::map<uint256, SaplingNoteEntry> mapFound;
+    for (const SaplingNoteEntry& entry : saplingEntries) {
+        if (entry.op.n == 0) {
+            mapFound.insert(std::make_pair(entry.op.hash, entry));
+        }
+    }
+
+    outputs.clear();
+    for (const uint256& txid : vPending_) {
+        auto it = mapFound.find(txid);
+        if (it == mapFound.end()) {
+            return false;
+        }
+        libzcash::SaplingExtendedSpendingKey extsk;
+        if (!pwalletMain->GetSaplingExtendedSpendingKey(toaddress_, extsk)) {
+            throw JSONRPCError(RPC_WALLET_ERROR, "Could not find spending key for the destination address");
+        }
+        outputs.push_back(ConsolidationInput{it->second.op, it->second.note, extsk.expsk});
+    }
+    return true;
+}
+
+/** Move on to the next level, which merges the outputs of the current one. */
+void AsyncRPCOperation_consolidate::next_level(const std::vector<ConsolidationInput>& outputs) {
+    if (outputs.size() != vPending_.size()) {
+        throw JSONRPCError(RPC_WALLET_ERROR, strprintf("Found %d outputs of %d merge transactions", outputs.size(), vPending_.size()));
+    }
+    inputs_ = outputs;
+    vPending_.clear();
+    std::lock_guard<std::mutex> guard(lock_);
+    nLevel_++;
+}
+
+/**
+ * Whether the operation can go on: the current level has been mined, or
+ * one of its transactions failed, which main() then reports.
+ */
+bool AsyncRPCOperation_consolidate::level_mined() {
+    std::vector<ConsolidationInput> outputs;
+    try {
+        return get_outputs(outputs);
+    } catch (const UniValue& objError) {
+        return true;
+    }
+}
+
+/** Have the scheduler check the current level, unless it has been stopped. */
+bool AsyncRPCOperation_consolidate::schedule_check() {
+    std::lock_guard<std::mutex> guard(cs_consolidations);
+    if (!pConsolidationScheduler) {
+        return false;
+    }
+    pConsolidationScheduler->scheduleFromNow(std::bind(&CheckConsolidation, getId()), CONSOLIDATE_CHECK_INTERVAL);
+    return true;
+}
+
+void CheckConsolidation(AsyncRPCOperationId id)
+{
+    std::shared_ptr<AsyncRPCOperation_consolidate> operation =
+        std::dynamic_pointer_cast<AsyncRPCOperation_consolidate>(getAsyncRPCQueue()->getOperationForId(id));
+    if (!operation) {
+        return;
+    }
+    // If the scheduler has stopped, main() fails the operation
+    if (operation->level_mined() || !operation->schedule_check()) {
+        getAsyncRPCQueue()->queueOperation(id);
+    }
+}
+
+void StartConsolidations(CScheduler& scheduler)
+{
+    std::lock_guard<std::mutex> guard(cs_consolidations);
+    pConsolidationScheduler = &scheduler;
+}
+
+void StopConsolidations()
+{
+    std::lock_guard<std::mutex> guard(cs_consolidations);
+    pConsolidationScheduler = NULL;
+}
+
+void AsyncRPCOperation_consolidate::lock_note(const SaplingOutPoint& op) {
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    pwalletMain->LockNote(op);
+    vLocked_.push_back(op);
+}
+
+void AsyncRPCOperation_consolidate::unlock_notes() {
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    for (const SaplingOutPoint& op : vLocked_) {
+        pwalletMain->UnlockNote(op);
+    }
+    vLocked_.clear();
+}
+
+/**
+ * Override getStatus() to append the plan and progress to the default status object.
+ */
+UniValue AsyncRPCOperation_consolidate::getStatus() const {
+    UniValue v = AsyncRPCOperation::getStatus();
+    UniValue obj = v.get_obj();
+    obj.pushKV("method", "z_consolidatenotes");
+    if (!contextinfo_.isNull()) {
+        obj.pushKV("params", contextinfo_);
+    }
+
+    size_t nPlanned = 0;
+    for (size_t nTxs : plan_) {
+        nPlanned += nTxs;
+    }
+    UniValue progress(UniValue::VOBJ);
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        progress.pushKV("levels", (uint64_t)plan_.size());
+        progress.pushKV("level", (uint64_t)nLevel_);
+        progress.pushKV("planned", (uint64_t)nPlanned);
+        progress.pushKV("built", (uint64_t)nBuilt_);
+        progress.pushKV("sent", (uint64_t)vTxids_.size());
+    }
+    obj.pushKV("progress", progress);
+    return obj;
+}
@@ -0,0 +1,160 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ASYNCRPCOPERATION_CONSOLIDATE_H
+#define ASYNCRPCOPERATION_CONSOLIDATE_H
+
+#include "asyncrpcoperation.h"
+#include "amount.h"
+#include "scheduler.h"
+#include "primitives/transaction.h"
+#include "zcash/Address.hpp"
+#include "zcash/IncrementalMerkleTree.hpp"
+#include "zcash/Note.hpp"
+
+#include <string>
+#include <vector>
+
+#include <boost/optional.hpp>
+#include <univalue.h>
+
+// Default fee and number of notes spent by each merge transaction
+#define CONSOLIDATE_DEFAULT_MINERS_FEE 10000
+#define CONSOLIDATE_DEFAULT_NOTES_PER_TX 50
+// Seconds between checks of whether the transactions of a level were mined
+#define CONSOLIDATE_CHECK_INTERVAL 5
+
+/** A Sapling note to be merged, with the key that spends it */
+struct ConsolidationInput {
+    SaplingOutPoint op;
+    libzcash::SaplingNote note;
+    libzcash::SaplingExpandedSpendingKey expsk;
+};
+
+/**
+ * Split nItems items into nGroups groups dealt round-robin, so that groups
+ * of items sorted by value have similar totals.
+ */
+std::vector<std::vector<size_t>> SplitIntoGroups(size_t nItems, size_t nGroups);
+
+/**
+ * Plan a merge tree for notes with the given values: each level merges the
+ * outputs of the previous one, up to nNotesPerTx at a time, until a single
+ * note is left. Returns the number of transactions at each level, or an
+ * empty plan if some transaction would not cover its fee.
+ */
+std::vector<size_t> PlanConsolidation(std::vector<CAmount> vValues, size_t nNotesPerTx, CAmount fee);
+
+/**
+ * Merge many Sapling notes into one note of a Sapling address in the wallet.
+ *
+ * The whole merge tree is planned up front. The transactions of each level
+ * are built and proven in parallel and then sent to the mempool. The
+ * operation then gives up its async worker, and the scheduler checks for
+ * the transactions to be mined before queueing it again to merge their
+ * outputs at the next level. The notes being merged and the planned outputs
+ * are locked while the operation runs.
+ */
+class AsyncRPCOperation_consolidate : public AsyncRPCOperation {
+public:
+    AsyncRPCOperation_consolidate(
+        std::vector<ConsolidationInput> inputs,
+        libzcash::SaplingPaymentAddress toAddress,
+        std::vector<size_t> plan,
+        CAmount fee = CONSOLIDATE_DEFAULT_MINERS_FEE,
+        UniValue contextInfo = NullUniValue);
+    virtual ~AsyncRPCOperation_consolidate();
+
+    // We don't want to be copied or moved around
+    AsyncRPCOperation_consolidate(AsyncRPCOperation_consolidate const&) = delete;             // Copy construct
+    AsyncRPCOperation_consolidate(AsyncRPCOperation_consolidate&&) = delete;                  // Move construct
+    AsyncRPCOperation_consolidate& operator=(AsyncRPCOperation_consolidate const&) = delete;  // Copy assign
+    AsyncRPCOperation_consolidate& operator=(AsyncRPCOperation_consolidate &&) = delete;      // Move assign
+
+    virtual void main();
+
+    virtual UniValue getStatus() const;
+
+    bool testmode = false;  // Set to true to disable sending txs; only the first level is built
+
+private:
+    friend class TEST_FRIEND_AsyncRPCOperation_consolidate;    // class for unit testing
+
+    UniValue contextinfo_;     // optional data to include in return value from getStatus()
+
+    std::vector<ConsolidationInput> inputs_;
+    libzcash::SaplingPaymentAddress toaddress_;
+    std::vector<size_t> plan_;
+    CAmount fee_;
+
+    // Progress, guarded by lock_
+    size_t nLevel_;
+    size_t nBuilt_;
+    std::vector<uint256> vTxids_;
+
+    // The merge transactions of the current level, once they have been sent
+    std::vector<uint256> vPending_;
+
+    // Outpoints locked by this operation
+    std::vector<SaplingOutPoint> vLocked_;
+
+    bool main_impl();
+    bool run_level();
+    std::vector<CTransaction> build_level(
+        const std::vector<ConsolidationInput>& inputs,
+        const std::vector<std::vector<size_t>>& groups);
+    CTransaction build_merge(
+        const std::vector<ConsolidationInput>& inputs,
+        const std::vector<size_t>& group,
+        const std::vector<boost::optional<SaplingWitness>>& witnesses,
+        const uint256& anchor,
+        int nHeight);
+    bool get_outputs(std::vector<ConsolidationInput>& outputs);
+    void next_level(const std::vector<ConsolidationInput>& outputs);
+    bool level_mined();
+    bool schedule_check();
+    void lock_note(const SaplingOutPoint& op);
+    void unlock_notes();
+
+    friend void CheckConsolidation(AsyncRPCOperationId id);
+};
+
+/** Let the scheduler wait for the levels of consolidations to be mined. */
+void StartConsolidations(CScheduler& scheduler);
+void StopConsolidations();
+
+// To test private methods, a friend class can act as a proxy
+class TEST_FRIEND_AsyncRPCOperation_consolidate {
+public:
+    std::shared_ptr<AsyncRPCOperation_consolidate> delegate;
+
+    TEST_FRIEND_AsyncRPCOperation_consolidate(std::shared_ptr<AsyncRPCOperation_consolidate> ptr) : delegate(ptr) {}
+
+    size_t level() {
+        std::lock_guard<std::mutex> guard(delegate->lock_);
+        return delegate->nLevel_;
+    }
+
+    const std::vector<ConsolidationInput>& inputs() {
+        return delegate->inputs_;
+    }
+
+    void set_pending(const std::vector<uint256>& txids) {
+        delegate->vPending_ = txids;
+    }
+
+    bool get_outputs(std::vector<ConsolidationInput>& outputs) {
+        return delegate->get_outputs(outputs);
+    }
+
+    void next_level(const std::vector<ConsolidationInput>& outputs) {
+        delegate->next_level(outputs);
+    }
+
+    bool level_mined() {
+        return delegate->level_mined();
+    }
+};
+
+#endif /* ASYNCRPCOPERATION_CONSOLIDATE_H */
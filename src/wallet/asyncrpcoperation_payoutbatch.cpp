@@ -0,0 +1,230 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "asyncrpcoperation_payoutbatch.h"
+
+#include "asyncrpcqueue.h"
+#include "chainparams.h"
+#include "consensus/consensus.h"
+#include "init.h"
+#include "main.h"
+#include "rpc/protocol.h"
+#include "rpc/server.h"
+#include "scheduler.h"
+#include "transaction_builder.h"
+#include "util.h"
+#include "utilmoneystr.h"
+#include "utiltime.h"
+#include "wallet.h"
+
+#include <map>
+#include <tuple>
+
+// Transparent outputs are assumed to be P2PKH, as in z_sendmany
+static const size_t PAYOUT_TXOUT_SIZE = 34;
+
+// Open batches, by from address, minconf and fee
+typedef std::tuple<std::string, int, CAmount> PayoutBatchKey;
+static std::mutex cs_pendingBatches;
+static std::map<PayoutBatchKey, std::shared_ptr<AsyncRPCOperation_payoutbatch>> mapPendingBatches;
+static CScheduler* pPayoutScheduler = NULL;
+
+AsyncRPCOperation_payoutbatch::AsyncRPCOperation_payoutbatch(
+        std::string fromAddress,
+        int minDepth,
+        CAmount fee) :
+        fromaddress_(fromAddress), mindepth_(minDepth), fee_(fee), fClosed_(false), nRequests_(0)
+{
+    LogPrint("zrpc", "%s: z_sendmanybatched batch opened\n", getId());
+}
+
+AsyncRPCOperation_payoutbatch::~AsyncRPCOperation_payoutbatch() {
+}
+
+bool AsyncRPCOperation_payoutbatch::add_payments(const std::vector<SendManyRecipient>& tOutputs, const std::vector<SendManyRecipient>& zOutputs) {
+    std::lock_guard<std::mutex> guard(batch_lock_);
+    if (fClosed_ || isCancelled()) {
+        return false;
+    }
+    t_outputs_.insert(t_outputs_.end(), tOutputs.begin(), tOutputs.end());
+    z_outputs_.insert(z_outputs_.end(), zOutputs.begin(), zOutputs.end());
+    nRequests_++;
+    return true;
+}
+
+void AsyncRPCOperation_payoutbatch::close() {
+    std::lock_guard<std::mutex> guardPending(cs_pendingBatches);
+    std::lock_guard<std::mutex> guard(batch_lock_);
+    fClosed_ = true;
+    auto it = mapPendingBatches.find(std::make_tuple(fromaddress_, mindepth_, fee_));
+    if (it != mapPendingBatches.end() && it->second.get() == this) {
+        mapPendingBatches.erase(it);
+    }
+}
+
+std::vector<PayoutGroup> AsyncRPCOperation_payoutbatch::split_payments() const {
+    // Outputs may take up half of a transaction, which leaves room for the
+    // spends, change and signatures.
+    const size_t nMaxOutputsSize = MAX_TX_SIZE_AFTER_SAPLING / 2;
+    const size_t nShieldedOutputSize = OUTPUTDESCRIPTION_SIZE;
+
+    std::lock_guard<std::mutex> guard(batch_lock_);
+    std::vector<PayoutGroup> groups;
+    size_t nGroupSize = nMaxOutputsSize;
+    for (const SendManyRecipient& r : z_outputs_) {
+        if (nGroupSize + nShieldedOutputSize > nMaxOutputsSize) {
+            groups.push_back(PayoutGroup());
+            nGroupSize = 0;
+        }
+        groups.back().zOutputs.push_back(r);
+        nGroupSize += nShieldedOutputSize;
+    }
+    for (const SendManyRecipient& r : t_outputs_) {
+        if (nGroupSize + PAYOUT_TXOUT_SIZE > nMaxOutputsSize) {
+            groups.push_back(PayoutGroup());
+            nGroupSize = 0;
+        }
+        groups.back().tOutputs.push_back(r);
+        nGroupSize += PAYOUT_TXOUT_SIZE;
+    }
+    return groups;
+}
+
+void AsyncRPCOperation_payoutbatch::main() {
+    if (isCancelled())
+        return;
+
+    set_state(OperationStatus::EXECUTING);
+    start_execution_clock();
+
+    // Normally already closed when the scheduler queued the batch
+    close();
+
+    std::vector<PayoutGroup> groups = split_payments();
+    LogPrint("zrpc", "%s: z_sendmanybatched sending %d requests in %d transactions\n", getId(), nRequests_, groups.size());
+
+    UniValue transactions(UniValue::VARR);
+    size_t nFailed = 0;
+    std::string strFirstError;
+    for (const PayoutGroup& group : groups) {
+        UniValue entry(UniValue::VOBJ);
+        try {
+            TransactionBuilder builder;
+            CMutableTransaction contextualTx;
+            {
+                LOCK(cs_main);
+                int nextBlockHeight = chainActive.Height() + 1;
+                builder = TransactionBuilder(Params().GetConsensus(), nextBlockHeight, pwalletMain);
+                contextualTx = CreateNewContextualCMutableTransaction(Params().GetConsensus(), nextBlockHeight);
+            }
+
+            // Each transaction selects and locks its own inputs, so they are
+            // built one after another from what the previous ones left.
+            AsyncRPCOperation_sendmany operation(builder, contextualTx, fromaddress_, group.tOutputs, group.zOutputs, mindepth_, fee_);
+            operation.testmode = testmode;
+            operation.main();
+            if (operation.isSuccess()) {
+                entry = operation.getResult();
+            } else {
+                entry.pushKV("error", operation.getErrorMessage());
+            }
+        } catch (const UniValue& objError) {
+            entry.pushKV("error", find_value(objError, "message").get_str());
+        } catch (const std::exception& e) {
+            entry.pushKV("error", std::string(e.what()));
+        }
+
+        UniValue error = find_value(entry, "error");
+        if (!error.isNull() && nFailed++ == 0) {
+            strFirstError = error.get_str();
+        }
+        entry.pushKV("outputs", (uint64_t)(group.tOutputs.size() + group.zOutputs.size()));
+        transactions.push_back(entry);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("transactions", transactions);
+    set_result(result);
+
+    stop_execution_clock();
+
+    if (nFailed == 0) {
+        set_state(OperationStatus::SUCCESS);
+    } else {
+        set_error_code(RPC_WALLET_ERROR);
+        set_error_message(strprintf("%d of %d transactions failed, first error: %s", nFailed, groups.size(), strFirstError));
+        set_state(OperationStatus::FAILED);
+    }
+
+    LogPrintf("%s: z_sendmanybatched finished (status=%s, transactions=%d, failed=%d)\n",
+        getId(), getStateAsString(), groups.size(), nFailed);
+}
+
+/**
+ * Override getStatus() to append the batch parameters to the default status object.
+ */
+UniValue AsyncRPCOperation_payoutbatch::getStatus() const {
+    UniValue v = AsyncRPCOperation::getStatus();
+    UniValue obj = v.get_obj();
+    obj.pushKV("method", "z_sendmanybatched");
+
+    UniValue params(UniValue::VOBJ);
+    params.pushKV("fromaddress", fromaddress_);
+    params.pushKV("minconf", mindepth_);
+    params.pushKV("fee", ValueFromAmount(fee_));
+    {
+        std::lock_guard<std::mutex> guard(batch_lock_);
+        params.pushKV("requests", (uint64_t)nRequests_);
+        params.pushKV("payments", (uint64_t)(t_outputs_.size() + z_outputs_.size()));
+    }
+    obj.pushKV("params", params);
+    return obj;
+}
+
+void StartPayoutBatch(std::shared_ptr<AsyncRPCOperation_payoutbatch> batch)
+{
+    batch->close();
+    getAsyncRPCQueue()->queueOperation(batch->getId());
+}
+
+void StartPayoutBatches(CScheduler& scheduler)
+{
+    std::lock_guard<std::mutex> guard(cs_pendingBatches);
+    pPayoutScheduler = &scheduler;
+}
+
+void StopPayoutBatches()
+{
+    std::lock_guard<std::mutex> guard(cs_pendingBatches);
+    pPayoutScheduler = NULL;
+}
+
+AsyncRPCOperationId QueuePayouts(
+    const std::string& fromAddress,
+    int minDepth,
+    CAmount fee,
+    const std::vector<SendManyRecipient>& tOutputs,
+    const std::vector<SendManyRecipient>& zOutputs)
+{
+    std::lock_guard<std::mutex> guard(cs_pendingBatches);
+    PayoutBatchKey key = std::make_tuple(fromAddress, minDepth, fee);
+    auto it = mapPendingBatches.find(key);
+    if (it != mapPendingBatches.end() && it->second->add_payments(tOutputs, zOutputs)) {
+        return it->second->getId();
+    }
+
+    int64_t nWindow = GetArg("-payoutbatchwindow", DEFAULT_PAYOUT_BATCH_WINDOW);
+    auto batch = std::make_shared<AsyncRPCOperation_payoutbatch>(fromAddress, minDepth, fee);
+    batch->add_payments(tOutputs, zOutputs);
+    mapPendingBatches[key] = batch;
+    if (pPayoutScheduler && nWindow > 0) {
+        // The batch is listed right away, but only takes up an async worker
+        // once the scheduler starts it at the end of the window.
+        getAsyncRPCQueue()->addPendingOperation(batch);
+        pPayoutScheduler->scheduleFromNow(std::bind(&StartPayoutBatch, batch), nWindow);
+    } else {
+        getAsyncRPCQueue()->addOperation(batch);
+    }
+    return batch->getId();
+}
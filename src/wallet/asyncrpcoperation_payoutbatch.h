@@ -0,0 +1,100 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ASYNCRPCOPERATION_PAYOUTBATCH_H
+#define ASYNCRPCOPERATION_PAYOUTBATCH_H
+
+#include "asyncrpcoperation.h"
+#include "amount.h"
+#include "wallet/asyncrpcoperation_sendmany.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <univalue.h>
+
+class CScheduler;
+
+/** Default for -payoutbatchwindow, in seconds */
+static const int64_t DEFAULT_PAYOUT_BATCH_WINDOW = 5;
+
+/** Payments that a batch sends in one transaction */
+struct PayoutGroup {
+    std::vector<SendManyRecipient> tOutputs;
+    std::vector<SendManyRecipient> zOutputs;
+};
+
+/**
+ * Payments queued by z_sendmanybatched for one from address, minconf and fee.
+ *
+ * Payments are accepted for -payoutbatchwindow seconds after the batch was
+ * created, after which the scheduler closes the batch and queues it. They are
+ * then split into as few transactions as the size limit allows, which are
+ * built and sent one after another.
+ */
+class AsyncRPCOperation_payoutbatch : public AsyncRPCOperation {
+public:
+    AsyncRPCOperation_payoutbatch(
+        std::string fromAddress,
+        int minDepth,
+        CAmount fee);
+    virtual ~AsyncRPCOperation_payoutbatch();
+
+    // We don't want to be copied or moved around
+    AsyncRPCOperation_payoutbatch(AsyncRPCOperation_payoutbatch const&) = delete;             // Copy construct
+    AsyncRPCOperation_payoutbatch(AsyncRPCOperation_payoutbatch&&) = delete;                  // Move construct
+    AsyncRPCOperation_payoutbatch& operator=(AsyncRPCOperation_payoutbatch const&) = delete;  // Copy assign
+    AsyncRPCOperation_payoutbatch& operator=(AsyncRPCOperation_payoutbatch &&) = delete;      // Move assign
+
+    /**
+     * Add the payments of one request to this batch. Returns false if the
+     * batch has stopped accepting payments.
+     */
+    bool add_payments(const std::vector<SendManyRecipient>& tOutputs, const std::vector<SendManyRecipient>& zOutputs);
+
+    /** Split the batched payments into groups that each fit in one transaction. */
+    std::vector<PayoutGroup> split_payments() const;
+
+    virtual void main();
+
+    virtual UniValue getStatus() const;
+
+    bool testmode = false;  // Set to true to disable sending txs and generating proofs
+
+private:
+    friend class TEST_FRIEND_AsyncRPCOperation_payoutbatch;    // class for unit testing
+
+    std::string fromaddress_;
+    int mindepth_;
+    CAmount fee_;
+
+    // Guards the fields below, which requests add to while the batch is open
+    mutable std::mutex batch_lock_;
+    bool fClosed_;
+    size_t nRequests_;
+    std::vector<SendManyRecipient> t_outputs_;
+    std::vector<SendManyRecipient> z_outputs_;
+
+    friend void StartPayoutBatch(std::shared_ptr<AsyncRPCOperation_payoutbatch> batch);
+    void close();
+};
+
+/** Let the scheduler start batches when their window has passed. */
+void StartPayoutBatches(CScheduler& scheduler);
+void StopPayoutBatches();
+
+/**
+ * Add payments to the open batch for fromAddress, minDepth and fee, queueing
+ * a new batch if there is none, and return the id of the batch operation.
+ */
+AsyncRPCOperationId QueuePayouts(
+    const std::string& fromAddress,
+    int minDepth,
+    CAmount fee,
+    const std::vector<SendManyRecipient>& tOutputs,
+    const std::vector<SendManyRecipient>& zOutputs);
+
+#endif /* ASYNCRPCOPERATION_PAYOUTBATCH_H */
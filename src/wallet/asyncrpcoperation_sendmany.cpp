@@ -32,6 +32,7 @@
 #include <array>
 #include <iostream>
 #include <chrono>
+#include <mutex>
 #include <thread>
 #include <string>
 
@@ -39,6 +40,10 @@
 
 using namespace libzcash;
 
+// Held by an operation from finding its inputs until it has locked the ones
+// it will spend, so that operations running in parallel pick disjoint inputs.
+static std::mutex cs_selectInputs;
+
 int find_output(UniValue obj, int n) {
     UniValue outputMapValue = find_value(obj, "outputmap");
     if (!outputMapValue.isArray()) {
@@ -167,6 +172,8 @@ void AsyncRPCOperation_sendmany::main() {
 
     stop_execution_clock();
 
+    unlock_inputs(); // clean up
+
     if (success) {
         set_state(OperationStatus::SUCCESS);
     } else {
@@ -200,11 +207,12 @@ void AsyncRPCOperation_sendmany::main() {
 // Notes:
 // 1. #1159 Currently there is no limit set on the number of joinsplits, so size of tx could be invalid.
 // 2. #1360 Note selection is not optimal
-// 3. #1277 Spendable notes are not locked, so an operation running in parallel could also try to use them
 bool AsyncRPCOperation_sendmany::main_impl() {
 
     assert(isfromtaddr_ != isfromzaddr_);
 
+    std::unique_lock<std::mutex> selectLock(cs_selectInputs);
+
     bool isSingleZaddrOutput = (t_outputs_.size()==0 && z_outputs_.size()==1);
     bool isMultipleZaddrOutput = (t_outputs_.size()==0 && z_outputs_.size()>=1);
     bool isPureTaddrOnlyTx = (isfromtaddr_ && z_outputs_.size() == 0);
@@ -339,6 +347,27 @@ bool AsyncRPCOperation_sendmany::main_impl() {
         }
     }
 
+    // Keep only the notes that will be spent, largest first, and lock them
+    // along with the selected utxos until this operation has finished.
+    CAmount selectedNoteAmount = 0;
+    for (size_t i = 0; i < z_sprout_inputs_.size(); i++) {
+        selectedNoteAmount += z_sprout_inputs_[i].amount;
+        if (selectedNoteAmount >= targetAmount) {
+            z_sprout_inputs_.erase(z_sprout_inputs_.begin() + i + 1, z_sprout_inputs_.end());
+            break;
+        }
+    }
+    selectedNoteAmount = 0;
+    for (size_t i = 0; i < z_sapling_inputs_.size(); i++) {
+        selectedNoteAmount += z_sapling_inputs_[i].note.value();
+        if (selectedNoteAmount >= targetAmount) {
+            z_sapling_inputs_.erase(z_sapling_inputs_.begin() + i + 1, z_sapling_inputs_.end());
+            break;
+        }
+    }
+    lock_inputs();
+    selectLock.unlock();
+
     if (isfromtaddr_) {
         LogPrint("zrpc", "%s: spending %s to send %s with fee %s\n",
             getId(), FormatMoney(targetAmount), FormatMoney(sendAmount), FormatMoney(minersFee));
@@ -1000,6 +1029,45 @@ bool AsyncRPCOperation_sendmany::find_unspent_notes() {
     return true;
 }
 
+/**
+ * Lock the selected utxos and notes
+ */
+void AsyncRPCOperation_sendmany::lock_inputs() {
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    for (auto t : t_inputs_) {
+        COutPoint outpt(t.txid, t.vout);
+        pwalletMain->LockCoin(outpt);
+    }
+    for (auto t : z_sprout_inputs_) {
+        pwalletMain->LockNote(t.point);
+    }
+    for (auto t : z_sapling_inputs_) {
+        pwalletMain->LockNote(t.op);
+    }
+    fInputsLocked_ = true;
+}
+
+/**
+ * Unlock the selected utxos and notes
+ */
+void AsyncRPCOperation_sendmany::unlock_inputs() {
+    if (!fInputsLocked_) {
+        return;
+    }
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    for (auto t : t_inputs_) {
+        COutPoint outpt(t.txid, t.vout);
+        pwalletMain->UnlockCoin(outpt);
+    }
+    for (auto t : z_sprout_inputs_) {
+        pwalletMain->UnlockNote(t.point);
+    }
+    for (auto t : z_sapling_inputs_) {
+        pwalletMain->UnlockNote(t.op);
+    }
+    fInputsLocked_ = false;
+}
+
 UniValue AsyncRPCOperation_sendmany::perform_joinsplit(AsyncJoinSplitInfo & info) {
     std::vector<boost::optional < SproutWitness>> witnesses;
     uint256 anchor;
@@ -132,10 +132,15 @@ private:
     TransactionBuilder builder_;
     CTransaction tx_;
 
+    // Whether the selected inputs are locked in the wallet
+    bool fInputsLocked_ = false;
+
     void add_taddr_change_output_to_tx(CReserveKey& keyChange, CAmount amount);
     void add_taddr_outputs_to_tx();
     bool find_unspent_notes();
     bool find_utxos(bool fAcceptCoinbase);
+    void lock_inputs();
+    void unlock_inputs();
     std::array<unsigned char, ZC_MEMO_SIZE> get_memo_from_hex_string(std::string s);
     bool main_impl();
 
@@ -11,6 +11,7 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <errno.h>
 #include <stdint.h>
 
 #ifndef WIN32
@@ -64,6 +65,9 @@ CDBEnv::~CDBEnv()
     EnvShutdown();
     delete dbenv;
     dbenv = NULL;
+    for (auto& entry : mapLogDb) {
+        delete entry.second;
+    }
 }
 
 void CDBEnv::Close()
@@ -217,6 +221,8 @@ bool CDBEnv::Salvage(const std::string& strFile, bool fAggressive, std::vector<C
 
 void CDBEnv::CheckpointLSN(const std::string& strFile)
 {
+    if (mapLogDb.count(strFile))
+        return;
     dbenv->txn_checkpoint(0, 0, 0);
     if (fMockDb)
         return;
@@ -224,7 +230,7 @@ void CDBEnv::CheckpointLSN(const std::string& strFile)
 }
 
 
-CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), activeTxn(NULL)
+CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), plog(NULL), activeTxn(NULL), fLogTxn(false)
 {
     int ret;
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
@@ -244,6 +250,26 @@ CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnClose
 
         strFile = strFilename;
         ++bitdb.mapFileUseCount[strFile];
+        if (bitdb.IsLogDb(strFile, fCreate)) {
+            plog = bitdb.mapLogDb[strFile];
+            if (plog == NULL) {
+                plog = new CLogDB(GetDataDir() / strFile);
+                if (!plog->Open(fCreate)) {
+                    delete plog;
+                    plog = NULL;
+                    --bitdb.mapFileUseCount[strFile];
+                    throw runtime_error(strprintf("CDB: Can't open database %s", strFilename));
+                }
+                bitdb.mapLogDb[strFile] = plog;
+                if (fCreate && !Exists(string("version"))) {
+                    bool fTmp = fReadOnly;
+                    fReadOnly = false;
+                    WriteVersion(CLIENT_VERSION);
+                    fReadOnly = fTmp;
+                }
+            }
+            return;
+        }
         pdb = bitdb.mapDb[strFile];
         if (pdb == NULL) {
             pdb = new Db(bitdb.dbenv, 0);
@@ -285,6 +311,11 @@ CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnClose
 
 void CDB::Flush()
 {
+    if (plog) {
+        if (!fLogTxn)
+            plog->Sync();
+        return;
+    }
     if (activeTxn)
         return;
 
@@ -298,15 +329,18 @@ void CDB::Flush()
 
 void CDB::Close()
 {
-    if (!pdb)
+    if (!pdb && !plog)
         return;
     if (activeTxn)
         activeTxn->abort();
     activeTxn = NULL;
-    pdb = NULL;
+    logTxn.Clear();
+    fLogTxn = false;
 
     if (fFlushOnClose)
         Flush();
+    pdb = NULL;
+    plog = NULL;
 
     {
         LOCK(bitdb.cs_db);
@@ -314,10 +348,97 @@ void CDB::Close()
     }
 }
 
+bool CDB::LogRead(const CDataStream& ssKey, CDataStream& ssValue)
+{
+    bool fErased;
+    if (fLogTxn && logTxn.Find(ssKey, fErased, &ssValue))
+        return !fErased;
+    return plog->Read(ssKey, ssValue);
+}
+
+bool CDB::LogWrite(const CDataStream& ssKey, const CDataStream& ssValue, bool fOverwrite)
+{
+    if (!fOverwrite && LogExists(ssKey))
+        return false;
+    if (fLogTxn) {
+        logTxn.Write(ssKey, ssValue);
+        return true;
+    }
+    CLogBatch batch;
+    batch.Write(ssKey, ssValue);
+    return plog->Write(batch, false);
+}
+
+bool CDB::LogErase(const CDataStream& ssKey)
+{
+    if (fLogTxn) {
+        logTxn.Erase(ssKey);
+        return true;
+    }
+    if (!plog->Exists(ssKey))
+        return true;
+    CLogBatch batch;
+    batch.Erase(ssKey);
+    return plog->Write(batch, false);
+}
+
+bool CDB::LogExists(const CDataStream& ssKey)
+{
+    bool fErased;
+    if (fLogTxn && logTxn.Find(ssKey, fErased, NULL))
+        return !fErased;
+    return plog->Exists(ssKey);
+}
+
+int CDB::ReadAtLogCursor(CDBCursor* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags)
+{
+    bool fFound;
+    if (fFlags == DB_SET_RANGE) {
+        fFound = pcursor->plog->ReadNext(ssKey, ssValue, true);
+    } else if (fFlags == DB_NEXT) {
+        ssKey = pcursor->ssLastKey;
+        fFound = pcursor->plog->ReadNext(ssKey, ssValue, pcursor->fStarted ? false : true);
+    } else {
+        return EINVAL;
+    }
+    if (!fFound)
+        return DB_NOTFOUND;
+    pcursor->fStarted = true;
+    pcursor->ssLastKey = ssKey;
+    ssKey.SetType(SER_DISK);
+    ssValue.SetType(SER_DISK);
+    return 0;
+}
+
+bool CDBEnv::IsLogDb(const std::string& strFile, bool fCreate)
+{
+    LOCK(cs_db);
+    if (fMockDb)
+        return false;
+    if (mapLogDb.count(strFile))
+        return true;
+    boost::filesystem::path path = GetDataDir() / strFile;
+    if (boost::filesystem::exists(path))
+        return CLogDB::IsLogFile(path);
+    return fCreate && GetArg("-walletbackend", DEFAULT_WALLET_BACKEND) == WALLET_BACKEND_LOG;
+}
+
 void CDBEnv::CloseDb(const string& strFile)
 {
     {
         LOCK(cs_db);
+        std::map<std::string, CLogDB*>::iterator it = mapLogDb.find(strFile);
+        if (it != mapLogDb.end()) {
+            // Log files are kept open so that their index is not read again;
+            // once synced they are self-contained.
+            if (it->second != NULL) {
+                // Drop replaced records once they take up most of the file
+                if (it->second->ShouldCompact())
+                    it->second->Rewrite();
+                it->second->Sync();
+            }
+            return;
+        }
         if (mapDb[strFile] != NULL) {
             // Close the database handle
             Db* pdb = mapDb[strFile];
@@ -343,6 +464,22 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
         {
             LOCK(bitdb.cs_db);
             if (!bitdb.mapFileUseCount.count(strFile) || bitdb.mapFileUseCount[strFile] == 0) {
+                if (bitdb.IsLogDb(strFile)) {
+                    bitdb.mapFileUseCount.erase(strFile);
+                    CLogDB*& plog = bitdb.mapLogDb[strFile];
+                    if (plog == NULL) {
+                        plog = new CLogDB(GetDataDir() / strFile);
+                        if (!plog->Open(false)) {
+                            delete plog;
+                            plog = NULL;
+                        }
+                    }
+                    bool fSuccess = plog && plog->Rewrite(pszSkip);
+                    if (!fSuccess)
+                        LogPrintf("CDB::Rewrite: Failed to rewrite database file %s\n", strFile);
+                    return fSuccess;
+                }
+
                 // Flush log data to the dat file
                 bitdb.CloseDb(strFile);
                 bitdb.CheckpointLSN(strFile);
@@ -366,7 +503,7 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
                         fSuccess = false;
                     }
 
-                    Dbc* pcursor = db.GetCursor();
+                    CDBCursor* pcursor = db.GetCursor();
                     if (pcursor)
                         while (fSuccess) {
                             CDataStream ssKey(SER_DISK, CLIENT_VERSION);
@@ -420,6 +557,79 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
     return false;
 }
 
+bool CDB::ConvertToLog(const string& strFile)
+{
+    LOCK(bitdb.cs_db);
+    assert(bitdb.mapFileUseCount.count(strFile) == 0 || bitdb.mapFileUseCount[strFile] == 0);
+
+    LogPrintf("CDB::ConvertToLog: Converting %s...\n", strFile);
+    boost::filesystem::path pathLog = GetDataDir() / (strFile + ".log");
+    boost::filesystem::remove(pathLog);
+    bool fSuccess = true;
+    {
+        CLogDB dbLog(pathLog);
+        if (!dbLog.Open(true))
+            return false;
+
+        // The copy only replaces the original once it is complete
+        CLogBatch batch;
+        size_t nBatchSize = 0;
+        {
+            CDB db(strFile.c_str(), "r");
+            CDBCursor* pcursor = db.GetCursor();
+            if (!pcursor)
+                return false;
+            while (true) {
+                CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+                CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+                int ret = db.ReadAtCursor(pcursor, ssKey, ssValue, DB_NEXT);
+                if (ret == DB_NOTFOUND)
+                    break;
+                if (ret != 0 || !fSuccess) {
+                    fSuccess = false;
+                    break;
+                }
+                nBatchSize += ssKey.size() + ssValue.size();
+                batch.Write(ssKey, ssValue);
+                if (nBatchSize >= (1 << 20)) {
+                    fSuccess = dbLog.Write(batch, false);
+                    batch.Clear();
+                    nBatchSize = 0;
+                }
+            }
+            pcursor->close();
+        }
+        fSuccess = fSuccess && dbLog.Write(batch, true);
+        dbLog.Close();
+    }
+
+    // Keep the original next to the converted wallet, like CWalletDB::Recover
+    std::string strBackup = strFile + strprintf(".%d.bdb.bak", GetTime());
+    bitdb.CloseDb(strFile);
+    bitdb.CheckpointLSN(strFile);
+    bitdb.mapFileUseCount.erase(strFile);
+    if (fSuccess && bitdb.dbenv->dbrename(NULL, strFile.c_str(), NULL, strBackup.c_str(), DB_AUTO_COMMIT) != 0) {
+        LogPrintf("CDB::ConvertToLog: Failed to rename %s to %s\n", strFile, strBackup);
+        fSuccess = false;
+    }
+    if (!fSuccess) {
+        boost::filesystem::remove(pathLog);
+        return false;
+    }
+    if (!RenameOver(pathLog, GetDataDir() / strFile)) {
+        // The wallet must not be left without a file under its name, or the
+        // next start would create an empty one
+        if (bitdb.dbenv->dbrename(NULL, strBackup.c_str(), NULL, strFile.c_str(), DB_AUTO_COMMIT) != 0) {
+            return error("CDB::ConvertToLog: Failed to move %s into place, and to move the original back from %s; "
+                         "rename either of them to %s", pathLog.string(), strBackup, strFile);
+        }
+        boost::filesystem::remove(pathLog);
+        return error("CDB::ConvertToLog: Failed to move %s into place; the original %s was restored from %s",
+                     pathLog.string(), strFile, strBackup);
+    }
+    LogPrintf("CDB::ConvertToLog: Original %s saved as %s\n", strFile, strBackup);
+    return true;
+}
 
 void CDBEnv::Flush(bool fShutdown)
 {
@@ -441,7 +651,7 @@ void CDBEnv::Flush(bool fShutdown)
                 LogPrint("db", "CDBEnv::Flush: %s checkpoint\n", strFile);
                 dbenv->txn_checkpoint(0, 0, 0);
                 LogPrint("db", "CDBEnv::Flush: %s detach\n", strFile);
-                if (!fMockDb)
+                if (!fMockDb && !mapLogDb.count(strFile))
                     dbenv->lsn_reset(strFile.c_str(), 0);
                 LogPrint("db", "CDBEnv::Flush: %s closed\n", strFile);
                 mi = mapFileUseCount.erase(mi);
@@ -452,6 +662,10 @@ void CDBEnv::Flush(bool fShutdown)
         if (fShutdown) {
             char** listp;
             if (mapFileUseCount.empty()) {
+                for (auto& entry : mapLogDb) {
+                    delete entry.second;
+                    entry.second = NULL;
+                }
                 dbenv->log_archive(&listp, DB_ARCH_REMOVE);
                 Close();
                 if (!fMockDb)
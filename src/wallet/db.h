@@ -11,6 +11,7 @@
 #include "streams.h"
 #include "sync.h"
 #include "version.h"
+#include "wallet/logdb.h"
 
 #include <map>
 #include <string>
@@ -42,6 +43,8 @@ public:
     DbEnv *dbenv;
     std::map<std::string, int> mapFileUseCount;
     std::map<std::string, Db*> mapDb;
+    //! Files stored by CLogDB rather than BerkeleyDB; closed files map to NULL
+    std::map<std::string, CLogDB*> mapLogDb;
 
     CDBEnv();
     ~CDBEnv();
@@ -78,6 +81,13 @@ public:
     void CloseDb(const std::string& strFile);
     bool RemoveDb(const std::string& strFile);
 
+    /**
+     * Whether strFile is stored by CLogDB: it has been opened as or is on
+     * disk in that format, or it does not exist yet, fCreate is set and
+     * -walletbackend selects that format for new wallets.
+     */
+    bool IsLogDb(const std::string& strFile, bool fCreate = false);
+
     DbTxn* TxnBegin(int flags = DB_TXN_WRITE_NOSYNC)
     {
         DbTxn* ptxn = NULL;
@@ -90,14 +100,39 @@ public:
 
 extern CDBEnv bitdb;
 
+/** A cursor returned by CDB::GetCursor() */
+struct CDBCursor
+{
+    //! The BerkeleyDB cursor, or NULL for a CLogDB file
+    Dbc* pdbc;
+    const CLogDB* plog;
+    bool fStarted;
+    CDataStream ssLastKey;
+
+    CDBCursor(Dbc* pdbcIn, const CLogDB* plogIn) :
+        pdbc(pdbcIn), plog(plogIn), fStarted(false), ssLastKey(SER_DISK, CLIENT_VERSION) {}
+
+    /** Release the cursor, which must not be used afterwards. */
+    void close()
+    {
+        if (pdbc)
+            pdbc->close();
+        delete this;
+    }
+};
+
 
-/** RAII class that provides access to a Berkeley database */
+/** RAII class that provides access to a Berkeley database or a CLogDB file */
 class CDB
 {
 protected:
     Db* pdb;
+    CLogDB* plog;
     std::string strFile;
     DbTxn* activeTxn;
+    //! Writes to a CLogDB file since TxnBegin()
+    bool fLogTxn;
+    CLogBatch logTxn;
     bool fReadOnly;
     bool fFlushOnClose;
 
@@ -112,17 +147,34 @@ private:
     CDB(const CDB&);
     void operator=(const CDB&);
 
+    bool LogRead(const CDataStream& ssKey, CDataStream& ssValue);
+    bool LogWrite(const CDataStream& ssKey, const CDataStream& ssValue, bool fOverwrite);
+    bool LogErase(const CDataStream& ssKey);
+    bool LogExists(const CDataStream& ssKey);
+
 protected:
     template <typename K, typename T>
     bool Read(const K& key, T& value)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        if (plog) {
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            if (!LogRead(ssKey, ssValue))
+                return false;
+            try {
+                ssValue >> value;
+            } catch (const std::exception&) {
+                return false;
+            }
+            return true;
+        }
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Read
@@ -151,7 +203,7 @@ protected:
     template <typename K, typename T>
     bool Write(const K& key, const T& value, bool fOverwrite = true)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
         if (fReadOnly)
             assert(!"Write called on database in read-only mode");
@@ -166,6 +218,8 @@ protected:
         CDataStream ssValue(SER_DISK, CLIENT_VERSION);
         ssValue.reserve(10000);
         ssValue << value;
+        if (plog)
+            return LogWrite(ssKey, ssValue, fOverwrite);
         Dbt datValue(&ssValue[0], ssValue.size());
 
         // Write
@@ -180,7 +234,7 @@ protected:
     template <typename K>
     bool Erase(const K& key)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
         if (fReadOnly)
             assert(!"Erase called on database in read-only mode");
@@ -189,6 +243,8 @@ protected:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+        if (plog)
+            return LogErase(ssKey);
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Erase
@@ -202,13 +258,15 @@ protected:
     template <typename K>
     bool Exists(const K& key)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+        if (plog)
+            return LogExists(ssKey);
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Exists
@@ -219,19 +277,29 @@ protected:
         return (ret == 0);
     }
 
-    Dbc* GetCursor()
+    CDBCursor* GetCursor()
     {
+        if (plog)
+            return new CDBCursor(NULL, plog);
         if (!pdb)
             return NULL;
-        Dbc* pcursor = NULL;
-        int ret = pdb->cursor(NULL, &pcursor, 0);
+        Dbc* pdbc = NULL;
+        int ret = pdb->cursor(NULL, &pdbc, 0);
         if (ret != 0)
             return NULL;
-        return pcursor;
+        return new CDBCursor(pdbc, NULL);
     }
 
-    int ReadAtCursor(Dbc* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags = DB_NEXT)
+    /**
+     * Read at the cursor with DB_NEXT or DB_SET_RANGE; the other flags are
+     * only supported for BerkeleyDB. Writes made in the current transaction
+     * are not visible to cursors over CLogDB files.
+     */
+    int ReadAtCursor(CDBCursor* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags = DB_NEXT)
     {
+        if (!pcursor->pdbc)
+            return ReadAtLogCursor(pcursor, ssKey, ssValue, fFlags);
+
         // Read at cursor
         Dbt datKey;
         if (fFlags == DB_SET || fFlags == DB_SET_RANGE || fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE) {
@@ -245,7 +313,7 @@ protected:
         }
         datKey.set_flags(DB_DBT_MALLOC);
         datValue.set_flags(DB_DBT_MALLOC);
-        int ret = pcursor->get(&datKey, &datValue, fFlags);
+        int ret = pcursor->pdbc->get(&datKey, &datValue, fFlags);
         if (ret != 0)
             return ret;
         else if (datKey.get_data() == NULL || datValue.get_data() == NULL)
@@ -267,9 +335,17 @@ protected:
         return 0;
     }
 
+    int ReadAtLogCursor(CDBCursor* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags);
+
 public:
     bool TxnBegin()
     {
+        if (plog) {
+            if (fLogTxn)
+                return false;
+            fLogTxn = true;
+            return true;
+        }
         if (!pdb || activeTxn)
             return false;
         DbTxn* ptxn = bitdb.TxnBegin();
@@ -281,6 +357,15 @@ public:
 
     bool TxnCommit()
     {
+        if (plog) {
+            if (!fLogTxn)
+                return false;
+            // The whole batch is appended at once and synced to disk
+            bool ret = plog->Write(logTxn, true);
+            logTxn.Clear();
+            fLogTxn = false;
+            return ret;
+        }
         if (!pdb || !activeTxn)
             return false;
         int ret = activeTxn->commit(0);
@@ -290,6 +375,13 @@ public:
 
     bool TxnAbort()
     {
+        if (plog) {
+            if (!fLogTxn)
+                return false;
+            logTxn.Clear();
+            fLogTxn = false;
+            return true;
+        }
         if (!pdb || !activeTxn)
             return false;
         int ret = activeTxn->abort();
@@ -309,6 +401,11 @@ public:
     }
 
     bool static Rewrite(const std::string& strFile, const char* pszSkip = NULL);
+    /**
+     * Convert the BerkeleyDB file strFile to the CLogDB format. The original
+     * is kept in the data directory as wallet.{timestamp}.bdb.bak.
+     */
+    bool static ConvertToLog(const std::string& strFile);
 };
 
 #endif // BITCOIN_WALLET_DB_H
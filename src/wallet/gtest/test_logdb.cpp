@@ -0,0 +1,249 @@
+#include <gtest/gtest.h>
+
+#include "clientversion.h"
+#include "primitives/block.h"
+#include "util.h"
+#include "wallet/logdb.h"
+#include "wallet/walletdb.h"
+
+#include <boost/filesystem.hpp>
+
+static CDataStream Stream(const std::string& str)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << str;
+    return ss;
+}
+
+static std::string ReadString(const CLogDB& db, const std::string& key)
+{
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    if (!db.Read(Stream(key), ssValue)) {
+        return "<missing>";
+    }
+    std::string value;
+    ssValue >> value;
+    return value;
+}
+
+class LogDBTest : public ::testing::Test {
+protected:
+    boost::filesystem::path path;
+
+    virtual void SetUp() {
+        path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    }
+
+    virtual void TearDown() {
+        boost::filesystem::remove(path);
+    }
+};
+
+TEST_F(LogDBTest, WriteReadErase) {
+    {
+        CLogDB db(path);
+        ASSERT_TRUE(db.Open(true));
+        CLogBatch batch;
+        batch.Write(Stream("b"), Stream("two"));
+        batch.Write(Stream("a"), Stream("one"));
+        batch.Write(Stream("c"), Stream("three"));
+        ASSERT_TRUE(db.Write(batch, true));
+
+        CLogBatch batch2;
+        batch2.Write(Stream("a"), Stream("uno"));
+        batch2.Erase(Stream("c"));
+        ASSERT_TRUE(db.Write(batch2, false));
+
+        EXPECT_EQ("uno", ReadString(db, "a"));
+        EXPECT_EQ("two", ReadString(db, "b"));
+        EXPECT_FALSE(db.Exists(Stream("c")));
+        EXPECT_EQ(2, db.Size());
+    }
+    EXPECT_TRUE(CLogDB::IsLogFile(path));
+
+    // The records are read back in key order after reopening
+    CLogDB db(path);
+    ASSERT_TRUE(db.Open(false));
+    EXPECT_EQ("uno", ReadString(db, "a"));
+    EXPECT_EQ("two", ReadString(db, "b"));
+    EXPECT_EQ("<missing>", ReadString(db, "c"));
+
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    std::vector<std::string> keys;
+    bool fInclusive = true;
+    while (db.ReadNext(ssKey, ssValue, fInclusive)) {
+        CDataStream ssCopy = ssKey;
+        std::string key;
+        ssCopy >> key;
+        keys.push_back(key);
+        fInclusive = false;
+    }
+    EXPECT_EQ(std::vector<std::string>({"a", "b"}), keys);
+}
+
+TEST_F(LogDBTest, IncompleteBatchIsDropped) {
+    uint64_t nSize;
+    {
+        CLogDB db(path);
+        ASSERT_TRUE(db.Open(true));
+        CLogBatch batch;
+        batch.Write(Stream("a"), Stream("one"));
+        ASSERT_TRUE(db.Write(batch, true));
+        nSize = db.FileSize();
+
+        CLogBatch batch2;
+        batch2.Write(Stream("a"), Stream("two"));
+        batch2.Write(Stream("b"), Stream("three"));
+        ASSERT_TRUE(db.Write(batch2, true));
+    }
+
+    // Simulate a crash in the middle of writing the second batch
+    FILE* file = fopen(path.string().c_str(), "r+b");
+    ASSERT_TRUE(file != NULL);
+    ASSERT_TRUE(TruncateFile(file, nSize + 12));
+    fclose(file);
+
+    CLogDB db(path);
+    ASSERT_TRUE(db.Open(false));
+    EXPECT_EQ("one", ReadString(db, "a"));
+    EXPECT_FALSE(db.Exists(Stream("b")));
+    EXPECT_EQ(nSize, db.FileSize());
+    EXPECT_EQ(nSize, boost::filesystem::file_size(path));
+}
+
+TEST_F(LogDBTest, CorruptBatchBeforeTheEndFailsOpen) {
+    uint64_t nSize;
+    {
+        CLogDB db(path);
+        ASSERT_TRUE(db.Open(true));
+        CLogBatch batch;
+        batch.Write(Stream("a"), Stream("one"));
+        ASSERT_TRUE(db.Write(batch, true));
+        nSize = db.FileSize();
+
+        CLogBatch batch2;
+        batch2.Write(Stream("b"), Stream("two"));
+        ASSERT_TRUE(db.Write(batch2, true));
+    }
+    uint64_t nFullSize = boost::filesystem::file_size(path);
+
+    // Flip the last byte of the first batch
+    FILE* file = fopen(path.string().c_str(), "r+b");
+    ASSERT_TRUE(file != NULL);
+    ASSERT_EQ(0, fseek(file, nSize - 1, SEEK_SET));
+    int ch = fgetc(file);
+    ASSERT_EQ(0, fseek(file, nSize - 1, SEEK_SET));
+    fputc(ch ^ 0xff, file);
+    fclose(file);
+
+    // The later batch must not be discarded along with it
+    CLogDB db(path);
+    EXPECT_FALSE(db.Open(false));
+    EXPECT_EQ(nFullSize, boost::filesystem::file_size(path));
+}
+
+TEST_F(LogDBTest, RewriteDropsReplacedRecords) {
+    CLogDB db(path);
+    ASSERT_TRUE(db.Open(true));
+    for (int i = 0; i < 10; i++) {
+        CLogBatch batch;
+        batch.Write(Stream("key"), Stream(strprintf("value%d", i)));
+        batch.Write(Stream("pool"), Stream("x"));
+        ASSERT_TRUE(db.Write(batch, false));
+    }
+    uint64_t nSize = db.FileSize();
+
+    ASSERT_TRUE(db.Rewrite("\x04pool"));
+    EXPECT_LT(db.FileSize(), nSize);
+    EXPECT_EQ("value9", ReadString(db, "key"));
+    EXPECT_FALSE(db.Exists(Stream("pool")));
+    EXPECT_EQ(1, db.Size());
+}
+
+// Exposes the cursor wrapper that the CWalletDB loops go through
+class TestWalletDB : public CWalletDB {
+public:
+    TestWalletDB(const std::string& strFilename, const char* pszMode) : CWalletDB(strFilename, pszMode) {}
+
+    std::vector<std::string> ListNames() {
+        std::vector<std::string> names;
+        CDBCursor* pcursor = GetCursor();
+        if (!pcursor) {
+            return names;
+        }
+        while (true) {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            if (ReadAtCursor(pcursor, ssKey, ssValue) != 0) {
+                break;
+            }
+            std::string strType;
+            ssKey >> strType;
+            if (strType == "name") {
+                std::string strAddress, strName;
+                ssKey >> strAddress;
+                ssValue >> strName;
+                names.push_back(strAddress + "=" + strName);
+            }
+        }
+        pcursor->close();
+        return names;
+    }
+};
+
+TEST(WalletLogDBTest, WalletDBOnLogBackend) {
+    boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+    mapArgs["-walletbackend"] = WALLET_BACKEND_LOG;
+    ClearDatadirCache();
+    const std::string strFile = "wallet-logdb-test.dat";
+
+    CBlockLocator locator(std::vector<uint256>(1, uint256S("0x1234")));
+    {
+        TestWalletDB walletdb(strFile, "cr+");
+        EXPECT_TRUE(bitdb.IsLogDb(strFile));
+
+        // A committed transaction is written as one batch
+        ASSERT_TRUE(walletdb.TxnBegin());
+        EXPECT_TRUE(walletdb.WriteName("b", "two"));
+        EXPECT_TRUE(walletdb.WriteName("a", "one"));
+        EXPECT_TRUE(walletdb.WriteBestBlock(locator));
+        ASSERT_TRUE(walletdb.TxnCommit());
+
+        // An aborted one leaves nothing behind
+        ASSERT_TRUE(walletdb.TxnBegin());
+        EXPECT_TRUE(walletdb.WriteName("c", "three"));
+        ASSERT_TRUE(walletdb.TxnAbort());
+
+        EXPECT_EQ(std::vector<std::string>({"a=one", "b=two"}), walletdb.ListNames());
+    }
+    EXPECT_TRUE(CLogDB::IsLogFile(pathTemp / strFile));
+
+    // Reopen the file from disk
+    {
+        LOCK(bitdb.cs_db);
+        delete bitdb.mapLogDb[strFile];
+        bitdb.mapLogDb.erase(strFile);
+        bitdb.mapFileUseCount.erase(strFile);
+    }
+    {
+        TestWalletDB walletdb(strFile, "r+");
+        CBlockLocator locatorRead;
+        ASSERT_TRUE(walletdb.ReadBestBlock(locatorRead));
+        EXPECT_EQ(locator.vHave, locatorRead.vHave);
+        EXPECT_EQ(std::vector<std::string>({"a=one", "b=two"}), walletdb.ListNames());
+    }
+
+    {
+        LOCK(bitdb.cs_db);
+        delete bitdb.mapLogDb[strFile];
+        bitdb.mapLogDb.erase(strFile);
+        bitdb.mapFileUseCount.erase(strFile);
+    }
+    mapArgs.erase("-walletbackend");
+    mapArgs.erase("-datadir");
+    ClearDatadirCache();
+    boost::filesystem::remove_all(pathTemp);
+}
@@ -29,9 +29,64 @@ public:
 
     MOCK_METHOD2(WriteTx, bool(uint256 hash, const CWalletTx& wtx));
     MOCK_METHOD1(WriteWitnessCacheSize, bool(int64_t nWitnessCacheSize));
+    MOCK_METHOD1(WriteWitnessCacheHeight, bool(int nHeight));
+    MOCK_METHOD2(WriteSproutWitnesses, bool(const JSOutPoint& jsop, const CSproutWitnessRecord& record));
+    MOCK_METHOD1(EraseSproutWitnesses, bool(const JSOutPoint& jsop));
+    MOCK_METHOD2(WriteSaplingWitnesses, bool(const SaplingOutPoint& op, const CSaplingWitnessRecord& record));
+    MOCK_METHOD1(EraseSaplingWitnesses, bool(const SaplingOutPoint& op));
+    MOCK_METHOD2(WriteWitnessCacheDelta, bool(int nHeight, const CWitnessCacheDelta& delta));
+    MOCK_METHOD1(EraseWitnessCacheDelta, bool(int nHeight));
     MOCK_METHOD1(WriteBestBlock, bool(const CBlockLocator& loc));
 };
 
+/** Keeps what SetBestChain() writes, as the wallet database would */
+class FakeWitnessDB {
+public:
+    int64_t nWitnessCacheSize = 0;
+    boost::optional<int> nWitnessCacheHeight;
+    std::map<JSOutPoint, CSproutWitnessRecord> mapSproutWitnesses;
+    std::map<SaplingOutPoint, CSaplingWitnessRecord> mapSaplingWitnesses;
+    std::map<int, CWitnessCacheDelta> mapWitnessDeltas;
+
+    bool TxnBegin() { return true; }
+    bool TxnCommit() { return true; }
+    bool TxnAbort() { return true; }
+
+    bool WriteWitnessCacheSize(int64_t n) { nWitnessCacheSize = n; return true; }
+    bool WriteWitnessCacheHeight(int nHeight) { nWitnessCacheHeight = nHeight; return true; }
+    bool WriteSproutWitnesses(const JSOutPoint& jsop, const CSproutWitnessRecord& record) {
+        mapSproutWitnesses[jsop] = record;
+        return true;
+    }
+    bool EraseSproutWitnesses(const JSOutPoint& jsop) { mapSproutWitnesses.erase(jsop); return true; }
+    bool WriteSaplingWitnesses(const SaplingOutPoint& op, const CSaplingWitnessRecord& record) {
+        mapSaplingWitnesses[op] = record;
+        return true;
+    }
+    bool EraseSaplingWitnesses(const SaplingOutPoint& op) { mapSaplingWitnesses.erase(op); return true; }
+    bool WriteWitnessCacheDelta(int nHeight, const CWitnessCacheDelta& delta) {
+        mapWitnessDeltas[nHeight] = delta;
+        return true;
+    }
+    bool EraseWitnessCacheDelta(int nHeight) { mapWitnessDeltas.erase(nHeight); return true; }
+    bool WriteBestBlock(const CBlockLocator& loc) { return true; }
+};
+
+/** Keeps the transaction summaries written by PageOutSettledTxs() */
+class FakeSettledTxDB {
+public:
+    std::map<uint256, CWalletTxSummary> mapSummaries;
+
+    bool TxnBegin() { return true; }
+    bool TxnCommit() { return true; }
+    bool TxnAbort() { return true; }
+
+    bool WriteTxSummary(uint256 hash, const CWalletTxSummary& summary) {
+        mapSummaries[hash] = summary;
+        return true;
+    }
+};
+
 template void CWallet::SetBestChainINTERNAL<MockWalletDB>(
         MockWalletDB& walletdb, const CBlockLocator& loc);
 
@@ -56,9 +111,14 @@ public:
     void DecrementNoteWitnesses(const CBlockIndex* pindex) {
         CWallet::DecrementNoteWitnesses(pindex);
     }
-    void SetBestChain(MockWalletDB& walletdb, const CBlockLocator& loc) {
+    template <typename WalletDB>
+    void SetBestChain(WalletDB& walletdb, const CBlockLocator& loc) {
         CWallet::SetBestChainINTERNAL(walletdb, loc);
     }
+    template <typename WalletDB>
+    void PageOutSettledTxs(WalletDB& walletdb) {
+        CWallet::PageOutSettledTxs(walletdb);
+    }
     bool UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx) {
         return CWallet::UpdatedNoteData(wtxIn, wtx);
     }
@@ -324,6 +384,211 @@ TEST(WalletTests, FindUnspentSproutNotes) {
     RegtestDeactivateSapling();
 }
 
+TEST(WalletTests, GetFilteredNotesByAddress) {
+    CWallet wallet;
+    LOCK2(cs_main, wallet.cs_wallet);
+
+    std::vector<libzcash::SproutSpendingKey> sks;
+    std::vector<JSOutPoint> jsops;
+    for (CAmount value : {10, 20}) {
+        auto sk = libzcash::SproutSpendingKey::random();
+        wallet.AddSproutSpendingKey(sk);
+        auto wtx = GetValidSproutReceive(sk, value, true);
+        auto note = GetSproutNote(sk, wtx, 0, 1);
+
+        mapSproutNoteData_t noteData;
+        JSOutPoint jsoutpt {wtx.GetHash(), 0, 1};
+        noteData[jsoutpt] = SproutNoteData {sk.address(), note.nullifier(sk)};
+        wtx.SetSproutNoteData(noteData);
+        wallet.AddToWallet(wtx, true, NULL);
+
+        sks.push_back(sk);
+        jsops.push_back(jsoutpt);
+    }
+
+    std::vector<SproutNoteEntry> sproutEntries;
+    std::vector<SaplingNoteEntry> saplingEntries;
+    std::set<libzcash::PaymentAddress> noFilter;
+    wallet.GetFilteredNotes(sproutEntries, saplingEntries, noFilter, -1);
+    ASSERT_EQ(2, sproutEntries.size());
+    EXPECT_EQ(std::min(jsops[0], jsops[1]), sproutEntries[0].jsop);
+
+    for (size_t i = 0; i < sks.size(); i++) {
+        // Repeated calls return the note from the cache
+        for (int n = 0; n < 2; n++) {
+            sproutEntries.clear();
+            std::set<libzcash::PaymentAddress> filter {sks[i].address()};
+            wallet.GetFilteredNotes(sproutEntries, saplingEntries, filter, -1);
+            ASSERT_EQ(1, sproutEntries.size());
+            EXPECT_EQ(jsops[i], sproutEntries[0].jsop);
+            EXPECT_EQ(sks[i].address(), sproutEntries[0].address);
+            EXPECT_EQ((i + 1) * 10, sproutEntries[0].note.value());
+            EXPECT_EQ(-1, sproutEntries[0].confirmations);
+        }
+    }
+
+    sproutEntries.clear();
+    std::set<libzcash::PaymentAddress> unknown {libzcash::SproutSpendingKey::random().address()};
+    wallet.GetFilteredNotes(sproutEntries, saplingEntries, unknown, -1);
+    EXPECT_EQ(0, sproutEntries.size());
+    EXPECT_EQ(0, saplingEntries.size());
+}
+
+
+TEST(WalletTests, CachedBalances) {
+    SelectParams(CBaseChainParams::REGTEST);
+    CWallet wallet;
+    CKey tsk = AddTestCKeyToKeyStore(wallet);
+    auto scriptPubKey = GetScriptForDestination(tsk.GetPubKey().GetID());
+
+    auto makeTx = [&](CAmount value, uint32_t nLockTime) {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        mtx.vout.push_back(CTxOut(value, scriptPubKey));
+        mtx.nLockTime = nLockTime;
+        return CWalletTx(&wallet, mtx);
+    };
+
+    auto wtx1 = makeTx(5 * COIN, 0);
+    CBlock block;
+    block.vtx.push_back(wtx1);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    auto blockHash = block.GetHash();
+    CBlockIndex fakeIndex {block};
+    mapBlockIndex.insert(std::make_pair(blockHash, &fakeIndex));
+    chainActive.SetTip(&fakeIndex);
+
+    {
+        LOCK2(cs_main, wallet.cs_wallet);
+        wtx1.SetMerkleBranch(block);
+        wallet.AddToWallet(wtx1, true, NULL);
+    }
+    EXPECT_EQ(5 * COIN, wallet.GetBalance());
+    EXPECT_EQ(0, wallet.GetUnconfirmedBalance());
+    EXPECT_EQ(0, wallet.GetWatchOnlyBalance());
+
+    // Adding a transaction invalidates the cached balances
+    auto wtx2 = makeTx(3 * COIN, 0);
+    {
+        LOCK2(cs_main, wallet.cs_wallet);
+        wtx2.hashBlock = blockHash;
+        wtx2.nIndex = 0;
+        wallet.AddToWallet(wtx2, true, NULL);
+    }
+    EXPECT_EQ(8 * COIN, wallet.GetBalance());
+
+    // Transactions that are not final yet are counted on every call
+    auto wtx3 = makeTx(2 * COIN, 100);
+    {
+        LOCK2(cs_main, wallet.cs_wallet);
+        wallet.AddToWallet(wtx3, true, NULL);
+    }
+    CWalletBalances balances = wallet.GetBalances();
+    EXPECT_EQ(8 * COIN, balances.balance);
+    EXPECT_EQ(2 * COIN, balances.unconfirmedBalance);
+    EXPECT_EQ(0, balances.immatureBalance);
+
+    // Changing the tip invalidates the cached balances
+    chainActive.SetTip(NULL);
+    EXPECT_EQ(0, wallet.GetBalance());
+    chainActive.SetTip(&fakeIndex);
+    EXPECT_EQ(8 * COIN, wallet.GetBalance());
+
+    // Tear down
+    chainActive.SetTip(NULL);
+    mapBlockIndex.erase(blockHash);
+}
+
+TEST(WalletTests, PageOutSettledTransactions) {
+    SelectParams(CBaseChainParams::REGTEST);
+    TestWallet wallet;
+    CKey tsk = AddTestCKeyToKeyStore(wallet);
+    auto scriptPubKey = GetScriptForDestination(tsk.GetPubKey().GetID());
+    CKey otherKey;
+    otherKey.MakeNewKey(true);
+    auto scriptOther = GetScriptForDestination(otherKey.GetPubKey().GetID());
+
+    // wtxReceive pays us, wtxSpend spends that output to someone else, and
+    // the output of wtxUnspent is never spent
+    CMutableTransaction mtxReceive;
+    mtxReceive.vin.resize(1);
+    mtxReceive.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    mtxReceive.vout.push_back(CTxOut(5 * COIN, scriptPubKey));
+    CWalletTx wtxReceive(&wallet, mtxReceive);
+
+    CMutableTransaction mtxSpend;
+    mtxSpend.vin.resize(1);
+    mtxSpend.vin[0].prevout = COutPoint(wtxReceive.GetHash(), 0);
+    mtxSpend.vout.push_back(CTxOut(4 * COIN, scriptOther));
+    CWalletTx wtxSpend(&wallet, mtxSpend);
+
+    CMutableTransaction mtxUnspent = mtxReceive;
+    mtxUnspent.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    CWalletTx wtxUnspent(&wallet, mtxUnspent);
+
+    CBlock block;
+    block.vtx.push_back(wtxReceive);
+    block.vtx.push_back(wtxSpend);
+    block.vtx.push_back(wtxUnspent);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    auto blockHash = block.GetHash();
+
+    std::vector<CBlockIndex> vIndex(MAX_REORG_LENGTH + 1);
+    vIndex[0].hashMerkleRoot = block.hashMerkleRoot;
+    for (size_t i = 1; i < vIndex.size(); i++) {
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = &vIndex[i - 1];
+    }
+    mapBlockIndex.insert(std::make_pair(blockHash, &vIndex[0]));
+
+    FakeSettledTxDB walletdb;
+    {
+        LOCK2(cs_main, wallet.cs_wallet);
+        for (CWalletTx* pwtx : {&wtxReceive, &wtxSpend, &wtxUnspent}) {
+            pwtx->SetMerkleBranch(block);
+            wallet.AddToWallet(*pwtx, true, NULL);
+        }
+
+        // Transactions that can still be reorged out stay in memory
+        chainActive.SetTip(&vIndex[MAX_REORG_LENGTH - 1]);
+        wallet.PageOutSettledTxs(walletdb);
+        EXPECT_EQ(3, wallet.mapWallet.size());
+        EXPECT_TRUE(walletdb.mapSummaries.empty());
+
+        chainActive.SetTip(&vIndex[MAX_REORG_LENGTH]);
+        wallet.PageOutSettledTxs(walletdb);
+        EXPECT_EQ(1, wallet.mapWallet.size());
+        EXPECT_EQ(1, wallet.mapWallet.count(wtxUnspent.GetHash()));
+        EXPECT_EQ(2, wallet.mapSettledTxs.size());
+        EXPECT_EQ(2, walletdb.mapSummaries.size());
+
+        // Spends of settled outputs are still recognized
+        EXPECT_TRUE(wallet.IsSpent(wtxReceive.GetHash(), 0));
+        EXPECT_EQ(ISMINE_SPENDABLE, wallet.IsMine(wtxSpend.vin[0]));
+        EXPECT_EQ(5 * COIN, wallet.GetDebit(wtxSpend.vin[0], ISMINE_SPENDABLE));
+    }
+    EXPECT_EQ(5 * COIN, wallet.GetBalance());
+
+    // A wallet loaded from the summaries does the same, and does not add
+    // the settled transactions again when they are rescanned
+    TestWallet wallet2;
+    wallet2.AddKey(tsk);
+    {
+        LOCK2(cs_main, wallet2.cs_wallet);
+        for (const auto& item : walletdb.mapSummaries) {
+            wallet2.LoadSettledTx(item.first, item.second);
+        }
+        EXPECT_TRUE(wallet2.IsSpent(wtxReceive.GetHash(), 0));
+        EXPECT_EQ(5 * COIN, wallet2.GetDebit(wtxSpend.vin[0], ISMINE_SPENDABLE));
+        EXPECT_FALSE(wallet2.AddToWalletIfInvolvingMe(wtxReceive, &block, 0, true));
+        EXPECT_EQ(0, wallet2.mapWallet.size());
+    }
+
+    // Tear down
+    chainActive.SetTip(NULL);
+    mapBlockIndex.erase(blockHash);
+}
 
 TEST(WalletTests, SetSproutNoteAddrsInCWalletTx) {
     auto sk = libzcash::SproutSpendingKey::random();
@@ -948,6 +1213,13 @@ TEST(WalletTests, NavigateFromSaplingNullifierToNote) {
         EXPECT_EQ(op.n, wallet.mapSaplingNullifiersToNotes[nf].n);
     }
 
+    // Updating again keeps the nullifiers computed at the note positions
+    wallet.UpdateSaplingNullifierNoteMapForBlock(&block);
+    EXPECT_EQ(2, wallet.mapSaplingNullifiersToNotes.size());
+    for (mapSaplingNoteData_t::value_type &item : wallet.mapWallet[hash].mapSaplingNoteData) {
+        EXPECT_TRUE(wtx.mapSaplingNoteData[item.first].nullifier == item.second.nullifier);
+    }
+
     // Tear down
     chainActive.SetTip(NULL);
     mapBlockIndex.erase(blockHash);
@@ -1298,6 +1570,63 @@ TEST(WalletTests, CachedWitnessesChainTip) {
     }
 }
 
+TEST(WalletTests, WitnessesOfSpentNotesDroppedBeyondReorg) {
+    TestWallet wallet;
+    LOCK(wallet.cs_wallet);
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+
+    CBlock block1;
+    CBlockIndex index1(block1);
+    index1.nHeight = 1;
+    auto outpts = CreateValidBlock(wallet, sk, index1, block1, sproutTree, saplingTree);
+    JSOutPoint jsoutpt = outpts.first;
+    SaplingOutPoint saplingOutPoint = outpts.second;
+    const SproutNoteData& nd = wallet.mapWallet[jsoutpt.hash].mapSproutNoteData[jsoutpt];
+    const SaplingNoteData& saplingNd = wallet.mapWallet[saplingOutPoint.hash].mapSaplingNoteData[saplingOutPoint];
+    ASSERT_TRUE((bool) nd.nullifier);
+
+    // The Sprout note is spent in the second block
+    CMutableTransaction mtx;
+    mtx.nVersion = 2;
+    mtx.vJoinSplit.resize(1);
+    mtx.vJoinSplit[0].nullifiers[0] = *nd.nullifier;
+    CBlock block2;
+    block2.vtx.push_back(CTransaction(mtx));
+    CBlockIndex index2(block2);
+    index2.nHeight = 2;
+    SproutMerkleTree sproutTree2 = sproutTree;
+    SaplingMerkleTree saplingTree2 = saplingTree;
+    wallet.IncrementNoteWitnesses(&index2, &block2, sproutTree2, saplingTree2);
+
+    // Disconnecting the block undoes the spend, and reconnecting it redoes it
+    wallet.DecrementNoteWitnesses(&index2);
+    wallet.IncrementNoteWitnesses(&index2, &block2, sproutTree, saplingTree);
+
+    const int nFinalHeight = 2 + MAX_REORG_LENGTH;
+    CBlock emptyBlock;
+    for (int nHeight = 3; nHeight < nFinalHeight; nHeight++) {
+        CBlockIndex index(emptyBlock);
+        index.nHeight = nHeight;
+        wallet.IncrementNoteWitnesses(&index, &emptyBlock, sproutTree, saplingTree);
+    }
+    EXPECT_FALSE(nd.witnesses.empty());
+    EXPECT_EQ(nFinalHeight - 1, nd.witnessHeight);
+
+    // Once the spend can no longer be reorged out, the witnesses are dropped
+    CBlockIndex index(emptyBlock);
+    index.nHeight = nFinalHeight;
+    wallet.IncrementNoteWitnesses(&index, &emptyBlock, sproutTree, saplingTree);
+    EXPECT_TRUE(nd.witnesses.empty());
+    EXPECT_EQ(-1, nd.witnessHeight);
+
+    // The unspent note is still being tracked
+    EXPECT_EQ(nFinalHeight, saplingNd.witnessHeight);
+}
+
 TEST(WalletTests, CachedWitnessesDecrementFirst) {
     TestWallet wallet;
     LOCK(wallet.cs_wallet);
@@ -1550,6 +1879,9 @@ TEST(WalletTests, WriteWitnessCache) {
     mapSproutNoteData_t noteData;
     JSOutPoint jsoutpt {wtx.GetHash(), 0, 1};
     SproutNoteData nd {sk.address(), nullifier};
+    SproutMerkleTree tree;
+    tree.append(note.cm());
+    nd.witnesses.push_front(tree.witness());
     noteData[jsoutpt] = nd;
     wtx.SetSproutNoteData(noteData);
     wallet.AddToWallet(wtx, true, NULL);
@@ -1561,20 +1893,29 @@ TEST(WalletTests, WriteWitnessCache) {
     EXPECT_CALL(walletdb, TxnBegin())
         .WillRepeatedly(Return(true));
 
-    // WriteTx fails
-    EXPECT_CALL(walletdb, WriteTx(wtx.GetHash(), wtx))
+    // WriteSproutWitnesses fails
+    EXPECT_CALL(walletdb, WriteSproutWitnesses(jsoutpt, ::testing::_))
         .WillOnce(Return(false));
     EXPECT_CALL(walletdb, TxnAbort())
         .Times(1);
     wallet.SetBestChain(walletdb, loc);
 
-    // WriteTx throws
-    EXPECT_CALL(walletdb, WriteTx(wtx.GetHash(), wtx))
+    // WriteSproutWitnesses throws
+    EXPECT_CALL(walletdb, WriteSproutWitnesses(jsoutpt, ::testing::_))
         .WillOnce(ThrowLogicError());
     EXPECT_CALL(walletdb, TxnAbort())
         .Times(1);
     wallet.SetBestChain(walletdb, loc);
-    EXPECT_CALL(walletdb, WriteTx(wtx.GetHash(), wtx))
+    EXPECT_CALL(walletdb, WriteSproutWitnesses(jsoutpt, ::testing::_))
+        .WillRepeatedly(Return(true));
+
+    // WriteWitnessCacheHeight fails
+    EXPECT_CALL(walletdb, WriteWitnessCacheHeight(-1))
+        .WillOnce(Return(false));
+    EXPECT_CALL(walletdb, TxnAbort())
+        .Times(1);
+    wallet.SetBestChain(walletdb, loc);
+    EXPECT_CALL(walletdb, WriteWitnessCacheHeight(-1))
         .WillRepeatedly(Return(true));
 
     // WriteWitnessCacheSize fails
@@ -1620,7 +1961,7 @@ TEST(WalletTests, WriteWitnessCache) {
     wallet.SetBestChain(walletdb, loc);
 }
 
-TEST(WalletTests, SetBestChainIgnoresTxsWithoutShieldedData) {
+TEST(WalletTests, SetBestChainLeavesTransactionsUntouched) {
     SelectParams(CBaseChainParams::REGTEST);
 
     TestWallet wallet;
@@ -1681,18 +2022,17 @@ TEST(WalletTests, SetBestChainIgnoresTxsWithoutShieldedData) {
     CWalletTx wtxSaplingTransparent {nullptr, mtxSaplingTransparent};
     wallet.AddToWallet(wtxSaplingTransparent, true, nullptr);
 
+    // The notes have no witnesses yet, so there is nothing to write for them
     EXPECT_CALL(walletdb, TxnBegin())
         .WillOnce(Return(true));
-    EXPECT_CALL(walletdb, WriteTx(wtxTransparent.GetHash(), wtxTransparent))
+    EXPECT_CALL(walletdb, WriteTx(::testing::_, ::testing::_))
         .Times(0);
-    EXPECT_CALL(walletdb, WriteTx(wtxSprout.GetHash(), wtxSprout))
-        .Times(1).WillOnce(Return(true));
-    EXPECT_CALL(walletdb, WriteTx(wtxSproutTransparent.GetHash(), wtxSproutTransparent))
+    EXPECT_CALL(walletdb, WriteSproutWitnesses(::testing::_, ::testing::_))
         .Times(0);
-    EXPECT_CALL(walletdb, WriteTx(wtxSapling.GetHash(), wtxSapling))
-        .Times(1).WillOnce(Return(true));
-    EXPECT_CALL(walletdb, WriteTx(wtxSaplingTransparent.GetHash(), wtxSaplingTransparent))
+    EXPECT_CALL(walletdb, WriteSaplingWitnesses(::testing::_, ::testing::_))
         .Times(0);
+    EXPECT_CALL(walletdb, WriteWitnessCacheHeight(-1))
+        .WillOnce(Return(true));
     EXPECT_CALL(walletdb, WriteWitnessCacheSize(0))
         .WillOnce(Return(true));
     EXPECT_CALL(walletdb, WriteBestBlock(loc))
@@ -1702,6 +2042,175 @@ TEST(WalletTests, SetBestChainIgnoresTxsWithoutShieldedData) {
     wallet.SetBestChain(walletdb, loc);
 }
 
+TEST(WalletTests, SetBestChainWritesOnlyChangedWitnesses) {
+    TestWallet wallet;
+    LOCK(wallet.cs_wallet);
+    MockWalletDB walletdb;
+    CBlockLocator loc;
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+
+    EXPECT_CALL(walletdb, TxnBegin())
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, TxnCommit())
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteWitnessCacheSize(::testing::_))
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteBestBlock(loc))
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteTx(::testing::_, ::testing::_))
+        .Times(0);
+
+    // The first flush writes every witnessed note
+    CBlock block1;
+    CBlockIndex index1(block1);
+    index1.nHeight = 1;
+    auto outpts1 = CreateValidBlock(wallet, sk, index1, block1, sproutTree, saplingTree);
+    EXPECT_CALL(walletdb, WriteSproutWitnesses(outpts1.first, ::testing::_))
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteSaplingWitnesses(outpts1.second, ::testing::_))
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteWitnessCacheDelta(::testing::_, ::testing::_))
+        .Times(0);
+    EXPECT_CALL(walletdb, WriteWitnessCacheHeight(1))
+        .WillOnce(Return(true));
+    wallet.SetBestChain(walletdb, loc);
+
+    // Then only the new note and the commitments of the new block
+    CBlock block2;
+    CBlockIndex index2(block2);
+    index2.nHeight = 2;
+    auto outpts2 = CreateValidBlock(wallet, sk, index2, block2, sproutTree, saplingTree);
+    EXPECT_CALL(walletdb, WriteSproutWitnesses(outpts1.first, ::testing::_))
+        .Times(0);
+    EXPECT_CALL(walletdb, WriteSaplingWitnesses(outpts1.second, ::testing::_))
+        .Times(0);
+    EXPECT_CALL(walletdb, WriteSproutWitnesses(outpts2.first, ::testing::_))
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteSaplingWitnesses(outpts2.second, ::testing::_))
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteWitnessCacheDelta(2, ::testing::_))
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteWitnessCacheHeight(2))
+        .WillOnce(Return(true));
+    wallet.SetBestChain(walletdb, loc);
+
+    // Disconnecting the block drops the records that depend on it
+    wallet.DecrementNoteWitnesses(&index2);
+    EXPECT_CALL(walletdb, WriteSproutWitnesses(::testing::_, ::testing::_))
+        .Times(0);
+    EXPECT_CALL(walletdb, WriteSaplingWitnesses(::testing::_, ::testing::_))
+        .Times(0);
+    EXPECT_CALL(walletdb, EraseSproutWitnesses(outpts2.first))
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, EraseSaplingWitnesses(outpts2.second))
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, EraseWitnessCacheDelta(2))
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteWitnessCacheHeight(1))
+        .WillOnce(Return(true));
+    wallet.SetBestChain(walletdb, loc);
+}
+
+TEST(WalletTests, LoadWitnessCache) {
+    TestWallet wallet;
+    LOCK(wallet.cs_wallet);
+    FakeWitnessDB walletdb;
+    CBlockLocator loc;
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+
+    std::vector<JSOutPoint> sproutNotes;
+    std::vector<SaplingOutPoint> saplingNotes;
+    int nHeight = 0;
+    for (int i = 0; i < 3; i++) {
+        CBlock block;
+        CBlockIndex index(block);
+        index.nHeight = ++nHeight;
+        auto outpts = CreateValidBlock(wallet, sk, index, block, sproutTree, saplingTree);
+        sproutNotes.push_back(outpts.first);
+        saplingNotes.push_back(outpts.second);
+        if (i != 1) {
+            wallet.SetBestChain(walletdb, loc);
+        }
+    }
+    // Enough blocks for the first records to be rewritten
+    while (nHeight < (int)WITNESS_CACHE_SIZE + 2) {
+        CBlock block;
+        CBlockIndex index(block);
+        index.nHeight = ++nHeight;
+        wallet.IncrementNoteWitnesses(&index, &block, sproutTree, saplingTree);
+        if (nHeight % 10 == 0) {
+            wallet.SetBestChain(walletdb, loc);
+        }
+    }
+    wallet.SetBestChain(walletdb, loc);
+    EXPECT_TRUE(walletdb.nWitnessCacheHeight == nHeight);
+    EXPECT_EQ(3, walletdb.mapSproutWitnesses.size());
+    EXPECT_EQ(3, walletdb.mapSaplingWitnesses.size());
+    // Deltas below the oldest record have been erased
+    int nMinRecordHeight = nHeight;
+    for (const auto& item : walletdb.mapSproutWitnesses) {
+        nMinRecordHeight = std::min(nMinRecordHeight, item.second.witnessHeight);
+    }
+    EXPECT_LT(nHeight - nMinRecordHeight, 2 * (int)WITNESS_CACHE_SIZE);
+    ASSERT_FALSE(walletdb.mapWitnessDeltas.empty());
+    EXPECT_EQ(nMinRecordHeight + 1, walletdb.mapWitnessDeltas.begin()->first);
+
+    {
+        // Load the same transactions with stale witnesses into another wallet
+        TestWallet wallet2;
+        LOCK(wallet2.cs_wallet);
+        for (const auto& wtxItem : wallet.mapWallet) {
+            CWalletTx wtx = wtxItem.second;
+            for (auto& item : wtx.mapSproutNoteData) {
+                item.second.witnesses.clear();
+                item.second.witnessHeight = -1;
+            }
+            for (auto& item : wtx.mapSaplingNoteData) {
+                item.second.witnesses.clear();
+                item.second.witnessHeight = -1;
+            }
+            wallet2.AddToWallet(wtx, true, NULL);
+        }
+        wallet2.nWitnessCacheSize = walletdb.nWitnessCacheSize;
+        EXPECT_TRUE(wallet2.LoadWitnessCache(walletdb.nWitnessCacheHeight, walletdb.mapSproutWitnesses,
+                                             walletdb.mapSaplingWitnesses, walletdb.mapWitnessDeltas));
+
+        for (const auto& jsop : sproutNotes) {
+            const auto& nd = wallet.mapWallet[jsop.hash].mapSproutNoteData[jsop];
+            const auto& nd2 = wallet2.mapWallet[jsop.hash].mapSproutNoteData[jsop];
+            EXPECT_EQ(nd.witnessHeight, nd2.witnessHeight);
+            EXPECT_TRUE(nd.witnesses == nd2.witnesses);
+        }
+        for (const auto& op : saplingNotes) {
+            const auto& nd = wallet.mapWallet[op.hash].mapSaplingNoteData[op];
+            const auto& nd2 = wallet2.mapWallet[op.hash].mapSaplingNoteData[op];
+            EXPECT_EQ(nd.witnessHeight, nd2.witnessHeight);
+            EXPECT_TRUE(nd.witnesses == nd2.witnesses);
+        }
+    }
+
+    {
+        // A missing delta cannot be replayed
+        walletdb.mapWitnessDeltas.erase(nHeight);
+        TestWallet wallet3;
+        LOCK(wallet3.cs_wallet);
+        for (const auto& wtxItem : wallet.mapWallet) {
+            wallet3.AddToWallet(wtxItem.second, true, NULL);
+        }
+        wallet3.nWitnessCacheSize = walletdb.nWitnessCacheSize;
+        EXPECT_FALSE(wallet3.LoadWitnessCache(walletdb.nWitnessCacheHeight, walletdb.mapSproutWitnesses,
+                                              walletdb.mapSaplingWitnesses, walletdb.mapWitnessDeltas));
+    }
+}
+
 TEST(WalletTests, UpdateSproutNullifierNoteMap) {
     TestWallet wallet;
     LOCK(wallet.cs_wallet);
@@ -2106,3 +2615,43 @@ TEST(WalletTests, SaplingNoteLocking) {
     EXPECT_FALSE(wallet.IsLockedNote(sop1));
     EXPECT_FALSE(wallet.IsLockedNote(sop2));
 }
+
+TEST(WalletTests, TxUpdates) {
+    CWalletTxUpdates updates(3);
+    uint256 hash1 = GetRandHash();
+    uint256 hash2 = GetRandHash();
+    uint256 hash3 = GetRandHash();
+    std::vector<uint256> vHashes;
+    uint64_t nNextCursor;
+
+    // Nothing to wait for yet
+    uint64_t nCursor = updates.GetCursor();
+    EXPECT_FALSE(updates.Wait(nCursor, 1));
+    EXPECT_TRUE(updates.GetSince(nCursor, vHashes, nNextCursor));
+    EXPECT_TRUE(vHashes.empty());
+    EXPECT_EQ(nNextCursor, nCursor);
+
+    // Each transaction is reported once, in order
+    updates.Add(hash1);
+    updates.Add(hash2);
+    updates.Add(hash1);
+    EXPECT_TRUE(updates.Wait(nCursor, 1));
+    EXPECT_TRUE(updates.GetSince(nCursor, vHashes, nNextCursor));
+    EXPECT_EQ(vHashes, std::vector<uint256>({hash1, hash2}));
+    EXPECT_EQ(nNextCursor, updates.GetCursor());
+
+    // Continuing from the returned cursor only reports later changes
+    nCursor = nNextCursor;
+    updates.Add(hash3);
+    EXPECT_TRUE(updates.GetSince(nCursor, vHashes, nNextCursor));
+    EXPECT_EQ(vHashes, std::vector<uint256>({hash3}));
+
+    // The first changes have been dropped from the log
+    EXPECT_FALSE(updates.GetSince(nCursor - 3, vHashes, nNextCursor));
+    EXPECT_EQ(vHashes, std::vector<uint256>({hash2, hash1, hash3}));
+
+    // A cursor from the future is not valid either
+    EXPECT_TRUE(updates.Wait(nNextCursor + 1, 1));
+    EXPECT_FALSE(updates.GetSince(nNextCursor + 1, vHashes, nNextCursor));
+    EXPECT_TRUE(vHashes.empty());
+}
@@ -0,0 +1,436 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "wallet/logdb.h"
+
+#include "clientversion.h"
+#include "crypto/common.h"
+#include "hash.h"
+#include "util.h"
+
+#include <string.h>
+
+#include <boost/filesystem.hpp>
+
+/** Length and checksum in front of every batch */
+static const size_t LOGDB_BATCH_HEADER_SIZE = 8;
+static const unsigned char LOGDB_OP_WRITE = 1;
+static const unsigned char LOGDB_OP_ERASE = 2;
+/** Rewrite() copies the live records in batches of about this size */
+static const size_t LOGDB_REWRITE_BATCH_SIZE = 1 << 20;
+
+static uint32_t BatchChecksum(const char* pbegin, const char* pend)
+{
+    uint256 hash = Hash(pbegin, pend);
+    return ReadLE32(hash.begin());
+}
+
+void CLogBatch::Write(const CDataStream& ssKey, const CDataStream& ssValue)
+{
+    Op op;
+    op.fErase = false;
+    op.vchKey.assign(ssKey.begin(), ssKey.end());
+    op.vchValue.assign(ssValue.begin(), ssValue.end());
+    vOps.push_back(std::move(op));
+}
+
+void CLogBatch::Erase(const CDataStream& ssKey)
+{
+    Op op;
+    op.fErase = true;
+    op.vchKey.assign(ssKey.begin(), ssKey.end());
+    vOps.push_back(std::move(op));
+}
+
+bool CLogBatch::Find(const CDataStream& ssKey, bool& fErased, CDataStream* pssValue) const
+{
+    std::vector<unsigned char> vchKey(ssKey.begin(), ssKey.end());
+    for (auto it = vOps.rbegin(); it != vOps.rend(); ++it) {
+        if (it->vchKey == vchKey) {
+            fErased = it->fErase;
+            if (!fErased && pssValue) {
+                pssValue->clear();
+                pssValue->write(it->vchValue.data(), it->vchValue.size());
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+CLogDB::CLogDB(const boost::filesystem::path& pathIn) :
+    path(pathIn), file(NULL), nFileSize(0), nDeadBytes(0)
+{
+}
+
+CLogDB::~CLogDB()
+{
+    Close();
+}
+
+bool CLogDB::IsLogFile(const boost::filesystem::path& path)
+{
+    FILE* f = fopen(path.string().c_str(), "rb");
+    if (!f) {
+        return false;
+    }
+    unsigned char magic[sizeof(LOGDB_MAGIC)];
+    bool fMatch = fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+                  memcmp(magic, LOGDB_MAGIC, sizeof(magic)) == 0;
+    fclose(f);
+    return fMatch;
+}
+
+bool CLogDB::Open(bool fCreate)
+{
+    LOCK(cs);
+    if (file) {
+        return true;
+    }
+    index.clear();
+    nDeadBytes = 0;
+
+    file = fopen(path.string().c_str(), "r+b");
+    if (!file) {
+        if (!fCreate || boost::filesystem::exists(path)) {
+            return error("%s: unable to open %s", __func__, path.string());
+        }
+        file = fopen(path.string().c_str(), "w+b");
+        if (!file) {
+            return error("%s: unable to create %s", __func__, path.string());
+        }
+        if (fwrite(LOGDB_MAGIC, 1, sizeof(LOGDB_MAGIC), file) != sizeof(LOGDB_MAGIC)) {
+            Close();
+            return error("%s: unable to write to %s", __func__, path.string());
+        }
+        FileCommit(file);
+        nFileSize = sizeof(LOGDB_MAGIC);
+        return true;
+    }
+
+    if (!Load()) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+bool CLogDB::Load()
+{
+    AssertLockHeld(cs);
+    unsigned char magic[sizeof(LOGDB_MAGIC)];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+        memcmp(magic, LOGDB_MAGIC, sizeof(magic)) != 0) {
+        return error("%s: %s is not a wallet log file", __func__, path.string());
+    }
+
+    uint64_t nPos = sizeof(LOGDB_MAGIC);
+    fseek(file, 0, SEEK_END);
+    uint64_t nEnd = ftell(file);
+    fseek(file, nPos, SEEK_SET);
+
+    // Only the last batch may be incomplete: a batch that does not fit in
+    // what is left of the file is a torn write, but one that fails its
+    // checksum with more data after it means the file is corrupt.
+    CSerializeData vchPayload;
+    while (nPos < nEnd) {
+        unsigned char header[LOGDB_BATCH_HEADER_SIZE];
+        if (nEnd - nPos < sizeof(header)) {
+            break;
+        }
+        if (fread(header, 1, sizeof(header), file) != sizeof(header)) {
+            return error("%s: unable to read %s at %d", __func__, path.string(), nPos);
+        }
+        uint32_t nSize = ReadLE32(header);
+        if (nSize > nEnd - nPos - sizeof(header)) {
+            break;
+        }
+        vchPayload.resize(nSize);
+        if (nSize > 0 && fread(vchPayload.data(), 1, nSize, file) != nSize) {
+            return error("%s: unable to read %s at %d", __func__, path.string(), nPos);
+        }
+        if (BatchChecksum(vchPayload.data(), vchPayload.data() + nSize) != ReadLE32(header + 4)) {
+            if (nPos + sizeof(header) + nSize < nEnd) {
+                return error("%s: corrupt batch at %d in %s, followed by %d more bytes", __func__,
+                             nPos, path.string(), nEnd - (nPos + sizeof(header) + nSize));
+            }
+            break;
+        }
+
+        // Apply the batch to the index
+        uint64_t nPayloadPos = nPos + sizeof(header);
+        CDataStream ss(vchPayload.begin(), vchPayload.end(), SER_DISK, CLIENT_VERSION);
+        try {
+            while (!ss.empty()) {
+                unsigned char nOp;
+                std::vector<unsigned char> vchKey;
+                ss >> nOp >> vchKey;
+                Index::iterator it = index.find(vchKey);
+                if (it != index.end()) {
+                    nDeadBytes += it->first.size() + it->second.nSize;
+                }
+                if (nOp == LOGDB_OP_WRITE) {
+                    uint64_t nValueSize = ReadCompactSize(ss);
+                    if (nValueSize > ss.size()) {
+                        throw std::ios_base::failure("value out of range");
+                    }
+                    CValuePos pos;
+                    pos.nPos = nPayloadPos + (nSize - ss.size());
+                    pos.nSize = nValueSize;
+                    ss.ignore(nValueSize);
+                    index[vchKey] = pos;
+                } else if (nOp == LOGDB_OP_ERASE) {
+                    nDeadBytes += vchKey.size();
+                    if (it != index.end()) {
+                        index.erase(it);
+                    }
+                } else {
+                    throw std::ios_base::failure("unknown operation");
+                }
+            }
+        } catch (const std::exception& e) {
+            // The checksum matched, so this is not a torn write
+            return error("%s: corrupt batch at %d in %s: %s", __func__, nPos, path.string(), e.what());
+        }
+        nPos = nPayloadPos + nSize;
+    }
+
+    if (nPos < nEnd) {
+        // Drop a batch that was not completely written, e.g. because of a
+        // crash, so that later batches are not appended after it.
+        LogPrintf("%s: discarding %d bytes of incomplete data at the end of %s\n", __func__, nEnd - nPos, path.string());
+        fflush(file);
+        if (!TruncateFile(file, nPos)) {
+            return error("%s: unable to truncate %s", __func__, path.string());
+        }
+        FileCommit(file);
+    }
+    nFileSize = nPos;
+    LogPrint("db", "%s: loaded %u records from %s (%d bytes, %d replaced)\n", __func__, index.size(), path.string(), nFileSize, nDeadBytes);
+    return true;
+}
+
+void CLogDB::Close()
+{
+    LOCK(cs);
+    if (file) {
+        FileCommit(file);
+        fclose(file);
+        file = NULL;
+    }
+    index.clear();
+}
+
+bool CLogDB::IsOpen() const
+{
+    LOCK(cs);
+    return file != NULL;
+}
+
+bool CLogDB::ReadValue(const CValuePos& pos, CDataStream& ssValue) const
+{
+    AssertLockHeld(cs);
+    ssValue.clear();
+    ssValue.resize(pos.nSize);
+    if (fseek(file, pos.nPos, SEEK_SET) != 0 ||
+        (pos.nSize > 0 && fread(&ssValue[0], 1, pos.nSize, file) != pos.nSize)) {
+        clearerr(file);
+        return error("%s: unable to read %u bytes at %d in %s", __func__, pos.nSize, pos.nPos, path.string());
+    }
+    return true;
+}
+
+bool CLogDB::Read(const CDataStream& ssKey, CDataStream& ssValue) const
+{
+    LOCK(cs);
+    if (!file) {
+        return false;
+    }
+    Index::const_iterator it = index.find(std::vector<unsigned char>(ssKey.begin(), ssKey.end()));
+    if (it == index.end()) {
+        return false;
+    }
+    return ReadValue(it->second, ssValue);
+}
+
+bool CLogDB::Exists(const CDataStream& ssKey) const
+{
+    LOCK(cs);
+    return file && index.count(std::vector<unsigned char>(ssKey.begin(), ssKey.end()));
+}
+
+bool CLogDB::ReadNext(CDataStream& ssKey, CDataStream& ssValue, bool fInclusive) const
+{
+    LOCK(cs);
+    if (!file) {
+        return false;
+    }
+    std::vector<unsigned char> vchKey(ssKey.begin(), ssKey.end());
+    Index::const_iterator it = fInclusive ? index.lower_bound(vchKey) : index.upper_bound(vchKey);
+    if (it == index.end()) {
+        return false;
+    }
+    ssKey.clear();
+    ssKey.write((const char*)it->first.data(), it->first.size());
+    return ReadValue(it->second, ssValue);
+}
+
+bool CLogDB::Append(const CLogBatch& batch, bool fSync)
+{
+    AssertLockHeld(cs);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss.resize(LOGDB_BATCH_HEADER_SIZE);
+    std::vector<std::pair<size_t, size_t>> vValueOffsets;
+    for (const CLogBatch::Op& op : batch.vOps) {
+        ss << (op.fErase ? LOGDB_OP_ERASE : LOGDB_OP_WRITE) << op.vchKey;
+        if (!op.fErase) {
+            WriteCompactSize(ss, op.vchValue.size());
+            vValueOffsets.push_back(std::make_pair(ss.size(), op.vchValue.size()));
+            ss.write(op.vchValue.data(), op.vchValue.size());
+        }
+    }
+    uint32_t nSize = ss.size() - LOGDB_BATCH_HEADER_SIZE;
+    WriteLE32((unsigned char*)&ss[0], nSize);
+    WriteLE32((unsigned char*)&ss[4], BatchChecksum(&ss[LOGDB_BATCH_HEADER_SIZE], &ss[0] + ss.size()));
+
+    if (fseek(file, nFileSize, SEEK_SET) != 0 ||
+        fwrite(&ss[0], 1, ss.size(), file) != ss.size() ||
+        fflush(file) != 0) {
+        clearerr(file);
+        return error("%s: unable to write to %s", __func__, path.string());
+    }
+    if (fSync) {
+        FileCommit(file);
+    }
+
+    // Update the index only once the batch has been written
+    auto itOffset = vValueOffsets.begin();
+    for (const CLogBatch::Op& op : batch.vOps) {
+        Index::iterator it = index.find(op.vchKey);
+        if (it != index.end()) {
+            nDeadBytes += it->first.size() + it->second.nSize;
+        }
+        if (op.fErase) {
+            nDeadBytes += op.vchKey.size();
+            if (it != index.end()) {
+                index.erase(it);
+            }
+        } else {
+            CValuePos pos;
+            pos.nPos = nFileSize + itOffset->first;
+            pos.nSize = itOffset->second;
+            index[op.vchKey] = pos;
+            ++itOffset;
+        }
+    }
+    nFileSize += ss.size();
+    return true;
+}
+
+bool CLogDB::Write(const CLogBatch& batch, bool fSync)
+{
+    LOCK(cs);
+    if (!file) {
+        return false;
+    }
+    if (batch.Empty()) {
+        return true;
+    }
+    return Append(batch, fSync);
+}
+
+void CLogDB::Sync()
+{
+    LOCK(cs);
+    if (file) {
+        FileCommit(file);
+    }
+}
+
+bool CLogDB::ShouldCompact() const
+{
+    LOCK(cs);
+    return nFileSize >= LOGDB_MIN_COMPACT_SIZE && nDeadBytes > nFileSize / 2;
+}
+
+bool CLogDB::Rewrite(const char* pszSkip)
+{
+    LOCK(cs);
+    if (!file) {
+        return false;
+    }
+    LogPrintf("%s: rewriting %s...\n", __func__, path.string());
+
+    boost::filesystem::path pathNew = path;
+    pathNew += ".rewrite";
+    CLogDB dbNew(pathNew);
+    boost::filesystem::remove(pathNew);
+    if (!dbNew.Open(true)) {
+        return false;
+    }
+
+    // The key of the record holding the version written by CDB::WriteVersion
+    CDataStream ssVersionKey(SER_DISK, CLIENT_VERSION);
+    ssVersionKey << std::string("version");
+    std::vector<unsigned char> vchVersionKey(ssVersionKey.begin(), ssVersionKey.end());
+
+    bool fSuccess = true;
+    size_t nSkipLen = pszSkip ? strlen(pszSkip) : 0;
+    CLogBatch batch;
+    size_t nBatchSize = 0;
+    for (Index::const_iterator it = index.begin(); fSuccess && it != index.end(); ++it) {
+        if (pszSkip && memcmp(it->first.data(), pszSkip, std::min(it->first.size(), nSkipLen)) == 0) {
+            continue;
+        }
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.write((const char*)it->first.data(), it->first.size());
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        if (it->first == vchVersionKey) {
+            ssValue << CLIENT_VERSION;
+        } else if (!ReadValue(it->second, ssValue)) {
+            fSuccess = false;
+            break;
+        }
+        batch.Write(ssKey, ssValue);
+        nBatchSize += it->first.size() + ssValue.size();
+        if (nBatchSize >= LOGDB_REWRITE_BATCH_SIZE) {
+            fSuccess = dbNew.Write(batch, false);
+            batch.Clear();
+            nBatchSize = 0;
+        }
+    }
+    if (fSuccess) {
+        fSuccess = dbNew.Write(batch, false);
+    }
+    dbNew.Close();
+    if (!fSuccess) {
+        boost::filesystem::remove(pathNew);
+        return error("%s: failed to rewrite %s", __func__, path.string());
+    }
+
+    fclose(file);
+    file = NULL;
+    if (!RenameOver(pathNew, path)) {
+        LogPrintf("%s: unable to replace %s\n", __func__, path.string());
+    }
+    file = fopen(path.string().c_str(), "r+b");
+    index.clear();
+    nDeadBytes = 0;
+    if (!file || !Load()) {
+        return error("%s: unable to reopen %s", __func__, path.string());
+    }
+    return true;
+}
+
+size_t CLogDB::Size() const
+{
+    LOCK(cs);
+    return index.size();
+}
+
+uint64_t CLogDB::FileSize() const
+{
+    LOCK(cs);
+    return nFileSize;
+}
@@ -0,0 +1,126 @@
+// Copyright (c) 2020 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_WALLET_LOGDB_H
+#define ZCASH_WALLET_LOGDB_H
+
+#include "serialize.h"
+#include "streams.h"
+#include "sync.h"
+
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+/** Values for -walletbackend */
+static const char* const WALLET_BACKEND_BDB = "bdb";
+static const char* const WALLET_BACKEND_LOG = "log";
+static const char* const DEFAULT_WALLET_BACKEND = WALLET_BACKEND_BDB;
+
+/** Bytes at the start of every append-only log wallet file */
+static const unsigned char LOGDB_MAGIC[8] = {'z', 'w', 'a', 'l', 'l', 'o', 'g', 0x01};
+/** Files smaller than this are never compacted automatically */
+static const uint64_t LOGDB_MIN_COMPACT_SIZE = 16 << 20;
+
+/** A group of writes that CLogDB applies atomically */
+class CLogBatch
+{
+public:
+    struct Op {
+        bool fErase;
+        std::vector<unsigned char> vchKey;
+        //! Values can hold private keys, so they are wiped when freed
+        CSerializeData vchValue;
+    };
+    std::vector<Op> vOps;
+
+    void Write(const CDataStream& ssKey, const CDataStream& ssValue);
+    void Erase(const CDataStream& ssKey);
+    void Clear() { vOps.clear(); }
+    bool Empty() const { return vOps.empty(); }
+
+    /**
+     * Look up the latest write to ssKey in this batch. Returns false if the
+     * batch does not touch the key; otherwise fErased tells whether it was
+     * erased and, if not, ssValue is set to the value written.
+     */
+    bool Find(const CDataStream& ssKey, bool& fErased, CDataStream* pssValue) const;
+};
+
+/**
+ * Wallet storage as an append-only log of write batches.
+ *
+ * Each batch is stored as its length, a checksum and the serialized
+ * operations, and is applied atomically: a batch that was only partly
+ * written before a crash fails its checksum and is truncated away when the
+ * file is next opened. Opening the file reads the keys and the positions of
+ * the values into an index sorted like BerkeleyDB's btree, and values are
+ * only read from disk when they are looked up. Overwritten and erased
+ * records are dropped by Rewrite(), which copies the live records to a new
+ * file.
+ */
+class CLogDB
+{
+private:
+    struct CValuePos {
+        uint64_t nPos;
+        uint32_t nSize;
+    };
+    typedef std::map<std::vector<unsigned char>, CValuePos> Index;
+
+    mutable CCriticalSection cs;
+    boost::filesystem::path path;
+    FILE* file;
+    Index index;
+    uint64_t nFileSize;
+    //! Bytes of the file taken up by records that have been replaced
+    uint64_t nDeadBytes;
+
+    bool Load();
+    bool Append(const CLogBatch& batch, bool fSync);
+    bool ReadValue(const CValuePos& pos, CDataStream& ssValue) const;
+
+public:
+    explicit CLogDB(const boost::filesystem::path& pathIn);
+    ~CLogDB();
+
+    /** Whether the file at path starts with LOGDB_MAGIC. */
+    static bool IsLogFile(const boost::filesystem::path& path);
+
+    /** Open the file, creating it if fCreate is set and it does not exist. */
+    bool Open(bool fCreate);
+    void Close();
+    bool IsOpen() const;
+
+    bool Read(const CDataStream& ssKey, CDataStream& ssValue) const;
+    bool Exists(const CDataStream& ssKey) const;
+    /** Append batch to the file; with fSync, wait until it is on disk. */
+    bool Write(const CLogBatch& batch, bool fSync);
+
+    /**
+     * Read the first record whose key is not less than ssKey (fInclusive)
+     * or greater than it (!fInclusive). Returns false at the end.
+     */
+    bool ReadNext(CDataStream& ssKey, CDataStream& ssValue, bool fInclusive) const;
+
+    /** Flush written batches to disk. */
+    void Sync();
+
+    /** Whether more than half of a large file is taken up by replaced records. */
+    bool ShouldCompact() const;
+    /**
+     * Copy the live records to a new file and replace this one with it,
+     * skipping keys that start with pszSkip and updating the stored version.
+     */
+    bool Rewrite(const char* pszSkip = NULL);
+
+    size_t Size() const;
+    uint64_t FileSize() const;
+};
+
+#endif // ZCASH_WALLET_LOGDB_H
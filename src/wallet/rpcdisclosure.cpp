@@ -93,10 +93,12 @@ UniValue z_getpaymentdisclosure(const UniValue& params, bool fHelp)
     }
 
     // Check is mine
-    if (!pwalletMain->mapWallet.count(hash)) {
+    std::shared_ptr<const CWalletTx> pwtxSettled = pwalletMain->GetSettledTx(hash);
+    const CWalletTx* pwtx = pwtxSettled ? pwtxSettled.get() : pwalletMain->GetWalletTx(hash);
+    if (!pwtx) {
         throw JSONRPCError(RPC_MISC_ERROR, "Transaction does not belong to the wallet");
     }
-    const CWalletTx& wtx = pwalletMain->mapWallet[hash];
+    const CWalletTx& wtx = *pwtx;
 
     // Check if shielded tx
     if (wtx.vJoinSplit.empty()) {
@@ -29,7 +29,9 @@
 #include "utiltime.h"
 #include "asyncrpcoperation.h"
 #include "asyncrpcqueue.h"
+#include "wallet/asyncrpcoperation_consolidate.h"
 #include "wallet/asyncrpcoperation_mergetoaddress.h"
+#include "wallet/asyncrpcoperation_payoutbatch.h"
 #include "wallet/asyncrpcoperation_saplingmigration.h"
 #include "wallet/asyncrpcoperation_sendmany.h"
 #include "wallet/asyncrpcoperation_shieldcoinbase.h"
@@ -194,15 +196,11 @@ CTxDestination GetAccountAddress(std::string strAccount, bool bForceNew=false)
     if (account.vchPubKey.IsValid())
     {
         CScript scriptPubKey = GetScriptForDestination(account.vchPubKey.GetID());
-        for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin();
-             it != pwalletMain->mapWallet.end() && account.vchPubKey.IsValid();
-             ++it)
-        {
-            const CWalletTx& wtx = (*it).second;
+        pwalletMain->ForEachWalletTx([&](const CWalletTx& wtx) {
             BOOST_FOREACH(const CTxOut& txout, wtx.vout)
                 if (txout.scriptPubKey == scriptPubKey)
                     bKeyUsed = true;
-        }
+        });
     }
 
     // Generate a new key
@@ -656,17 +654,15 @@ UniValue getreceivedbyaddress(const UniValue& params, bool fHelp)
 
     // Tally
     CAmount nAmount = 0;
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
-    {
-        const CWalletTx& wtx = (*it).second;
+    pwalletMain->ForEachWalletTx([&](const CWalletTx& wtx) {
         if (wtx.IsCoinBase() || !CheckFinalTx(wtx))
-            continue;
+            return;
 
         BOOST_FOREACH(const CTxOut& txout, wtx.vout)
             if (txout.scriptPubKey == scriptPubKey)
                 if (wtx.GetDepthInMainChain() >= nMinDepth)
                     nAmount += txout.nValue;
-    }
+    });
 
     // inZat
     if (params.size() > 2 && params[2].get_bool()) {
@@ -716,11 +712,9 @@ UniValue getreceivedbyaccount(const UniValue& params, bool fHelp)
 
     // Tally
     CAmount nAmount = 0;
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
-    {
-        const CWalletTx& wtx = (*it).second;
+    pwalletMain->ForEachWalletTx([&](const CWalletTx& wtx) {
         if (wtx.IsCoinBase() || !CheckFinalTx(wtx))
-            continue;
+            return;
 
         BOOST_FOREACH(const CTxOut& txout, wtx.vout)
         {
@@ -729,7 +723,7 @@ UniValue getreceivedbyaccount(const UniValue& params, bool fHelp)
                 if (wtx.GetDepthInMainChain() >= nMinDepth)
                     nAmount += txout.nValue;
         }
-    }
+    });
 
     // inZat
     if (params.size() > 2 && params[2].get_bool()) {
@@ -745,11 +739,9 @@ CAmount GetAccountBalance(CWalletDB& walletdb, const string& strAccount, int nMi
     CAmount nBalance = 0;
 
     // Tally wallet transactions
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
-    {
-        const CWalletTx& wtx = (*it).second;
+    pwalletMain->ForEachWalletTx([&](const CWalletTx& wtx) {
         if (!CheckFinalTx(wtx) || wtx.GetBlocksToMaturity() > 0 || wtx.GetDepthInMainChain() < 0)
-            continue;
+            return;
 
         CAmount nReceived, nSent, nFee;
         wtx.GetAccountAmounts(strAccount, nReceived, nSent, nFee, filter);
@@ -757,7 +749,7 @@ CAmount GetAccountBalance(CWalletDB& walletdb, const string& strAccount, int nMi
         if (nReceived != 0 && wtx.GetDepthInMainChain() >= nMinDepth)
             nBalance += nReceived;
         nBalance -= nSent + nFee;
-    }
+    });
 
     // Tally internal accounting entries
     nBalance += walletdb.GetAccountCreditDebit(strAccount);
@@ -815,11 +807,9 @@ UniValue getbalance(const UniValue& params, bool fHelp)
         // (GetBalance() sums up all unspent TxOuts)
         // getbalance and "getbalance * 1 true" should return the same number
         CAmount nBalance = 0;
-        for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
-        {
-            const CWalletTx& wtx = (*it).second;
+        pwalletMain->ForEachWalletTx([&](const CWalletTx& wtx) {
             if (!CheckFinalTx(wtx) || wtx.GetBlocksToMaturity() > 0 || wtx.GetDepthInMainChain() < 0)
-                continue;
+                return;
 
             CAmount allFee;
             string strSentAccount;
@@ -834,7 +824,7 @@ UniValue getbalance(const UniValue& params, bool fHelp)
             BOOST_FOREACH(const COutputEntry& s, listSent)
                 nBalance -= s.amount;
             nBalance -= allFee;
-        }
+        });
 
         // inZat
         if (params.size() > 3 && params[3].get_bool()) {
@@ -1210,15 +1200,13 @@ UniValue ListReceived(const UniValue& params, bool fByAccounts)
 
     // Tally
     std::map<CTxDestination, tallyitem> mapTally;
-    for (const std::pair<uint256, CWalletTx>& pairWtx : pwalletMain->mapWallet) {
-        const CWalletTx& wtx = pairWtx.second;
-
+    pwalletMain->ForEachWalletTx([&](const CWalletTx& wtx) {
         if (wtx.IsCoinBase() || !CheckFinalTx(wtx))
-            continue;
+            return;
 
         int nDepth = wtx.GetDepthInMainChain();
         if (nDepth < nMinDepth)
-            continue;
+            return;
 
         BOOST_FOREACH(const CTxOut& txout, wtx.vout)
         {
@@ -1237,7 +1225,7 @@ UniValue ListReceived(const UniValue& params, bool fByAccounts)
             if (mine & ISMINE_WATCH_ONLY)
                 item.fIsWatchonly = true;
         }
-    }
+    });
 
     KeyIO keyIO(Params());
 
@@ -1572,16 +1560,33 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
 
     std::list<CAccountingEntry> acentries;
     CWallet::TxItems txOrdered = pwalletMain->OrderedTxItems(acentries, strAccount);
+    // Settled transactions are read back from the wallet file as they are reached
+    std::multimap<int64_t, uint256> settledOrdered;
+    for (const auto& item : pwalletMain->mapSettledTxs)
+        settledOrdered.insert(std::make_pair(item.second.nOrderPos, item.first));
 
     // iterate backwards until we have nCount items to return:
-    for (CWallet::TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
+    CWallet::TxItems::reverse_iterator it = txOrdered.rbegin();
+    std::multimap<int64_t, uint256>::reverse_iterator sit = settledOrdered.rbegin();
+    while (it != txOrdered.rend() || sit != settledOrdered.rend())
     {
-        CWalletTx *const pwtx = (*it).second.first;
-        if (pwtx != 0)
-            ListTransactions(*pwtx, strAccount, 0, true, ret, filter);
-        CAccountingEntry *const pacentry = (*it).second.second;
-        if (pacentry != 0)
-            AcentryToJSON(*pacentry, strAccount, ret);
+        if (sit != settledOrdered.rend() && (it == txOrdered.rend() || sit->first > it->first))
+        {
+            std::shared_ptr<const CWalletTx> pwtx = pwalletMain->GetSettledTx(sit->second);
+            if (pwtx)
+                ListTransactions(*pwtx, strAccount, 0, true, ret, filter);
+            ++sit;
+        }
+        else
+        {
+            CWalletTx *const pwtx = (*it).second.first;
+            if (pwtx != 0)
+                ListTransactions(*pwtx, strAccount, 0, true, ret, filter);
+            CAccountingEntry *const pacentry = (*it).second.second;
+            if (pacentry != 0)
+                AcentryToJSON(*pacentry, strAccount, ret);
+            ++it;
+        }
 
         if ((int)ret.size() >= (nCount+nFrom)) break;
     }
@@ -1655,16 +1660,14 @@ UniValue listaccounts(const UniValue& params, bool fHelp)
             mapAccountBalances[entry.second.name] = 0;
     }
 
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
-    {
-        const CWalletTx& wtx = (*it).second;
+    pwalletMain->ForEachWalletTx([&](const CWalletTx& wtx) {
         CAmount nFee;
         string strSentAccount;
         list<COutputEntry> listReceived;
         list<COutputEntry> listSent;
         int nDepth = wtx.GetDepthInMainChain();
         if (wtx.GetBlocksToMaturity() > 0 || nDepth < 0)
-            continue;
+            return;
         wtx.GetAmounts(listReceived, listSent, nFee, strSentAccount, includeWatchonly);
         mapAccountBalances[strSentAccount] -= nFee;
         BOOST_FOREACH(const COutputEntry& s, listSent)
@@ -1677,7 +1680,7 @@ UniValue listaccounts(const UniValue& params, bool fHelp)
                 else
                     mapAccountBalances[""] += r.amount;
         }
-    }
+    });
 
     list<CAccountingEntry> acentries;
     CWalletDB(pwalletMain->strWalletFile).ListAccountCreditDebit("*", acentries);
@@ -1767,13 +1770,10 @@ UniValue listsinceblock(const UniValue& params, bool fHelp)
 
     UniValue transactions(UniValue::VARR);
 
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
-    {
-        CWalletTx tx = (*it).second;
-
+    pwalletMain->ForEachWalletTx([&](const CWalletTx& tx) {
         if (depth == -1 || tx.GetDepthInMainChain() < depth)
             ListTransactions(tx, "*", 0, true, transactions, filter);
-    }
+    });
 
     CBlockIndex *pblockLast = chainActive[chainActive.Height() + 1 - target_confirms];
     uint256 lastblock = pblockLast ? pblockLast->GetBlockHash() : uint256();
@@ -1785,6 +1785,76 @@ UniValue listsinceblock(const UniValue& params, bool fHelp)
     return ret;
 }
 
+UniValue waitforwallettx(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() > 2)
+        throw runtime_error(
+            "waitforwallettx ( cursor timeout )\n"
+            "\nWaits for transactions to be added to the wallet or updated, for example when they are mined,\n"
+            "conflicted or disconnected, and returns the ones changed since cursor.\n"
+            "\nArguments:\n"
+            "1. cursor    (numeric, optional) The cursor returned by the previous call. Defaults to now.\n"
+            "2. timeout   (numeric, optional, default=0) Time in milliseconds to wait for, 0 for no timeout\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"cursor\": n,             (numeric) The cursor to pass to the next call\n"
+            "  \"complete\": true|false,  (boolean) False if some changes since cursor are no longer known, for\n"
+            "                           example after a restart. The caller should then rescan with listsinceblock.\n"
+            "  \"transactions\": [        (array of string) The ids of the transactions changed since cursor\n"
+            "    \"txid\", ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("waitforwallettx", "")
+            + HelpExampleCli("waitforwallettx", "1596106234000000 60000")
+            + HelpExampleRpc("waitforwallettx", "1596106234000000, 60000")
+        );
+
+    CWalletTxUpdates& updates = pwalletMain->txUpdates;
+    uint64_t nCursor = updates.GetCursor();
+    if (params.size() > 0 && !params[0].isNull()) {
+        int64_t n = params[0].get_int64();
+        if (n < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+        nCursor = n;
+    }
+
+    int64_t nTimeout = 0;
+    if (params.size() > 1)
+        nTimeout = params[1].get_int64();
+    if (nTimeout < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative timeout");
+
+    // Wait without cs_wallet, a second at a time so that shutdown is noticed
+    int64_t nDeadline = GetTimeMillis() + nTimeout;
+    while (IsRPCRunning()) {
+        int64_t nWait = 1000;
+        if (nTimeout > 0)
+            nWait = std::min(nWait, nDeadline - GetTimeMillis());
+        if (nWait <= 0 || updates.Wait(nCursor, nWait))
+            break;
+    }
+    if (!IsRPCRunning())
+        throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down");
+
+    std::vector<uint256> vHashes;
+    uint64_t nNextCursor;
+    bool fComplete = updates.GetSince(nCursor, vHashes, nNextCursor);
+
+    UniValue transactions(UniValue::VARR);
+    for (const uint256& hash : vHashes)
+        transactions.push_back(hash.GetHex());
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("cursor", nNextCursor);
+    ret.pushKV("complete", fComplete);
+    ret.pushKV("transactions", transactions);
+    return ret;
+}
+
 UniValue gettransaction(const UniValue& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
@@ -1851,9 +1921,11 @@ UniValue gettransaction(const UniValue& params, bool fHelp)
             filter = filter | ISMINE_WATCH_ONLY;
 
     UniValue entry(UniValue::VOBJ);
-    if (!pwalletMain->mapWallet.count(hash))
+    std::shared_ptr<const CWalletTx> pwtxSettled = pwalletMain->GetSettledTx(hash);
+    const CWalletTx* pwtx = pwtxSettled ? pwtxSettled.get() : pwalletMain->GetWalletTx(hash);
+    if (!pwtx)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid or non-wallet transaction id");
-    const CWalletTx& wtx = pwalletMain->mapWallet[hash];
+    const CWalletTx& wtx = *pwtx;
 
     CAmount nCredit = wtx.GetCredit(filter);
     CAmount nDebit = wtx.GetDebit(filter);
@@ -2373,12 +2445,13 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
 
     UniValue obj(UniValue::VOBJ);
     obj.pushKV("walletversion", pwalletMain->GetVersion());
-    obj.pushKV("balance",       ValueFromAmount(pwalletMain->GetBalance()));
-    obj.pushKV("unconfirmed_balance", ValueFromAmount(pwalletMain->GetUnconfirmedBalance()));
-    obj.pushKV("immature_balance",    ValueFromAmount(pwalletMain->GetImmatureBalance()));
+    CWalletBalances balances = pwalletMain->GetBalances();
+    obj.pushKV("balance",       ValueFromAmount(balances.balance));
+    obj.pushKV("unconfirmed_balance", ValueFromAmount(balances.unconfirmedBalance));
+    obj.pushKV("immature_balance",    ValueFromAmount(balances.immatureBalance));
     obj.pushKV("shielded_balance",    FormatMoney(getBalanceZaddr("", 1, INT_MAX)));
     obj.pushKV("shielded_unconfirmed_balance", FormatMoney(getBalanceZaddr("", 0, 0)));
-    obj.pushKV("txcount",       (int)pwalletMain->mapWallet.size());
+    obj.pushKV("txcount",       (int)(pwalletMain->mapWallet.size() + pwalletMain->mapSettledTxs.size()));
     obj.pushKV("keypoololdest", pwalletMain->GetOldestKeyPoolTime());
     obj.pushKV("keypoolsize",   (int)pwalletMain->GetKeyPoolSize());
     if (pwalletMain->IsCrypted())
@@ -3416,12 +3489,19 @@ struct txblock
 
     txblock(uint256 hash)
     {
+        std::shared_ptr<const CWalletTx> pwtxSettled;
+        const CWalletTx* pwtx = nullptr;
         if (pwalletMain->mapWallet.count(hash)) {
-            const CWalletTx& wtx = pwalletMain->mapWallet[hash];
-            if (!wtx.hashBlock.IsNull())
-                height = mapBlockIndex[wtx.hashBlock]->nHeight;
-            index = wtx.nIndex;
-            time = wtx.GetTxTime();
+            pwtx = &pwalletMain->mapWallet[hash];
+        } else {
+            pwtxSettled = pwalletMain->GetSettledTx(hash);
+            pwtx = pwtxSettled.get();
+        }
+        if (pwtx) {
+            if (!pwtx->hashBlock.IsNull())
+                height = mapBlockIndex[pwtx->hashBlock]->nHeight;
+            index = pwtx->nIndex;
+            time = pwtx->GetTxTime();
         }
     }
 };
@@ -3724,9 +3804,11 @@ UniValue z_viewtransaction(const UniValue& params, bool fHelp)
     hash.SetHex(params[0].get_str());
 
     UniValue entry(UniValue::VOBJ);
-    if (!pwalletMain->mapWallet.count(hash))
+    std::shared_ptr<const CWalletTx> pwtxSettled = pwalletMain->GetSettledTx(hash);
+    const CWalletTx* pwtx = pwtxSettled ? pwtxSettled.get() : pwalletMain->GetWalletTx(hash);
+    if (!pwtx)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid or non-wallet transaction id");
-    const CWalletTx& wtx = pwalletMain->mapWallet[hash];
+    const CWalletTx& wtx = *pwtx;
 
     entry.pushKV("txid", hash.GetHex());
 
@@ -3763,7 +3845,12 @@ UniValue z_viewtransaction(const UniValue& params, bool fHelp)
                 continue;
             }
             auto jsop = res->second;
-            auto wtxPrev = pwalletMain->mapWallet.at(jsop.hash);
+            std::shared_ptr<const CWalletTx> pwtxPrevSettled = pwalletMain->GetSettledTx(jsop.hash);
+            const CWalletTx* pwtxPrev = pwtxPrevSettled ? pwtxPrevSettled.get() : pwalletMain->GetWalletTx(jsop.hash);
+            if (!pwtxPrev) {
+                continue;
+            }
+            const CWalletTx& wtxPrev = *pwtxPrev;
 
             auto decrypted = wtxPrev.DecryptSproutNote(jsop);
             auto notePt = decrypted.first;
@@ -3821,7 +3908,12 @@ UniValue z_viewtransaction(const UniValue& params, bool fHelp)
             continue;
         }
         auto op = res->second;
-        auto wtxPrev = pwalletMain->mapWallet.at(op.hash);
+        std::shared_ptr<const CWalletTx> pwtxPrevSettled = pwalletMain->GetSettledTx(op.hash);
+        const CWalletTx* pwtxPrev = pwtxPrevSettled ? pwtxPrevSettled.get() : pwalletMain->GetWalletTx(op.hash);
+        if (!pwtxPrev) {
+            continue;
+        }
+        const CWalletTx& wtxPrev = *pwtxPrev;
 
         // We don't need to check the leadbyte here: if wtx exists in
         // the wallet, it must have been successfully decrypted. This
@@ -4306,6 +4398,319 @@ UniValue z_sendmany(const UniValue& params, bool fHelp)
     return operationId;
 }
 
+UniValue z_sendmanybatched(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() < 2 || params.size() > 4)
+        throw runtime_error(
+            "z_sendmanybatched \"fromaddress\" [{\"address\":... ,\"amount\":...},...] ( minconf ) ( fee )\n"
+            "\nQueue payments to be sent together with other z_sendmanybatched payments from the same address."
+            "\nPayments with the same fromaddress, minconf and fee that arrive within -payoutbatchwindow seconds"
+            + strprintf(" (default: %d) are joined into one operation.", DEFAULT_PAYOUT_BATCH_WINDOW) +
+            "\nThe operation selects notes or utxos once per transaction and sends the payments in as few transactions"
+            "\nas the transaction size limit allows. Only taddrs and Sapling zaddrs are supported."
+            + HelpRequiringPassphrase() + "\n"
+            "\nArguments:\n"
+            "1. \"fromaddress\"         (string, required) The taddr or Sapling zaddr to send the funds from.\n"
+            "2. \"amounts\"             (array, required) An array of json objects representing the amounts to send.\n"
+            "    [{\n"
+            "      \"address\":address  (string, required) The address is a taddr or Sapling zaddr\n"
+            "      \"amount\":amount    (numeric, required) The numeric amount in " + CURRENCY_UNIT + " is the value\n"
+            "      \"memo\":memo        (string, optional) If the address is a zaddr, raw data represented in hexadecimal string format\n"
+            "    }, ... ]\n"
+            "3. minconf               (numeric, optional, default=1) Only use funds confirmed at least this many times.\n"
+            "4. fee                   (numeric, optional, default="
+            + strprintf("%s", FormatMoney(ASYNC_RPC_OPERATION_DEFAULT_MINERS_FEE)) + ") The fee amount to attach to each transaction of the batch.\n"
+            "\nResult:\n"
+            "\"operationid\"          (string) The operationid of the batch, shared by all payments in it. Its result lists\n"
+            "                         each transaction sent, with its txid or error and the number of outputs.\n"
+            "\nExamples:\n"
+            + HelpExampleCli("z_sendmanybatched", "\"ztestsapling19rnyu293v44f0kvtmszhx35lpdug574twc0lwyf4s7w0umtkrdq5nfcauxrxcyfmh3m7slemqsj\" '[{\"address\": \"t1M72Sfpbz1BPpXFHz9m3CdqATR44Jvaydd\" ,\"amount\": 5.0}]'")
+            + HelpExampleRpc("z_sendmanybatched", "\"ztestsapling19rnyu293v44f0kvtmszhx35lpdug574twc0lwyf4s7w0umtkrdq5nfcauxrxcyfmh3m7slemqsj\", [{\"address\": \"t1M72Sfpbz1BPpXFHz9m3CdqATR44Jvaydd\" ,\"amount\": 5.0}]")
+        );
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    ThrowIfInitialBlockDownload();
+
+    int nextBlockHeight = chainActive.Height() + 1;
+    if (!Params().GetConsensus().NetworkUpgradeActive(nextBlockHeight, Consensus::UPGRADE_SAPLING)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot batch payments before Sapling has activated");
+    }
+
+    // Check that the from address is valid.
+    auto fromaddress = params[0].get_str();
+    KeyIO keyIO(Params());
+    if (!IsValidDestination(keyIO.DecodeDestination(fromaddress))) {
+        auto res = keyIO.DecodePaymentAddress(fromaddress);
+        if (!IsValidPaymentAddress(res)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid from address, should be a taddr or zaddr.");
+        }
+        if (boost::get<libzcash::SaplingPaymentAddress>(&res) == nullptr) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Sprout addresses are not supported by z_sendmanybatched");
+        }
+        if (!boost::apply_visitor(HaveSpendingKeyForPaymentAddress(pwalletMain), res)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "From address does not belong to this node, zaddr spending key not found.");
+        }
+    }
+
+    UniValue outputs = params[1].get_array();
+    if (outputs.size()==0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, amounts array is empty.");
+
+    std::vector<SendManyRecipient> taddrRecipients;
+    std::vector<SendManyRecipient> zaddrRecipients;
+    CAmount nTotalOut = 0;
+    for (const UniValue& o : outputs.getValues()) {
+        if (!o.isObject())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, expected object");
+
+        // sanity check, report error if unknown key-value pairs
+        for (const string& name_ : o.getKeys()) {
+            if (name_ != "address" && name_ != "amount" && name_ != "memo")
+                throw JSONRPCError(RPC_INVALID_PARAMETER, string("Invalid parameter, unknown key: ") + name_);
+        }
+
+        string address = find_value(o, "address").get_str();
+        bool isZaddr = false;
+        if (!IsValidDestination(keyIO.DecodeDestination(address))) {
+            auto res = keyIO.DecodePaymentAddress(address);
+            if (!IsValidPaymentAddress(res)) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, string("Invalid parameter, unknown address format: ") + address);
+            }
+            if (boost::get<libzcash::SaplingPaymentAddress>(&res) == nullptr) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Sprout addresses are not supported by z_sendmanybatched");
+            }
+            isZaddr = true;
+        }
+
+        UniValue memoValue = find_value(o, "memo");
+        string memo;
+        if (!memoValue.isNull()) {
+            memo = memoValue.get_str();
+            if (!isZaddr) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Memo cannot be used with a taddr.  It can only be used with a zaddr.");
+            } else if (!IsHex(memo)) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, expected memo data in hexadecimal format.");
+            }
+            if (memo.length() > ZC_MEMO_SIZE*2) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER,  strprintf("Invalid parameter, size of memo is larger than maximum allowed %d", ZC_MEMO_SIZE ));
+            }
+        }
+
+        CAmount nAmount = AmountFromValue(find_value(o, "amount"));
+        if (nAmount < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, amount must be positive");
+
+        if (isZaddr) {
+            zaddrRecipients.push_back( SendManyRecipient(address, nAmount, memo) );
+        } else {
+            taddrRecipients.push_back( SendManyRecipient(address, nAmount, memo) );
+        }
+        nTotalOut += nAmount;
+    }
+
+    // Minimum confirmations
+    int nMinDepth = 1;
+    if (params.size() > 2) {
+        nMinDepth = params[2].get_int();
+    }
+    if (nMinDepth < 0) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Minimum number of confirmations cannot be less than 0");
+    }
+    if (nMinDepth == 0 && !IsValidDestination(keyIO.DecodeDestination(fromaddress))) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Minconf cannot be zero when sending from zaddr");
+    }
+
+    // Fee per transaction of the batch
+    CAmount nFee = ASYNC_RPC_OPERATION_DEFAULT_MINERS_FEE;
+    if (params.size() > 3) {
+        if (params[3].get_real() == 0.0) {
+            nFee = 0;
+        } else {
+            nFee = AmountFromValue( params[3] );
+        }
+
+        // Check that the user specified fee is not absurd, as in z_sendmany
+        if (nTotalOut < ASYNC_RPC_OPERATION_DEFAULT_MINERS_FEE) {
+            if (nFee > ASYNC_RPC_OPERATION_DEFAULT_MINERS_FEE) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Small transaction amount %s has fee %s that is greater than the default fee %s", FormatMoney(nTotalOut), FormatMoney(nFee), FormatMoney(ASYNC_RPC_OPERATION_DEFAULT_MINERS_FEE)));
+            }
+        } else if (nFee > nTotalOut) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Fee %s is greater than the sum of outputs %s and also greater than the default fee", FormatMoney(nFee), FormatMoney(nTotalOut)));
+        }
+    }
+
+    return QueuePayouts(fromaddress, nMinDepth, nFee, taddrRecipients, zaddrRecipients);
+}
+
+UniValue z_consolidatenotes(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() < 2 || params.size() > 5)
+        throw runtime_error(
+            "z_consolidatenotes [\"fromaddress\", ... ] \"toaddress\" ( fee ) ( notes_per_tx ) ( max_notes )\n"
+            "\nMerge many Sapling notes into a single note of a Sapling address in this wallet."
+            "\n\nThe whole merge is planned up front as a tree of transactions. The transactions of each level are built in"
+            "\nparallel and sent, and once they have been mined the next level merges their outputs. The notes being merged"
+            "\nare locked until the operation finishes. Progress is reported by z_getoperationstatus."
+            + HelpRequiringPassphrase() + "\n"
+            "\nArguments:\n"
+            "1. fromaddresses         (array, required) A JSON array with Sapling zaddrs, or \"ANY_SAPLING\" to merge notes from\n"
+            "                         any Sapling zaddr belonging to the wallet.\n"
+            "2. \"toaddress\"           (string, required) The Sapling zaddr to send the funds to. Its spending key must be in the wallet.\n"
+            "3. fee                   (numeric, optional, default="
+            + strprintf("%s", FormatMoney(CONSOLIDATE_DEFAULT_MINERS_FEE)) + ") The fee of each merge transaction.\n"
+            "4. notes_per_tx          (numeric, optional, default="
+            + strprintf("%d", CONSOLIDATE_DEFAULT_NOTES_PER_TX) + ") The maximum number of notes spent by each transaction.\n"
+            "5. max_notes             (numeric, optional, default=0) Limit on the number of notes to merge, largest first. 0 for no limit.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"notes\": xxx           (numeric) Number of notes being merged.\n"
+            "  \"value\": xxx           (numeric) Value of the notes being merged.\n"
+            "  \"levels\": [ n, ... ]   (array) Number of transactions at each level of the merge tree.\n"
+            "  \"fees\": xxx            (numeric) Total fees of the planned transactions.\n"
+            "  \"opid\": xxx            (string) An operationid to pass to z_getoperationstatus to get the result of the operation.\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("z_consolidatenotes", "'[\"ANY_SAPLING\"]' ztestsapling19rnyu293v44f0kvtmszhx35lpdug574twc0lwyf4s7w0umtkrdq5nfcauxrxcyfmh3m7slemqsj")
+            + HelpExampleRpc("z_consolidatenotes", "[\"ANY_SAPLING\"], \"ztestsapling19rnyu293v44f0kvtmszhx35lpdug574twc0lwyf4s7w0umtkrdq5nfcauxrxcyfmh3m7slemqsj\"")
+        );
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    ThrowIfInitialBlockDownload();
+
+    if (!Params().GetConsensus().NetworkUpgradeActive(chainActive.Height() + 1, Consensus::UPGRADE_SAPLING)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, Sapling has not activated");
+    }
+
+    KeyIO keyIO(Params());
+    bool useAnySapling = false;
+    std::set<libzcash::PaymentAddress> zaddrs;
+    UniValue addresses = params[0].get_array();
+    if (addresses.size() == 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, fromaddresses array is empty.");
+    for (const UniValue& o : addresses.getValues()) {
+        if (!o.isStr())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, expected string");
+        std::string address = o.get_str();
+        if (address == "ANY_SAPLING") {
+            useAnySapling = true;
+            continue;
+        }
+        auto zaddr = keyIO.DecodePaymentAddress(address);
+        if (!IsValidPaymentAddress(zaddr) || boost::get<libzcash::SaplingPaymentAddress>(&zaddr) == nullptr) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, string("Invalid parameter, expected a Sapling zaddr: ") + address);
+        }
+        if (!zaddrs.insert(zaddr).second) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, string("Invalid parameter, duplicated address: ") + address);
+        }
+    }
+    if (useAnySapling && zaddrs.size() > 0) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot specify specific zaddrs when using \"ANY_SAPLING\"");
+    }
+
+    auto destaddress = keyIO.DecodePaymentAddress(params[1].get_str());
+    auto toAddress = boost::get<libzcash::SaplingPaymentAddress>(&destaddress);
+    if (!IsValidPaymentAddress(destaddress) || toAddress == nullptr) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, toaddress must be a Sapling zaddr");
+    }
+    libzcash::SaplingExtendedSpendingKey extskTo;
+    if (!pwalletMain->GetSaplingExtendedSpendingKey(*toAddress, extskTo)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Spending key for toaddress not found, it is needed to merge later levels");
+    }
+
+    CAmount nFee = CONSOLIDATE_DEFAULT_MINERS_FEE;
+    if (params.size() > 2) {
+        if (params[2].get_real() == 0.0) {
+            nFee = 0;
+        } else {
+            nFee = AmountFromValue( params[2] );
+        }
+    }
+
+    int nNotesPerTx = CONSOLIDATE_DEFAULT_NOTES_PER_TX;
+    if (params.size() > 3) {
+        nNotesPerTx = params[3].get_int();
+    }
+    // Leave room in the transaction for its output and signatures
+    int nMaxNotesPerTx = (MAX_TX_SIZE_AFTER_SAPLING - OUTPUTDESCRIPTION_SIZE - 1000) / SPENDDESCRIPTION_SIZE;
+    if (nNotesPerTx < 2 || nNotesPerTx > nMaxNotesPerTx) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Invalid parameter, notes_per_tx must be between 2 and %d", nMaxNotesPerTx));
+    }
+
+    int nMaxNotes = 0;
+    if (params.size() > 4) {
+        nMaxNotes = params[4].get_int();
+        if (nMaxNotes < 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Limit on maximum number of notes cannot be negative");
+        }
+    }
+
+    std::vector<SproutNoteEntry> sproutEntries;
+    std::vector<SaplingNoteEntry> saplingEntries;
+    pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, zaddrs);
+    std::sort(saplingEntries.begin(), saplingEntries.end(),
+        [](const SaplingNoteEntry& a, const SaplingNoteEntry& b) -> bool {
+            return a.note.value() > b.note.value();
+        });
+    if (nMaxNotes > 0 && saplingEntries.size() > (size_t)nMaxNotes) {
+        saplingEntries.erase(saplingEntries.begin() + nMaxNotes, saplingEntries.end());
+    }
+    if (saplingEntries.size() < 2) {
+        throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Could not find at least two Sapling notes to merge.");
+    }
+
+    std::vector<ConsolidationInput> inputs;
+    std::vector<CAmount> vValues;
+    CAmount nValue = 0;
+    for (const SaplingNoteEntry& entry : saplingEntries) {
+        libzcash::SaplingExtendedSpendingKey extsk;
+        if (!pwalletMain->GetSaplingExtendedSpendingKey(entry.address, extsk)) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Could not find spending key for payment address.");
+        }
+        inputs.push_back(ConsolidationInput{entry.op, entry.note, extsk.expsk});
+        vValues.push_back(entry.note.value());
+        nValue += entry.note.value();
+    }
+
+    std::vector<size_t> plan = PlanConsolidation(vValues, nNotesPerTx, nFee);
+    if (plan.empty()) {
+        throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS,
+            strprintf("Insufficient funds, some merge transactions would not cover the fee of %s", FormatMoney(nFee)));
+    }
+    size_t nTxs = 0;
+    UniValue levels(UniValue::VARR);
+    for (size_t n : plan) {
+        nTxs += n;
+        levels.push_back((uint64_t)n);
+    }
+
+    UniValue contextInfo(UniValue::VOBJ);
+    contextInfo.pushKV("fromaddresses", params[0]);
+    contextInfo.pushKV("toaddress", params[1]);
+    contextInfo.pushKV("fee", ValueFromAmount(nFee));
+    contextInfo.pushKV("notes_per_tx", nNotesPerTx);
+
+    std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
+    std::shared_ptr<AsyncRPCOperation> operation(
+        new AsyncRPCOperation_consolidate(inputs, *toAddress, plan, nFee, contextInfo) );
+    q->addOperation(operation);
+
+    UniValue o(UniValue::VOBJ);
+    o.pushKV("notes", (uint64_t)inputs.size());
+    o.pushKV("value", ValueFromAmount(nValue));
+    o.pushKV("levels", levels);
+    o.pushKV("fees", ValueFromAmount(nFee * nTxs));
+    o.pushKV("opid", operation->getId());
+    return o;
+}
+
 UniValue z_setmigration(const UniValue& params, bool fHelp) {
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
@@ -4384,8 +4789,7 @@ UniValue z_getmigrationstatus(const UniValue& params, bool fHelp) {
     CAmount finalizedMigratedAmount = 0;
     int numFinalizedMigrationTxs = 0;
     uint64_t timeStarted = 0;
-    for (const auto& txPair : pwalletMain->mapWallet) {
-        CWalletTx tx = txPair.second;
+    pwalletMain->ForEachWalletTx([&](const CWalletTx& tx) {
         // A given transaction is defined as a migration transaction iff it has:
         // * one or more Sprout JoinSplits with nonzero vpub_new field; and
         // * no Sapling Spends, and;
@@ -4399,9 +4803,9 @@ UniValue z_getmigrationstatus(const UniValue& params, bool fHelp) {
                 }
             }
             if (!nonZeroVPubNew) {
-                continue;
+                return;
             }
-            migrationTxids.push_back(txPair.first.ToString());
+            migrationTxids.push_back(tx.GetHash().ToString());
             //  A transaction is "finalized" iff it has at least 10 confirmations.
             // TODO: subject to change, if the recommended number of confirmations changes.
             if (tx.GetDepthInMainChain() >= 10) {
@@ -4412,7 +4816,7 @@ UniValue z_getmigrationstatus(const UniValue& params, bool fHelp) {
             }
             // If the transaction is in the mempool it will not be associated with a block yet
             if (tx.hashBlock.IsNull() || mapBlockIndex[tx.hashBlock] == nullptr) {
-                continue;
+                return;
             }
             CBlockIndex* blockIndex = mapBlockIndex[tx.hashBlock];
             //  The value of "time_started" is the earliest Unix timestamp of any known
@@ -4422,7 +4826,7 @@ UniValue z_getmigrationstatus(const UniValue& params, bool fHelp) {
                 timeStarted = blockIndex->GetBlockTime();
             }
         }
-    }
+    });
     migrationStatus.pushKV("unfinalized_migrated_amount", FormatMoney(unfinalizedMigratedAmount));
     migrationStatus.pushKV("finalized_migrated_amount", FormatMoney(finalizedMigratedAmount));
     migrationStatus.pushKV("finalized_migration_transactions", numFinalizedMigrationTxs);
@@ -5170,12 +5574,12 @@ UniValue z_getnotescount(const UniValue& params, bool fHelp)
 
     int sprout = 0;
     int sapling = 0;
-    for (auto& wtx : pwalletMain->mapWallet) {
-        if (wtx.second.GetDepthInMainChain() >= nMinDepth) {
-            sprout += wtx.second.mapSproutNoteData.size();
-            sapling += wtx.second.mapSaplingNoteData.size();
+    pwalletMain->ForEachWalletTx([&](const CWalletTx& wtx) {
+        if (wtx.GetDepthInMainChain() >= nMinDepth) {
+            sprout += wtx.mapSproutNoteData.size();
+            sapling += wtx.mapSaplingNoteData.size();
         }
-    }
+    });
     UniValue ret(UniValue::VOBJ);
     ret.pushKV("sprout", sprout);
     ret.pushKV("sapling", sapling);
@@ -5200,80 +5604,83 @@ extern UniValue z_getpaymentdisclosure(const UniValue& params, bool fHelp); // i
 extern UniValue z_validatepaymentdisclosure(const UniValue &params, bool fHelp);
 
 static const CRPCCommand commands[] =
-{ //  category              name                        actor (function)           okSafeMode
-    //  --------------------- ------------------------    -----------------------    ----------
-    { "rawtransactions",    "fundrawtransaction",       &fundrawtransaction,       false },
-    { "hidden",             "resendwallettransactions", &resendwallettransactions, true  },
-    { "wallet",             "addmultisigaddress",       &addmultisigaddress,       true  },
-    { "wallet",             "backupwallet",             &backupwallet,             true  },
-    { "wallet",             "dumpprivkey",              &dumpprivkey,              true  },
-    { "wallet",             "dumpwallet",               &dumpwallet,               true  },
-    { "wallet",             "encryptwallet",            &encryptwallet,            true  },
-    { "wallet",             "getaccountaddress",        &getaccountaddress,        true  },
-    { "wallet",             "getaccount",               &getaccount,               true  },
-    { "wallet",             "getaddressesbyaccount",    &getaddressesbyaccount,    true  },
-    { "wallet",             "getbalance",               &getbalance,               false },
-    { "wallet",             "getnewaddress",            &getnewaddress,            true  },
-    { "wallet",             "getrawchangeaddress",      &getrawchangeaddress,      true  },
-    { "wallet",             "getreceivedbyaccount",     &getreceivedbyaccount,     false },
-    { "wallet",             "getreceivedbyaddress",     &getreceivedbyaddress,     false },
-    { "wallet",             "gettransaction",           &gettransaction,           false },
-    { "wallet",             "getunconfirmedbalance",    &getunconfirmedbalance,    false },
-    { "wallet",             "getwalletinfo",            &getwalletinfo,            false },
-    { "wallet",             "importprivkey",            &importprivkey,            true  },
-    { "wallet",             "importwallet",             &importwallet,             true  },
-    { "wallet",             "importaddress",            &importaddress,            true  },
-    { "wallet",             "importpubkey",             &importpubkey,             true  },
-    { "wallet",             "keypoolrefill",            &keypoolrefill,            true  },
-    { "wallet",             "listaccounts",             &listaccounts,             false },
-    { "wallet",             "listaddressgroupings",     &listaddressgroupings,     false },
-    { "wallet",             "listlockunspent",          &listlockunspent,          false },
-    { "wallet",             "listreceivedbyaccount",    &listreceivedbyaccount,    false },
-    { "wallet",             "listreceivedbyaddress",    &listreceivedbyaddress,    false },
-    { "wallet",             "listsinceblock",           &listsinceblock,           false },
-    { "wallet",             "listtransactions",         &listtransactions,         false },
-    { "wallet",             "listunspent",              &listunspent,              false },
-    { "wallet",             "lockunspent",              &lockunspent,              true  },
-    { "wallet",             "move",                     &movecmd,                  false },
-    { "wallet",             "sendfrom",                 &sendfrom,                 false },
-    { "wallet",             "sendmany",                 &sendmany,                 false },
-    { "wallet",             "sendtoaddress",            &sendtoaddress,            false },
-    { "wallet",             "setaccount",               &setaccount,               true  },
-    { "wallet",             "settxfee",                 &settxfee,                 true  },
-    { "wallet",             "signmessage",              &signmessage,              true  },
-    { "wallet",             "walletlock",               &walletlock,               true  },
-    { "wallet",             "walletpassphrasechange",   &walletpassphrasechange,   true  },
-    { "wallet",             "walletpassphrase",         &walletpassphrase,         true  },
-    { "wallet",             "zcbenchmark",              &zc_benchmark,             true  },
-    { "wallet",             "zcrawkeygen",              &zc_raw_keygen,            true  },
-    { "wallet",             "zcrawjoinsplit",           &zc_raw_joinsplit,         true  },
-    { "wallet",             "zcrawreceive",             &zc_raw_receive,           true  },
-    { "wallet",             "zcsamplejoinsplit",        &zc_sample_joinsplit,      true  },
-    { "wallet",             "z_listreceivedbyaddress",  &z_listreceivedbyaddress,  false },
-    { "wallet",             "z_listunspent",            &z_listunspent,            false },
-    { "wallet",             "z_getbalance",             &z_getbalance,             false },
-    { "wallet",             "z_gettotalbalance",        &z_gettotalbalance,        false },
-    { "wallet",             "z_mergetoaddress",         &z_mergetoaddress,         false },
-    { "wallet",             "z_sendmany",               &z_sendmany,               false },
-    { "wallet",             "z_setmigration",           &z_setmigration,           false },
-    { "wallet",             "z_getmigrationstatus",     &z_getmigrationstatus,     false },
-    { "wallet",             "z_shieldcoinbase",         &z_shieldcoinbase,         false },
-    { "wallet",             "z_getoperationstatus",     &z_getoperationstatus,     true  },
-    { "wallet",             "z_getoperationresult",     &z_getoperationresult,     true  },
-    { "wallet",             "z_listoperationids",       &z_listoperationids,       true  },
-    { "wallet",             "z_getnewaddress",          &z_getnewaddress,          true  },
-    { "wallet",             "z_listaddresses",          &z_listaddresses,          true  },
-    { "wallet",             "z_exportkey",              &z_exportkey,              true  },
-    { "wallet",             "z_importkey",              &z_importkey,              true  },
-    { "wallet",             "z_exportviewingkey",       &z_exportviewingkey,       true  },
-    { "wallet",             "z_importviewingkey",       &z_importviewingkey,       true  },
-    { "wallet",             "z_exportwallet",           &z_exportwallet,           true  },
-    { "wallet",             "z_importwallet",           &z_importwallet,           true  },
-    { "wallet",             "z_viewtransaction",        &z_viewtransaction,        false },
-    { "wallet",             "z_getnotescount",          &z_getnotescount,          false },
+{ //  category              name                        actor (function)           okSafeMode readOnly
+    //  --------------------- ------------------------    -----------------------    ---------- --------
+    { "rawtransactions",    "fundrawtransaction",       &fundrawtransaction,       false,     false },
+    { "hidden",             "resendwallettransactions", &resendwallettransactions, true,      false },
+    { "wallet",             "addmultisigaddress",       &addmultisigaddress,       true,      false },
+    { "wallet",             "backupwallet",             &backupwallet,             true,      false },
+    { "wallet",             "dumpprivkey",              &dumpprivkey,              true,      false },
+    { "wallet",             "dumpwallet",               &dumpwallet,               true,      false },
+    { "wallet",             "encryptwallet",            &encryptwallet,            true,      false },
+    { "wallet",             "getaccountaddress",        &getaccountaddress,        true,      false },
+    { "wallet",             "getaccount",               &getaccount,               true,      true  },
+    { "wallet",             "getaddressesbyaccount",    &getaddressesbyaccount,    true,      true  },
+    { "wallet",             "getbalance",               &getbalance,               false,     true  },
+    { "wallet",             "getnewaddress",            &getnewaddress,            true,      false },
+    { "wallet",             "getrawchangeaddress",      &getrawchangeaddress,      true,      false },
+    { "wallet",             "getreceivedbyaccount",     &getreceivedbyaccount,     false,     true  },
+    { "wallet",             "getreceivedbyaddress",     &getreceivedbyaddress,     false,     true  },
+    { "wallet",             "gettransaction",           &gettransaction,           false,     true  },
+    { "wallet",             "getunconfirmedbalance",    &getunconfirmedbalance,    false,     true  },
+    { "wallet",             "getwalletinfo",            &getwalletinfo,            false,     true  },
+    { "wallet",             "importprivkey",            &importprivkey,            true,      false },
+    { "wallet",             "importwallet",             &importwallet,             true,      false },
+    { "wallet",             "importaddress",            &importaddress,            true,      false },
+    { "wallet",             "importpubkey",             &importpubkey,             true,      false },
+    { "wallet",             "keypoolrefill",            &keypoolrefill,            true,      false },
+    { "wallet",             "listaccounts",             &listaccounts,             false,     true  },
+    { "wallet",             "listaddressgroupings",     &listaddressgroupings,     false,     true  },
+    { "wallet",             "listlockunspent",          &listlockunspent,          false,     true  },
+    { "wallet",             "listreceivedbyaccount",    &listreceivedbyaccount,    false,     true  },
+    { "wallet",             "listreceivedbyaddress",    &listreceivedbyaddress,    false,     true  },
+    { "wallet",             "listsinceblock",           &listsinceblock,           false,     true  },
+    { "wallet",             "waitforwallettx",          &waitforwallettx,          false,     true  },
+    { "wallet",             "listtransactions",         &listtransactions,         false,     true  },
+    { "wallet",             "listunspent",              &listunspent,              false,     true  },
+    { "wallet",             "lockunspent",              &lockunspent,              true,      false },
+    { "wallet",             "move",                     &movecmd,                  false,     false },
+    { "wallet",             "sendfrom",                 &sendfrom,                 false,     false },
+    { "wallet",             "sendmany",                 &sendmany,                 false,     false },
+    { "wallet",             "sendtoaddress",            &sendtoaddress,            false,     false },
+    { "wallet",             "setaccount",               &setaccount,               true,      false },
+    { "wallet",             "settxfee",                 &settxfee,                 true,      false },
+    { "wallet",             "signmessage",              &signmessage,              true,      false },
+    { "wallet",             "walletlock",               &walletlock,               true,      false },
+    { "wallet",             "walletpassphrasechange",   &walletpassphrasechange,   true,      false },
+    { "wallet",             "walletpassphrase",         &walletpassphrase,         true,      false },
+    { "wallet",             "zcbenchmark",              &zc_benchmark,             true,      false },
+    { "wallet",             "zcrawkeygen",              &zc_raw_keygen,            true,      false },
+    { "wallet",             "zcrawjoinsplit",           &zc_raw_joinsplit,         true,      false },
+    { "wallet",             "zcrawreceive",             &zc_raw_receive,           true,      false },
+    { "wallet",             "zcsamplejoinsplit",        &zc_sample_joinsplit,      true,      false },
+    { "wallet",             "z_listreceivedbyaddress",  &z_listreceivedbyaddress,  false,     true  },
+    { "wallet",             "z_listunspent",            &z_listunspent,            false,     true  },
+    { "wallet",             "z_getbalance",             &z_getbalance,             false,     true  },
+    { "wallet",             "z_gettotalbalance",        &z_gettotalbalance,        false,     true  },
+    { "wallet",             "z_mergetoaddress",         &z_mergetoaddress,         false,     false },
+    { "wallet",             "z_consolidatenotes",       &z_consolidatenotes,       false,     false },
+    { "wallet",             "z_sendmany",               &z_sendmany,               false,     false },
+    { "wallet",             "z_sendmanybatched",        &z_sendmanybatched,        false,     false },
+    { "wallet",             "z_setmigration",           &z_setmigration,           false,     false },
+    { "wallet",             "z_getmigrationstatus",     &z_getmigrationstatus,     false,     true  },
+    { "wallet",             "z_shieldcoinbase",         &z_shieldcoinbase,         false,     false },
+    { "wallet",             "z_getoperationstatus",     &z_getoperationstatus,     true,      true  },
+    { "wallet",             "z_getoperationresult",     &z_getoperationresult,     true,      false },
+    { "wallet",             "z_listoperationids",       &z_listoperationids,       true,      true  },
+    { "wallet",             "z_getnewaddress",          &z_getnewaddress,          true,      false },
+    { "wallet",             "z_listaddresses",          &z_listaddresses,          true,      true  },
+    { "wallet",             "z_exportkey",              &z_exportkey,              true,      false },
+    { "wallet",             "z_importkey",              &z_importkey,              true,      false },
+    { "wallet",             "z_exportviewingkey",       &z_exportviewingkey,       true,      false },
+    { "wallet",             "z_importviewingkey",       &z_importviewingkey,       true,      false },
+    { "wallet",             "z_exportwallet",           &z_exportwallet,           true,      false },
+    { "wallet",             "z_importwallet",           &z_importwallet,           true,      false },
+    { "wallet",             "z_viewtransaction",        &z_viewtransaction,        false,     true  },
+    { "wallet",             "z_getnotescount",          &z_getnotescount,          false,     true  },
     // TODO: rearrange into another category
-    { "disclosure",         "z_getpaymentdisclosure",   &z_getpaymentdisclosure,   true  },
-    { "disclosure",         "z_validatepaymentdisclosure", &z_validatepaymentdisclosure, true }
+    { "disclosure",         "z_getpaymentdisclosure",   &z_getpaymentdisclosure,   true,      false },
+    { "disclosure",         "z_validatepaymentdisclosure", &z_validatepaymentdisclosure, true,      true  },
 };
 
 void RegisterWalletRPCCommands(CRPCTable &tableRPC)
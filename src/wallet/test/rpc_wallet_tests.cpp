@@ -14,7 +14,9 @@
 #include "asyncrpcqueue.h"
 #include "asyncrpcoperation.h"
 #include "wallet/asyncrpcoperation_common.h"
+#include "wallet/asyncrpcoperation_consolidate.h"
 #include "wallet/asyncrpcoperation_mergetoaddress.h"
+#include "wallet/asyncrpcoperation_payoutbatch.h"
 #include "wallet/asyncrpcoperation_sendmany.h"
 #include "wallet/asyncrpcoperation_shieldcoinbase.h"
 
@@ -1436,6 +1438,9 @@ BOOST_AUTO_TEST_CASE(rpc_z_sendmany_taddr_to_sapling)
     operation->main();
     BOOST_CHECK(operation->isSuccess());
 
+    // The spent utxo is only locked while the operation runs
+    BOOST_CHECK(!pwalletMain->IsLockedCoin(wtx.GetHash(), 0));
+
     // Get the transaction
     auto result = operation->getResult();
     BOOST_ASSERT(result.isObject());
@@ -1475,6 +1480,113 @@ BOOST_AUTO_TEST_CASE(rpc_z_sendmany_taddr_to_sapling)
 }
 
 
+BOOST_AUTO_TEST_CASE(rpc_z_sendmanybatched_split_payments)
+{
+    AsyncRPCOperation_payoutbatch batch("tmRr6yJonqGK23UVhrKuyvTpF8qxQQjKigJ", 1, ASYNC_RPC_OPERATION_DEFAULT_MINERS_FEE);
+    BOOST_CHECK(batch.split_payments().empty());
+
+    // Requests are joined, and shielded outputs fill half of a transaction
+    size_t nPerTx = (MAX_TX_SIZE_AFTER_SAPLING / 2) / OUTPUTDESCRIPTION_SIZE;
+    std::vector<SendManyRecipient> zOutputs(nPerTx, SendManyRecipient("zaddr", COIN, ""));
+    std::vector<SendManyRecipient> tOutputs(3, SendManyRecipient("taddr", COIN, ""));
+    BOOST_CHECK(batch.add_payments({}, zOutputs));
+    BOOST_CHECK(batch.add_payments(tOutputs, {zOutputs[0]}));
+
+    auto groups = batch.split_payments();
+    BOOST_REQUIRE_EQUAL(groups.size(), 2);
+    BOOST_CHECK_EQUAL(groups[0].zOutputs.size(), nPerTx);
+    BOOST_CHECK(groups[0].tOutputs.empty());
+    BOOST_CHECK_EQUAL(groups[1].zOutputs.size(), 1);
+    BOOST_CHECK_EQUAL(groups[1].tOutputs.size(), 3);
+
+    UniValue params = find_value(batch.getStatus(), "params");
+    BOOST_CHECK_EQUAL(find_value(params, "requests").get_int(), 2);
+    BOOST_CHECK_EQUAL(find_value(params, "payments").get_int(), nPerTx + 4);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_z_consolidatenotes_plan)
+{
+    // 120 notes, 50 per transaction: 3 transactions, then 1 merging their outputs
+    std::vector<CAmount> vValues(120, COIN);
+    std::vector<size_t> plan = PlanConsolidation(vValues, 50, 10000);
+    BOOST_REQUIRE_EQUAL(plan.size(), 2);
+    BOOST_CHECK_EQUAL(plan[0], 3);
+    BOOST_CHECK_EQUAL(plan[1], 1);
+
+    // Groups are dealt round-robin and differ in size by at most one
+    auto groups = SplitIntoGroups(120, 3);
+    BOOST_REQUIRE_EQUAL(groups.size(), 3);
+    BOOST_CHECK_EQUAL(groups[0].size(), 40);
+    BOOST_CHECK_EQUAL(groups[1][0], 1);
+    BOOST_CHECK_EQUAL(groups[2].back(), 119);
+
+    // A single transaction suffices
+    plan = PlanConsolidation(std::vector<CAmount>(50, COIN), 50, 10000);
+    BOOST_REQUIRE_EQUAL(plan.size(), 1);
+    BOOST_CHECK_EQUAL(plan[0], 1);
+
+    // Notes that cannot cover the fee are not planned
+    BOOST_CHECK(PlanConsolidation(std::vector<CAmount>(10, 1000), 5, 10000).empty());
+    BOOST_CHECK(PlanConsolidation(vValues, 1, 10000).empty());
+}
+
+BOOST_AUTO_TEST_CASE(rpc_z_consolidatenotes_levels)
+{
+    // Six notes, merged by three transactions and then by one
+    auto sk = SaplingSpendingKey::random();
+    auto addr = sk.default_address();
+    auto expsk = sk.expanded_spending_key();
+    std::vector<ConsolidationInput> inputs;
+    for (int i = 0; i < 6; i++) {
+        inputs.push_back(ConsolidationInput{SaplingOutPoint(GetRandHash(), 0),
+            SaplingNote(addr, COIN, Zip212Enabled::BeforeZip212), expsk});
+    }
+    auto operation = std::make_shared<AsyncRPCOperation_consolidate>(inputs, addr, std::vector<size_t>{3, 1});
+    TEST_FRIEND_AsyncRPCOperation_consolidate proxy(operation);
+    BOOST_CHECK_EQUAL(proxy.level(), 0);
+    BOOST_CHECK_EQUAL(proxy.inputs().size(), 6);
+
+    // The first level has been sent, but its transactions are not in the
+    // wallet, so they will never be mined
+    std::vector<uint256> txids = {GetRandHash(), GetRandHash(), GetRandHash()};
+    proxy.set_pending(txids);
+    std::vector<ConsolidationInput> outputs;
+    try {
+        proxy.get_outputs(outputs);
+        BOOST_FAIL("Should have caused an error");
+    } catch (const UniValue& objError) {
+        BOOST_CHECK(find_error(objError, "was not mined"));
+    }
+    // The scheduler queues the operation again, so that main() reports it
+    BOOST_CHECK(proxy.level_mined());
+
+    // The next level merges one output per transaction of the current one
+    for (const uint256& txid : txids) {
+        outputs.push_back(ConsolidationInput{SaplingOutPoint(txid, 0),
+            SaplingNote(addr, 2 * COIN - 10000, Zip212Enabled::BeforeZip212), expsk});
+    }
+    try {
+        proxy.next_level({outputs[0]});
+        BOOST_FAIL("Should have caused an error");
+    } catch (const UniValue& objError) {
+        BOOST_CHECK(find_error(objError, "Found 1 outputs of 3 merge transactions"));
+    }
+    BOOST_CHECK_EQUAL(proxy.level(), 0);
+
+    proxy.next_level(outputs);
+    BOOST_CHECK_EQUAL(proxy.level(), 1);
+    BOOST_REQUIRE_EQUAL(proxy.inputs().size(), 3);
+    for (size_t i = 0; i < txids.size(); i++) {
+        BOOST_CHECK(proxy.inputs()[i].op == SaplingOutPoint(txids[i], 0));
+    }
+    UniValue progress = find_value(operation->getStatus(), "progress");
+    BOOST_CHECK_EQUAL(find_value(progress, "level").get_int(), 1);
+
+    // Nothing is waiting to be mined until the last level is sent
+    BOOST_CHECK(proxy.get_outputs(outputs));
+    BOOST_CHECK(outputs.empty());
+}
+
 /*
  * This test covers storing encrypted zkeys in the wallet.
  */
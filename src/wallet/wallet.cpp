@@ -25,6 +25,7 @@
 #include "utilmoneystr.h"
 #include "zcash/Note.hpp"
 #include "crypter.h"
+#include "wallet/asyncrpcoperation_payoutbatch.h"
 #include "wallet/asyncrpcoperation_saplingmigration.h"
 
 #include <assert.h>
@@ -614,6 +615,9 @@ void CWallet::ChainTip(const CBlockIndex *pindex,
                        const CBlock *pblock,
                        boost::optional<std::pair<SproutMerkleTree, SaplingMerkleTree>> added)
 {
+    auto span = TracingSpan("info", "main", "CWallet::ChainTip");
+    auto spanGuard = span.Enter();
+
     if (added) {
         ChainTipAdded(pindex, pblock, added->first, added->second);
         // Prevent migration transactions from being created when node is syncing after launch,
@@ -678,6 +682,10 @@ void CWallet::SetBestChain(const CBlockLocator& loc)
 {
     CWalletDB walletdb(strWalletFile);
     SetBestChainINTERNAL(walletdb, loc);
+    if (fLazyLoad && fFileBacked) {
+        LOCK2(cs_main, cs_wallet);
+        PageOutSettledTxs(walletdb);
+    }
 }
 
 std::set<std::pair<libzcash::PaymentAddress, uint256>> CWallet::GetNullifiersForAddresses(
@@ -717,6 +725,55 @@ std::set<std::pair<libzcash::PaymentAddress, uint256>> CWallet::GetNullifiersFor
             }
         }
     }
+    if (mapSettledTxs.empty()) {
+        return nullifierSet;
+    }
+
+    // Settled transactions are not in mapWallet, so their notes are found
+    // through the note index, and their nullifiers in their summaries
+    LOCK(cs_wallet);
+    IndexSaplingNotes();
+    IndexSettledNotes();
+    for (const auto & addr : addresses) {
+        auto sproutAddr = boost::get<libzcash::SproutPaymentAddress>(&addr);
+        if (sproutAddr == nullptr) {
+            continue;
+        }
+        auto it = mapSproutNotesByAddress.find(*sproutAddr);
+        if (it == mapSproutNotesByAddress.end()) {
+            continue;
+        }
+        for (const JSOutPoint & jsop : it->second) {
+            auto sit = mapSettledTxs.find(jsop.hash);
+            if (sit == mapSettledTxs.end()) {
+                continue;
+            }
+            for (const auto & note : sit->second.mapSproutNotes) {
+                if (note.second == jsop) {
+                    nullifierSet.insert(std::make_pair(addr, note.first));
+                }
+            }
+        }
+    }
+    for (const auto & item : mapSaplingNotesByAddress) {
+        libzcash::SaplingIncomingViewingKey ivk;
+        if (!GetSaplingIncomingViewingKey(item.first, ivk) || !ivkMap.count(ivk)) {
+            continue;
+        }
+        for (const SaplingOutPoint & op : item.second) {
+            auto sit = mapSettledTxs.find(op.hash);
+            if (sit == mapSettledTxs.end()) {
+                continue;
+            }
+            for (const auto & note : sit->second.mapSaplingNotes) {
+                if (note.second == op) {
+                    for (const auto & addr : ivkMap[ivk]) {
+                        nullifierSet.insert(std::make_pair(addr, note.first));
+                    }
+                }
+            }
+        }
+    }
     return nullifierSet;
 }
 
@@ -734,6 +791,15 @@ bool CWallet::IsNoteSproutChange(
     // - Notes created by consolidation transactions (e.g. using
     //   z_mergetoaddress).
     // - Notes sent from one address to itself.
+    auto sit = mapSettledTxs.find(jsop.hash);
+    if (sit != mapSettledTxs.end()) {
+        for (const uint256 & nullifier : sit->second.vSproutNullifiers) {
+            if (nullifierSet.count(std::make_pair(address, nullifier))) {
+                return true;
+            }
+        }
+        return false;
+    }
     for (const JSDescription & jsd : mapWallet[jsop.hash].vJoinSplit) {
         for (const uint256 & nullifier : jsd.nullifiers) {
             if (nullifierSet.count(std::make_pair(address, nullifier))) {
@@ -756,6 +822,15 @@ bool CWallet::IsNoteSaplingChange(const std::set<std::pair<libzcash::PaymentAddr
     // - Notes created by consolidation transactions (e.g. using
     //   z_mergetoaddress).
     // - Notes sent from one address to itself.
+    auto sit = mapSettledTxs.find(op.hash);
+    if (sit != mapSettledTxs.end()) {
+        for (const uint256 & nullifier : sit->second.vSaplingNullifiers) {
+            if (nullifierSet.count(std::make_pair(address, nullifier))) {
+                return true;
+            }
+        }
+        return false;
+    }
     for (const SpendDescription &spend : mapWallet[op.hash].vShieldedSpend) {
         if (nullifierSet.count(std::make_pair(address, spend.nullifier))) {
             return true;
@@ -881,6 +956,11 @@ bool CWallet::Verify()
     LogPrintf("Using wallet %s\n", walletFile);
     uiInterface.InitMessage(_("Verifying wallet..."));
 
+    std::string strBackend = GetArg("-walletbackend", DEFAULT_WALLET_BACKEND);
+    if (strBackend != WALLET_BACKEND_BDB && strBackend != WALLET_BACKEND_LOG) {
+        return UIError(strprintf(_("Unknown -walletbackend: '%s'"), strBackend));
+    }
+
     if (walletFile != boost::filesystem::basename(walletFile) + boost::filesystem::extension(walletFile)) {
         boost::filesystem::path path(walletFile);
         if (path.is_absolute()) {
@@ -914,14 +994,24 @@ bool CWallet::Verify()
         }
     }
 
+    bool fLogDb = bitdb.IsLogDb(walletFile);
     if (GetBoolArg("-salvagewallet", false))
     {
         // Recover readable keypairs:
-        if (!CWalletDB::Recover(bitdb, walletFile, true))
+        if (fLogDb)
+            LogPrintf("-salvagewallet is not needed for %s, which is checked when it is opened\n", walletFile);
+        else if (!CWalletDB::Recover(bitdb, walletFile, true))
             return false;
     }
 
-    if (boost::filesystem::exists(GetDataDir() / walletFile))
+    if (fLogDb && boost::filesystem::exists(GetDataDir() / walletFile))
+    {
+        // Opening the file checks every batch and drops an incomplete one at the end
+        CLogDB db(GetDataDir() / walletFile);
+        if (!db.Open(false))
+            return UIError(strprintf(_("Error opening wallet file %s"), walletFile));
+    }
+    else if (boost::filesystem::exists(GetDataDir() / walletFile))
     {
         CDBEnv::VerifyResult r = bitdb.Verify(walletFile, CWalletDB::Recover);
         if (r == CDBEnv::RECOVER_OK)
@@ -934,6 +1024,9 @@ bool CWallet::Verify()
         }
         if (r == CDBEnv::RECOVER_FAIL)
             return UIError(strprintf(_("%s corrupt, salvage failed"), walletFile));
+
+        if (strBackend == WALLET_BACKEND_LOG && !CDB::ConvertToLog(walletFile))
+            return UIError(strprintf(_("Error converting %s to the log wallet format, see debug.log"), walletFile));
     }
 
     return true;
@@ -946,23 +1039,28 @@ void CWallet::SyncMetaData(pair<typename TxSpendMap<T>::iterator, typename TxSpe
     // the oldest (smallest nOrderPos).
     // So: find smallest nOrderPos:
 
+    // Settled transactions are left out, as they are not in mapWallet.
     int nMinOrderPos = std::numeric_limits<int>::max();
     const CWalletTx* copyFrom = NULL;
     for (typename TxSpendMap<T>::iterator it = range.first; it != range.second; ++it)
     {
-        const uint256& hash = it->second;
-        int n = mapWallet[hash].nOrderPos;
+        std::map<uint256, CWalletTx>::iterator mit = mapWallet.find(it->second);
+        if (mit == mapWallet.end())
+            continue;
+        int n = mit->second.nOrderPos;
         if (n < nMinOrderPos)
         {
             nMinOrderPos = n;
-            copyFrom = &mapWallet[hash];
+            copyFrom = &mit->second;
         }
     }
     // Now copy data from copyFrom to rest:
     for (typename TxSpendMap<T>::iterator it = range.first; it != range.second; ++it)
     {
-        const uint256& hash = it->second;
-        CWalletTx* copyTo = &mapWallet[hash];
+        std::map<uint256, CWalletTx>::iterator mit = mapWallet.find(it->second);
+        if (mit == mapWallet.end())
+            continue;
+        CWalletTx* copyTo = &mit->second;
         if (copyFrom == copyTo) continue;
         copyTo->mapValue = copyFrom->mapValue;
         // mapSproutNoteData and mapSaplingNoteData not copied on purpose
@@ -994,6 +1092,8 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
         std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(wtxid);
         if (mit != mapWallet.end() && mit->second.GetDepthInMainChain() >= 0)
             return true; // Spent
+        if (mapSettledTxs.count(wtxid))
+            return true; // Spent
     }
     return false;
 }
@@ -1013,6 +1113,9 @@ bool CWallet::IsSproutSpent(const uint256& nullifier) const {
         if (mit != mapWallet.end() && mit->second.GetDepthInMainChain() >= 0) {
             return true; // Spent
         }
+        if (mapSettledTxs.count(wtxid)) {
+            return true; // Spent
+        }
     }
     return false;
 }
@@ -1028,6 +1131,9 @@ bool CWallet::IsSaplingSpent(const uint256& nullifier) const {
         if (mit != mapWallet.end() && mit->second.GetDepthInMainChain() >= 0) {
             return true; // Spent
         }
+        if (mapSettledTxs.count(wtxid)) {
+            return true; // Spent
+        }
     }
     return false;
 }
@@ -1093,13 +1199,320 @@ void CWallet::ClearNoteWitnessCache()
         }
     }
     nWitnessCacheSize = 0;
+    nWitnessCacheHeight = -1;
+    mapPendingWitnessDeltas.clear();
+    mapSproutWitnessedSpends.clear();
+    mapSaplingWitnessedSpends.clear();
+    // Have the next SetBestChain() erase all stored witness records
+    for (const auto& item : mapSproutWitnessRecords) {
+        setSproutWitnessesDirty.insert(item.first);
+    }
+    for (const auto& item : mapSaplingWitnessRecords) {
+        setSaplingWitnessesDirty.insert(item.first);
+    }
+}
+
+template<typename OutPoint, typename NoteData, typename Record>
+void GetNoteWitnessUpdates(const std::map<OutPoint, NoteData>& noteDataMap,
+                           const std::map<OutPoint, int>& mapRecords,
+                           const std::set<OutPoint>& setDirty,
+                           int nCacheHeight,
+                           std::vector<std::pair<OutPoint, Record>>& vWrites,
+                           std::vector<OutPoint>& vErases,
+                           int& nMinRecordHeight)
+{
+    for (const auto& item : noteDataMap) {
+        const NoteData& nd = item.second;
+        auto it = mapRecords.find(item.first);
+        bool fStored = it != mapRecords.end();
+        if (nd.witnesses.empty()) {
+            if (fStored) {
+                vErases.push_back(item.first);
+            }
+        } else if (!fStored || setDirty.count(item.first) ||
+                   nCacheHeight - it->second >= (int)WITNESS_CACHE_SIZE) {
+            // Rewriting old records bounds the number of deltas to keep
+            vWrites.push_back(std::make_pair(item.first, Record(nd.witnessHeight, nd.witnesses)));
+            nMinRecordHeight = std::min(nMinRecordHeight, nd.witnessHeight);
+        } else {
+            nMinRecordHeight = std::min(nMinRecordHeight, it->second);
+        }
+    }
+}
+
+void CWallet::GetWitnessCacheUpdates(WitnessCacheUpdates& updates)
+{
+    AssertLockHeld(cs_wallet);
+    int nMinRecordHeight = nWitnessCacheHeight;
+    for (const std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+        ::GetNoteWitnessUpdates(wtxItem.second.mapSproutNoteData, mapSproutWitnessRecords, setSproutWitnessesDirty,
+                                nWitnessCacheHeight, updates.sproutWrites, updates.sproutErases, nMinRecordHeight);
+        ::GetNoteWitnessUpdates(wtxItem.second.mapSaplingNoteData, mapSaplingWitnessRecords, setSaplingWitnessesDirty,
+                                nWitnessCacheHeight, updates.saplingWrites, updates.saplingErases, nMinRecordHeight);
+    }
+
+    // Records of notes that are no longer in the wallet
+    for (const auto& item : mapSproutWitnessRecords) {
+        auto it = mapWallet.find(item.first.hash);
+        if (it == mapWallet.end() || !it->second.mapSproutNoteData.count(item.first)) {
+            updates.sproutErases.push_back(item.first);
+        }
+    }
+    for (const auto& item : mapSaplingWitnessRecords) {
+        auto it = mapWallet.find(item.first.hash);
+        if (it == mapWallet.end() || !it->second.mapSaplingNoteData.count(item.first)) {
+            updates.saplingErases.push_back(item.first);
+        }
+    }
+
+    // Only the deltas above the oldest record are needed to rebuild the
+    // cache; any above the cache height are left over from a reorg.
+    for (const auto& item : mapPendingWitnessDeltas) {
+        if (item.first > nMinRecordHeight && item.first <= nWitnessCacheHeight) {
+            updates.deltaWrites.push_back(item.first);
+        }
+    }
+    for (int nHeight : setWitnessDeltaHeights) {
+        if (nHeight <= nMinRecordHeight || nHeight > nWitnessCacheHeight) {
+            updates.deltaErases.push_back(nHeight);
+        }
+    }
+}
+
+void CWallet::WitnessCacheUpdatesWritten(const WitnessCacheUpdates& updates)
+{
+    AssertLockHeld(cs_wallet);
+    for (const auto& item : updates.sproutWrites) {
+        mapSproutWitnessRecords[item.first] = item.second.witnessHeight;
+    }
+    for (const JSOutPoint& jsop : updates.sproutErases) {
+        mapSproutWitnessRecords.erase(jsop);
+    }
+    for (const auto& item : updates.saplingWrites) {
+        mapSaplingWitnessRecords[item.first] = item.second.witnessHeight;
+    }
+    for (const SaplingOutPoint& op : updates.saplingErases) {
+        mapSaplingWitnessRecords.erase(op);
+    }
+    // Every dirty note has now been rewritten, erased, or has no witnesses
+    setSproutWitnessesDirty.clear();
+    setSaplingWitnessesDirty.clear();
+
+    for (int nHeight : updates.deltaWrites) {
+        setWitnessDeltaHeights.insert(nHeight);
+    }
+    for (int nHeight : updates.deltaErases) {
+        setWitnessDeltaHeights.erase(nHeight);
+    }
+    mapPendingWitnessDeltas.clear();
 }
 
-template<typename NoteDataMap>
-void CopyPreviousWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize)
+template<typename Witness>
+bool ReplayNoteWitnesses(CNoteWitnessRecord<Witness>& record,
+                         int nHeight,
+                         const std::map<int, CWitnessCacheDelta>& mapWitnessDeltas,
+                         std::vector<uint256> CWitnessCacheDelta::*commitments)
 {
+    // This mirrors what IncrementNoteWitnesses did to the note after the
+    // record was written.
+    for (int h = record.witnessHeight + 1; h <= nHeight; h++) {
+        auto it = mapWitnessDeltas.find(h);
+        if (it == mapWitnessDeltas.end() || record.witnesses.empty()) {
+            return false;
+        }
+        record.witnesses.push_front(record.witnesses.front());
+        if (record.witnesses.size() > WITNESS_CACHE_SIZE) {
+            record.witnesses.pop_back();
+        }
+        for (const uint256& note_commitment : it->second.*commitments) {
+            record.witnesses.front().append(note_commitment);
+        }
+        record.witnessHeight = h;
+    }
+    return true;
+}
+
+template<typename OutPoint, typename NoteData, typename Record>
+bool LoadNoteWitnesses(std::map<OutPoint, NoteData>& noteDataMap,
+                       const std::map<OutPoint, Record>& mapStored,
+                       int nHeight,
+                       int64_t nWitnessCacheSize,
+                       const std::map<int, CWitnessCacheDelta>& mapWitnessDeltas,
+                       std::vector<uint256> CWitnessCacheDelta::*commitments)
+{
+    bool fComplete = true;
     for (auto& item : noteDataMap) {
         auto* nd = &(item.second);
+        // The witnesses serialized with the transaction may be stale
+        nd->witnesses.clear();
+        nd->witnessHeight = nHeight;
+        auto it = mapStored.find(item.first);
+        if (it == mapStored.end()) {
+            continue;
+        }
+        Record record = it->second;
+        if (!::ReplayNoteWitnesses(record, nHeight, mapWitnessDeltas, commitments) ||
+                record.witnesses.size() > nWitnessCacheSize) {
+            LogPrintf("Unable to rebuild witnesses for %s from height %d\n",
+                      item.first.ToString(), it->second.witnessHeight);
+            fComplete = false;
+            continue;
+        }
+        nd->witnesses = std::move(record.witnesses);
+        nd->witnessHeight = record.witnessHeight;
+    }
+    return fComplete;
+}
+
+bool CWallet::LoadWitnessCache(boost::optional<int> nHeight,
+                               const std::map<JSOutPoint, CSproutWitnessRecord>& mapSproutWitnesses,
+                               const std::map<SaplingOutPoint, CSaplingWitnessRecord>& mapSaplingWitnesses,
+                               const std::map<int, CWitnessCacheDelta>& mapWitnessDeltas)
+{
+    LOCK(cs_wallet);
+    if (!nHeight) {
+        // The witnesses were last written inside the transactions, all at
+        // the same height. They are written out separately on the next
+        // SetBestChain().
+        nWitnessCacheHeight = -1;
+        for (const std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+            for (const auto& item : wtxItem.second.mapSproutNoteData) {
+                nWitnessCacheHeight = std::max(nWitnessCacheHeight, item.second.witnessHeight);
+            }
+            for (const auto& item : wtxItem.second.mapSaplingNoteData) {
+                nWitnessCacheHeight = std::max(nWitnessCacheHeight, item.second.witnessHeight);
+            }
+        }
+        return true;
+    }
+
+    nWitnessCacheHeight = *nHeight;
+    bool fComplete = true;
+    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+        fComplete &= ::LoadNoteWitnesses(wtxItem.second.mapSproutNoteData, mapSproutWitnesses, nWitnessCacheHeight,
+                                         nWitnessCacheSize, mapWitnessDeltas, &CWitnessCacheDelta::sproutCommitments);
+        fComplete &= ::LoadNoteWitnesses(wtxItem.second.mapSaplingNoteData, mapSaplingWitnesses, nWitnessCacheHeight,
+                                         nWitnessCacheSize, mapWitnessDeltas, &CWitnessCacheDelta::saplingCommitments);
+    }
+
+    // Records of notes that are no longer in the wallet are kept here so
+    // that the next SetBestChain() erases them.
+    for (const auto& item : mapSproutWitnesses) {
+        mapSproutWitnessRecords[item.first] = item.second.witnessHeight;
+    }
+    for (const auto& item : mapSaplingWitnesses) {
+        mapSaplingWitnessRecords[item.first] = item.second.witnessHeight;
+    }
+    for (const auto& item : mapWitnessDeltas) {
+        setWitnessDeltaHeights.insert(item.first);
+    }
+    return fComplete;
+}
+
+void CWallet::AddToWitnessedNotes(const CWalletTx& wtx)
+{
+    LOCK(cs_wallet);
+    for (const auto& item : wtx.mapSproutNoteData) {
+        setSproutWitnessedNotes.insert(item.first);
+    }
+    for (const auto& item : wtx.mapSaplingNoteData) {
+        setSaplingWitnessedNotes.insert(item.first);
+    }
+}
+
+void CWallet::LoadWitnessedSpends()
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    mapSproutWitnessedSpends.clear();
+    mapSaplingWitnessedSpends.clear();
+    for (const auto& item : mapTxSproutNullifiers) {
+        auto nit = mapSproutNullifiersToNotes.find(item.first);
+        auto wit = mapWallet.find(item.second);
+        if (nit == mapSproutNullifiersToNotes.end() || wit == mapWallet.end()) {
+            continue;
+        }
+        BlockMap::const_iterator mi = mapBlockIndex.find(wit->second.hashBlock);
+        if (mi != mapBlockIndex.end() && chainActive.Contains(mi->second)) {
+            mapSproutWitnessedSpends.insert(std::make_pair(mi->second->nHeight, nit->second));
+        }
+    }
+    for (const auto& item : mapTxSaplingNullifiers) {
+        auto nit = mapSaplingNullifiersToNotes.find(item.first);
+        auto wit = mapWallet.find(item.second);
+        if (nit == mapSaplingNullifiersToNotes.end() || wit == mapWallet.end()) {
+            continue;
+        }
+        BlockMap::const_iterator mi = mapBlockIndex.find(wit->second.hashBlock);
+        if (mi != mapBlockIndex.end() && chainActive.Contains(mi->second)) {
+            mapSaplingWitnessedSpends.insert(std::make_pair(mi->second->nHeight, nit->second));
+        }
+    }
+}
+
+template<typename OutPoint, typename NoteData>
+NoteData* FindNoteData(std::map<uint256, CWalletTx>& mapWallet,
+                       std::map<OutPoint, NoteData> CWalletTx::*noteDataMap,
+                       const OutPoint& op)
+{
+    auto wit = mapWallet.find(op.hash);
+    if (wit == mapWallet.end()) {
+        return nullptr;
+    }
+    auto nit = (wit->second.*noteDataMap).find(op);
+    if (nit == (wit->second.*noteDataMap).end()) {
+        return nullptr;
+    }
+    return &(nit->second);
+}
+
+template<typename OutPoint, typename NoteData>
+std::vector<NoteData*> GetWitnessedNotes(std::map<uint256, CWalletTx>& mapWallet,
+                                         std::set<OutPoint>& setWitnessedNotes,
+                                         std::map<OutPoint, NoteData> CWalletTx::*noteDataMap)
+{
+    std::vector<NoteData*> notes;
+    notes.reserve(setWitnessedNotes.size());
+    auto it = setWitnessedNotes.begin();
+    while (it != setWitnessedNotes.end()) {
+        NoteData* nd = ::FindNoteData(mapWallet, noteDataMap, *it);
+        if (nd) {
+            notes.push_back(nd);
+            ++it;
+        } else {
+            // The transaction was removed from the wallet
+            it = setWitnessedNotes.erase(it);
+        }
+    }
+    return notes;
+}
+
+// Stop updating the witnesses of notes whose spend can no longer be
+// reorged out; they are never needed again.
+template<typename OutPoint, typename NoteData>
+void ForgetSpentWitnesses(std::map<uint256, CWalletTx>& mapWallet,
+                          std::set<OutPoint>& setWitnessedNotes,
+                          std::multimap<int, OutPoint>& mapWitnessedSpends,
+                          std::map<OutPoint, NoteData> CWalletTx::*noteDataMap,
+                          int indexHeight)
+{
+    auto it = mapWitnessedSpends.begin();
+    while (it != mapWitnessedSpends.end() && indexHeight - it->first >= (int)MAX_REORG_LENGTH) {
+        if (setWitnessedNotes.erase(it->second)) {
+            NoteData* nd = ::FindNoteData(mapWallet, noteDataMap, it->second);
+            if (nd) {
+                nd->witnesses.clear();
+                nd->witnessHeight = -1;
+            }
+        }
+        it = mapWitnessedSpends.erase(it);
+    }
+}
+
+template<typename NoteData>
+void CopyPreviousWitnesses(const std::vector<NoteData*>& notes, int indexHeight, int64_t nWitnessCacheSize)
+{
+    for (NoteData* nd : notes) {
         // Only increment witnesses that are behind the current height
         if (nd->witnessHeight < indexHeight) {
             // Check the validity of the cache
@@ -1122,25 +1535,63 @@ void CopyPreviousWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nW
     }
 }
 
-template<typename NoteDataMap>
-void AppendNoteCommitment(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, const uint256& note_commitment)
+/**
+ * The witnesses being brought up to date with a block. Note commitments are
+ * queued until the next of our notes in the block, and then appended to all
+ * of the witnesses at once so that they share the hashing.
+ */
+template<typename Witness, typename Hash>
+class WitnessBatch
 {
-    for (auto& item : noteDataMap) {
-        auto* nd = &(item.second);
-        if (nd->witnessHeight < indexHeight && nd->witnesses.size() > 0) {
-            // Check the validity of the cache
-            // See comment in CopyPreviousWitnesses about validity.
-            assert(nWitnessCacheSize >= nd->witnesses.size());
-            nd->witnesses.front().append(note_commitment);
+private:
+    std::vector<Witness*> witnesses;
+    std::vector<Hash> pending;
+
+public:
+    template<typename NoteData>
+    WitnessBatch(const std::vector<NoteData*>& notes, int indexHeight, int64_t nWitnessCacheSize)
+    {
+        for (NoteData* nd : notes) {
+            if (nd->witnessHeight < indexHeight && nd->witnesses.size() > 0) {
+                // Check the validity of the cache
+                // See comment in CopyPreviousWitnesses about validity.
+                assert(nWitnessCacheSize >= nd->witnesses.size());
+                witnesses.push_back(&nd->witnesses.front());
+            }
         }
     }
-}
 
-template<typename OutPoint, typename NoteData, typename Witness>
-void WitnessNoteIfMine(std::map<OutPoint, NoteData>& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, const OutPoint& key, const Witness& witness)
+    void Append(const uint256& note_commitment)
+    {
+        pending.push_back(note_commitment);
+    }
+
+    void Flush()
+    {
+        Witness::append_all(witnesses, pending);
+        pending.clear();
+    }
+
+    // Called after Flush() with the note's witness list before and after it
+    // is (re)witnessed.
+    template<typename NoteData>
+    void Witnessed(NoteData* nd, Witness* previous)
+    {
+        if (previous) {
+            witnesses.erase(std::remove(witnesses.begin(), witnesses.end(), previous), witnesses.end());
+        }
+        witnesses.push_back(&nd->witnesses.front());
+    }
+};
+
+template<typename OutPoint, typename NoteData, typename Witness, typename Hash>
+NoteData* WitnessNoteIfMine(std::map<OutPoint, NoteData>& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, const OutPoint& key, const Witness& witness, WitnessBatch<Witness, Hash>& batch)
 {
     if (noteDataMap.count(key) && noteDataMap[key].witnessHeight < indexHeight) {
         auto* nd = &(noteDataMap[key]);
+        // Bring the witnesses up to date with the commitments before this one
+        batch.Flush();
+        Witness* previous = nd->witnesses.size() > 0 ? &nd->witnesses.front() : nullptr;
         if (nd->witnesses.size() > 0) {
             // We think this can happen because we write out the
             // witness cache state after every block increment or
@@ -1163,15 +1614,17 @@ void WitnessNoteIfMine(std::map<OutPoint, NoteData>& noteDataMap, int indexHeigh
         nd->witnessHeight = indexHeight - 1;
         // Check the validity of the cache
         assert(nWitnessCacheSize >= nd->witnesses.size());
+        batch.Witnessed(nd, previous);
+        return nd;
     }
+    return nullptr;
 }
 
 
-template<typename NoteDataMap>
-void UpdateWitnessHeights(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize)
+template<typename NoteData>
+void UpdateWitnessHeights(const std::vector<NoteData*>& notes, int indexHeight, int64_t nWitnessCacheSize)
 {
-    for (auto& item : noteDataMap) {
-        auto* nd = &(item.second);
+    for (NoteData* nd : notes) {
         if (nd->witnessHeight < indexHeight) {
             nd->witnessHeight = indexHeight;
             // Check the validity of the cache
@@ -1187,10 +1640,12 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
                                      SaplingMerkleTree& saplingTree)
 {
     LOCK(cs_wallet);
-    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-       ::CopyPreviousWitnesses(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
-       ::CopyPreviousWitnesses(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
-    }
+    ::ForgetSpentWitnesses(mapWallet, setSproutWitnessedNotes, mapSproutWitnessedSpends, &CWalletTx::mapSproutNoteData, pindex->nHeight);
+    ::ForgetSpentWitnesses(mapWallet, setSaplingWitnessedNotes, mapSaplingWitnessedSpends, &CWalletTx::mapSaplingNoteData, pindex->nHeight);
+    std::vector<SproutNoteData*> sproutNotes = ::GetWitnessedNotes(mapWallet, setSproutWitnessedNotes, &CWalletTx::mapSproutNoteData);
+    std::vector<SaplingNoteData*> saplingNotes = ::GetWitnessedNotes(mapWallet, setSaplingWitnessedNotes, &CWalletTx::mapSaplingNoteData);
+    ::CopyPreviousWitnesses(sproutNotes, pindex->nHeight, nWitnessCacheSize);
+    ::CopyPreviousWitnesses(saplingNotes, pindex->nHeight, nWitnessCacheSize);
 
     if (nWitnessCacheSize < WITNESS_CACHE_SIZE) {
         nWitnessCacheSize += 1;
@@ -1203,25 +1658,52 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
         pblock = &block;
     }
 
+    CWitnessCacheDelta& delta = mapPendingWitnessDeltas[pindex->nHeight];
+    delta.sproutCommitments.clear();
+    delta.saplingCommitments.clear();
+
+    WitnessBatch<SproutWitness, libzcash::SHA256Compress> sproutBatch(sproutNotes, pindex->nHeight, nWitnessCacheSize);
+    WitnessBatch<SaplingWitness, libzcash::PedersenHash> saplingBatch(saplingNotes, pindex->nHeight, nWitnessCacheSize);
+
     for (const CTransaction& tx : pblock->vtx) {
         auto hash = tx.GetHash();
         bool txIsOurs = mapWallet.count(hash);
+        // Record spends of our notes
+        for (const JSDescription& jsdesc : tx.vJoinSplit) {
+            for (const uint256& nullifier : jsdesc.nullifiers) {
+                auto it = mapSproutNullifiersToNotes.find(nullifier);
+                if (it != mapSproutNullifiersToNotes.end()) {
+                    mapSproutWitnessedSpends.insert(std::make_pair(pindex->nHeight, it->second));
+                }
+            }
+        }
+        for (const SpendDescription& spend : tx.vShieldedSpend) {
+            auto it = mapSaplingNullifiersToNotes.find(spend.nullifier);
+            if (it != mapSaplingNullifiersToNotes.end()) {
+                mapSaplingWitnessedSpends.insert(std::make_pair(pindex->nHeight, it->second));
+            }
+        }
         // Sprout
         for (size_t i = 0; i < tx.vJoinSplit.size(); i++) {
             const JSDescription& jsdesc = tx.vJoinSplit[i];
             for (uint8_t j = 0; j < jsdesc.commitments.size(); j++) {
                 const uint256& note_commitment = jsdesc.commitments[j];
                 sproutTree.append(note_commitment);
+                delta.sproutCommitments.push_back(note_commitment);
 
                 // Increment existing witnesses
-                for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                    ::AppendNoteCommitment(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, note_commitment);
-                }
+                sproutBatch.Append(note_commitment);
 
                 // If this is our note, witness it
                 if (txIsOurs) {
                     JSOutPoint jsoutpt {hash, i, j};
-                    ::WitnessNoteIfMine(mapWallet[hash].mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, jsoutpt, sproutTree.witness());
+                    if (mapSproutWitnessRecords.count(jsoutpt)) {
+                        setSproutWitnessesDirty.insert(jsoutpt);
+                    }
+                    SproutNoteData* nd = ::WitnessNoteIfMine(mapWallet[hash].mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, jsoutpt, sproutTree.witness(), sproutBatch);
+                    if (nd && setSproutWitnessedNotes.insert(jsoutpt).second) {
+                        sproutNotes.push_back(nd);
+                    }
                 }
             }
         }
@@ -1229,36 +1711,42 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
         for (uint32_t i = 0; i < tx.vShieldedOutput.size(); i++) {
             const uint256& note_commitment = tx.vShieldedOutput[i].cmu;
             saplingTree.append(note_commitment);
+            delta.saplingCommitments.push_back(note_commitment);
 
             // Increment existing witnesses
-            for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                ::AppendNoteCommitment(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, note_commitment);
-            }
+            saplingBatch.Append(note_commitment);
 
             // If this is our note, witness it
             if (txIsOurs) {
                 SaplingOutPoint outPoint {hash, i};
-                ::WitnessNoteIfMine(mapWallet[hash].mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, outPoint, saplingTree.witness());
+                if (mapSaplingWitnessRecords.count(outPoint)) {
+                    setSaplingWitnessesDirty.insert(outPoint);
+                }
+                SaplingNoteData* nd = ::WitnessNoteIfMine(mapWallet[hash].mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, outPoint, saplingTree.witness(), saplingBatch);
+                if (nd && setSaplingWitnessedNotes.insert(outPoint).second) {
+                    saplingNotes.push_back(nd);
+                }
             }
         }
     }
 
+    sproutBatch.Flush();
+    saplingBatch.Flush();
+
     // Update witness heights
-    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-        ::UpdateWitnessHeights(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
-        ::UpdateWitnessHeights(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
-    }
+    ::UpdateWitnessHeights(sproutNotes, pindex->nHeight, nWitnessCacheSize);
+    ::UpdateWitnessHeights(saplingNotes, pindex->nHeight, nWitnessCacheSize);
+    nWitnessCacheHeight = pindex->nHeight;
 
     // For performance reasons, we write out the witness cache in
     // CWallet::SetBestChain() (which also ensures that overall consistency
     // of the wallet.dat is maintained).
 }
 
-template<typename NoteDataMap>
-void DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize)
+template<typename NoteData>
+void DecrementNoteWitnesses(const std::vector<NoteData*>& notes, int indexHeight, int64_t nWitnessCacheSize)
 {
-    for (auto& item : noteDataMap) {
-        auto* nd = &(item.second);
+    for (NoteData* nd : notes) {
         // Only decrement witnesses that are not above the current height
         if (nd->witnessHeight <= indexHeight) {
             // Check the validity of the cache
@@ -1297,14 +1785,32 @@ void DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t n
 void CWallet::DecrementNoteWitnesses(const CBlockIndex* pindex)
 {
     LOCK(cs_wallet);
-    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-        ::DecrementNoteWitnesses(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
-        ::DecrementNoteWitnesses(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
-    }
+    ::DecrementNoteWitnesses(::GetWitnessedNotes(mapWallet, setSproutWitnessedNotes, &CWalletTx::mapSproutNoteData),
+                             pindex->nHeight, nWitnessCacheSize);
+    ::DecrementNoteWitnesses(::GetWitnessedNotes(mapWallet, setSaplingWitnessedNotes, &CWalletTx::mapSaplingNoteData),
+                             pindex->nHeight, nWitnessCacheSize);
+    // The spends in the removed block are undone
+    mapSproutWitnessedSpends.erase(mapSproutWitnessedSpends.lower_bound(pindex->nHeight), mapSproutWitnessedSpends.end());
+    mapSaplingWitnessedSpends.erase(mapSaplingWitnessedSpends.lower_bound(pindex->nHeight), mapSaplingWitnessedSpends.end());
     nWitnessCacheSize -= 1;
     // TODO: If nWitnessCache is zero, we need to regenerate the caches (#1302)
     assert(nWitnessCacheSize > 0);
 
+    // Stored witness records that include the removed block can no longer
+    // be brought up to date from the deltas.
+    mapPendingWitnessDeltas.erase(pindex->nHeight);
+    for (const auto& item : mapSproutWitnessRecords) {
+        if (item.second >= pindex->nHeight) {
+            setSproutWitnessesDirty.insert(item.first);
+        }
+    }
+    for (const auto& item : mapSaplingWitnessRecords) {
+        if (item.second >= pindex->nHeight) {
+            setSaplingWitnessesDirty.insert(item.first);
+        }
+    }
+    nWitnessCacheHeight = pindex->nHeight - 1;
+
     // For performance reasons, we write out the witness cache in
     // CWallet::SetBestChain() (which also ensures that overall consistency
     // of the wallet.dat is maintained).
@@ -1509,39 +2015,54 @@ void CWallet::UpdateNullifierNoteMapWithTx(const CWalletTx& wtx)
 
 /**
  * Update mapSaplingNullifiersToNotes, computing the nullifier from a cached witness if necessary.
+ *
+ * A note's position is fixed once its block is connected, so the nullifier is
+ * only computed the first time the note is witnessed and then kept until the
+ * block is disconnected (which pops the note's last witness).
  */
 void CWallet::UpdateSaplingNullifierNoteMapWithTx(CWalletTx& wtx) {
     LOCK(cs_wallet);
 
     for (mapSaplingNoteData_t::value_type &item : wtx.mapSaplingNoteData) {
         SaplingOutPoint op = item.first;
-        SaplingNoteData nd = item.second;
+        SaplingNoteData& nd = item.second;
 
         if (nd.witnesses.empty()) {
             // If there are no witnesses, erase the nullifier and associated mapping.
-            if (item.second.nullifier) {
-                mapSaplingNullifiersToNotes.erase(item.second.nullifier.get());
+            if (nd.nullifier) {
+                mapSaplingNullifiersToNotes.erase(nd.nullifier.get());
             }
-            item.second.nullifier = boost::none;
+            nd.nullifier = boost::none;
+        }
+        else if (nd.nullifier) {
+            // Already computed at this position
+            mapSaplingNullifiersToNotes[nd.nullifier.get()] = op;
         }
         else {
             uint64_t position = nd.witnesses.front().position();
             auto extfvk = mapSaplingFullViewingKeys.at(nd.ivk);
-            OutputDescription output = wtx.vShieldedOutput[op.n];
 
-            auto optDeserialized = SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(output.encCiphertext, nd.ivk, output.ephemeralKey);
+            boost::optional<SaplingNote> optNote;
+            auto eit = mapDecryptedSaplingNotes.find(op);
+            if (eit != mapDecryptedSaplingNotes.end()) {
+                optNote = eit->second.note;
+            } else {
+                OutputDescription output = wtx.vShieldedOutput[op.n];
+
+                auto optDeserialized = SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(output.encCiphertext, nd.ivk, output.ephemeralKey);
 
-            // The transaction would not have entered the wallet unless
-            // its plaintext had been successfully decrypted previously.
-            assert(optDeserialized != boost::none);
+                // The transaction would not have entered the wallet unless
+                // its plaintext had been successfully decrypted previously.
+                assert(optDeserialized != boost::none);
 
-            auto optPlaintext = SaplingNotePlaintext::plaintext_checks_without_height(*optDeserialized, nd.ivk, output.ephemeralKey, output.cmu);
+                auto optPlaintext = SaplingNotePlaintext::plaintext_checks_without_height(*optDeserialized, nd.ivk, output.ephemeralKey, output.cmu);
 
-            // An item in mapSaplingNoteData must have already been successfully decrypted,
-            // otherwise the item would not exist in the first place.
-            assert(optPlaintext != boost::none);
+                // An item in mapSaplingNoteData must have already been successfully decrypted,
+                // otherwise the item would not exist in the first place.
+                assert(optPlaintext != boost::none);
 
-            auto optNote = optPlaintext.get().note(nd.ivk);
+                optNote = optPlaintext.get().note(nd.ivk);
+            }
             assert(optNote != boost::none);
 
             auto optNullifier = optNote.get().nullifier(extfvk.fvk, position);
@@ -1549,7 +2070,7 @@ void CWallet::UpdateSaplingNullifierNoteMapWithTx(CWalletTx& wtx) {
             assert(optNullifier != boost::none);
             uint256 nullifier = optNullifier.get();
             mapSaplingNullifiersToNotes[nullifier] = op;
-            item.second.nullifier = nullifier;
+            nd.nullifier = nullifier;
         }
     }
 }
@@ -1579,6 +2100,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         mapWallet[hash] = wtxIn;
         mapWallet[hash].BindWallet(this);
         UpdateNullifierNoteMapWithTx(mapWallet[hash]);
+        AddToWitnessedNotes(mapWallet[hash]);
+        AddToNoteIndex(mapWallet[hash]);
         AddToSpends(hash);
     }
     else
@@ -1589,6 +2112,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         CWalletTx& wtx = (*ret.first).second;
         wtx.BindWallet(this);
         UpdateNullifierNoteMapWithTx(wtx);
+        AddToWitnessedNotes(wtxIn);
+        AddToNoteIndex(wtxIn);
         bool fInsertedNew = ret.second;
         if (fInsertedNew)
         {
@@ -1671,28 +2196,227 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         //// debug print
         LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
-        // Write to disk
-        if (fInsertedNew || fUpdated)
-            if (!wtx.WriteToDisk(pwalletdb))
-                return false;
+        // Write to disk
+        if (fInsertedNew || fUpdated)
+            if (!wtx.WriteToDisk(pwalletdb))
+                return false;
+
+        // Break debit/credit balance caches:
+        wtx.MarkDirty();
+
+        // Notify UI of new or updated transaction
+        NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
+        txUpdates.Add(hash);
+
+        // notify an external script when a wallet transaction comes in or is updated
+        std::string strCmd = GetArg("-walletnotify", "");
+
+        if ( !strCmd.empty())
+        {
+            boost::replace_all(strCmd, "%s", wtxIn.GetHash().GetHex());
+            boost::thread t(runCommand, strCmd); // thread runs free
+        }
+
+    }
+    return true;
+}
+
+// Whether key is spent by a transaction that can no longer be reorged out
+// of the active chain
+template <class T>
+static bool IsSpentBeyondReorg(const std::multimap<T, uint256>& mapSpends,
+                               const std::map<uint256, CWalletTx>& mapWallet,
+                               const std::map<uint256, CWalletTxSummary>& mapSettledTxs,
+                               const T& key)
+{
+    auto range = mapSpends.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (mapSettledTxs.count(it->second)) {
+            return true;
+        }
+        auto mit = mapWallet.find(it->second);
+        if (mit != mapWallet.end() && mit->second.GetDepthInMainChain() > (int)MAX_REORG_LENGTH) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CWallet::IsSettled(const CWalletTx& wtx) const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    if (wtx.GetDepthInMainChain() <= (int)MAX_REORG_LENGTH || wtx.GetBlocksToMaturity() > 0) {
+        return false;
+    }
+    uint256 hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        if (IsMine(wtx.vout[i]) != ISMINE_NO &&
+                !IsSpentBeyondReorg(mapTxSpends, mapWallet, mapSettledTxs, COutPoint(hash, i))) {
+            return false;
+        }
+    }
+    // Notes without a cached nullifier may be unspent
+    for (const auto& item : wtx.mapSproutNoteData) {
+        if (!item.second.nullifier ||
+                !IsSpentBeyondReorg(mapTxSproutNullifiers, mapWallet, mapSettledTxs, *item.second.nullifier)) {
+            return false;
+        }
+    }
+    for (const auto& item : wtx.mapSaplingNoteData) {
+        if (!item.second.nullifier ||
+                !IsSpentBeyondReorg(mapTxSaplingNullifiers, mapWallet, mapSettledTxs, *item.second.nullifier)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+CWalletTxSummary CWallet::SummarizeTx(const CWalletTx& wtx) const
+{
+    CWalletTxSummary summary;
+    summary.hashBlock = wtx.hashBlock;
+    summary.nOrderPos = wtx.nOrderPos;
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        if (IsMine(wtx.vout[i]) != ISMINE_NO) {
+            summary.mapOutputs.insert(std::make_pair(i, wtx.vout[i]));
+        }
+    }
+    if (!wtx.IsCoinBase()) {
+        for (const CTxIn& txin : wtx.vin) {
+            summary.vPrevouts.push_back(txin.prevout);
+        }
+    }
+    for (const JSDescription& jsdesc : wtx.vJoinSplit) {
+        for (const uint256& nullifier : jsdesc.nullifiers) {
+            summary.vSproutNullifiers.push_back(nullifier);
+        }
+    }
+    for (const SpendDescription& spend : wtx.vShieldedSpend) {
+        summary.vSaplingNullifiers.push_back(spend.nullifier);
+    }
+    for (const auto& item : wtx.mapSproutNoteData) {
+        if (item.second.nullifier) {
+            summary.mapSproutNotes.insert(std::make_pair(*item.second.nullifier, item.first));
+        }
+    }
+    for (const auto& item : wtx.mapSaplingNoteData) {
+        if (item.second.nullifier) {
+            summary.mapSaplingNotes.insert(std::make_pair(*item.second.nullifier, item.first));
+        }
+    }
+    return summary;
+}
+
+void CWallet::GetSettledTxs(std::vector<std::pair<uint256, CWalletTxSummary>>& vSettled) const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    for (const std::pair<const uint256, CWalletTx>& item : mapWallet) {
+        if (IsSettled(item.second)) {
+            vSettled.push_back(std::make_pair(item.first, SummarizeTx(item.second)));
+        }
+    }
+}
+
+void CWallet::SettledTxsWritten(const std::vector<std::pair<uint256, CWalletTxSummary>>& vSettled)
+{
+    AssertLockHeld(cs_wallet);
+    // The spend and nullifier maps already refer to these transactions.
+    for (const auto& item : vSettled) {
+        mapWallet.erase(item.first);
+        mapSettledTxs[item.first] = item.second;
+    }
+    MarkBalancesDirty();
+    LogPrint("wallet", "Moved %u settled transactions out of memory, %u left\n", vSettled.size(), mapWallet.size());
+}
+
+void CWallet::LoadSettledTx(const uint256& hash, const CWalletTxSummary& summary)
+{
+    AssertLockHeld(cs_wallet);
+    mapSettledTxs[hash] = summary;
+    // Settled transactions take no part in SyncMetaData, so the maps are
+    // filled directly.
+    for (const COutPoint& prevout : summary.vPrevouts) {
+        mapTxSpends.insert(std::make_pair(prevout, hash));
+    }
+    for (const uint256& nullifier : summary.vSproutNullifiers) {
+        mapTxSproutNullifiers.insert(std::make_pair(nullifier, hash));
+    }
+    for (const uint256& nullifier : summary.vSaplingNullifiers) {
+        mapTxSaplingNullifiers.insert(std::make_pair(nullifier, hash));
+    }
+    for (const auto& item : summary.mapSproutNotes) {
+        mapSproutNullifiersToNotes[item.first] = item.second;
+    }
+    for (const auto& item : summary.mapSaplingNotes) {
+        mapSaplingNullifiersToNotes[item.first] = item.second;
+    }
+    if (!summary.mapSproutNotes.empty() || !summary.mapSaplingNotes.empty()) {
+        setUnindexedSettledTxs.insert(hash);
+    }
+}
+
+std::shared_ptr<CWalletTx> CWallet::ReadSettledTx(const uint256& hash, CWalletDB& walletdb)
+{
+    std::shared_ptr<CWalletTx> pwtx = std::make_shared<CWalletTx>();
+    if (!walletdb.ReadTx(hash, *pwtx) || pwtx->GetHash() != hash) {
+        LogPrintf("%s: Couldn't read settled transaction %s\n", __func__, hash.ToString());
+        return nullptr;
+    }
+    pwtx->BindWallet(this);
+    return pwtx;
+}
 
-        // Break debit/credit balance caches:
-        wtx.MarkDirty();
+std::shared_ptr<const CWalletTx> CWallet::GetSettledTx(const uint256& hash)
+{
+    AssertLockHeld(cs_wallet);
+    if (!fFileBacked || !mapSettledTxs.count(hash)) {
+        return nullptr;
+    }
+    auto it = mapSettledTxCache.find(hash);
+    if (it != mapSettledTxCache.end()) {
+        lruSettledTxs.splice(lruSettledTxs.begin(), lruSettledTxs, it->second);
+        return it->second->second;
+    }
 
-        // Notify UI of new or updated transaction
-        NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
+    CWalletDB walletdb(strWalletFile, "r");
+    std::shared_ptr<const CWalletTx> pwtx = ReadSettledTx(hash, walletdb);
+    if (!pwtx || nSettledTxCacheSize == 0) {
+        return pwtx;
+    }
+    lruSettledTxs.push_front(std::make_pair(hash, pwtx));
+    mapSettledTxCache[hash] = lruSettledTxs.begin();
+    while (lruSettledTxs.size() > nSettledTxCacheSize) {
+        mapSettledTxCache.erase(lruSettledTxs.back().first);
+        lruSettledTxs.pop_back();
+    }
+    return pwtx;
+}
 
-        // notify an external script when a wallet transaction comes in or is updated
-        std::string strCmd = GetArg("-walletnotify", "");
+void CWallet::ForEachWalletTx(const std::function<void(const CWalletTx&)>& f)
+{
+    AssertLockHeld(cs_wallet);
+    for (const std::pair<const uint256, CWalletTx>& item : mapWallet) {
+        f(item.second);
+    }
+    if (!fFileBacked || mapSettledTxs.empty()) {
+        return;
+    }
 
-        if ( !strCmd.empty())
-        {
-            boost::replace_all(strCmd, "%s", wtxIn.GetHash().GetHex());
-            boost::thread t(runCommand, strCmd); // thread runs free
+    // Bypass the cache, so that a full scan does not evict what is in use
+    CWalletDB walletdb(strWalletFile, "r");
+    for (const auto& item : mapSettledTxs) {
+        auto it = mapSettledTxCache.find(item.first);
+        if (it != mapSettledTxCache.end()) {
+            f(*it->second->second);
+            continue;
+        }
+        std::shared_ptr<CWalletTx> pwtx = ReadSettledTx(item.first, walletdb);
+        if (pwtx) {
+            f(*pwtx);
         }
-
     }
-    return true;
 }
 
 bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
@@ -1750,6 +2474,8 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
         AssertLockHeld(cs_wallet);
         bool fExisted = mapWallet.count(tx.GetHash()) != 0;
         if (fExisted && !fUpdate) return false;
+        // Settled transactions can no longer change
+        if (mapSettledTxs.count(tx.GetHash())) return false;
         auto sproutNoteData = FindMySproutNotes(tx);
         auto saplingNoteDataAndAddressesToAdd = FindMySaplingNotes(tx, nHeight);
         auto saplingNoteData = saplingNoteDataAndAddressesToAdd.first;
@@ -1828,8 +2554,17 @@ void CWallet::EraseFromWallet(const uint256 &hash)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
+        if (mapWallet.erase(hash)) {
             CWalletDB(strWalletFile).EraseTx(hash);
+            MarkBalancesDirty();
+        } else if (mapSettledTxs.erase(hash)) {
+            CWalletDB(strWalletFile).EraseTx(hash);
+            auto it = mapSettledTxCache.find(hash);
+            if (it != mapSettledTxCache.end()) {
+                lruSettledTxs.erase(it->second);
+                mapSettledTxCache.erase(it);
+            }
+        }
     }
     return;
 }
@@ -1964,8 +2699,9 @@ bool CWallet::IsSproutNullifierFromMe(const uint256& nullifier) const
 {
     {
         LOCK(cs_wallet);
-        if (mapSproutNullifiersToNotes.count(nullifier) &&
-                mapWallet.count(mapSproutNullifiersToNotes.at(nullifier).hash)) {
+        auto it = mapSproutNullifiersToNotes.find(nullifier);
+        if (it != mapSproutNullifiersToNotes.end() &&
+                (mapWallet.count(it->second.hash) || mapSettledTxs.count(it->second.hash))) {
             return true;
         }
     }
@@ -1976,8 +2712,9 @@ bool CWallet::IsSaplingNullifierFromMe(const uint256& nullifier) const
 {
     {
         LOCK(cs_wallet);
-        if (mapSaplingNullifiersToNotes.count(nullifier) &&
-                mapWallet.count(mapSaplingNullifiersToNotes.at(nullifier).hash)) {
+        auto it = mapSaplingNullifiersToNotes.find(nullifier);
+        if (it != mapSaplingNullifiersToNotes.end() &&
+                (mapWallet.count(it->second.hash) || mapSettledTxs.count(it->second.hash))) {
             return true;
         }
     }
@@ -2038,6 +2775,18 @@ void CWallet::GetSaplingNoteWitnesses(std::vector<SaplingOutPoint> notes,
     }
 }
 
+// Our output spent by txin, if its transaction has been settled
+static const CTxOut* GetSettledOutput(const std::map<uint256, CWalletTxSummary>& mapSettledTxs, const COutPoint& prevout)
+{
+    auto it = mapSettledTxs.find(prevout.hash);
+    if (it == mapSettledTxs.end())
+        return NULL;
+    auto oit = it->second.mapOutputs.find(prevout.n);
+    if (oit == it->second.mapOutputs.end())
+        return NULL;
+    return &oit->second;
+}
+
 isminetype CWallet::IsMine(const CTxIn &txin) const
 {
     {
@@ -2049,6 +2798,9 @@ isminetype CWallet::IsMine(const CTxIn &txin) const
             if (txin.prevout.n < prev.vout.size())
                 return IsMine(prev.vout[txin.prevout.n]);
         }
+        const CTxOut* pprevout = GetSettledOutput(mapSettledTxs, txin.prevout);
+        if (pprevout)
+            return IsMine(*pprevout);
     }
     return ISMINE_NO;
 }
@@ -2065,6 +2817,9 @@ CAmount CWallet::GetDebit(const CTxIn &txin, const isminefilter& filter) const
                 if (IsMine(prev.vout[txin.prevout.n]) & filter)
                     return prev.vout[txin.prevout.n].nValue;
         }
+        const CTxOut* pprevout = GetSettledOutput(mapSettledTxs, txin.prevout);
+        if (pprevout && (IsMine(*pprevout) & filter))
+            return pprevout->nValue;
     }
     return 0;
 }
@@ -2268,6 +3023,20 @@ bool CWallet::LoadCryptedHDSeed(const uint256& seedFp, const std::vector<unsigne
     return CCryptoKeyStore::SetCryptedHDSeed(seedFp, seed);
 }
 
+void CWalletTx::MarkDirty()
+{
+    fCreditCached = false;
+    fAvailableCreditCached = false;
+    fWatchDebitCached = false;
+    fWatchCreditCached = false;
+    fAvailableWatchCreditCached = false;
+    fImmatureWatchCreditCached = false;
+    fDebitCached = false;
+    fChangeCached = false;
+    if (pwallet)
+        pwallet->MarkBalancesDirty();
+}
+
 void CWalletTx::SetSproutNoteData(mapSproutNoteData_t &noteData)
 {
     mapSproutNoteData.clear();
@@ -3117,94 +3886,129 @@ void CWallet::ResendWalletTransactions(int64_t nBestBlockTime)
  */
 
 
-CAmount CWallet::GetBalance() const
+CWalletTxUpdates::CWalletTxUpdates(size_t nMaxEntriesIn) :
+    nLastSequence(GetTimeMicros()), nMaxEntries(nMaxEntriesIn)
+{
+}
+
+void CWalletTxUpdates::Add(const uint256& hash)
 {
-    CAmount nTotal = 0;
     {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
-        }
+        std::unique_lock<std::mutex> lock(mutex);
+        entries.emplace_back(++nLastSequence, hash);
+        while (entries.size() > nMaxEntries)
+            entries.pop_front();
     }
+    cond.notify_all();
+}
 
-    return nTotal;
+uint64_t CWalletTxUpdates::GetCursor() const
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    return nLastSequence;
 }
 
-CAmount CWallet::GetUnconfirmedBalance() const
+bool CWalletTxUpdates::GetSince(uint64_t nCursor, std::vector<uint256>& vHashes, uint64_t& nNextCursor) const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!CheckFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableCredit();
-        }
+    std::unique_lock<std::mutex> lock(mutex);
+    nNextCursor = nLastSequence;
+    vHashes.clear();
+    if (nCursor > nLastSequence)
+        return false;
+
+    std::set<uint256> setSeen;
+    for (const std::pair<uint64_t, uint256>& entry : entries) {
+        if (entry.first > nCursor && setSeen.insert(entry.second).second)
+            vHashes.push_back(entry.second);
     }
-    return nTotal;
+    // Complete if the log still starts right after the cursor
+    uint64_t nFirstKept = entries.empty() ? nLastSequence + 1 : entries.front().first;
+    return nFirstKept <= nCursor + 1;
 }
 
-CAmount CWallet::GetImmatureBalance() const
+bool CWalletTxUpdates::Wait(uint64_t nCursor, int64_t nTimeout)
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
+    std::unique_lock<std::mutex> lock(mutex);
+    return cond.wait_for(lock, std::chrono::milliseconds(nTimeout),
+        [&] { return nLastSequence != nCursor; });
+}
+
+static void AddToBalances(const CWalletTx& wtx, bool fFinal, int nDepth, CWalletBalances& balances)
+{
+    bool fTrusted = wtx.IsTrusted();
+    if (fTrusted) {
+        balances.balance += wtx.GetAvailableCredit();
+        balances.watchOnlyBalance += wtx.GetAvailableWatchOnlyCredit();
     }
-    return nTotal;
+    if (!fFinal || (!fTrusted && nDepth == 0)) {
+        balances.unconfirmedBalance += wtx.GetAvailableCredit();
+        balances.unconfirmedWatchOnlyBalance += wtx.GetAvailableWatchOnlyCredit();
+    }
+    balances.immatureBalance += wtx.GetImmatureCredit();
+    balances.immatureWatchOnlyBalance += wtx.GetImmatureWatchOnlyCredit();
 }
 
-CAmount CWallet::GetWatchOnlyBalance() const
+CWalletBalances CWallet::GetBalances() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
+    LOCK2(cs_main, cs_wallet);
+    // Read the version before visiting the transactions, so that a concurrent
+    // MarkDirty() can only cause an unnecessary recomputation.
+    uint64_t nVersion = nTxStateVersion;
+    if (pindexBalances != chainActive.Tip() || nBalancesVersion != nVersion) {
+        cachedBalances = CWalletBalances();
+        vBalancesPending.clear();
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
+            const CWalletTx& wtx = (*it).second;
+            if (wtx.GetDepthInMainChain() >= 1 && CheckFinalTx(wtx)) {
+                AddToBalances(wtx, true, wtx.GetDepthInMainChain(), cachedBalances);
+            } else {
+                vBalancesPending.push_back((*it).first);
+            }
+        }
+        pindexBalances = chainActive.Tip();
+        nBalancesVersion = nVersion;
+    }
+
+    CWalletBalances balances = cachedBalances;
+    for (const uint256& hash : vBalancesPending) {
+        map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+        if (it != mapWallet.end()) {
+            const CWalletTx& wtx = (*it).second;
+            AddToBalances(wtx, CheckFinalTx(wtx), wtx.GetDepthInMainChain(), balances);
         }
     }
+    return balances;
+}
+
+CAmount CWallet::GetBalance() const
+{
+    return GetBalances().balance;
+}
+
+CAmount CWallet::GetUnconfirmedBalance() const
+{
+    return GetBalances().unconfirmedBalance;
+}
+
+CAmount CWallet::GetImmatureBalance() const
+{
+    return GetBalances().immatureBalance;
+}
 
-    return nTotal;
+CAmount CWallet::GetWatchOnlyBalance() const
+{
+    return GetBalances().watchOnlyBalance;
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!CheckFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().unconfirmedWatchOnlyBalance;
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().immatureWatchOnlyBalance;
 }
 
 void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const CCoinControl *coinControl, bool fIncludeZeroValue, bool fIncludeCoinBase) const
@@ -4643,6 +5447,7 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
     strUsage += HelpMessageOpt("-migrationdestaddress=<zaddr>", _("Set the Sapling migration address"));
     strUsage += HelpMessageOpt("-mintxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for transaction creation (default: %s)"),
                                                             CURRENCY_UNIT, FormatMoney(DEFAULT_TRANSACTION_MINFEE)));
+    strUsage += HelpMessageOpt("-payoutbatchwindow=<n>", strprintf(_("Collect z_sendmanybatched payments from the same address for <n> seconds before sending them together (default: %u)"), DEFAULT_PAYOUT_BATCH_WINDOW));
     strUsage += HelpMessageOpt("-paytxfee=<amt>", strprintf(_("Fee (in %s/kB) to add to transactions you send (default: %s)"),
                                                             CURRENCY_UNIT, FormatMoney(payTxFee.GetFeePerK())));
     strUsage += HelpMessageOpt("-rescan", _("Rescan the block chain for missing wallet transactions on startup"));
@@ -4653,7 +5458,11 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
     strUsage += HelpMessageOpt("-txexpirydelta", strprintf(_("Set the number of blocks after which a transaction that has not been mined will become invalid (min: %u, default: %u (pre-Blossom) or %u (post-Blossom))"), TX_EXPIRING_SOON_THRESHOLD + 1, DEFAULT_PRE_BLOSSOM_TX_EXPIRY_DELTA, DEFAULT_POST_BLOSSOM_TX_EXPIRY_DELTA));
     strUsage += HelpMessageOpt("-upgradewallet", _("Upgrade wallet to latest format on startup"));
     strUsage += HelpMessageOpt("-wallet=<file>", _("Specify wallet file absolute path or a path relative to the data directory") + " " + strprintf(_("(default: %s)"), DEFAULT_WALLET_DAT));
+    strUsage += HelpMessageOpt("-walletbackend=<format>", strprintf(_("Storage format for the wallet file, %s (BerkeleyDB) or %s (append-only log). With %s, an existing BerkeleyDB wallet is converted on startup (default: %s)"),
+                                                                    WALLET_BACKEND_BDB, WALLET_BACKEND_LOG, WALLET_BACKEND_LOG, DEFAULT_WALLET_BACKEND));
     strUsage += HelpMessageOpt("-walletbroadcast", _("Make the wallet broadcast transactions") + " " + strprintf(_("(default: %u)"), DEFAULT_WALLETBROADCAST));
+    strUsage += HelpMessageOpt("-walletlazycache=<n>", strprintf(_("Keep up to <n> settled transactions read back from the wallet file in memory (default: %u)"), DEFAULT_WALLET_LAZY_CACHE));
+    strUsage += HelpMessageOpt("-walletlazyload", strprintf(_("Keep settled wallet transactions, whose outputs and notes were all spent more than %u blocks ago, on disk instead of in memory (default: %u)"), MAX_REORG_LENGTH, DEFAULT_WALLET_LAZY_LOAD));
     strUsage += HelpMessageOpt("-walletnotify=<cmd>", _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)"));
     strUsage += HelpMessageOpt("-zapwallettxes=<mode>", _("Delete all wallet transactions and only recover those parts of the blockchain through -rescan on startup") +
                                " " + _("(1 = keep tx meta data e.g. account owner and payment request information, 2 = drop tx meta data)"));
@@ -4695,6 +5504,8 @@ bool CWallet::InitLoadWallet(bool clearWitnessCaches)
     int64_t nStart = GetTimeMillis();
     bool fFirstRun = true;
     CWallet *walletInstance = new CWallet(walletFile);
+    walletInstance->fLazyLoad = GetBoolArg("-walletlazyload", DEFAULT_WALLET_LAZY_LOAD);
+    walletInstance->nSettledTxCacheSize = std::max(GetArg("-walletlazycache", DEFAULT_WALLET_LAZY_CACHE), (int64_t)0);
     DBErrors nLoadWalletRet = walletInstance->LoadWallet(fFirstRun);
     if (nLoadWalletRet != DB_LOAD_OK)
     {
@@ -4761,6 +5572,11 @@ bool CWallet::InitLoadWallet(bool clearWitnessCaches)
         walletInstance->SetBestChain(chainActive.GetLocator());
     }
 
+    {
+        LOCK2(cs_main, walletInstance->cs_wallet);
+        walletInstance->LoadWitnessedSpends();
+    }
+
     LogPrintf(" wallet      %15dms\n", GetTimeMillis() - nStart);
 
     RegisterValidationInterface(walletInstance);
@@ -5002,6 +5818,158 @@ void CWallet::GetFilteredNotes(
     GetFilteredNotes(sproutEntries, saplingEntries, filterAddresses, minDepth, INT_MAX, ignoreSpent, requireSpendingKey);
 }
 
+void CWallet::AddToNoteIndex(const CWalletTx& wtx)
+{
+    LOCK(cs_wallet);
+    for (const auto& item : wtx.mapSproutNoteData) {
+        mapSproutNotesByAddress[item.second.address].insert(item.first);
+    }
+    for (const auto& item : wtx.mapSaplingNoteData) {
+        if (!mapDecryptedSaplingNotes.count(item.first)) {
+            setUnindexedSaplingNotes.insert(item.first);
+        }
+    }
+}
+
+void CWallet::IndexSaplingNotes()
+{
+    AssertLockHeld(cs_wallet);
+    for (const SaplingOutPoint& op : setUnindexedSaplingNotes) {
+        auto wit = mapWallet.find(op.hash);
+        if (wit != mapWallet.end()) {
+            IndexSaplingNote(wit->second, op);
+        } else if (mapSettledTxs.count(op.hash)) {
+            // Settled before it was indexed
+            setUnindexedSettledTxs.insert(op.hash);
+        }
+    }
+    setUnindexedSaplingNotes.clear();
+}
+
+void CWallet::IndexSaplingNote(const CWalletTx& wtx, const SaplingOutPoint& op)
+{
+    AssertLockHeld(cs_wallet);
+    auto nit = wtx.mapSaplingNoteData.find(op);
+    if (nit == wtx.mapSaplingNoteData.end() || mapDecryptedSaplingNotes.count(op)) {
+        return;
+    }
+    const SaplingNoteData& nd = nit->second;
+
+    auto optDeserialized = SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(wtx.vShieldedOutput[op.n].encCiphertext, nd.ivk, wtx.vShieldedOutput[op.n].ephemeralKey);
+
+    // The transaction would not have entered the wallet unless
+    // its plaintext had been successfully decrypted previously.
+    assert(optDeserialized != boost::none);
+
+    auto notePt = optDeserialized.get();
+    auto maybe_pa = nd.ivk.address(notePt.d);
+    assert(static_cast<bool>(maybe_pa));
+    auto pa = maybe_pa.get();
+
+    mapDecryptedSaplingNotes.insert(std::make_pair(op, SaplingNoteEntry {
+        op, pa, notePt.note(nd.ivk).get(), notePt.memo(), 0 }));
+    mapSaplingNotesByAddress[pa].insert(op);
+}
+
+void CWallet::IndexSettledNotes()
+{
+    AssertLockHeld(cs_wallet);
+    if (!fFileBacked || setUnindexedSettledTxs.empty()) {
+        return;
+    }
+
+    // Bypass the cache, as ForEachWalletTx does
+    CWalletDB walletdb(strWalletFile, "r");
+    for (const uint256& hash : setUnindexedSettledTxs) {
+        if (!mapSettledTxs.count(hash)) {
+            continue;
+        }
+        std::shared_ptr<CWalletTx> pwtx = ReadSettledTx(hash, walletdb);
+        if (!pwtx) {
+            continue;
+        }
+        for (const auto& item : pwtx->mapSproutNoteData) {
+            mapSproutNotesByAddress[item.second.address].insert(item.first);
+        }
+        for (const auto& item : pwtx->mapSaplingNoteData) {
+            IndexSaplingNote(*pwtx, item.first);
+        }
+    }
+    setUnindexedSettledTxs.clear();
+}
+
+const SproutNoteEntry& CWallet::GetDecryptedSproutNote(const CWalletTx& wtx, const JSOutPoint& jsop,
+                                                       const SproutPaymentAddress& pa)
+{
+    AssertLockHeld(cs_wallet);
+    auto it = mapDecryptedSproutNotes.find(jsop);
+    if (it != mapDecryptedSproutNotes.end()) {
+        return it->second;
+    }
+
+    KeyIO keyIO(Params());
+    int i = jsop.js; // Index into CTransaction.vJoinSplit
+    int j = jsop.n; // Index into JSDescription.ciphertexts
+
+    // Get cached decryptor
+    ZCNoteDecryption decryptor;
+    if (!GetNoteDecryptor(pa, decryptor)) {
+        // Note decryptors are created when the wallet is loaded, so it should always exist
+        throw std::runtime_error(strprintf("Could not find note decryptor for payment address %s", keyIO.EncodePaymentAddress(pa)));
+    }
+
+    // determine amount of funds in the note
+    auto hSig = wtx.vJoinSplit[i].h_sig(wtx.joinSplitPubKey);
+    try {
+        SproutNotePlaintext plaintext = SproutNotePlaintext::decrypt(
+                decryptor,
+                wtx.vJoinSplit[i].ciphertexts[j],
+                wtx.vJoinSplit[i].ephemeralKey,
+                hSig,
+                (unsigned char) j);
+
+        return mapDecryptedSproutNotes.insert(std::make_pair(jsop, SproutNoteEntry {
+            jsop, pa, plaintext.note(pa), plaintext.memo(), 0 })).first->second;
+
+    } catch (const note_decryption_failed &err) {
+        // Couldn't decrypt with this spending key
+        throw std::runtime_error(strprintf("Could not decrypt note for payment address %s", keyIO.EncodePaymentAddress(pa)));
+    } catch (const std::exception &exc) {
+        // Unexpected failure
+        throw std::runtime_error(strprintf("Error while decrypting note for payment address %s: %s", keyIO.EncodePaymentAddress(pa), exc.what()));
+    }
+}
+
+// Checks the transaction-level filters of GetFilteredNotes, computing the
+// depth once for all of the notes of a transaction.
+class FilteredNotesTxCheck
+{
+private:
+    int minDepth;
+    int maxDepth;
+    uint256 hashLast;
+    bool fLastPassed = false;
+    int nLastDepth = 0;
+
+public:
+    FilteredNotesTxCheck(int minDepthIn, int maxDepthIn) : minDepth(minDepthIn), maxDepth(maxDepthIn) { }
+
+    bool operator()(const CWalletTx& wtx, int& nDepth)
+    {
+        if (wtx.GetHash() != hashLast) {
+            hashLast = wtx.GetHash();
+            nLastDepth = wtx.GetDepthInMainChain();
+            fLastPassed = CheckFinalTx(wtx) &&
+                          nLastDepth >= minDepth &&
+                          nLastDepth <= maxDepth &&
+                          // Filter coinbase transactions that don't have Sapling outputs
+                          !(wtx.IsCoinBase() && wtx.mapSaplingNoteData.empty());
+        }
+        nDepth = nLastDepth;
+        return fLastPassed;
+    }
+};
+
 /**
  * Find notes in the wallet filtered by payment addresses, min depth, max depth, 
  * if the note is spent, if a spending key is required, and if the notes are locked.
@@ -5018,118 +5986,152 @@ void CWallet::GetFilteredNotes(
     bool ignoreLocked)
 {
     LOCK2(cs_main, cs_wallet);
+    IndexSaplingNotes();
+    if (!ignoreSpent) {
+        IndexSettledNotes();
+    }
 
-    KeyIO keyIO(Params());
-    for (auto & p : mapWallet) {
-        CWalletTx wtx = p.second;
-
-        // Filter the transactions before checking for notes
-        if (!CheckFinalTx(wtx) ||
-            wtx.GetDepthInMainChain() < minDepth ||
-            wtx.GetDepthInMainChain() > maxDepth) {
+    // Collect the candidate notes, in wallet order
+    std::vector<std::pair<JSOutPoint, SproutPaymentAddress>> sproutNotes;
+    std::vector<SaplingOutPoint> saplingNotes;
+    auto addSproutNotes = [&](const std::pair<const SproutPaymentAddress, std::set<JSOutPoint>>& item) {
+        for (const JSOutPoint& jsop : item.second) {
+            sproutNotes.push_back(std::make_pair(jsop, item.first));
+        }
+    };
+    if (filterAddresses.empty()) {
+        for (const auto& item : mapSproutNotesByAddress) {
+            addSproutNotes(item);
+        }
+        for (const auto& item : mapSaplingNotesByAddress) {
+            saplingNotes.insert(saplingNotes.end(), item.second.begin(), item.second.end());
+        }
+    } else {
+        for (const PaymentAddress& addr : filterAddresses) {
+            if (auto sproutAddr = boost::get<SproutPaymentAddress>(&addr)) {
+                auto it = mapSproutNotesByAddress.find(*sproutAddr);
+                if (it != mapSproutNotesByAddress.end()) {
+                    addSproutNotes(*it);
+                }
+            } else if (auto saplingAddr = boost::get<SaplingPaymentAddress>(&addr)) {
+                auto it = mapSaplingNotesByAddress.find(*saplingAddr);
+                if (it != mapSaplingNotesByAddress.end()) {
+                    saplingNotes.insert(saplingNotes.end(), it->second.begin(), it->second.end());
+                }
+            }
+        }
+    }
+    std::sort(sproutNotes.begin(), sproutNotes.end(),
+        [](const std::pair<JSOutPoint, SproutPaymentAddress>& a, const std::pair<JSOutPoint, SproutPaymentAddress>& b) {
+            return a.first < b.first;
+        });
+    std::sort(saplingNotes.begin(), saplingNotes.end());
+
+    FilteredNotesTxCheck checkTx(minDepth, maxDepth);
+
+    // Every note of a settled transaction is spent, so settled transactions
+    // are only read back from the wallet file when spent notes are wanted.
+    // Returns NULL, with fRemoved set if the transaction is gone from the
+    // wallet, when there is nothing to return.
+    std::shared_ptr<const CWalletTx> pwtxSettled;
+    auto findTx = [&](const uint256& hash, bool& fRemoved) -> const CWalletTx* {
+        fRemoved = false;
+        auto wit = mapWallet.find(hash);
+        if (wit != mapWallet.end()) {
+            return &wit->second;
+        }
+        if (!mapSettledTxs.count(hash)) {
+            fRemoved = true;
+            return nullptr;
+        }
+        if (ignoreSpent) {
+            return nullptr;
+        }
+        if (!pwtxSettled || pwtxSettled->GetHash() != hash) {
+            pwtxSettled = GetSettledTx(hash);
+        }
+        return pwtxSettled.get();
+    };
+
+    for (const auto& item : sproutNotes) {
+        const JSOutPoint& jsop = item.first;
+        const SproutPaymentAddress& pa = item.second;
+        bool fRemoved;
+        const CWalletTx* pwtx = findTx(jsop.hash, fRemoved);
+        if (fRemoved || (pwtx && !pwtx->mapSproutNoteData.count(jsop))) {
+            // The transaction was removed from the wallet
+            mapSproutNotesByAddress[pa].erase(jsop);
+            mapDecryptedSproutNotes.erase(jsop);
             continue;
         }
-
-        // Filter coinbase transactions that don't have Sapling outputs
-        if (wtx.IsCoinBase() && wtx.mapSaplingNoteData.empty()) {
+        if (!pwtx) {
             continue;
         }
+        const CWalletTx& wtx = *pwtx;
+        const SproutNoteData& nd = wtx.mapSproutNoteData.at(jsop);
 
-        for (auto & pair : wtx.mapSproutNoteData) {
-            JSOutPoint jsop = pair.first;
-            SproutNoteData nd = pair.second;
-            SproutPaymentAddress pa = nd.address;
-
-            // skip notes which belong to a different payment address in the wallet
-            if (!(filterAddresses.empty() || filterAddresses.count(pa))) {
-                continue;
-            }
-
-            // skip note which has been spent
-            if (ignoreSpent && nd.nullifier && IsSproutSpent(*nd.nullifier)) {
-                continue;
-            }
-
-            // skip notes which cannot be spent
-            if (requireSpendingKey && !HaveSproutSpendingKey(pa)) {
-                continue;
-            }
-
-            // skip locked notes
-            if (ignoreLocked && IsLockedNote(jsop)) {
-                continue;
-            }
-
-            int i = jsop.js; // Index into CTransaction.vJoinSplit
-            int j = jsop.n; // Index into JSDescription.ciphertexts
-
-            // Get cached decryptor
-            ZCNoteDecryption decryptor;
-            if (!GetNoteDecryptor(pa, decryptor)) {
-                // Note decryptors are created when the wallet is loaded, so it should always exist
-                throw std::runtime_error(strprintf("Could not find note decryptor for payment address %s", keyIO.EncodePaymentAddress(pa)));
-            }
-
-            // determine amount of funds in the note
-            auto hSig = wtx.vJoinSplit[i].h_sig(wtx.joinSplitPubKey);
-            try {
-                SproutNotePlaintext plaintext = SproutNotePlaintext::decrypt(
-                        decryptor,
-                        wtx.vJoinSplit[i].ciphertexts[j],
-                        wtx.vJoinSplit[i].ephemeralKey,
-                        hSig,
-                        (unsigned char) j);
-
-                sproutEntries.push_back(SproutNoteEntry {
-                    jsop, pa, plaintext.note(pa), plaintext.memo(), wtx.GetDepthInMainChain() });
-
-            } catch (const note_decryption_failed &err) {
-                // Couldn't decrypt with this spending key
-                throw std::runtime_error(strprintf("Could not decrypt note for payment address %s", keyIO.EncodePaymentAddress(pa)));
-            } catch (const std::exception &exc) {
-                // Unexpected failure
-                throw std::runtime_error(strprintf("Error while decrypting note for payment address %s: %s", keyIO.EncodePaymentAddress(pa), exc.what()));
-            }
+        int nDepth;
+        if (!checkTx(wtx, nDepth)) {
+            continue;
         }
 
-        for (auto & pair : wtx.mapSaplingNoteData) {
-            SaplingOutPoint op = pair.first;
-            SaplingNoteData nd = pair.second;
+        // skip note which has been spent
+        if (ignoreSpent && nd.nullifier && IsSproutSpent(*nd.nullifier)) {
+            continue;
+        }
 
-            auto optDeserialized = SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(wtx.vShieldedOutput[op.n].encCiphertext, nd.ivk, wtx.vShieldedOutput[op.n].ephemeralKey);
+        // skip notes which cannot be spent
+        if (requireSpendingKey && !HaveSproutSpendingKey(pa)) {
+            continue;
+        }
 
-            // The transaction would not have entered the wallet unless
-            // its plaintext had been successfully decrypted previously.
-            assert(optDeserialized != boost::none);
+        // skip locked notes
+        if (ignoreLocked && IsLockedNote(jsop)) {
+            continue;
+        }
 
-            auto notePt = optDeserialized.get();
-            auto maybe_pa = nd.ivk.address(notePt.d);
-            assert(static_cast<bool>(maybe_pa));
-            auto pa = maybe_pa.get();
+        sproutEntries.push_back(GetDecryptedSproutNote(wtx, jsop, pa));
+        sproutEntries.back().confirmations = nDepth;
+    }
 
-            // skip notes which belong to a different payment address in the wallet
-            if (!(filterAddresses.empty() || filterAddresses.count(pa))) {
-                continue;
-            }
+    for (const SaplingOutPoint& op : saplingNotes) {
+        auto eit = mapDecryptedSaplingNotes.find(op);
+        bool fRemoved;
+        const CWalletTx* pwtx = findTx(op.hash, fRemoved);
+        if (fRemoved || (pwtx && !pwtx->mapSaplingNoteData.count(op))) {
+            // The transaction was removed from the wallet
+            mapSaplingNotesByAddress[eit->second.address].erase(op);
+            mapDecryptedSaplingNotes.erase(eit);
+            continue;
+        }
+        if (!pwtx) {
+            continue;
+        }
+        const CWalletTx& wtx = *pwtx;
+        const SaplingNoteData& nd = wtx.mapSaplingNoteData.at(op);
+        const SaplingPaymentAddress& pa = eit->second.address;
 
-            if (ignoreSpent && nd.nullifier && IsSaplingSpent(*nd.nullifier)) {
-                continue;
-            }
+        int nDepth;
+        if (!checkTx(wtx, nDepth)) {
+            continue;
+        }
 
-            // skip notes which cannot be spent
-            if (requireSpendingKey && !HaveSpendingKeyForPaymentAddress(this)(pa)) {
-                continue;
-            }
+        if (ignoreSpent && nd.nullifier && IsSaplingSpent(*nd.nullifier)) {
+            continue;
+        }
 
-            // skip locked notes
-            if (ignoreLocked && IsLockedNote(op)) {
-                continue;
-            }
+        // skip notes which cannot be spent
+        if (requireSpendingKey && !HaveSpendingKeyForPaymentAddress(this)(pa)) {
+            continue;
+        }
 
-            auto note = notePt.note(nd.ivk).get();
-            saplingEntries.push_back(SaplingNoteEntry {
-                op, pa, note, notePt.memo(), wtx.GetDepthInMainChain() });
+        // skip locked notes
+        if (ignoreLocked && IsLockedNote(op)) {
+            continue;
         }
+
+        saplingEntries.push_back(eit->second);
+        saplingEntries.back().confirmations = nDepth;
     }
 }
 
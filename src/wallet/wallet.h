@@ -27,7 +27,14 @@
 #include "base58.h"
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <stdexcept>
 #include <stdint.h>
@@ -36,6 +43,7 @@
 #include <vector>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
 
 extern CWallet* pwalletMain;
 
@@ -64,6 +72,12 @@ static const unsigned int DEFAULT_TX_CONFIRM_TARGET = 2;
 //! Largest (in bytes) free transaction we're willing to create
 static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
 static const bool DEFAULT_WALLETBROADCAST = true;
+//! Default for -walletlazyload
+static const bool DEFAULT_WALLET_LAZY_LOAD = false;
+//! Default for -walletlazycache
+static const unsigned int DEFAULT_WALLET_LAZY_CACHE = 1000;
+//! Number of wallet transaction changes kept for waitforwallettx
+static const size_t WALLET_TX_UPDATES_SIZE = 10000;
 //! Size of witness cache
 //  Should be large enough that we can expect not to reorg beyond our cache
 //  unless there is some exceptional network disruption.
@@ -541,17 +555,7 @@ public:
     }
 
     //! make sure balances are recalculated
-    void MarkDirty()
-    {
-        fCreditCached = false;
-        fAvailableCreditCached = false;
-        fWatchDebitCached = false;
-        fWatchCreditCached = false;
-        fAvailableWatchCreditCached = false;
-        fImmatureWatchCreditCached = false;
-        fDebitCached = false;
-        fChangeCached = false;
-    }
+    void MarkDirty();
 
     void BindWallet(CWallet *pwalletIn)
     {
@@ -742,6 +746,100 @@ private:
 };
 
 
+/**
+ * What the wallet keeps in memory of a settled transaction when it is
+ * loaded lazily (-walletlazyload).
+ *
+ * A transaction is settled once it is deeper than MAX_REORG_LENGTH and
+ * every output and note of ours in it has been spent by a transaction that
+ * is that deep too, so its state can no longer change. The summary holds
+ * what the rest of the wallet needs to look up without the full
+ * transaction; the full transaction stays in the wallet file and is read
+ * back on demand.
+ */
+class CWalletTxSummary
+{
+public:
+    uint256 hashBlock;
+    int64_t nOrderPos;
+    //! Our outputs, by index, so that transactions spending them are recognized as ours
+    std::map<uint32_t, CTxOut> mapOutputs;
+    //! What the transaction spends, to populate the wallet's spend maps
+    std::vector<COutPoint> vPrevouts;
+    std::vector<uint256> vSproutNullifiers;
+    std::vector<uint256> vSaplingNullifiers;
+    //! The notes of ours in the transaction, by nullifier
+    std::map<uint256, JSOutPoint> mapSproutNotes;
+    std::map<uint256, SaplingOutPoint> mapSaplingNotes;
+
+    CWalletTxSummary() : nOrderPos(-1) { }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hashBlock);
+        READWRITE(nOrderPos);
+        READWRITE(mapOutputs);
+        READWRITE(vPrevouts);
+        READWRITE(vSproutNullifiers);
+        READWRITE(vSaplingNullifiers);
+        READWRITE(mapSproutNotes);
+        READWRITE(mapSaplingNotes);
+    }
+};
+
+
+/** The wallet balances reported by getinfo and getwalletinfo */
+struct CWalletBalances
+{
+    CAmount balance = 0;
+    CAmount unconfirmedBalance = 0;
+    CAmount immatureBalance = 0;
+    CAmount watchOnlyBalance = 0;
+    CAmount unconfirmedWatchOnlyBalance = 0;
+    CAmount immatureWatchOnlyBalance = 0;
+};
+
+/**
+ * The most recent changes to wallet transactions, in order, for clients that
+ * wait for them with waitforwallettx instead of polling. Each change gets the
+ * next sequence number, and clients pass back the last one they saw as their
+ * cursor. Sequence numbers start from the time the log is created, so that a
+ * cursor from before a restart is older than anything in the log.
+ */
+class CWalletTxUpdates
+{
+private:
+    mutable std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<std::pair<uint64_t, uint256>> entries;
+    uint64_t nLastSequence;
+    size_t nMaxEntries;
+
+public:
+    explicit CWalletTxUpdates(size_t nMaxEntriesIn = WALLET_TX_UPDATES_SIZE);
+
+    /** Record that a wallet transaction was added or updated. */
+    void Add(const uint256& hash);
+
+    /** The cursor that the next change will come after. */
+    uint64_t GetCursor() const;
+
+    /**
+     * Get each transaction changed after nCursor once, and the cursor to
+     * continue from. Returns false if some of those changes are no longer
+     * in the log, in which case the caller has to rescan the wallet.
+     */
+    bool GetSince(uint64_t nCursor, std::vector<uint256>& vHashes, uint64_t& nNextCursor) const;
+
+    /**
+     * Wait for up to nTimeout milliseconds for a change after nCursor.
+     * Returns whether GetSince(nCursor) has something new to report.
+     */
+    bool Wait(uint64_t nCursor, int64_t nTimeout);
+};
+
 /** 
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -787,6 +885,54 @@ private:
     TxNullifiers mapTxSproutNullifiers;
     TxNullifiers mapTxSaplingNullifiers;
 
+    /**
+     * The wallet's notes by payment address, with their decrypted contents
+     * cached, so that GetFilteredNotes only visits and decrypts the notes it
+     * may return. Sapling notes are indexed by the first GetFilteredNotes call
+     * after they enter the wallet, since their address is only known once
+     * they are decrypted. Entries for transactions that have been removed
+     * from the wallet are dropped when they are next visited. The notes of
+     * settled transactions stay in the index; those loaded from the wallet
+     * file are indexed the first time spent notes are asked for.
+     */
+    std::map<libzcash::SproutPaymentAddress, std::set<JSOutPoint>> mapSproutNotesByAddress;
+    std::map<libzcash::SaplingPaymentAddress, std::set<SaplingOutPoint>> mapSaplingNotesByAddress;
+    std::set<SaplingOutPoint> setUnindexedSaplingNotes;
+    std::set<uint256> setUnindexedSettledTxs;
+    std::map<JSOutPoint, SproutNoteEntry> mapDecryptedSproutNotes;
+    std::map<SaplingOutPoint, SaplingNoteEntry> mapDecryptedSaplingNotes;
+
+    void AddToNoteIndex(const CWalletTx& wtx);
+    void IndexSaplingNotes();
+    void IndexSaplingNote(const CWalletTx& wtx, const SaplingOutPoint& op);
+    void IndexSettledNotes();
+    const SproutNoteEntry& GetDecryptedSproutNote(const CWalletTx& wtx, const JSOutPoint& jsop,
+                                                  const libzcash::SproutPaymentAddress& pa);
+
+    /**
+     * Balances of the transactions confirmed in the active chain, so that
+     * polling the balances of a large wallet does not visit every transaction.
+     * They are valid while the tip is pindexBalances and no transaction has
+     * been marked dirty since nBalancesVersion; the transactions in
+     * vBalancesPending (unconfirmed, conflicted or not yet final) can change
+     * state with the mempool and are added up on every call.
+     */
+    mutable std::atomic<uint64_t> nTxStateVersion{0};
+    mutable const CBlockIndex* pindexBalances = NULL;
+    mutable uint64_t nBalancesVersion = 0;
+    mutable CWalletBalances cachedBalances;
+    mutable std::vector<uint256> vBalancesPending;
+
+    /**
+     * Settled transactions read back from the wallet file, most recently
+     * used first, so that repeated lookups do not go to disk.
+     */
+    typedef std::list<std::pair<uint256, std::shared_ptr<const CWalletTx>>> SettledTxList;
+    SettledTxList lruSettledTxs;
+    std::map<uint256, SettledTxList::iterator> mapSettledTxCache;
+
+    std::shared_ptr<CWalletTx> ReadSettledTx(const uint256& hash, CWalletDB& walletdb);
+
     std::vector<CTransaction> pendingSaplingMigrationTxs;
     AsyncRPCOperationId saplingMigrationOperationId;
 
@@ -803,8 +949,27 @@ public:
      */
     int64_t nWitnessCacheSize;
     bool fSaplingMigrationEnabled = false;
+    //! Move settled transactions out of mapWallet (-walletlazyload)
+    bool fLazyLoad = false;
+    //! Number of settled transactions GetSettledTx keeps in memory
+    size_t nSettledTxCacheSize = DEFAULT_WALLET_LAZY_CACHE;
 
     void ClearNoteWitnessCache();
+    /**
+     * Rebuild the witness cache from the records read by CWalletDB::LoadWallet.
+     * nHeight is unset for wallets written before witnesses were stored
+     * separately, in which case the witnesses stored in the transactions are
+     * used. Returns false if some witnesses could not be rebuilt.
+     */
+    bool LoadWitnessCache(boost::optional<int> nHeight,
+                          const std::map<JSOutPoint, CSproutWitnessRecord>& mapSproutWitnesses,
+                          const std::map<SaplingOutPoint, CSaplingWitnessRecord>& mapSaplingWitnesses,
+                          const std::map<int, CWitnessCacheDelta>& mapWitnessDeltas);
+    /**
+     * Find the witnessed notes already spent in the active chain, so that
+     * IncrementNoteWitnesses stops updating them once the spend is final.
+     */
+    void LoadWitnessedSpends();
 
 protected:
     /**
@@ -819,27 +984,103 @@ protected:
      */
     void DecrementNoteWitnesses(const CBlockIndex* pindex);
 
+    /** Changes to the stored witness cache made by one SetBestChain() call */
+    struct WitnessCacheUpdates {
+        std::vector<std::pair<JSOutPoint, CSproutWitnessRecord>> sproutWrites;
+        std::vector<JSOutPoint> sproutErases;
+        std::vector<std::pair<SaplingOutPoint, CSaplingWitnessRecord>> saplingWrites;
+        std::vector<SaplingOutPoint> saplingErases;
+        //! Heights of entries in mapPendingWitnessDeltas to write
+        std::vector<int> deltaWrites;
+        std::vector<int> deltaErases;
+    };
+
+    /**
+     * Height of the block the witness cache is valid for, i.e. of the last
+     * block passed to IncrementNoteWitnesses, or -1 if unknown.
+     */
+    int nWitnessCacheHeight;
+    //! Commitments of the blocks connected since the last SetBestChain(), by height
+    std::map<int, CWitnessCacheDelta> mapPendingWitnessDeltas;
+    //! Heights of the witness cache deltas stored in the wallet database
+    std::set<int> setWitnessDeltaHeights;
+    //! Height each note's stored witness record was written at
+    std::map<JSOutPoint, int> mapSproutWitnessRecords;
+    std::map<SaplingOutPoint, int> mapSaplingWitnessRecords;
+    //! Notes whose stored witness record can no longer be brought up to date by replaying deltas
+    std::set<JSOutPoint> setSproutWitnessesDirty;
+    std::set<SaplingOutPoint> setSaplingWitnessesDirty;
+
+    /**
+     * Notes whose witnesses IncrementNoteWitnesses and DecrementNoteWitnesses
+     * keep up to date. Once a note has been spent deeper than the longest
+     * possible reorg, it is dropped from here along with its witnesses.
+     */
+    std::set<JSOutPoint> setSproutWitnessedNotes;
+    std::set<SaplingOutPoint> setSaplingWitnessedNotes;
+    //! Witnessed notes spent in the active chain, by the height of the spending block
+    std::multimap<int, JSOutPoint> mapSproutWitnessedSpends;
+    std::multimap<int, SaplingOutPoint> mapSaplingWitnessedSpends;
+
+    void AddToWitnessedNotes(const CWalletTx& wtx);
+
+    void GetWitnessCacheUpdates(WitnessCacheUpdates& updates);
+    void WitnessCacheUpdatesWritten(const WitnessCacheUpdates& updates);
+
+    template <typename WalletDB>
+    bool WriteWitnessCacheUpdates(WalletDB& walletdb, const WitnessCacheUpdates& updates) {
+        for (const auto& item : updates.sproutWrites) {
+            if (!walletdb.WriteSproutWitnesses(item.first, item.second))
+                return false;
+        }
+        for (const JSOutPoint& jsop : updates.sproutErases) {
+            if (!walletdb.EraseSproutWitnesses(jsop))
+                return false;
+        }
+        for (const auto& item : updates.saplingWrites) {
+            if (!walletdb.WriteSaplingWitnesses(item.first, item.second))
+                return false;
+        }
+        for (const SaplingOutPoint& op : updates.saplingErases) {
+            if (!walletdb.EraseSaplingWitnesses(op))
+                return false;
+        }
+        for (int nHeight : updates.deltaWrites) {
+            if (!walletdb.WriteWitnessCacheDelta(nHeight, mapPendingWitnessDeltas[nHeight]))
+                return false;
+        }
+        for (int nHeight : updates.deltaErases) {
+            if (!walletdb.EraseWitnessCacheDelta(nHeight))
+                return false;
+        }
+        return walletdb.WriteWitnessCacheHeight(nWitnessCacheHeight);
+    }
+
+    /**
+     * Write the witness cache and the best block atomically.
+     *
+     * Instead of rewriting every CWalletTx with note data, this writes the
+     * commitments of each block connected since the last call, and a full
+     * witness record only for notes that were newly witnessed, invalidated by
+     * a reorg, or whose record is more than WITNESS_CACHE_SIZE blocks old.
+     * The bookkeeping is only updated once the database transaction commits.
+     */
     template <typename WalletDB>
     void SetBestChainINTERNAL(WalletDB& walletdb, const CBlockLocator& loc) {
+        LOCK(cs_wallet);
+        WitnessCacheUpdates updates;
+        GetWitnessCacheUpdates(updates);
+
         if (!walletdb.TxnBegin()) {
             // This needs to be done atomically, so don't do it at all
             LogPrintf("SetBestChain(): Couldn't start atomic write\n");
             return;
         }
         try {
-            for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                auto wtx = wtxItem.second;
-                // We skip transactions for which mapSproutNoteData and mapSaplingNoteData
-                // are empty. This covers transactions that have no Sprout or Sapling data
-                // (i.e. are purely transparent), as well as shielding and unshielding
-                // transactions in which we only have transparent addresses involved.
-                if (!(wtx.mapSproutNoteData.empty() && wtx.mapSaplingNoteData.empty())) {
-                    if (!walletdb.WriteTx(wtxItem.first, wtx)) {
-                        LogPrintf("SetBestChain(): Failed to write CWalletTx, aborting atomic write\n");
-                        walletdb.TxnAbort();
-                        return;
-                    }
-                }
+            if (!WriteWitnessCacheUpdates(walletdb, updates)) {
+                LogPrintf("SetBestChain(): Failed to write note witnesses, aborting atomic write\n");
+                walletdb.TxnAbort();
+                return;
             }
             if (!walletdb.WriteWitnessCacheSize(nWitnessCacheSize)) {
                 LogPrintf("SetBestChain(): Failed to write nWitnessCacheSize, aborting atomic write\n");
@@ -863,6 +1104,44 @@ protected:
             LogPrintf("SetBestChain(): Couldn't commit atomic write\n");
             return;
         }
+        WitnessCacheUpdatesWritten(updates);
+    }
+
+    /** Summarize the settled transactions still in mapWallet. */
+    void GetSettledTxs(std::vector<std::pair<uint256, CWalletTxSummary>>& vSettled) const;
+    /** Replace the given transactions in mapWallet by their summaries. */
+    void SettledTxsWritten(const std::vector<std::pair<uint256, CWalletTxSummary>>& vSettled);
+
+    /**
+     * Write the summaries of the settled transactions atomically, then drop
+     * the transactions from memory. Their full records stay in the wallet
+     * file for GetSettledTx and ForEachWalletTx.
+     */
+    template <typename WalletDB>
+    void PageOutSettledTxs(WalletDB& walletdb) {
+        AssertLockHeld(cs_wallet);
+        std::vector<std::pair<uint256, CWalletTxSummary>> vSettled;
+        GetSettledTxs(vSettled);
+        if (vSettled.empty()) {
+            return;
+        }
+
+        if (!walletdb.TxnBegin()) {
+            LogPrintf("PageOutSettledTxs(): Couldn't start atomic write\n");
+            return;
+        }
+        for (const auto& item : vSettled) {
+            if (!walletdb.WriteTxSummary(item.first, item.second)) {
+                LogPrintf("PageOutSettledTxs(): Failed to write transaction summary, aborting atomic write\n");
+                walletdb.TxnAbort();
+                return;
+            }
+        }
+        if (!walletdb.TxnCommit()) {
+            LogPrintf("PageOutSettledTxs(): Couldn't commit atomic write\n");
+            return;
+        }
+        SettledTxsWritten(vSettled);
     }
 
 private:
@@ -885,7 +1164,7 @@ public:
      *      fFileBacked (immutable after instantiation)
      *      strWalletFile (immutable after instantiation)
      */
-    mutable CCriticalSection cs_wallet;
+    mutable CInstrumentedCriticalSection cs_wallet{"cs_wallet"};
 
     bool fFileBacked;
     std::string strWalletFile;
@@ -933,6 +1212,7 @@ public:
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
         nWitnessCacheSize = 0;
+        nWitnessCacheHeight = -1;
     }
 
     /**
@@ -982,12 +1262,17 @@ public:
      *
      * - Restarting the node with -reindex (which operates on a locked wallet
      *   but with the now-cached nullifiers).
+     *
+     * Every nullifier spent by a connected block is probed against these
+     * maps, so they are hashed rather than ordered.
      */
-    std::map<uint256, JSOutPoint> mapSproutNullifiersToNotes;
+    boost::unordered_map<uint256, JSOutPoint, CCoinsKeyHasher> mapSproutNullifiersToNotes;
 
-    std::map<uint256, SaplingOutPoint> mapSaplingNullifiersToNotes;
+    boost::unordered_map<uint256, SaplingOutPoint, CCoinsKeyHasher> mapSaplingNullifiersToNotes;
 
     std::map<uint256, CWalletTx> mapWallet;
+    //! Settled transactions that were moved out of mapWallet (-walletlazyload)
+    std::map<uint256, CWalletTxSummary> mapSettledTxs;
 
     int64_t nOrderPosNext;
     std::map<uint256, int> mapRequestCount;
@@ -1004,6 +1289,26 @@ public:
 
     const CWalletTx* GetWalletTx(const uint256& hash) const;
 
+    /**
+     * Whether wtx is settled: deeper than MAX_REORG_LENGTH, with every
+     * output and note of ours spent by a transaction that is as deep.
+     */
+    bool IsSettled(const CWalletTx& wtx) const;
+    CWalletTxSummary SummarizeTx(const CWalletTx& wtx) const;
+    /** Add the summary of a settled transaction read from the wallet file. */
+    void LoadSettledTx(const uint256& hash, const CWalletTxSummary& summary);
+    /**
+     * Read a settled transaction back from the wallet file, through a cache
+     * of the nSettledTxCacheSize most recently used ones. Returns NULL if
+     * hash is not a settled transaction of this wallet.
+     */
+    std::shared_ptr<const CWalletTx> GetSettledTx(const uint256& hash);
+    /**
+     * Call f on every wallet transaction, including the settled ones, which
+     * are read from the wallet file one at a time.
+     */
+    void ForEachWalletTx(const std::function<void(const CWalletTx&)>& f);
+
     //! check whether we are allowed to upgrade (or already support) to the named feature
     bool CanSupportFeature(enum WalletFeature wf) { AssertLockHeld(cs_wallet); return nWalletMaxVersion >= wf; }
 
@@ -1177,6 +1482,9 @@ public:
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime);
     std::vector<uint256> ResendWalletTransactionsBefore(int64_t nTime);
+    /** Invalidate the cached balances; called when a transaction is marked dirty. */
+    void MarkBalancesDirty() const { nTxStateVersion++; }
+    CWalletBalances GetBalances() const;
     CAmount GetBalance() const;
     CAmount GetUnconfirmedBalance() const;
     CAmount GetImmatureBalance() const;
@@ -1336,6 +1644,9 @@ public:
     boost::signals2::signal<void (CWallet *wallet, const uint256 &hashTx,
             ChangeType status)> NotifyTransactionChanged;
 
+    /** Transactions added or updated, for waitforwallettx */
+    CWalletTxUpdates txUpdates;
+
     /** Show progress e.g. for rescan */
     boost::signals2::signal<void (const std::string &title, int nProgress)> ShowProgress;
 
@@ -62,10 +62,23 @@ bool CWalletDB::WriteTx(uint256 hash, const CWalletTx& wtx)
     return Write(std::make_pair(std::string("tx"), hash), wtx);
 }
 
+bool CWalletDB::ReadTx(uint256 hash, CWalletTx& wtx)
+{
+    return Read(std::make_pair(std::string("tx"), hash), wtx);
+}
+
 bool CWalletDB::EraseTx(uint256 hash)
 {
     nWalletDBUpdated++;
-    return Erase(std::make_pair(std::string("tx"), hash));
+    // The summary of a settled transaction goes with it
+    return Erase(std::make_pair(std::string("tx"), hash)) &&
+           Erase(std::make_pair(std::string("txsum"), hash));
+}
+
+bool CWalletDB::WriteTxSummary(uint256 hash, const CWalletTxSummary& summary)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("txsum"), hash), summary);
 }
 
 bool CWalletDB::WriteKey(const CPubKey& vchPubKey, const CPrivKey& vchPrivKey, const CKeyMetadata& keyMeta)
@@ -258,6 +271,48 @@ bool CWalletDB::WriteWitnessCacheSize(int64_t nWitnessCacheSize)
     return Write(std::string("witnesscachesize"), nWitnessCacheSize);
 }
 
+bool CWalletDB::WriteWitnessCacheHeight(int nHeight)
+{
+    nWalletDBUpdated++;
+    return Write(std::string("witnesscacheheight"), nHeight);
+}
+
+bool CWalletDB::WriteSproutWitnesses(const JSOutPoint& jsop, const CSproutWitnessRecord& record)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("sproutwitnesses"), jsop), record);
+}
+
+bool CWalletDB::EraseSproutWitnesses(const JSOutPoint& jsop)
+{
+    nWalletDBUpdated++;
+    return Erase(std::make_pair(std::string("sproutwitnesses"), jsop));
+}
+
+bool CWalletDB::WriteSaplingWitnesses(const SaplingOutPoint& op, const CSaplingWitnessRecord& record)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("saplingwitnesses"), op), record);
+}
+
+bool CWalletDB::EraseSaplingWitnesses(const SaplingOutPoint& op)
+{
+    nWalletDBUpdated++;
+    return Erase(std::make_pair(std::string("saplingwitnesses"), op));
+}
+
+bool CWalletDB::WriteWitnessCacheDelta(int nHeight, const CWitnessCacheDelta& delta)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("witnessdelta"), nHeight), delta);
+}
+
+bool CWalletDB::EraseWitnessCacheDelta(int nHeight)
+{
+    nWalletDBUpdated++;
+    return Erase(std::make_pair(std::string("witnessdelta"), nHeight));
+}
+
 bool CWalletDB::ReadPool(int64_t nPool, CKeyPool& keypool)
 {
     return Read(std::make_pair(std::string("pool"), nPool), keypool);
@@ -317,7 +372,7 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
 {
     bool fAllAccounts = (strAccount == "*");
 
-    Dbc* pcursor = GetCursor();
+    CDBCursor* pcursor = GetCursor();
     if (!pcursor)
         throw runtime_error("CWalletDB::ListAccountCreditDebit(): cannot create DB cursor");
     unsigned int fFlags = DB_SET_RANGE;
@@ -445,6 +500,12 @@ public:
     bool fAnyUnordered;
     int nFileVersion;
     vector<uint256> vWalletUpgrade;
+    boost::optional<int> nWitnessCacheHeight;
+    std::map<JSOutPoint, CSproutWitnessRecord> mapSproutWitnesses;
+    std::map<SaplingOutPoint, CSaplingWitnessRecord> mapSaplingWitnesses;
+    std::map<int, CWitnessCacheDelta> mapWitnessDeltas;
+    //! Summaries of settled transactions that are not used without -walletlazyload
+    std::vector<uint256> vUnusedTxSummaries;
 
     CWalletScanState() {
         nKeys = nCKeys = nKeyMeta = nZKeys = nCZKeys = nZKeyMeta = nSapZAddrs = 0;
@@ -481,6 +542,10 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         {
             uint256 hash;
             ssKey >> hash;
+            if (pwallet->mapSettledTxs.count(hash)) {
+                // Settled transactions are read on demand
+                return true;
+            }
             CWalletTx wtx;
             ssValue >> wtx;
             CValidationState state;
@@ -513,6 +578,15 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
 
             pwallet->AddToWallet(wtx, true, NULL);
         }
+        else if (strType == "txsum")
+        {
+            // Read before the other records by LoadSettledTxs
+            if (!pwallet->fLazyLoad) {
+                uint256 hash;
+                ssKey >> hash;
+                wss.vUnusedTxSummaries.push_back(hash);
+            }
+        }
         else if (strType == "acentry")
         {
             string strAccount;
@@ -842,6 +916,30 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         {
             ssValue >> pwallet->nWitnessCacheSize;
         }
+        else if (strType == "witnesscacheheight")
+        {
+            int nHeight;
+            ssValue >> nHeight;
+            wss.nWitnessCacheHeight = nHeight;
+        }
+        else if (strType == "sproutwitnesses")
+        {
+            JSOutPoint jsop;
+            ssKey >> jsop;
+            ssValue >> wss.mapSproutWitnesses[jsop];
+        }
+        else if (strType == "saplingwitnesses")
+        {
+            SaplingOutPoint op;
+            ssKey >> op;
+            ssValue >> wss.mapSaplingWitnesses[op];
+        }
+        else if (strType == "witnessdelta")
+        {
+            int nHeight;
+            ssKey >> nHeight;
+            ssValue >> wss.mapWitnessDeltas[nHeight];
+        }
         else if (strType == "hdseed")
         {
             uint256 seedFp;
@@ -898,6 +996,48 @@ static bool IsKeyType(string strType)
             strType == "mkey" || strType == "ckey");
 }
 
+bool CWalletDB::LoadSettledTxs(CWallet* pwallet)
+{
+    CDBCursor* pcursor = GetCursor();
+    if (!pcursor)
+        return false;
+
+    unsigned int fFlags = DB_SET_RANGE;
+    while (true)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        if (fFlags == DB_SET_RANGE)
+            ssKey << std::make_pair(std::string("txsum"), uint256());
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        int ret = ReadAtCursor(pcursor, ssKey, ssValue, fFlags);
+        fFlags = DB_NEXT;
+        if (ret == DB_NOTFOUND)
+            break;
+        else if (ret != 0)
+        {
+            pcursor->close();
+            return false;
+        }
+
+        string strType;
+        ssKey >> strType;
+        if (strType != "txsum")
+            break;
+        uint256 hash;
+        CWalletTxSummary summary;
+        try {
+            ssKey >> hash;
+            ssValue >> summary;
+        } catch (const std::exception&) {
+            pcursor->close();
+            return false;
+        }
+        pwallet->LoadSettledTx(hash, summary);
+    }
+    pcursor->close();
+    return true;
+}
+
 DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
 {
     pwallet->vchDefaultKey = CPubKey();
@@ -915,8 +1055,16 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             pwallet->LoadMinVersion(nMinVersion);
         }
 
+        // The summaries of settled transactions are needed to skip their
+        // full records, which come first in the database.
+        if (pwallet->fLazyLoad && !LoadSettledTxs(pwallet))
+        {
+            LogPrintf("Error reading settled wallet transactions\n");
+            return DB_CORRUPT;
+        }
+
         // Get cursor
-        Dbc* pcursor = GetCursor();
+        CDBCursor* pcursor = GetCursor();
         if (!pcursor)
         {
             LogPrintf("Error getting wallet database cursor\n");
@@ -958,6 +1106,14 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 LogPrintf("%s\n", strErr);
         }
         pcursor->close();
+
+        // Witness records can be read before the transactions they belong to,
+        // so they are applied once everything has been loaded.
+        if (!pwallet->LoadWitnessCache(wss.nWitnessCacheHeight, wss.mapSproutWitnesses,
+                                       wss.mapSaplingWitnesses, wss.mapWitnessDeltas)) {
+            LogPrintf("Stored note witnesses are incomplete, rescanning\n");
+            SoftSetBoolArg("-rescan", true);
+        }
     }
     catch (const boost::thread_interrupted&) {
         throw;
@@ -989,6 +1145,15 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     BOOST_FOREACH(uint256 hash, wss.vWalletUpgrade)
         WriteTx(hash, pwallet->mapWallet[hash]);
 
+    // Without -walletlazyload every transaction was loaded in full, so the
+    // summaries would only go stale.
+    BOOST_FOREACH(uint256 hash, wss.vUnusedTxSummaries)
+        Erase(std::make_pair(std::string("txsum"), hash));
+
+    if (!pwallet->mapSettledTxs.empty())
+        LogPrintf("Settled transactions: %u left on disk, %u in memory\n",
+                  pwallet->mapSettledTxs.size(), pwallet->mapWallet.size());
+
     // Rewrite encrypted wallets of versions 0.4.0 and 0.5.0rc:
     if (wss.fIsEncrypted && (wss.nFileVersion == 40000 || wss.nFileVersion == 50000))
         return DB_NEED_REWRITE;
@@ -1019,7 +1184,7 @@ DBErrors CWalletDB::FindWalletTxToZap(CWallet* pwallet, vector<uint256>& vTxHash
         }
 
         // Get cursor
-        Dbc* pcursor = GetCursor();
+        CDBCursor* pcursor = GetCursor();
         if (!pcursor)
         {
             LogPrintf("Error getting wallet database cursor\n");
@@ -11,6 +11,7 @@
 #include "key.h"
 #include "keystore.h"
 #include "zcash/Address.hpp"
+#include "zcash/IncrementalMerkleTree.hpp"
 
 #include <list>
 #include <stdint.h>
@@ -28,6 +29,9 @@ class CMasterKey;
 class CScript;
 class CWallet;
 class CWalletTx;
+class CWalletTxSummary;
+class JSOutPoint;
+class SaplingOutPoint;
 class uint160;
 class uint256;
 
@@ -118,6 +122,52 @@ public:
     }
 };
 
+/**
+ * The note commitments appended to the Sprout and Sapling trees by one block.
+ *
+ * The wallet persists its witness cache as one CNoteWitnessRecord per note,
+ * rewritten only occasionally, plus one of these for every block since the
+ * oldest record. Loading replays the deltas on top of the records, so a flush
+ * does not need to rewrite the witnesses of every note.
+ */
+class CWitnessCacheDelta
+{
+public:
+    std::vector<uint256> sproutCommitments;
+    std::vector<uint256> saplingCommitments;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(sproutCommitments);
+        READWRITE(saplingCommitments);
+    }
+};
+
+/** The cached witnesses of one note, as of witnessHeight. */
+template <typename Witness>
+class CNoteWitnessRecord
+{
+public:
+    int witnessHeight;
+    std::list<Witness> witnesses;
+
+    CNoteWitnessRecord() : witnessHeight {-1} { }
+    CNoteWitnessRecord(int h, const std::list<Witness>& w) : witnessHeight {h}, witnesses {w} { }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(witnessHeight);
+        READWRITE(witnesses);
+    }
+};
+
+typedef CNoteWitnessRecord<SproutWitness> CSproutWitnessRecord;
+typedef CNoteWitnessRecord<SaplingWitness> CSaplingWitnessRecord;
+
 /** Access to the wallet database */
 class CWalletDB : public CDB
 {
@@ -133,7 +183,9 @@ public:
     bool ErasePurpose(const std::string& strAddress);
 
     bool WriteTx(uint256 hash, const CWalletTx& wtx);
+    bool ReadTx(uint256 hash, CWalletTx& wtx);
     bool EraseTx(uint256 hash);
+    bool WriteTxSummary(uint256 hash, const CWalletTxSummary& summary);
 
     bool WriteKey(const CPubKey& vchPubKey, const CPrivKey& vchPrivKey, const CKeyMetadata &keyMeta);
     bool WriteCryptedKey(const CPubKey& vchPubKey, const std::vector<unsigned char>& vchCryptedSecret, const CKeyMetadata &keyMeta);
@@ -152,6 +204,14 @@ public:
     bool WriteDefaultKey(const CPubKey& vchPubKey);
 
     bool WriteWitnessCacheSize(int64_t nWitnessCacheSize);
+    bool WriteWitnessCacheHeight(int nHeight);
+
+    bool WriteSproutWitnesses(const JSOutPoint& jsop, const CSproutWitnessRecord& record);
+    bool EraseSproutWitnesses(const JSOutPoint& jsop);
+    bool WriteSaplingWitnesses(const SaplingOutPoint& op, const CSaplingWitnessRecord& record);
+    bool EraseSaplingWitnesses(const SaplingOutPoint& op);
+    bool WriteWitnessCacheDelta(int nHeight, const CWitnessCacheDelta& delta);
+    bool EraseWitnessCacheDelta(int nHeight);
 
     bool ReadPool(int64_t nPool, CKeyPool& keypool);
     bool WritePool(int64_t nPool, const CKeyPool& keypool);
@@ -173,6 +233,8 @@ public:
 
     DBErrors ReorderTransactions(CWallet* pwallet);
     DBErrors LoadWallet(CWallet* pwallet);
+    /** Load the summaries of the settled transactions (-walletlazyload). */
+    bool LoadSettledTxs(CWallet* pwallet);
     DBErrors FindWalletTxToZap(CWallet* pwallet, std::vector<uint256>& vTxHash, std::vector<CWalletTx>& vWtx);
     DBErrors ZapWalletTx(CWallet* pwallet, std::vector<CWalletTx>& vWtx);
     static bool Recover(CDBEnv& dbenv, const std::string& filename, bool fOnlyKeys);
@@ -1,4 +1,7 @@
+#include <algorithm>
+#include <map>
 #include <stdexcept>
+#include <tuple>
 
 #include <boost/foreach.hpp>
 
@@ -1136,6 +1139,104 @@ void IncrementalWitness<Depth, Hash>::append(Hash obj) {
     }
 }
 
+// The position the next appended leaf will have in the tree.
+template<size_t Depth, typename Hash>
+uint64_t IncrementalWitness<Depth, Hash>::next_position() const {
+    uint64_t pos = position();
+    if (cursor) {
+        // The cursor is filling the right sibling of the subtree of depth
+        // cursor_depth that contains the witnessed leaf.
+        return (((pos >> cursor_depth) + 1) << cursor_depth) + cursor->size();
+    }
+    size_t depth = tree.next_depth(filled.size());
+    if (depth >= Depth) {
+        return (uint64_t)1 << Depth;
+    }
+    return ((pos >> depth) + 1) << depth;
+}
+
+template<size_t Depth, typename Hash>
+void IncrementalWitness<Depth, Hash>::append_all(const std::vector<IncrementalWitness*>& witnesses,
+                                                 const std::vector<Hash>& leaves) {
+    if (leaves.empty()) {
+        return;
+    }
+
+    // Every witness fills aligned subtrees to the right of its leaf, and
+    // witnesses that fill the same subtree (identified by its depth and the
+    // position of its first leaf) hold identical cursors for it. The state of
+    // each such subtree after the new leaves is computed once, keyed also by
+    // the position of the first new leaf since witnesses may be at different
+    // positions.
+    struct Subtree {
+        IncrementalMerkleTree<Depth, Hash> tree;
+        bool complete;
+        Hash root;
+    };
+    std::map<std::tuple<size_t, uint64_t, uint64_t>, Subtree> subtrees;
+
+    for (IncrementalWitness* witness : witnesses) {
+        const uint64_t first = witness->next_position();
+        const uint64_t end = first + leaves.size();
+
+        auto fill = [&](size_t depth, uint64_t start) -> const Subtree& {
+            auto key = std::make_tuple(depth, start, first);
+            auto it = subtrees.find(key);
+            if (it != subtrees.end()) {
+                return it->second;
+            }
+            Subtree subtree;
+            if (start < first) {
+                // Continue the subtree from the witness' cursor
+                subtree.tree = *witness->cursor;
+            }
+            uint64_t stop = std::min(start + ((uint64_t)1 << depth), end);
+            for (uint64_t i = std::max(start, first); i < stop; i++) {
+                subtree.tree.append(leaves[i - first]);
+            }
+            subtree.complete = subtree.tree.is_complete(depth);
+            if (subtree.complete) {
+                subtree.root = subtree.tree.root(depth);
+            }
+            return subtrees.insert(std::make_pair(key, subtree)).first->second;
+        };
+
+        uint64_t pos = first;
+        if (witness->cursor) {
+            uint64_t start = first - witness->cursor->size();
+            const Subtree& subtree = fill(witness->cursor_depth, start);
+            if (!subtree.complete) {
+                witness->cursor = subtree.tree;
+                continue;
+            }
+            witness->filled.push_back(subtree.root);
+            witness->cursor = boost::none;
+            pos = start + ((uint64_t)1 << witness->cursor_depth);
+        }
+        while (pos < end) {
+            witness->cursor_depth = witness->tree.next_depth(witness->filled.size());
+
+            if (witness->cursor_depth >= Depth) {
+                throw std::runtime_error("tree is full");
+            }
+
+            if (witness->cursor_depth == 0) {
+                witness->filled.push_back(leaves[pos - first]);
+                pos++;
+                continue;
+            }
+
+            const Subtree& subtree = fill(witness->cursor_depth, pos);
+            if (!subtree.complete) {
+                witness->cursor = subtree.tree;
+                break;
+            }
+            witness->filled.push_back(subtree.root);
+            pos += (uint64_t)1 << witness->cursor_depth;
+        }
+    }
+}
+
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, SHA256Compress>;
 
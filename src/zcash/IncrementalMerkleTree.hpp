@@ -175,6 +175,13 @@ public:
 
     void append(Hash obj);
 
+    // Appends the same leaves to each witness. This is equivalent to calling
+    // append() on every witness for every leaf, but the subtrees the witnesses
+    // are filling are hashed once and shared, so each witness only does
+    // O(Depth) work instead of O(leaves).
+    static void append_all(const std::vector<IncrementalWitness*>& witnesses,
+                           const std::vector<Hash>& leaves);
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -196,6 +203,7 @@ private:
     boost::optional<IncrementalMerkleTree<Depth, Hash>> cursor;
     size_t cursor_depth = 0;
     std::deque<Hash> partial_path() const;
+    uint64_t next_position() const;
     IncrementalWitness(IncrementalMerkleTree<Depth, Hash> tree) : tree(tree) {}
 };
 
@@ -11,12 +11,17 @@ CZMQAbstractNotifier::~CZMQAbstractNotifier()
     assert(!psocket);
 }
 
+bool CZMQAbstractNotifier::WantsBlockData() const
+{
+    return false;
+}
+
 bool CZMQAbstractNotifier::NotifyBlock(const CBlockIndex * /*CBlockIndex*/)
 {
     return true;
 }
 
-bool CZMQAbstractNotifier::NotifyBlock(const CBlock &)
+bool CZMQAbstractNotifier::NotifyBlock(const CBlock &, ZMQBlock)
 {
     return true;
 }
@@ -25,3 +30,13 @@ bool CZMQAbstractNotifier::NotifyTransaction(const CTransaction &/*transaction*/
 {
     return true;
 }
+
+bool CZMQAbstractNotifier::NotifyTransactionRemoval(const CTransaction &/*transaction*/, MemPoolRemovalReason /*reason*/)
+{
+    return true;
+}
+
+bool CZMQAbstractNotifier::NotifyChainTip(const CBlockIndex * /*pindex*/, const CBlock &/*block*/, bool /*fConnected*/)
+{
+    return true;
+}
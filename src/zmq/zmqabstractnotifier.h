@@ -6,12 +6,21 @@
 #define BITCOIN_ZMQ_ZMQABSTRACTNOTIFIER_H
 
 #include "zmqconfig.h"
+#include "streams.h"
+
+#include <memory>
 
 class CBlockIndex;
 class CZMQAbstractNotifier;
+enum class MemPoolRemovalReason;
 
 typedef CZMQAbstractNotifier* (*CZMQNotifierFactory)();
 
+/** A serialized block or transaction, shared by the notifiers that publish it */
+typedef std::shared_ptr<const CSerializeData> ZMQPayload;
+/** A copy of a block, shared by the notifiers that publish it */
+typedef std::shared_ptr<const CBlock> ZMQBlock;
+
 class CZMQAbstractNotifier
 {
 public:
@@ -32,9 +41,15 @@ public:
     virtual bool Initialize(void *pcontext) = 0;
     virtual void Shutdown() = 0;
 
+    //! Whether NotifyBlock(block, pblock) should be given a copy of the block
+    virtual bool WantsBlockData() const;
+
     virtual bool NotifyBlock(const CBlockIndex *pindex);
-    virtual bool NotifyBlock(const CBlock& pblock);
+    virtual bool NotifyBlock(const CBlock& block, ZMQBlock pblock);
     virtual bool NotifyTransaction(const CTransaction &transaction);
+    virtual bool NotifyTransactionRemoval(const CTransaction &transaction, MemPoolRemovalReason reason);
+    //! Called for each block connected to (fConnected) or disconnected from the active chain
+    virtual bool NotifyChainTip(const CBlockIndex *pindex, const CBlock &block, bool fConnected);
 
 protected:
     void *psocket;
@@ -15,7 +15,7 @@ void zmqError(const char *str)
     LogPrint("zmq", "zmq: Error: %s, errno=%s\n", str, zmq_strerror(errno));
 }
 
-CZMQNotificationInterface::CZMQNotificationInterface() : pcontext(NULL)
+CZMQNotificationInterface::CZMQNotificationInterface() : pcontext(NULL), nMaxQueuedBytes(DEFAULT_ZMQ_PUB_QUEUE_SIZE << 20)
 {
 }
 
@@ -40,6 +40,8 @@ CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const
     factories["pubrawblock"] = CZMQAbstractNotifier::Create<CZMQPublishRawBlockNotifier>;
     factories["pubrawtx"] = CZMQAbstractNotifier::Create<CZMQPublishRawTransactionNotifier>;
     factories["pubcheckedblock"] = CZMQAbstractNotifier::Create<CZMQPublishCheckedBlockNotifier>;
+    factories["pubremovedtx"] = CZMQAbstractNotifier::Create<CZMQPublishRemovedTransactionNotifier>;
+    factories["pubshieldedblock"] = CZMQAbstractNotifier::Create<CZMQPublishShieldedBlockNotifier>;
 
     for (std::map<std::string, CZMQNotifierFactory>::const_iterator i=factories.begin(); i!=factories.end(); ++i)
     {
@@ -60,6 +62,10 @@ CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const
         notificationInterface = new CZMQNotificationInterface();
         notificationInterface->notifiers = notifiers;
 
+        std::map<std::string, std::string>::const_iterator j = args.find("-zmqpubqueuesize");
+        if (j != args.end())
+            notificationInterface->nMaxQueuedBytes = std::max(atoi64(j->second), (int64_t)0) << 20;
+
         if (!notificationInterface->Initialize())
         {
             delete notificationInterface;
@@ -104,6 +110,8 @@ bool CZMQNotificationInterface::Initialize()
         return false;
     }
 
+    GetZMQPublisher().Start(nMaxQueuedBytes);
+
     return true;
 }
 
@@ -113,6 +121,9 @@ void CZMQNotificationInterface::Shutdown()
     LogPrint("zmq", "zmq: Shutdown notification interface\n");
     if (pcontext)
     {
+        // The publisher uses the sockets, so it has to stop first
+        GetZMQPublisher().Stop();
+
         for (std::list<CZMQAbstractNotifier*>::iterator i=notifiers.begin(); i!=notifiers.end(); ++i)
         {
             CZMQAbstractNotifier *notifier = *i;
@@ -148,10 +159,20 @@ void CZMQNotificationInterface::BlockChecked(const CBlock& block, const CValidat
         return;
     }
 
+    // Copy the block once for all the notifiers that publish it; it is
+    // serialized on the publisher thread, not under cs_main.
+    ZMQBlock pblock;
+    for (CZMQAbstractNotifier *notifier : notifiers) {
+        if (notifier->WantsBlockData()) {
+            pblock = std::make_shared<const CBlock>(block);
+            break;
+        }
+    }
+
     for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
     {
         CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyBlock(block))
+        if (notifier->NotifyBlock(block, pblock))
         {
             i++;
         }
@@ -179,3 +200,39 @@ void CZMQNotificationInterface::SyncTransaction(const CTransaction &tx, const CB
         }
     }
 }
+
+void CZMQNotificationInterface::TransactionRemovedFromMempool(const CTransaction &tx, MemPoolRemovalReason reason)
+{
+    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
+    {
+        CZMQAbstractNotifier *notifier = *i;
+        if (notifier->NotifyTransactionRemoval(tx, reason))
+        {
+            i++;
+        }
+        else
+        {
+            notifier->Shutdown();
+            i = notifiers.erase(i);
+        }
+    }
+}
+
+void CZMQNotificationInterface::ChainTip(const CBlockIndex *pindex, const CBlock *pblock, boost::optional<std::pair<SproutMerkleTree, SaplingMerkleTree>> added)
+{
+    // added is only set when the block was connected
+    bool fConnected = added.is_initialized();
+    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
+    {
+        CZMQAbstractNotifier *notifier = *i;
+        if (notifier->NotifyChainTip(pindex, *pblock, fConnected))
+        {
+            i++;
+        }
+        else
+        {
+            notifier->Shutdown();
+            i = notifiers.erase(i);
+        }
+    }
+}
@@ -13,6 +13,9 @@
 class CBlockIndex;
 class CZMQAbstractNotifier;
 
+/** Default for -zmqpubqueuesize, in MiB */
+static const size_t DEFAULT_ZMQ_PUB_QUEUE_SIZE = 64;
+
 class CZMQNotificationInterface : public CValidationInterface
 {
 public:
@@ -26,6 +29,8 @@ protected:
 
     // CValidationInterface
     void SyncTransaction(const CTransaction &tx, const CBlock *pblock, const int nHeight);
+    void TransactionRemovedFromMempool(const CTransaction &tx, MemPoolRemovalReason reason);
+    void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, boost::optional<std::pair<SproutMerkleTree, SaplingMerkleTree>> added);
     void UpdatedBlockTip(const CBlockIndex *pindex);
     void BlockChecked(const CBlock& block, const CValidationState& state);
 
@@ -34,6 +39,7 @@ private:
 
     void *pcontext;
     std::list<CZMQAbstractNotifier*> notifiers;
+    size_t nMaxQueuedBytes;
 };
 
 #endif // BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
@@ -5,6 +5,9 @@
 #include "chainparams.h"
 #include "zmqpublishnotifier.h"
 #include "main.h"
+#include "metrics.h"
+#include "serialize.h"
+#include "txmempool.h"
 #include "util.h"
 
 static std::multimap<std::string, CZMQAbstractPublishNotifier*> mapPublishNotifiers;
@@ -14,6 +17,8 @@ static const char *MSG_HASHTX    = "hashtx";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
 static const char *MSG_CHECKEDBLOCK = "checkedblock";
+static const char *MSG_REMOVEDTX = "removedtx";
+static const char *MSG_SHIELDEDBLOCK = "shieldedblock";
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -55,6 +60,109 @@ static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
     return 0;
 }
 
+void CZMQPublisher::Start(size_t nMaxQueuedBytesIn)
+{
+    assert(!thread.joinable());
+    nMaxQueuedBytes = nMaxQueuedBytesIn;
+    fStop = false;
+    thread = std::thread(&TraceThread<std::function<void()>>, "zmqpub", [this] { ThreadPublish(); });
+}
+
+void CZMQPublisher::Stop()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        fStop = true;
+        queue.clear();
+        nQueuedBytes = 0;
+    }
+    cond.notify_all();
+    if (thread.joinable())
+        thread.join();
+}
+
+bool CZMQPublisher::Queue(void *psocket, const char *command, ZMQPayload data, ZMQBlock pblock, const CBlockIndex* pindexRead, const CDiskBlockPos& blockPos, uint32_t nSequence)
+{
+    static MetricValue& dropped = GetMetricCounter("buck_zmq_dropped_messages_total",
+        "ZMQ messages dropped because the publisher queue was full.");
+
+    size_t nBytes = data ? data->size() : 0;
+    if (pblock)
+        nBytes = ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION);
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (fStop)
+            return false;
+        // Always accept a message into an empty queue, so that blocks larger
+        // than the limit are still published when subscribers keep up.
+        if (!queue.empty() && nQueuedBytes + nBytes > nMaxQueuedBytes) {
+            dropped.add();
+            LogPrint("zmq", "zmq: Publisher queue full, dropping %s message %d\n", command, nSequence);
+            return false;
+        }
+        queue.push_back(Message{psocket, command, data, pblock, pindexRead, blockPos, nSequence, nBytes});
+        nQueuedBytes += nBytes;
+    }
+    cond.notify_one();
+    return true;
+}
+
+void CZMQPublisher::ThreadPublish()
+{
+    while (true) {
+        Message message;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this] { return fStop || !queue.empty(); });
+            if (fStop)
+                return;
+            message = queue.front();
+            queue.pop_front();
+            nQueuedBytes -= message.nBytes;
+        }
+        Send(message);
+    }
+}
+
+void CZMQPublisher::Send(const Message& message)
+{
+    ZMQPayload data = message.data;
+    if (message.pblock) {
+        if (message.pblock != pLastBlock) {
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss << *message.pblock;
+            auto serialized = std::make_shared<CSerializeData>();
+            ss.GetAndClear(*serialized);
+            pLastBlock = message.pblock;
+            lastBlockData = serialized;
+        }
+        data = lastBlockData;
+    } else if (message.pindexRead) {
+        // Checks the hash, and finds the block again if it has moved since
+        CBlock block;
+        if (!ReadBlockFromDiskUnlocked(block, message.pindexRead, Params().GetConsensus(), message.blockPos)) {
+            zmqError("Can't read block from disk");
+            return;
+        }
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << block;
+        auto serialized = std::make_shared<CSerializeData>();
+        ss.GetAndClear(*serialized);
+        data = serialized;
+    }
+
+    /* send three parts, command & data & a LE 4byte sequence number */
+    unsigned char msgseq[sizeof(uint32_t)];
+    WriteLE32(&msgseq[0], message.nSequence);
+    zmq_send_multipart(message.psocket, message.command, strlen(message.command), data->data(), data->size(), msgseq, (size_t)sizeof(uint32_t), (void*)0);
+}
+
+CZMQPublisher& GetZMQPublisher()
+{
+    static CZMQPublisher publisher;
+    return publisher;
+}
+
 bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
 {
     assert(!psocket);
@@ -124,75 +232,89 @@ void CZMQAbstractPublishNotifier::Shutdown()
     psocket = 0;
 }
 
-bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* data, size_t size)
+bool CZMQAbstractPublishNotifier::SendMessage(const char *command, ZMQPayload data, ZMQBlock pblock, const CBlockIndex* pindexRead, const CDiskBlockPos& blockPos)
 {
     assert(psocket);
 
-    /* send three parts, command & data & a LE 4byte sequence number */
-    unsigned char msgseq[sizeof(uint32_t)];
-    WriteLE32(&msgseq[0], nSequence);
-    int rc = zmq_send_multipart(psocket, command, strlen(command), data, size, msgseq, (size_t)sizeof(uint32_t), (void*)0);
-    if (rc == -1)
-        return false;
-
-    /* increment memory only sequence number after sending */
-    nSequence++;
+    /* a dropped message still uses up its sequence number, so that
+       subscribers can tell that they missed it */
+    GetZMQPublisher().Queue(psocket, command, data, pblock, pindexRead, blockPos, nSequence++);
 
     return true;
 }
 
+static ZMQPayload HashPayload(const uint256& hash)
+{
+    auto data = std::make_shared<CSerializeData>(32);
+    for (unsigned int i = 0; i < 32; i++)
+        (*data)[31 - i] = hash.begin()[i];
+    return data;
+}
+
 bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     uint256 hash = pindex->GetBlockHash();
     LogPrint("zmq", "zmq: Publish hashblock %s\n", hash.GetHex());
-    char data[32];
-    for (unsigned int i = 0; i < 32; i++)
-        data[31 - i] = hash.begin()[i];
-    return SendMessage(MSG_HASHBLOCK, data, 32);
+    return SendMessage(MSG_HASHBLOCK, HashPayload(hash));
 }
 
 bool CZMQPublishHashTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
 {
     uint256 hash = transaction.GetHash();
     LogPrint("zmq", "zmq: Publish hashtx %s\n", hash.GetHex());
-    char data[32];
-    for (unsigned int i = 0; i < 32; i++)
-        data[31 - i] = hash.begin()[i];
-    return SendMessage(MSG_HASHTX, data, 32);
+    return SendMessage(MSG_HASHTX, HashPayload(hash));
 }
 
-bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
+bool CZMQPublishRawBlockNotifier::WantsBlockData() const
 {
-    LogPrint("zmq", "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
-
-    const Consensus::Params& consensusParams = Params().GetConsensus();
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    {
-        LOCK(cs_main);
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex, consensusParams))
-        {
-            zmqError("Can't read block from disk");
-            return false;
-        }
+    // Tips are only published once the initial block download is over
+    return !IsInitialBlockDownload(Params());
+}
 
-        ss << block;
+bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlock &block, ZMQBlock pblock)
+{
+    if (pblock) {
+        std::unique_lock<std::mutex> lock(cs_lastChecked);
+        hashLastChecked = block.GetHash();
+        lastChecked = pblock;
     }
-
-    return SendMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());
+    return true;
 }
 
-bool CZMQPublishCheckedBlockNotifier::NotifyBlock(const CBlock& block)
+bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
-    LogPrint("zmq", "zmq: Publish checkedblock %s\n", block.GetHash().GetHex());
+    uint256 hash = pindex->GetBlockHash();
+    LogPrint("zmq", "zmq: Publish rawblock %s\n", hash.GetHex());
 
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ZMQBlock pblock;
+    {
+        std::unique_lock<std::mutex> lock(cs_lastChecked);
+        if (lastChecked && hashLastChecked == hash)
+            pblock = lastChecked;
+    }
+    if (pblock) {
+        return SendMessage(MSG_RAWBLOCK, nullptr, pblock);
+    }
+
+    // Not the block we last saw validated, so leave it to the publisher to
+    // read from disk.
+    CDiskBlockPos pos;
     {
         LOCK(cs_main);
-        ss << block;
+        pos = pindex->GetBlockPos();
     }
+    return SendMessage(MSG_RAWBLOCK, nullptr, nullptr, pindex, pos);
+}
+
+bool CZMQPublishCheckedBlockNotifier::WantsBlockData() const
+{
+    return true;
+}
 
-    return SendMessage(MSG_CHECKEDBLOCK, &(*ss.begin()), ss.size());
+bool CZMQPublishCheckedBlockNotifier::NotifyBlock(const CBlock& block, ZMQBlock pblock)
+{
+    LogPrint("zmq", "zmq: Publish checkedblock %s\n", block.GetHash().GetHex());
+    return SendMessage(MSG_CHECKEDBLOCK, nullptr, pblock);
 }
 
 bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
@@ -201,5 +323,78 @@ bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &tr
     LogPrint("zmq", "zmq: Publish rawtx %s\n", hash.GetHex());
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
     ss << transaction;
-    return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
+    auto data = std::make_shared<CSerializeData>();
+    ss.GetAndClear(*data);
+    return SendMessage(MSG_RAWTX, data);
+}
+
+bool CZMQPublishRemovedTransactionNotifier::NotifyTransactionRemoval(const CTransaction &transaction, MemPoolRemovalReason reason)
+{
+    uint256 hash = transaction.GetHash();
+    std::string strReason = RemovalReasonToString(reason);
+    LogPrint("zmq", "zmq: Publish removedtx %s (%s)\n", hash.GetHex(), strReason);
+    auto data = std::make_shared<CSerializeData>(32);
+    for (unsigned int i = 0; i < 32; i++)
+        (*data)[31 - i] = hash.begin()[i];
+    data->insert(data->end(), strReason.begin(), strReason.end());
+    return SendMessage(MSG_REMOVEDTX, data);
+}
+
+/** The shielded spends and outputs of one transaction in a shieldedblock message */
+struct ShieldedTxSummary {
+    uint32_t nIndex;
+    uint256 txid;
+    std::vector<uint256> vSproutNullifiers;
+    std::vector<uint256> vSproutCommitments;
+    std::vector<uint256> vSaplingNullifiers;
+    std::vector<uint256> vSaplingCommitments;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nIndex);
+        READWRITE(txid);
+        READWRITE(vSproutNullifiers);
+        READWRITE(vSproutCommitments);
+        READWRITE(vSaplingNullifiers);
+        READWRITE(vSaplingCommitments);
+    }
+};
+
+bool CZMQPublishShieldedBlockNotifier::NotifyChainTip(const CBlockIndex *pindex, const CBlock &block, bool fConnected)
+{
+    std::vector<ShieldedTxSummary> vtx;
+    for (uint32_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        if (tx.vJoinSplit.empty() && tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty())
+            continue;
+
+        ShieldedTxSummary summary;
+        summary.nIndex = i;
+        summary.txid = tx.GetHash();
+        for (const JSDescription& joinsplit : tx.vJoinSplit) {
+            summary.vSproutNullifiers.insert(summary.vSproutNullifiers.end(), joinsplit.nullifiers.begin(), joinsplit.nullifiers.end());
+            summary.vSproutCommitments.insert(summary.vSproutCommitments.end(), joinsplit.commitments.begin(), joinsplit.commitments.end());
+        }
+        for (const SpendDescription& spend : tx.vShieldedSpend)
+            summary.vSaplingNullifiers.push_back(spend.nullifier);
+        for (const OutputDescription& output : tx.vShieldedOutput)
+            summary.vSaplingCommitments.push_back(output.cmu);
+        vtx.push_back(summary);
+    }
+
+    uint256 hash = pindex->GetBlockHash();
+    LogPrint("zmq", "zmq: Publish shieldedblock %s (%s, %u shielded txs)\n",
+        hash.GetHex(), fConnected ? "connected" : "disconnected", vtx.size());
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << hash;
+    ss << (int32_t)pindex->nHeight;
+    ss << (uint8_t)(fConnected ? 1 : 0);
+    ss << pindex->hashFinalSaplingRoot;
+    ss << vtx;
+    auto data = std::make_shared<CSerializeData>();
+    ss.GetAndClear(*data);
+    return SendMessage(MSG_SHIELDEDBLOCK, data);
 }
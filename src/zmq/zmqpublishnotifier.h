@@ -6,9 +6,71 @@
 #define BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H
 
 #include "zmqabstractnotifier.h"
+#include "chain.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 class CBlockIndex;
 
+/**
+ * Sends the messages of all publish notifiers from a thread of its own, so
+ * that neither block serialization, disk reads nor slow subscribers hold up the
+ * validation callbacks that queue them. Messages that do not fit in the
+ * queue are dropped and counted; subscribers see them as gaps in the
+ * sequence numbers. The thread only takes cs_main to find a block again
+ * that moved after it was queued.
+ */
+class CZMQPublisher
+{
+private:
+    struct Message {
+        void *psocket;
+        const char *command;
+        ZMQPayload data;
+        //! Block to serialize and send instead of data
+        ZMQBlock pblock;
+        //! Block to read from disk and send instead of data, and where it
+        //! was when the message was queued
+        const CBlockIndex* pindexRead;
+        CDiskBlockPos blockPos;
+        uint32_t nSequence;
+        //! Bytes counted against the queue limit
+        size_t nBytes;
+    };
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<Message> queue;
+    size_t nQueuedBytes;
+    size_t nMaxQueuedBytes;
+    bool fStop;
+    std::thread thread;
+
+    //! The block serialized last, which several topics may publish in a row;
+    //! only used by the publisher thread
+    ZMQBlock pLastBlock;
+    ZMQPayload lastBlockData;
+
+    void ThreadPublish();
+    void Send(const Message& message);
+
+public:
+    CZMQPublisher() : nQueuedBytes(0), nMaxQueuedBytes(0), fStop(false) {}
+
+    void Start(size_t nMaxQueuedBytesIn);
+    /** Stop the thread, dropping the messages it has not sent yet. */
+    void Stop();
+
+    /** Queue a message, returning false if it was dropped. */
+    bool Queue(void *psocket, const char *command, ZMQPayload data, ZMQBlock pblock, const CBlockIndex* pindexRead, const CDiskBlockPos& blockPos, uint32_t nSequence);
+};
+
+/** The publisher that all publish notifiers queue their messages on */
+CZMQPublisher& GetZMQPublisher();
+
 class CZMQAbstractPublishNotifier : public CZMQAbstractNotifier
 {
 private:
@@ -16,13 +78,15 @@ private:
 
 public:
 
-    /* send zmq multipart message
+    /* queue zmq multipart message on the publisher
        parts:
           * command
-          * data
+          * data (or pblock, serialized by the publisher, or the block of
+            pindexRead, read by the publisher starting at blockPos)
           * message sequence number
     */
-    bool SendMessage(const char *command, const void* data, size_t size);
+    bool SendMessage(const char *command, ZMQPayload data, ZMQBlock pblock = nullptr,
+                     const CBlockIndex* pindexRead = NULL, const CDiskBlockPos& blockPos = CDiskBlockPos());
 
     bool Initialize(void *pcontext);
     void Shutdown();
@@ -43,7 +107,15 @@ public:
 class CZMQPublishRawBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
+    bool WantsBlockData() const;
     bool NotifyBlock(const CBlockIndex *pindex);
+    bool NotifyBlock(const CBlock &block, ZMQBlock pblock);
+
+private:
+    //! The last block that passed validation, which is usually the new tip
+    std::mutex cs_lastChecked;
+    uint256 hashLastChecked;
+    ZMQBlock lastChecked;
 };
 
 class CZMQPublishRawTransactionNotifier : public CZMQAbstractPublishNotifier
@@ -55,7 +127,20 @@ public:
 class CZMQPublishCheckedBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyBlock(const CBlock &block);
+    bool WantsBlockData() const;
+    bool NotifyBlock(const CBlock &block, ZMQBlock pblock);
+};
+
+class CZMQPublishRemovedTransactionNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyTransactionRemoval(const CTransaction &transaction, MemPoolRemovalReason reason);
+};
+
+class CZMQPublishShieldedBlockNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyChainTip(const CBlockIndex *pindex, const CBlock &block, bool fConnected);
 };
 
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H